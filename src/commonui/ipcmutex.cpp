@@ -117,16 +117,22 @@ int CInterProcessMutex::TryLock()
 #ifdef FZ_WINDOWS
 	if (!hMutex) {
 		m_locked = false;
-		return 0;
+		return -1;
 	}
 
 	int res = ::WaitForSingleObject(hMutex, 1);
-	if (res == WAIT_OBJECT_0) {
+	// If the previous owner exited without releasing the mutex, it is
+	// abandoned and now owned by us.
+	if (res == WAIT_OBJECT_0 || res == WAIT_ABANDONED) {
 		m_locked = true;
 		return 1;
 	}
 #else
-	if (m_fd >= 0) {
+	if (m_fd < 0) {
+		// No lockfile, can't do any locking
+		return -1;
+	}
+	else {
 		// Try to lock 1 byte region in the lockfile. m_type specifies the byte to lock.
 		struct flock f = {};
 		f.l_type = F_WRLCK;
@@ -26,6 +26,11 @@ std::unique_ptr<CNotification> CFileZillaEngine::GetNextNotification()
 	return impl_->GetNextNotification();
 }
 
+bool CFileZillaEngine::GetNotifications(std::vector<std::unique_ptr<CNotification>> & notifications)
+{
+	return impl_->GetNotifications(notifications);
+}
+
 bool CFileZillaEngine::SetAsyncRequestReply(std::unique_ptr<CAsyncRequestNotification> && pNotification)
 {
 	return impl_->SetAsyncRequestReply(std::move(pNotification));
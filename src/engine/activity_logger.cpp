@@ -35,3 +35,13 @@ void activity_logger::set_notifier(std::function<void()> && notification_cb)
 		waiting_ = true;
 	}
 }
+
+void activity_logger::record_tls_handshake(bool resumed)
+{
+	++handshakes_[resumed ? 1 : 0];
+}
+
+std::pair<uint64_t, uint64_t> activity_logger::tls_handshakes() const
+{
+	return {handshakes_[0].load(), handshakes_[1].load()};
+}
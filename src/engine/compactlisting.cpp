@@ -0,0 +1,183 @@
+#include "filezilla.h"
+#include "compactlisting.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+CCompactListing::CCompactListing(CDirectoryListing const& listing)
+{
+	size_t const count = listing.size();
+	listing_flags_ = listing.m_flags & (CDirectoryListing::listing_has_dirs | CDirectoryListing::listing_has_perms | CDirectoryListing::listing_has_usergroup);
+
+	name_offsets_.reserve(count + 1);
+	sizes_.reserve(count);
+	times_.reserve(count);
+	flags_.reserve(count);
+	permissions_.reserve(count);
+	owner_groups_.reserve(count);
+
+	strings_.emplace_back();
+	std::unordered_map<std::wstring_view, uint32_t> indexes;
+	auto const index_of = [&](fz::shared_value<std::wstring> const& v) -> uint32_t {
+		if (v->empty()) {
+			return 0;
+		}
+		auto it = indexes.find(*v);
+		if (it != indexes.end()) {
+			return it->second;
+		}
+		uint32_t const index = static_cast<uint32_t>(strings_.size());
+		strings_.push_back(v);
+		indexes.emplace(*v, index);
+		return index;
+	};
+
+	name_offsets_.push_back(0);
+	folded_offsets_.reserve(count + 1);
+	folded_offsets_.push_back(0);
+	for (size_t i = 0; i < count; ++i) {
+		CDirentry const& entry = listing[i];
+		std::string const name = fz::to_utf8(entry.name);
+		if (name.empty() && !entry.name.empty()) {
+			*this = CCompactListing();
+			valid_ = false;
+			return;
+		}
+		names_ += name;
+		name_offsets_.push_back(static_cast<uint32_t>(names_.size()));
+		sizes_.push_back(entry.size);
+		times_.push_back(entry.time);
+		flags_.push_back(static_cast<uint8_t>(entry.flags));
+		permissions_.push_back(index_of(entry.permissions));
+		owner_groups_.push_back(index_of(entry.ownerGroup));
+		if (entry.target) {
+			targets_.emplace_back(static_cast<uint32_t>(i), *entry.target);
+		}
+
+		std::string const folded = fz::to_utf8(fz::str_tolower(entry.name));
+		if (folded != name) {
+			folded_ += folded;
+		}
+		folded_offsets_.push_back(static_cast<uint32_t>(folded_.size()));
+	}
+	names_.shrink_to_fit();
+	folded_.shrink_to_fit();
+
+	order_.resize(count);
+	for (size_t i = 0; i < count; ++i) {
+		order_[i] = static_cast<uint32_t>(i);
+	}
+	std::sort(order_.begin(), order_.end(), [this](uint32_t a, uint32_t b) {
+		int const cmp = folded_name(a).compare(folded_name(b));
+		return cmp < 0 || (!cmp && a < b);
+	});
+}
+
+std::string_view CCompactListing::entry_ref::name_utf8() const
+{
+	return std::string_view(l_.names_).substr(l_.name_offsets_[i_], l_.name_offsets_[i_ + 1] - l_.name_offsets_[i_]);
+}
+
+std::wstring CCompactListing::entry_ref::name() const
+{
+	return fz::to_wstring_from_utf8(name_utf8());
+}
+
+std::wstring const* CCompactListing::entry_ref::target() const
+{
+	if (!(flags() & CDirentry::flag_link)) {
+		return nullptr;
+	}
+
+	auto it = std::lower_bound(l_.targets_.cbegin(), l_.targets_.cend(), i_, [](auto const& t, size_t i) { return t.first < i; });
+	if (it == l_.targets_.cend() || it->first != i_) {
+		return nullptr;
+	}
+	return &it->second;
+}
+
+CDirentry CCompactListing::entry_ref::materialize() const
+{
+	CDirentry entry;
+	entry.name = name();
+	entry.size = size();
+	entry.permissions = permissions();
+	entry.ownerGroup = ownerGroup();
+	entry.time = time();
+	entry.flags = flags();
+	if (auto t = target()) {
+		entry.target = fz::sparse_optional<std::wstring>(*t);
+	}
+	return entry;
+}
+
+std::vector<fz::shared_value<CDirentry>> CCompactListing::Expand() const
+{
+	std::vector<fz::shared_value<CDirentry>> entries;
+	entries.reserve(size());
+	for (size_t i = 0; i < size(); ++i) {
+		entries.emplace_back((*this)[i].materialize());
+	}
+	return entries;
+}
+
+std::string_view CCompactListing::folded_name(size_t index) const
+{
+	uint32_t const begin = folded_offsets_[index];
+	uint32_t const end = folded_offsets_[index + 1];
+	if (begin == end) {
+		return (*this)[index].name_utf8();
+	}
+	return std::string_view(folded_).substr(begin, end - begin);
+}
+
+std::pair<std::vector<uint32_t>::const_iterator, std::vector<uint32_t>::const_iterator> CCompactListing::equal_range_nocase(std::string_view const& folded) const
+{
+	auto const first = std::lower_bound(order_.cbegin(), order_.cend(), folded, [this](uint32_t i, std::string_view const& v) {
+		return folded_name(i) < v;
+	});
+	auto last = first;
+	while (last != order_.cend() && folded_name(*last) == folded) {
+		++last;
+	}
+	return {first, last};
+}
+
+size_t CCompactListing::FindFile_CmpCase(std::wstring_view const& name) const
+{
+	std::string const utf8 = fz::to_utf8(name);
+	auto const range = equal_range_nocase(fz::to_utf8(fz::str_tolower(name)));
+	for (auto it = range.first; it != range.second; ++it) {
+		if ((*this)[*it].name_utf8() == utf8) {
+			return *it;
+		}
+	}
+
+	return std::wstring::npos;
+}
+
+size_t CCompactListing::FindFile_CmpNoCase(std::wstring_view const& name) const
+{
+	auto const range = equal_range_nocase(fz::to_utf8(fz::str_tolower(name)));
+	if (range.first == range.second) {
+		return std::wstring::npos;
+	}
+
+	return *range.first;
+}
+
+size_t CCompactListing::memory_usage() const
+{
+	size_t ret = sizeof(*this);
+	ret += names_.capacity() + folded_.capacity();
+	ret += (name_offsets_.capacity() + folded_offsets_.capacity()) * sizeof(uint32_t);
+	ret += sizes_.capacity() * sizeof(int64_t);
+	ret += times_.capacity() * sizeof(fz::datetime);
+	ret += flags_.capacity();
+	ret += (permissions_.capacity() + owner_groups_.capacity() + order_.capacity()) * sizeof(uint32_t);
+	ret += strings_.capacity() * sizeof(fz::shared_value<std::wstring>);
+	for (auto const& t : targets_) {
+		ret += sizeof(t) + t.second.capacity() * sizeof(wchar_t);
+	}
+	return ret;
+}
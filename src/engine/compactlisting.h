@@ -0,0 +1,113 @@
+#ifndef FILEZILLA_ENGINE_COMPACTLISTING_HEADER
+#define FILEZILLA_ENGINE_COMPACTLISTING_HEADER
+
+#include "../include/directorylisting.h"
+
+#include <string_view>
+#include <vector>
+
+/*
+Memory efficient, read-only representation of the entries of a directory
+listing, used by the directory cache for listings not in active use.
+
+Instead of one heap allocated CDirentry per entry, all names are packed into
+a single UTF-8 encoded string and the other fields are held in parallel
+arrays.
+Permissions and owner/group strings are stored once and referenced by index.
+Link targets are rare, they are kept separately.
+
+Entries are accessed through lightweight references. Expand() turns the
+entries back into what CDirectoryListing::Assign expects, alternatively a
+CDirectoryListing can be backed by a shared compact listing directly.
+*/
+class FZC_PUBLIC_SYMBOL CCompactListing final
+{
+public:
+	CCompactListing() = default;
+	explicit CCompactListing(CDirectoryListing const& listing);
+
+	class entry_ref final
+	{
+	public:
+		std::wstring name() const;
+		std::string_view name_utf8() const;
+		int64_t size() const { return l_.sizes_[i_]; }
+		fz::datetime const& time() const { return l_.times_[i_]; }
+		int flags() const { return l_.flags_[i_]; }
+		bool is_dir() const { return (flags() & CDirentry::flag_dir) != 0; }
+
+		fz::shared_value<std::wstring> const& permissions() const { return l_.strings_[l_.permissions_[i_]]; }
+		fz::shared_value<std::wstring> const& ownerGroup() const { return l_.strings_[l_.owner_groups_[i_]]; }
+
+		// Returns nullptr if there is no link target
+		std::wstring const* target() const;
+
+		CDirentry materialize() const;
+
+	private:
+		friend class CCompactListing;
+		entry_ref(CCompactListing const& l, size_t i)
+			: l_(l)
+			, i_(i)
+		{}
+
+		CCompactListing const& l_;
+		size_t const i_;
+	};
+
+	entry_ref operator[](size_t index) const { return entry_ref(*this, index); }
+
+	// False if the listing could not be represented, e.g. due to names
+	// that cannot be converted to UTF-8.
+	bool valid() const { return valid_; }
+
+	size_t size() const { return sizes_.size(); }
+	bool empty() const { return sizes_.empty(); }
+
+	// The listing_has_* flags of the listing it got created from
+	int listing_flags() const { return listing_flags_; }
+
+	std::vector<fz::shared_value<CDirentry>> Expand() const;
+
+	// Same semantics as the functions of the same name in CDirectoryListing,
+	// if multiple entries match, the first is returned.
+	size_t FindFile_CmpCase(std::wstring_view const& name) const;
+	size_t FindFile_CmpNoCase(std::wstring_view const& name) const;
+
+	// Approximate amount of memory used, in bytes
+	size_t memory_usage() const;
+
+private:
+	std::pair<std::vector<uint32_t>::const_iterator, std::vector<uint32_t>::const_iterator> equal_range_nocase(std::string_view const& folded) const;
+
+	// Lowercase name, UTF-8 encoded
+	std::string_view folded_name(size_t index) const;
+
+	bool valid_{true};
+	int listing_flags_{};
+
+	std::string names_;
+	std::vector<uint32_t> name_offsets_; // size() + 1 elements
+
+	// Lowercase names, only for entries where they differ from the name.
+	// An empty range means the name is already lowercase.
+	std::string folded_;
+	std::vector<uint32_t> folded_offsets_; // size() + 1 elements
+
+	std::vector<int64_t> sizes_;
+	std::vector<fz::datetime> times_;
+	std::vector<uint8_t> flags_;
+
+	// Indexes into strings_, index 0 is the empty string
+	std::vector<uint32_t> permissions_;
+	std::vector<uint32_t> owner_groups_;
+	std::vector<fz::shared_value<std::wstring>> strings_;
+
+	// Sorted by entry index
+	std::vector<std::pair<uint32_t, std::wstring>> targets_;
+
+	// Entry indexes, sorted by lowercase name and then by index
+	std::vector<uint32_t> order_;
+};
+
+#endif
@@ -10,8 +10,10 @@
 
 #include "../include/local_path.h"
 #include "../include/engine_options.h"
+#include "../include/segment_writer.h"
 #include "../include/sizeformatting_base.h"
 
+#include <libfilezilla/encode.hpp>
 #include <libfilezilla/event_loop.hpp>
 #include <libfilezilla/iputils.hpp>
 #include <libfilezilla/local_filesys.hpp>
@@ -68,9 +70,7 @@ Command CControlSocket::GetCurrentCommandId() const
 
 void CControlSocket::LogTransferResultMessage(int nErrorCode, CFileTransferOpData *pData)
 {
-	bool tmp{};
-
-	CTransferStatus const status = engine_.transfer_status_.Get(tmp);
+	CTransferStatus const status = engine_.transfer_status_.Peek();
 	if (!status.empty() && (nErrorCode == FZ_REPLY_OK || status.madeProgress)) {
 		int elapsed = static_cast<int>((fz::datetime::now() - status.started).get_seconds());
 		if (elapsed <= 0) {
@@ -199,6 +199,13 @@ int CControlSocket::ResetOperation(int nErrorCode)
 		case Command::transfer:
 			{
 				auto & data = static_cast<CFileTransferOpData &>(*oldOperation);
+				if (data.corrupt_) {
+					// Don't let a retry resume a corrupt file. Protocols close
+					// their writer before this.
+					if (!fz::remove_file(fz::to_native(data.writer_factory_->name()))) {
+						log(logmsg::error, _("Could not delete the corrupt file \"%s\", retrying might resume it."), data.writer_factory_->name());
+					}
+				}
 				if (!data.download() && data.transferInitiated_) {
 					if (!currentServer_) {
 						log(logmsg::debug_warning, L"currentServer_ is empty");
@@ -310,6 +317,79 @@ CServer const& CControlSocket::GetCurrentServer() const
 	return currentServer_;
 }
 
+bool CControlSocket::WantChecksum(CFileTransferOpData const& data, bool binary, int64_t resumeOffset) const
+{
+	return engine_.GetOptions().get_int(OPTION_VERIFY_CHECKSUMS) && binary && !resumeOffset && !data.segmentSize_;
+}
+
+namespace {
+wchar_t const* hash_name(fz::hash_algorithm alg)
+{
+	switch (alg) {
+	case fz::hash_algorithm::md5:
+		return L"MD5";
+	case fz::hash_algorithm::sha1:
+		return L"SHA-1";
+	case fz::hash_algorithm::sha256:
+		return L"SHA-256";
+	case fz::hash_algorithm::sha512:
+		return L"SHA-512";
+	}
+	return L"";
+}
+}
+
+int CControlSocket::VerifyChecksum(std::wstring const& reply)
+{
+	if (operations_.empty() || operations_.back()->opId != Command::transfer) {
+		log(logmsg::debug_info, L"VerifyChecksum called without active transfer.");
+		return FZ_REPLY_INTERNALERROR;
+	}
+
+	auto & data = static_cast<CFileTransferOpData &>(*operations_.back());
+	if (!data.hasher_) {
+		return FZ_REPLY_OK;
+	}
+
+	std::wstring const local = fz::hex_encode<std::wstring>(data.hasher_->digest());
+	data.hasher_.reset();
+
+	// Servers differ in what else they put into the reply, look for a token of the right length
+	std::wstring remote;
+	for (auto const& token : fz::strtok_view(reply, L" \t")) {
+		if (token.size() == local.size() && fz::hex_decode(token).size() * 2 == local.size()) {
+			remote = token;
+			break;
+		}
+	}
+
+	if (remote.empty()) {
+		log(logmsg::status, _("Could not find the %s checksum of the file in the server's reply, transferred file not verified."), hash_name(data.hashAlgorithm_));
+		return FZ_REPLY_OK;
+	}
+	if (!fz::equal_insensitive_ascii(local, remote)) {
+		log(logmsg::error, _("Checksum mismatch: %s of transferred data is %s, server reports %s."), hash_name(data.hashAlgorithm_), local, remote);
+		if (data.download() && dynamic_cast<fz::file_writer_factory const*>(&*data.writer_factory_)) {
+			// Deleted in ResetOperation, the writer might still have it open
+			data.corrupt_ = true;
+		}
+		return FZ_REPLY_ERROR;
+	}
+
+	log(logmsg::status, _("%s checksum verified"), hash_name(data.hashAlgorithm_));
+	return FZ_REPLY_OK;
+}
+
+CFileTransferOpData* CControlSocket::PendingChecksum()
+{
+	if (operations_.empty() || operations_.back()->opId != Command::transfer) {
+		return nullptr;
+	}
+
+	auto & data = static_cast<CFileTransferOpData &>(*operations_.back());
+	return data.checksumPending_ ? &data : nullptr;
+}
+
 bool CControlSocket::ParsePwdReply(std::wstring reply, CServerPath const& defaultPath)
 {
 	size_t pos1 = reply.find('"');
@@ -371,6 +451,11 @@ int CControlSocket::CheckOverwriteFile()
 	}
 
 	auto & data = static_cast<CFileTransferOpData &>(*operations_.back());
+	if (data.segmentSize_) {
+		// The file has been created for the segments on purpose
+		return FZ_REPLY_OK;
+	}
+
 	data.localFileSize_ = data.download() ? data.writer_factory_.size() : data.reader_factory_.size();
 	data.localFileTime_ = data.download() ? data.writer_factory_.mtime() : data.reader_factory_.mtime();
 
@@ -462,6 +547,14 @@ CFileTransferOpData::CFileTransferOpData(wchar_t const* name, CFileTransferComma
 {
 	localFileSize_ = download() ? writer_factory_.size() : reader_factory_.size();
 	localFileTime_ = download() ? writer_factory_.mtime() : reader_factory_.mtime();
+
+	if (download() && writer_factory_) {
+		auto const* segment = dynamic_cast<segment_writer_factory const*>(&*writer_factory_);
+		if (segment) {
+			segmentOffset_ = segment->segment_offset();
+			segmentSize_ = segment->segment_size();
+		}
+	}
 }
 
 std::wstring CControlSocket::ConvToLocal(char const* buffer, size_t len)
@@ -534,8 +627,32 @@ void CControlSocket::OnTimer(fz::timer_id)
 	if (timeout > 0) {
 		fz::duration elapsed = fz::monotonic_clock::now() - m_lastActivity;
 
+		fz::duration limit = fz::duration::from_seconds(timeout);
+		auto * checksum = PendingChecksum();
+		if (checksum) {
+			// Allow for hashing at 16 MiB/s
+			int64_t size = -1;
+			if (checksum->download()) {
+				size = checksum->remoteFileSize_;
+			}
+			else if (checksum->localFileSize_ != fz::aio_base::nosize) {
+				size = static_cast<int64_t>(checksum->localFileSize_);
+			}
+			if (size > 0) {
+				limit += fz::duration::from_seconds(size / (16 * 1024 * 1024));
+			}
+		}
+
 		if ((operations_.empty() || !operations_.back()->waitForAsyncRequest) && !opLockManager_.Waiting(this)) {
-			if (elapsed > fz::duration::from_seconds(timeout)) {
+			if (elapsed > limit) {
+				if (checksum) {
+					// The data has been transferred successfully
+					log(logmsg::status, _("Server did not send the checksum in time, transferred file not verified."));
+					checksum->hasher_.reset();
+					checksum->checksumPending_ = false;
+					ResetOperation(FZ_REPLY_OK);
+					return;
+				}
 				log(logmsg::error, fztranslate("Connection timed out after %d second of inactivity", "Connection timed out after %d seconds of inactivity", timeout), timeout);
 				DoClose(FZ_REPLY_TIMEOUT);
 				return;
@@ -545,7 +662,7 @@ void CControlSocket::OnTimer(fz::timer_id)
 			elapsed = fz::duration();
 		}
 
-		m_timer = add_timer(fz::duration::from_milliseconds(timeout * 1000) - elapsed, true);
+		m_timer = add_timer(limit - elapsed, true);
 	}
 }
 
@@ -1171,7 +1288,9 @@ void CControlSocket::Sleep(fz::duration const& delay)
 bool CControlSocket::InitBufferPool(bool use_shm)
 {
 	if (!buffer_pool_) {
-		buffer_pool_.emplace(logger_, 8, 0, use_shm);
+		// With shared memory, fzsftp gets handed up to all buffers at once
+		size_t const count = use_shm ? static_cast<size_t>(engine_.GetOptions().get_int(OPTION_SFTP_RING_DEPTH)) : 8;
+		buffer_pool_.emplace(logger_, count, 0, use_shm);
 	}
 	return *buffer_pool_;
 }
@@ -10,8 +10,11 @@
 #include "oplock_manager.h"
 
 #include <libfilezilla/buffer.hpp>
+#include <libfilezilla/hash.hpp>
 #include <libfilezilla/socket.hpp>
 
+#include <atomic>
+
 class COpData
 {
 public:
@@ -150,6 +153,25 @@ public:
 
 	int64_t remoteFileSize_{-1};
 	fz::datetime remoteFileTime_;
+
+	// If segmentSize_ is set, only that many bytes starting at segmentOffset_
+	// get downloaded, see segment_writer_factory.
+	uint64_t segmentOffset_{};
+	uint64_t segmentSize_{};
+
+	// If set, the transferred data gets hashed as it passes through, to be
+	// compared with the checksum the server computes once the transfer is done.
+	std::unique_ptr<fz::hash_accumulator> hasher_;
+	fz::hash_algorithm hashAlgorithm_{};
+
+	// Set while waiting for the checksum. Servers take a while to compute it
+	// for large files, the timeout gets extended accordingly. If it still
+	// expires, the transfer succeeds unverified, see CControlSocket::OnTimer.
+	bool checksumPending_{};
+
+	// Set on a checksum mismatch. The downloaded file gets deleted once the
+	// writer is closed, so that a retry cannot resume it.
+	bool corrupt_{};
 };
 
 class CMkdirOpData : public COpData
@@ -294,6 +316,17 @@ protected:
 
 	int CheckOverwriteFile();
 
+	// Checks whether the transferred file is to be verified. Only complete
+	// binary transfers can be verified.
+	bool WantChecksum(CFileTransferOpData const& data, bool binary, int64_t resumeOffset) const;
+
+	// Compares the hash of the transferred data with the hex-encoded digest
+	// found in the server's reply. Only a mismatch is an error.
+	int VerifyChecksum(std::wstring const& reply);
+
+	// The transfer if waiting for its checksum, else nullptr
+	CFileTransferOpData* PendingChecksum();
+
 	bool ParsePwdReply(std::wstring reply, const CServerPath& defaultPath = CServerPath());
 
 	virtual void Push(std::unique_ptr<COpData> && pNewOpData);
@@ -312,7 +345,8 @@ protected:
 
 	CServerPath currentPath_;
 
-	bool m_useUTF8{};
+	// Atomic as the listing parser may convert lines from a worker thread
+	std::atomic<bool> m_useUTF8{};
 
 	// Timeout data
 	fz::timer_id m_timer{};
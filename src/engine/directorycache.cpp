@@ -1,113 +1,193 @@
 #include "filezilla.h"
 #include "directorycache.h"
+#include "directorycachestore.h"
+#include "stringpool.h"
 
 #include <assert.h>
 
-CDirectoryCache::CDirectoryCache()
+namespace {
+// Only uses properties compared by CServer::SameContent
+size_t server_hash(CServer const& server)
 {
+	size_t h = std::hash<std::wstring>()(server.GetHost());
+	auto const add = [&h](size_t v) {
+		h ^= v + 0x9e3779b9 + (h << 6) + (h >> 2);
+	};
+	add(std::hash<std::wstring>()(server.GetUser()));
+	add(server.GetPort());
+	add(server.GetProtocol());
+	return h;
 }
 
-CDirectoryCache::~CDirectoryCache()
+size_t listing_bytes(CDirectoryListing const& listing)
 {
-	for (auto & serverEntry : m_serverList) {
-		for (auto & cacheEntry : serverEntry.cacheList) {
-#ifndef NDEBUG
-			m_totalFileCount -= cacheEntry.listing.size();
-#endif
-			tLruList::iterator* lruIt = (tLruList::iterator*)cacheEntry.lruIt;
-			if (lruIt) {
-				m_leastRecentlyUsedList.erase(*lruIt);
-				delete lruIt;
-			}
+	// Each entry is a separate allocation with a reference count
+	size_t ret = sizeof(CDirectoryListing) + listing.size() * (sizeof(fz::shared_value<CDirentry>) + sizeof(CDirentry) + 2 * sizeof(void*));
+	for (size_t i = 0; i < listing.size(); ++i) {
+		CDirentry const& entry = listing[i];
+		ret += entry.name.capacity() * sizeof(wchar_t);
+		if (entry.target) {
+			ret += sizeof(std::wstring) + entry.target->capacity() * sizeof(wchar_t);
 		}
 	}
-#ifndef NDEBUG
-	assert(m_totalFileCount == 0);
-#endif
+	return ret;
+}
 }
 
-void CDirectoryCache::Store(CDirectoryListing const& listing, CServer const& server)
+CDirectoryCache::CDirectoryCache(CStringPool & pool)
+	: pool_(pool)
 {
-	fz::scoped_lock lock(mutex_);
+}
 
-	tServerIter sit = CreateServerEntry(server);
-	assert(sit != m_serverList.end());
+CDirectoryCache::~CDirectoryCache()
+{
+	SavePersisted();
+}
 
-	m_totalFileCount += listing.size();
+size_t CDirectoryCache::CCacheEntry::find(std::wstring const& name, bool cmpCase) const
+{
+	fz::scoped_lock lock(find_mutex);
 
-	tCacheIter cit;
-	bool unused;
-	if (Lookup(cit, sit, listing.path, true, unused)) {
-		auto & entry = const_cast<CCacheEntry&>(*cit);
-		entry.modificationTime = fz::monotonic_clock::now();
+	if (compacted) {
+		return cmpCase ? compact->FindFile_CmpCase(name) : compact->FindFile_CmpNoCase(name);
+	}
+	return cmpCase ? listing.FindFile_CmpCase(name) : listing.FindFile_CmpNoCase(name);
+}
 
-		m_totalFileCount -= cit->listing.size();
-		entry.listing = listing;
+CDirentry CDirectoryCache::CCacheEntry::entry(size_t index) const
+{
+	if (compacted) {
+		return (*compact)[index].materialize();
+	}
+	return listing[index];
+}
 
-		return;
+CDirectoryCache::read_lock::read_lock(CDirectoryCache & cache, CServer const& server, CServerPath const& path)
+	: mutex_(cache.mutex_)
+{
+	mutex_.lock_read();
+	if (cache.store_ && cache.store_->Contains(server, path)) {
+		mutex_.unlock_read();
+		mutex_.lock_write();
+		exclusive_ = true;
+		cache.LoadPersisted(server, path, false);
+	}
+}
+
+CDirectoryCache::read_lock::~read_lock()
+{
+	if (exclusive_) {
+		mutex_.unlock_write();
+	}
+	else {
+		mutex_.unlock_read();
 	}
+}
 
-	cit = sit->cacheList.emplace_hint(cit, listing);
+void CDirectoryCache::Store(CDirectoryListing const& listing, CServer const& server)
+{
+	fz::scoped_write_lock lock(mutex_);
 
-	UpdateLru(sit, cit);
+	if (store_) {
+		store_->Forget(server, listing.path);
+	}
 
-	Prune();
+	DoStore(listing, server, true);
 }
 
-bool CDirectoryCache::Lookup(CDirectoryListing &listing, CServer const& server, const CServerPath &path, bool allowUnsureEntries, bool& is_outdated)
+void CDirectoryCache::DoStore(CDirectoryListing const& listing, CServer const& server, bool replace)
 {
-	fz::scoped_lock lock(mutex_);
+	CServerEntry & s = CreateServerEntry(server);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
-		return false;
+	auto [it, inserted] = s.entries.try_emplace(listing.path, s, listing);
+	CCacheEntry & entry = it->second;
+	if (inserted) {
+		++m_listingCount;
+		entry.persisted = !replace;
 	}
+	else {
+		if (!replace) {
+			return;
+		}
 
-	tCacheIter iter;
-	if (Lookup(iter, sit, path, allowUnsureEntries, is_outdated)) {
-		listing = iter->listing;
-		return true;
+		m_totalFileCount -= entry.file_count();
+		m_expandedFileCount -= entry.expanded_count();
+		entry.listing = listing;
+		entry.compact.reset();
+		entry.compacted = false;
+		entry.modificationTime = fz::monotonic_clock::now();
+		entry.persisted = false;
 	}
 
-	return false;
+	m_totalFileCount += listing.size();
+	m_expandedFileCount += listing.size();
+	UpdateSize(entry);
+	UpdateLru(entry);
+
+	CompactColdEntries();
+	Prune();
 }
 
-bool CDirectoryCache::Lookup(tCacheIter &cacheIter, tServerIter &sit, CServerPath const& path, bool allowUnsureEntries, bool& is_outdated)
+bool CDirectoryCache::Lookup(CDirectoryListing &listing, CServer const& server, const CServerPath &path, bool allowUnsureEntries, bool& is_outdated)
 {
-	CCacheEntry dummy;
-	dummy.listing.path = path;
-	cacheIter = sit->cacheList.lower_bound(dummy);
-
-	if (cacheIter != sit->cacheList.end()) {
-		CCacheEntry const& entry = *cacheIter;
+	read_lock lock(*this, server, path);
+
+	CCacheEntry const* entry = Lookup(server, path, allowUnsureEntries, is_outdated);
+	if (entry) {
+		fz::scoped_lock l(entry->find_mutex);
+		listing = entry->listing;
+		if (entry->compacted) {
+			listing.Assign(entry->compact);
+		}
+		else {
+			// Other lookups may still be adding to the shared search maps
+			listing.ClearFindMap();
+		}
+		return true;
+	}
 
-		if (entry.listing.path == path) {
-			UpdateLru(sit, cacheIter);
+	return false;
+}
 
-			if (!allowUnsureEntries && entry.listing.get_unsure_flags()) {
-				return false;
+CDirectoryCache::CCacheEntry* CDirectoryCache::Lookup(CServer const& server, CServerPath const& path, bool allowUnsureEntries, bool& is_outdated)
+{
+	CServerEntry* s = GetServerEntry(server);
+	if (s) {
+		auto it = s->entries.find(path);
+		if (it != s->entries.end()) {
+			CCacheEntry & entry = it->second;
+			entry.referenced = true;
+
+			if (allowUnsureEntries || !entry.listing.get_unsure_flags()) {
+				++hits_;
+				is_outdated = entry.persisted || (fz::monotonic_clock::now() - entry.listing.m_firstListTime) > ttl_;
+				return &entry;
 			}
-
-			is_outdated = (fz::monotonic_clock::now() - entry.listing.m_firstListTime) > ttl_;
-			return true;
 		}
 	}
 
-	return false;
+	++misses_;
+	return nullptr;
 }
 
-bool CDirectoryCache::DoesExist(CServer const& server, CServerPath const& path, int &hasUnsureEntries, bool &is_outdated)
+template<typename F>
+void CDirectoryCache::ForEachNoCase(CServerEntry & s, CServerPath const& path, F && f)
 {
-	fz::scoped_lock lock(mutex_);
-
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
-		return false;
+	size_t const bucket = s.entries.bucket(path);
+	for (auto it = s.entries.begin(bucket); it != s.entries.end(bucket); ++it) {
+		if (!path.CmpNoCase(it->first)) {
+			f(it->second);
+		}
 	}
+}
 
-	tCacheIter iter;
-	if (Lookup(iter, sit, path, true, is_outdated)) {
-		hasUnsureEntries = iter->listing.get_unsure_flags();
+bool CDirectoryCache::DoesExist(CServer const& server, CServerPath const& path, int &hasUnsureEntries, bool &is_outdated)
+{
+	read_lock lock(*this, server, path);
+
+	CCacheEntry* entry = Lookup(server, path, true, is_outdated);
+	if (entry) {
+		hasUnsureEntries = entry->listing.get_unsure_flags();
 		return true;
 	}
 
@@ -119,16 +199,11 @@ std::tuple<LookupResults, CDirentry> CDirectoryCache::LookupFile(CServer const&
 	LookupResults results{};
 	CDirentry entry;
 
-	fz::scoped_lock lock(mutex_);
+	read_lock lock(*this, server, path);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
-		return {results, entry};
-	}
-
-	tCacheIter iter;
 	bool outdated{};
-	if (!Lookup(iter, sit, path, true, outdated)) {
+	CCacheEntry const* cacheEntry = Lookup(server, path, true, outdated);
+	if (!cacheEntry) {
 		return {results, entry};
 	}
 
@@ -141,18 +216,15 @@ std::tuple<LookupResults, CDirentry> CDirectoryCache::LookupFile(CServer const&
 
 	results |= LookupResults::direxists;
 
-	CCacheEntry const& cacheEntry = *iter;
-	CDirectoryListing const& listing = cacheEntry.listing;
-
-	size_t i = listing.FindFile_CmpCase(filename);
+	size_t i = cacheEntry->find(filename, true);
 	if (i != std::string::npos) {
-		entry = listing[i];
+		entry = cacheEntry->entry(i);
 		results |= LookupResults::found | LookupResults::matchedcase;
 	}
 	else if (server.GetCaseSensitivity() != CaseSensitivity::yes || (flags & LookupFlags::force_caseinsensitive)) {
-		i = listing.FindFile_CmpNoCase(filename);
+		i = cacheEntry->find(filename, false);
 		if (i != std::string::npos) {
-			entry = listing[i];
+			entry = cacheEntry->entry(i);
 			results |= LookupResults::found;
 		}
 	}
@@ -164,16 +236,11 @@ std::vector<std::tuple<LookupResults, CDirentry>> CDirectoryCache::LookupFiles(C
 {
 	std::vector<std::tuple<LookupResults, CDirentry>> ret;
 
-	fz::scoped_lock lock(mutex_);
+	read_lock lock(*this, server, path);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
-		return ret;
-	}
-
-	tCacheIter iter;
 	bool outdated{};
-	if (!Lookup(iter, sit, path, true, outdated)) {
+	CCacheEntry const* cacheEntry = Lookup(server, path, true, outdated);
+	if (!cacheEntry) {
 		return ret;
 	}
 
@@ -188,23 +255,20 @@ std::vector<std::tuple<LookupResults, CDirentry>> CDirectoryCache::LookupFiles(C
 
 	results |= LookupResults::direxists;
 
-	CCacheEntry const& cacheEntry = *iter;
-	CDirectoryListing const& listing = cacheEntry.listing;
-
 	ret.reserve(filenames.size());
 
 	for (auto const& filename : filenames) {
 		CDirentry entry;
 		LookupResults fileresults = results;
-		size_t i = listing.FindFile_CmpCase(filename);
+		size_t i = cacheEntry->find(filename, true);
 		if (i != std::string::npos) {
-			entry = listing[i];
+			entry = cacheEntry->entry(i);
 			fileresults |= LookupResults::found | LookupResults::matchedcase;
 		}
 		else if (server.GetCaseSensitivity() != CaseSensitivity::yes || (flags & LookupFlags::force_caseinsensitive)) {
-			i = listing.FindFile_CmpNoCase(filename);
+			i = cacheEntry->find(filename, false);
 			if (i != std::string::npos) {
-				entry = listing[i];
+				entry = cacheEntry->entry(i);
 				fileresults |= LookupResults::found;
 			}
 		}
@@ -216,34 +280,25 @@ std::vector<std::tuple<LookupResults, CDirentry>> CDirectoryCache::LookupFiles(C
 
 bool CDirectoryCache::LookupFile(CDirentry &entry, CServer const& server, CServerPath const& path, std::wstring const& filename, bool &dirDidExist, bool &matchedCase)
 {
-	fz::scoped_lock lock(mutex_);
+	read_lock lock(*this, server, path);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
-		dirDidExist = false;
-		return false;
-	}
-
-	tCacheIter iter;
 	bool unused;
-	if (!Lookup(iter, sit, path, true, unused)) {
+	CCacheEntry const* cacheEntry = Lookup(server, path, true, unused);
+	if (!cacheEntry) {
 		dirDidExist = false;
 		return false;
 	}
 	dirDidExist = true;
 
-	const CCacheEntry &cacheEntry = *iter;
-	const CDirectoryListing &listing = cacheEntry.listing;
-
-	size_t i = listing.FindFile_CmpCase(filename);
+	size_t i = cacheEntry->find(filename, true);
 	if (i != std::string::npos) {
-		entry = listing[i];
+		entry = cacheEntry->entry(i);
 		matchedCase = true;
 		return true;
 	}
-	i = listing.FindFile_CmpNoCase(filename);
+	i = cacheEntry->find(filename, false);
 	if (i != std::string::npos) {
-		entry = listing[i];
+		entry = cacheEntry->entry(i);
 		matchedCase = false;
 		return true;
 	}
@@ -253,10 +308,11 @@ bool CDirectoryCache::LookupFile(CDirentry &entry, CServer const& server, CServe
 
 bool CDirectoryCache::InvalidateFile(CServer const& server, CServerPath const& path, std::wstring const& filename)
 {
-	fz::scoped_lock lock(mutex_);
+	fz::scoped_write_lock lock(mutex_);
+	LoadPersisted(server, path, true, true);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
+	CServerEntry* s = GetServerEntry(server);
+	if (!s) {
 		return false;
 	}
 
@@ -264,21 +320,9 @@ bool CDirectoryCache::InvalidateFile(CServer const& server, CServerPath const& p
 	bool dir{};
 
 	auto const now = fz::monotonic_clock::now();
-	for (tCacheIter iter = sit->cacheList.begin(); iter != sit->cacheList.end(); ++iter) {
-		auto & entry = const_cast<CCacheEntry&>(*iter);
-
-		if (cmpCase) {
-			if (path != entry.listing.path) {
-				continue;
-			}
-		}
-		else {
-			if (path.CmpNoCase(entry.listing.path)) {
-				continue;
-			}
-		}
-
-		UpdateLru(sit, iter);
+	auto const invalidate = [&](CCacheEntry & entry) {
+		UpdateLru(entry);
+		Expand(entry);
 
 		for (unsigned int i = 0; i < entry.listing.size(); i++) {
 			bool same;
@@ -297,13 +341,23 @@ bool CDirectoryCache::InvalidateFile(CServer const& server, CServerPath const& p
 		}
 		entry.listing.m_flags |= CDirectoryListing::unsure_unknown;
 		entry.modificationTime = now;
+	};
+
+	if (cmpCase) {
+		auto it = s->entries.find(path);
+		if (it != s->entries.end()) {
+			invalidate(it->second);
+		}
+	}
+	else {
+		ForEachNoCase(*s, path, invalidate);
 	}
 
 	if (dir) {
 		CServerPath child = path;
 		if (child.ChangePath(filename)) {
-			for (tCacheIter iter = sit->cacheList.begin(); iter != sit->cacheList.end(); ++iter) {
-				auto & entry = const_cast<CCacheEntry&>(*iter);
+			for (auto & it : s->entries) {
+				auto & entry = it.second;
 				if (path.IsParentOf(entry.listing.path, !cmpCase, true)) {
 					entry.listing.m_flags |= CDirectoryListing::unsure_unknown;
 					entry.modificationTime = now;
@@ -317,22 +371,24 @@ bool CDirectoryCache::InvalidateFile(CServer const& server, CServerPath const& p
 
 bool CDirectoryCache::UpdateFile(CServer const& server, CServerPath const& path, std::wstring const& filename, bool mayCreate, Filetype type, int64_t size, std::wstring const& ownerGroup)
 {
-	fz::scoped_lock lock(mutex_);
+	fz::scoped_write_lock lock(mutex_);
+	return DoUpdateFile(server, path, filename, mayCreate, type, size, ownerGroup);
+}
+
+bool CDirectoryCache::DoUpdateFile(CServer const& server, CServerPath const& path, std::wstring const& filename, bool mayCreate, Filetype type, int64_t size, std::wstring const& ownerGroup)
+{
+	LoadPersisted(server, path, false, true);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
+	CServerEntry* s = GetServerEntry(server);
+	if (!s) {
 		return false;
 	}
 
 	bool updated = false;
 
-	for (tCacheIter iter = sit->cacheList.begin(); iter != sit->cacheList.end(); ++iter) {
-		auto & entry = const_cast<CCacheEntry&>(*iter);
-		if (path.CmpNoCase(entry.listing.path)) {
-			continue;
-		}
-
-		UpdateLru(sit, iter);
+	ForEachNoCase(*s, path, [&](CCacheEntry & entry) {
+		UpdateLru(entry);
+		Expand(entry);
 
 		bool matchCase = false;
 		size_t i;
@@ -369,7 +425,7 @@ bool CDirectoryCache::UpdateFile(CServer const& server, CServerPath const& path,
 			}
 			direntry.size = size;
 			if (!ownerGroup.empty()) {
-				direntry.ownerGroup.get() = ownerGroup;
+				direntry.ownerGroup = pool_.Get(ownerGroup);
 			}
 			switch (type) {
 			case dir:
@@ -385,6 +441,8 @@ bool CDirectoryCache::UpdateFile(CServer const& server, CServerPath const& path,
 			entry.listing.Append(std::move(direntry));
 
 			++m_totalFileCount;
+			++m_expandedFileCount;
+			UpdateSize(entry);
 		}
 		else {
 			entry.listing.m_flags |= CDirectoryListing::unsure_unknown;
@@ -392,27 +450,30 @@ bool CDirectoryCache::UpdateFile(CServer const& server, CServerPath const& path,
 		entry.modificationTime = fz::monotonic_clock::now();
 
 		updated = true;
-	}
+	});
 
 	return updated;
 }
 
 bool CDirectoryCache::RemoveFile(CServer const& server, CServerPath const& path, std::wstring const& filename)
 {
-	fz::scoped_lock lock(mutex_);
+	fz::scoped_write_lock lock(mutex_);
+	DoRemoveFile(server, path, filename);
+	return true;
+}
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
-		return false;
-	}
+void CDirectoryCache::DoRemoveFile(CServer const& server, CServerPath const& path, std::wstring const& filename)
+{
+	LoadPersisted(server, path, false, true);
 
-	for (tCacheIter iter = sit->cacheList.begin(); iter != sit->cacheList.end(); ++iter) {
-		auto & entry = const_cast<CCacheEntry&>(*iter);
-		if (path.CmpNoCase(entry.listing.path)) {
-			continue;
-		}
+	CServerEntry* s = GetServerEntry(server);
+	if (!s) {
+		return;
+	}
 
-		UpdateLru(sit, iter);
+	ForEachNoCase(*s, path, [&](CCacheEntry & entry) {
+		UpdateLru(entry);
+		Expand(entry);
 
 		bool matchCase = false;
 		for (size_t i = 0; i < entry.listing.size(); ++i) {
@@ -432,6 +493,8 @@ bool CDirectoryCache::RemoveFile(CServer const& server, CServerPath const& path,
 
 			entry.listing.RemoveEntry(i); // This does set m_hasUnsureEntries
 			--m_totalFileCount;
+			--m_expandedFileCount;
+			UpdateSize(entry);
 		}
 		else {
 			for (size_t i = 0; i < entry.listing.size(); ++i) {
@@ -442,48 +505,35 @@ bool CDirectoryCache::RemoveFile(CServer const& server, CServerPath const& path,
 			entry.listing.m_flags |= CDirectoryListing::unsure_invalid;
 		}
 		entry.modificationTime = fz::monotonic_clock::now();
-	}
-
-	return true;
+	});
 }
 
 void CDirectoryCache::InvalidateServer(CServer const& server)
 {
-	fz::scoped_lock lock(mutex_);
-
-	for (auto iter = m_serverList.begin(); iter != m_serverList.end(); ++iter) {
-		if (!iter->server.SameContent(server)) {
-			continue;
-		}
-
-		for (tCacheIter cit = iter->cacheList.begin(); cit != iter->cacheList.end(); ++cit) {
-			tLruList::iterator* lruIt = (tLruList::iterator*)cit->lruIt;
-			if (lruIt) {
-				m_leastRecentlyUsedList.erase(*lruIt);
-				delete lruIt;
-			}
+	fz::scoped_write_lock lock(mutex_);
+	DoInvalidateServer(server);
+}
 
-			m_totalFileCount -= cit->listing.size();
-		}
+void CDirectoryCache::DoInvalidateServer(CServer const& server)
+{
+	if (store_) {
+		store_->Forget(server);
+	}
 
-		m_serverList.erase(iter);
-		break;
+	CServerEntry* s = GetServerEntry(server);
+	if (s) {
+		RemoveServer(*s);
 	}
 }
 
 bool CDirectoryCache::GetChangeTime(fz::monotonic_clock& time, CServer const& server, CServerPath const& path)
 {
-	fz::scoped_lock lock(mutex_);
-
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
-		return false;
-	}
+	read_lock lock(*this, server, path);
 
-	tCacheIter iter;
 	bool unused;
-	if (Lookup(iter, sit, path, true, unused)) {
-		time = iter->modificationTime;
+	CCacheEntry const* entry = Lookup(server, path, true, unused);
+	if (entry) {
+		time = entry->modificationTime;
 		return true;
 	}
 
@@ -492,57 +542,56 @@ bool CDirectoryCache::GetChangeTime(fz::monotonic_clock& time, CServer const& se
 
 void CDirectoryCache::RemoveDir(CServer const& server, CServerPath const& path, std::wstring const& filename, CServerPath const&)
 {
-	fz::scoped_lock lock(mutex_);
+	fz::scoped_write_lock lock(mutex_);
+	DoRemoveDir(server, path, filename);
+}
 
+void CDirectoryCache::DoRemoveDir(CServer const& server, CServerPath const& path, std::wstring const& filename)
+{
 	// TODO: This is not 100% foolproof and may not work properly
 	// Perhaps just throw away the complete cache?
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
-		return;
-	}
-
 	CServerPath absolutePath = path;
 	if (!absolutePath.AddSegment(filename)) {
 		absolutePath.clear();
 	}
+	else if (store_) {
+		store_->Forget(server, absolutePath, true, true);
+	}
+	LoadPersisted(server, path, false);
 
-	for (tCacheIter iter = sit->cacheList.begin(); iter != sit->cacheList.end(); ) {
-		auto & entry = const_cast<CCacheEntry&>(*iter);
+	CServerEntry* s = GetServerEntry(server);
+	if (!s) {
+		return;
+	}
+
+	if (!absolutePath.empty()) {
 		// Delete exact matches and subdirs
-		if (!absolutePath.empty() && (entry.listing.path == absolutePath || absolutePath.IsParentOf(entry.listing.path, true))) {
-			m_totalFileCount -= entry.listing.size();
-			tLruList::iterator* lruIt = (tLruList::iterator*)iter->lruIt;
-			if (lruIt) {
-				m_leastRecentlyUsedList.erase(*lruIt);
-				delete lruIt;
+		for (auto it = s->entries.begin(); it != s->entries.end(); ) {
+			if (it->first == absolutePath || absolutePath.IsParentOf(it->first, true)) {
+				it = Remove(it);
+			}
+			else {
+				++it;
 			}
-			sit->cacheList.erase(iter++);
-		}
-		else {
-			++iter;
 		}
 	}
 
-	RemoveFile(server, path, filename);
+	DoRemoveFile(server, path, filename);
 }
 
 void CDirectoryCache::Rename(CServer const& server, CServerPath const& pathFrom, std::wstring const& fileFrom, CServerPath const& pathTo, std::wstring const& fileTo)
 {
-	fz::scoped_lock lock(mutex_);
-
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
-		return;
-	}
+	fz::scoped_write_lock lock(mutex_);
+	LoadPersisted(server, pathFrom, false);
 
-	tCacheIter iter;
 	bool is_outdated = false;
-	bool found = Lookup(iter, sit, pathFrom, true, is_outdated);
-	if (found) {
-		auto & listing = const_cast<CDirectoryListing&>(iter->listing);
+	CCacheEntry* entry = Lookup(server, pathFrom, true, is_outdated);
+	if (entry) {
+		UpdateLru(*entry);
+		auto & listing = Expand(*entry);
 		if (pathFrom == pathTo) {
-			RemoveFile(server, pathFrom, fileTo);
+			DoRemoveFile(server, pathFrom, fileTo);
 			size_t i;
 			for (i = 0; i < listing.size(); ++i) {
 				if (listing[i].name == fileFrom) {
@@ -551,9 +600,9 @@ void CDirectoryCache::Rename(CServer const& server, CServerPath const& pathFrom,
 			}
 			if (i != listing.size()) {
 				if (listing[i].is_dir()) {
-					RemoveDir(server, pathFrom, fileFrom, CServerPath());
-					RemoveDir(server, pathFrom, fileTo, CServerPath());
-					UpdateFile(server, pathFrom, fileTo, true, dir);
+					DoRemoveDir(server, pathFrom, fileFrom);
+					DoRemoveDir(server, pathFrom, fileTo);
+					DoUpdateFile(server, pathFrom, fileTo, true, dir);
 				}
 				else {
 					listing.get(i).name = fileTo;
@@ -573,12 +622,12 @@ void CDirectoryCache::Rename(CServer const& server, CServerPath const& pathFrom,
 			}
 			if (i != listing.size()) {
 				if (listing[i].is_dir()) {
-					RemoveDir(server, pathFrom, fileFrom, CServerPath());
-					UpdateFile(server, pathTo, fileTo, true, dir);
+					DoRemoveDir(server, pathFrom, fileFrom);
+					DoUpdateFile(server, pathTo, fileTo, true, dir);
 				}
 				else {
-					RemoveFile(server, pathFrom, fileFrom);
-					UpdateFile(server, pathTo, fileTo, true, file);
+					DoRemoveFile(server, pathFrom, fileFrom);
+					DoUpdateFile(server, pathTo, fileTo, true, file);
 				}
 			}
 			return;
@@ -586,23 +635,19 @@ void CDirectoryCache::Rename(CServer const& server, CServerPath const& pathFrom,
 	}
 
 	// We know nothing, be on the safe side and invalidate everything.
-	InvalidateServer(server);
+	DoInvalidateServer(server);
 }
 
 void CDirectoryCache::UpdateOwnerGroup(CServer const& server, CServerPath const& path, std::wstring const& filename, std::wstring& ownerGroup)
 {
-	fz::scoped_lock lock(mutex_);
+	fz::scoped_write_lock lock(mutex_);
+	LoadPersisted(server, path, false);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
-		return;
-	}
-
-	tCacheIter iter;
 	bool is_outdated = false;
-	bool found = Lookup(iter, sit, path, true, is_outdated);
-	if (found) {
-		auto & listing = const_cast<CDirectoryListing&>(iter->listing);
+	CCacheEntry* entry = Lookup(server, path, true, is_outdated);
+	if (entry) {
+		UpdateLru(*entry);
+		auto & listing = Expand(*entry);
 		size_t i;
 		for (i = 0; i < listing.size(); ++i) {
 			if (listing[i].name == filename) {
@@ -611,7 +656,7 @@ void CDirectoryCache::UpdateOwnerGroup(CServer const& server, CServerPath const&
 		}
 		if (i != listing.size()) {
 			if (!listing[i].is_dir()) {
-				listing.get(i).ownerGroup.get() = ownerGroup;
+				listing.get(i).ownerGroup = pool_.Get(ownerGroup);
 				listing.ClearFindMap();
 			}
 			return;
@@ -619,71 +664,185 @@ void CDirectoryCache::UpdateOwnerGroup(CServer const& server, CServerPath const&
 	}
 
 	// We know nothing, be on the safe side and invalidate everything.
-	InvalidateServer(server);
+	DoInvalidateServer(server);
 }
 
 
-CDirectoryCache::tServerIter CDirectoryCache::CreateServerEntry(CServer const& server)
+CDirectoryCache::CServerEntry& CDirectoryCache::CreateServerEntry(CServer const& server)
 {
-	for (tServerIter iter = m_serverList.begin(); iter != m_serverList.end(); ++iter) {
-		if (iter->server.SameContent(server)) {
-			return iter;
+	size_t const hash = server_hash(server);
+	auto range = m_servers.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it) {
+		if (it->second.server.SameContent(server)) {
+			return it->second;
 		}
 	}
-	m_serverList.emplace_back(server);
 
-	return --m_serverList.end();
+	return m_servers.emplace(std::piecewise_construct, std::forward_as_tuple(hash), std::forward_as_tuple(server))->second;
 }
 
-CDirectoryCache::tServerIter CDirectoryCache::GetServerEntry(CServer const& server)
+CDirectoryCache::CServerEntry* CDirectoryCache::GetServerEntry(CServer const& server)
 {
-	tServerIter iter;
-	for (iter = m_serverList.begin(); iter != m_serverList.end(); ++iter) {
-		if (iter->server.SameContent(server)) {
-			break;
+	auto range = m_servers.equal_range(server_hash(server));
+	for (auto it = range.first; it != range.second; ++it) {
+		if (it->second.server.SameContent(server)) {
+			return &it->second;
 		}
 	}
 
-	return iter;
+	return nullptr;
+}
+
+CDirectoryCache::tEntries::iterator CDirectoryCache::Remove(tEntries::iterator it)
+{
+	CCacheEntry & entry = it->second;
+	UnlinkLru(entry);
+
+	--m_listingCount;
+	m_totalFileCount -= entry.file_count();
+	m_expandedFileCount -= entry.expanded_count();
+	m_totalBytes -= entry.bytes;
+
+	return entry.server.entries.erase(it);
 }
 
-void CDirectoryCache::UpdateLru(tServerIter const& sit, tCacheIter const& cit)
+void CDirectoryCache::RemoveServer(CServerEntry & s)
 {
-	tLruList::iterator* lruIt = (tLruList::iterator*)cit->lruIt;
-	if (lruIt) {
-		m_leastRecentlyUsedList.splice(m_leastRecentlyUsedList.end(), m_leastRecentlyUsedList, *lruIt);
-		**lruIt = std::make_pair(sit, cit);
+	for (auto it = s.entries.begin(); it != s.entries.end(); ) {
+		it = Remove(it);
+	}
+
+	auto range = m_servers.equal_range(server_hash(s.server));
+	for (auto it = range.first; it != range.second; ++it) {
+		if (&it->second == &s) {
+			m_servers.erase(it);
+			break;
+		}
+	}
+}
+
+void CDirectoryCache::UpdateLru(CCacheEntry & entry)
+{
+	if (lru_last_ == &entry) {
+		return;
+	}
+
+	UnlinkLru(entry);
+	entry.lru_prev = lru_last_;
+	if (lru_last_) {
+		lru_last_->lru_next = &entry;
 	}
 	else {
-		auto & entry = const_cast<CCacheEntry&>(*cit);
-		entry.lruIt = (void*)new tLruList::iterator(m_leastRecentlyUsedList.emplace(m_leastRecentlyUsedList.end(), sit, cit));
+		lru_first_ = &entry;
+	}
+	lru_last_ = &entry;
+}
+
+void CDirectoryCache::UnlinkLru(CCacheEntry & entry)
+{
+	if (entry.lru_prev) {
+		entry.lru_prev->lru_next = entry.lru_next;
+	}
+	else if (lru_first_ == &entry) {
+		lru_first_ = entry.lru_next;
+	}
+	if (entry.lru_next) {
+		entry.lru_next->lru_prev = entry.lru_prev;
+	}
+	else if (lru_last_ == &entry) {
+		lru_last_ = entry.lru_prev;
 	}
+	entry.lru_prev = nullptr;
+	entry.lru_next = nullptr;
+}
+
+void CDirectoryCache::UpdateSize(CCacheEntry & entry)
+{
+	m_totalBytes -= entry.bytes;
+
+	// Hash table node and bucket
+	entry.bytes = sizeof(tEntries::value_type) + 3 * sizeof(void*);
+	entry.bytes += entry.compacted ? entry.compact->memory_usage() : listing_bytes(entry.listing);
+
+	m_totalBytes += entry.bytes;
 }
 
 void CDirectoryCache::Prune()
 {
-	while ((m_leastRecentlyUsedList.size() > 50000) ||
-		(m_totalFileCount > 1000000 && m_leastRecentlyUsedList.size() > 1000) ||
-		(m_totalFileCount > 5000000 && m_leastRecentlyUsedList.size() > 100))
-	{
-		tFullEntryPosition pos = m_leastRecentlyUsedList.front();
-		tLruList::iterator* lruIt = (tLruList::iterator*)pos.second->lruIt;
-		delete lruIt;
+	// The most recently used listing always stays, also once referenced
+	// listings got rotated behind it.
+	CCacheEntry* const newest = lru_last_;
+	while (m_totalBytes > maxBytes_ && lru_first_ != lru_last_) {
+		if (lru_first_ == newest) {
+			UpdateLru(*lru_first_);
+			continue;
+		}
+		if (lru_first_->referenced.exchange(false)) {
+			// Second chance
+			UpdateLru(*lru_first_);
+			continue;
+		}
 
-		m_totalFileCount -= pos.second->listing.size();
+		CServerEntry & s = lru_first_->server;
+		Remove(s.entries.find(lru_first_->listing.path));
+		++evictions_;
 
-		pos.first->cacheList.erase(pos.second);
-		if (pos.first->cacheList.empty()) {
-			m_serverList.erase(pos.first);
+		if (s.entries.empty()) {
+			RemoveServer(s);
 		}
+	}
+}
 
-		m_leastRecentlyUsedList.pop_front();
+CDirectoryListing& CDirectoryCache::Expand(CCacheEntry & entry)
+{
+	if (entry.compacted) {
+		entry.listing.Assign(entry.compact->Expand());
+		entry.compact.reset();
+		entry.compacted = false;
+
+		m_expandedFileCount += entry.listing.size();
+		UpdateSize(entry);
+	}
+
+	return entry.listing;
+}
+
+void CDirectoryCache::CompactColdEntries()
+{
+	// Starting with the least recently used, but never the most recently used one
+	CCacheEntry* const last = lru_last_;
+	CCacheEntry* next{};
+	for (CCacheEntry* it = lru_first_; m_expandedFileCount > 100000 && it && it != last; it = next) {
+		next = it->lru_next;
+
+		// Leaves the flag alone, it is Prune's second chance
+		auto & entry = *it;
+		if (entry.referenced || entry.compacted) {
+			continue;
+		}
+
+		CCompactListing compact(entry.listing);
+		if (!compact.valid()) {
+			continue;
+		}
+		m_expandedFileCount -= entry.listing.size();
+		entry.compact = std::make_shared<CCompactListing const>(std::move(compact));
+		entry.compacted = true;
+
+		// Drop the entries, retain everything else
+		CDirectoryListing stripped;
+		stripped.path = entry.listing.path;
+		stripped.m_firstListTime = entry.listing.m_firstListTime;
+		stripped.m_flags = entry.listing.m_flags;
+		entry.listing = std::move(stripped);
+
+		UpdateSize(entry);
 	}
 }
 
 void CDirectoryCache::SetTtl(fz::duration const& ttl)
 {
-	fz::scoped_lock lock(mutex_);
+	fz::scoped_write_lock lock(mutex_);
 
 	if (ttl < fz::duration::from_seconds(30)) {
 		ttl_ = fz::duration::from_seconds(30);
@@ -695,3 +854,67 @@ void CDirectoryCache::SetTtl(fz::duration const& ttl)
 		ttl_ = ttl;
 	}
 }
+
+void CDirectoryCache::SetMemoryLimit(size_t bytes)
+{
+	fz::scoped_write_lock lock(mutex_);
+
+	maxBytes_ = bytes;
+	Prune();
+}
+
+directory_cache_stats CDirectoryCache::GetStats() const
+{
+	fz::scoped_read_lock lock(mutex_);
+
+	directory_cache_stats ret;
+	ret.hits = hits_;
+	ret.misses = misses_;
+	ret.evictions = evictions_;
+	ret.listings = m_listingCount;
+	ret.files = m_totalFileCount;
+	ret.bytes = m_totalBytes;
+	ret.max_bytes = maxBytes_;
+	return ret;
+}
+
+void CDirectoryCache::EnablePersistence(fz::native_string const& file)
+{
+	fz::scoped_write_lock lock(mutex_);
+
+	SavePersisted();
+	store_ = std::make_unique<CDirectoryCacheStore>(file, pool_);
+}
+
+void CDirectoryCache::LoadPersisted(CServer const& server, CServerPath const& path, bool subtree, bool nocase)
+{
+	if (!store_) {
+		return;
+	}
+
+	auto listings = store_->Take(server, path, subtree, nocase);
+	for (auto const& listing : listings) {
+		DoStore(listing, server, false);
+	}
+}
+
+void CDirectoryCache::SavePersisted()
+{
+	if (!store_) {
+		return;
+	}
+
+	std::vector<std::pair<CServer, CDirectoryListing>> listings;
+	listings.reserve(m_listingCount);
+	for (auto const& s : m_servers) {
+		for (auto const& it : s.second.entries) {
+			CCacheEntry const& entry = it.second;
+			listings.emplace_back(s.second.server, entry.listing);
+			if (entry.compacted) {
+				listings.back().second.Assign(entry.compact);
+			}
+		}
+	}
+	store_->Save(listings);
+	store_.reset();
+}
@@ -12,14 +12,36 @@ multiple entries in a cache directory using a case insensitive search
 On other operations, the directory is marked as unsure. It may still be valid,
 but for some operations the engine/interface prefers to retrieve a clean
 version.
+
+Listings are found through a hash of server and path. Once the estimated
+memory use exceeds the limit, the least recently used listings are evicted.
+
+Lookups only take a shared lock so that the engines can query the cache in
+parallel, modifications are exclusive. Lookups merely flag the listings they
+use, recency is approximated by giving flagged listings a second chance before
+they get evicted. Flagged listings are not compacted.
+
+Only the most recently used listings are kept as-is, all others are held in
+compact form to reduce memory use. They get expanded again once needed.
+
+Optionally, listings are kept on disk across restarts, see
+CDirectoryCacheStore. Stored listings are loaded into memory once looked up,
+or when an operation on them requires invalidation.
 */
 
 #include "../include/directorylisting.h"
+#include "../include/engine_context.h"
+#include "compactlisting.h"
 
 #include <libfilezilla/mutex.hpp>
+#include <libfilezilla/rwmutex.hpp>
+
+#include <atomic>
+#include <memory>
+#include <unordered_map>
 
-#include <list>
-#include <set>
+class CDirectoryCacheStore;
+class CStringPool;
 
 enum class LookupFlags
 {
@@ -77,7 +99,7 @@ public:
 		dir
 	};
 
-	CDirectoryCache();
+	explicit CDirectoryCache(CStringPool & pool);
 	~CDirectoryCache();
 
 	CDirectoryCache(CDirectoryCache const&) = delete;
@@ -102,70 +124,173 @@ public:
 
 	void SetTtl(fz::duration const& ttl);
 
+	// Least recently used listings get evicted once their estimated memory
+	// use exceeds the limit.
+	void SetMemoryLimit(size_t bytes);
+
+	// Loads and saves listings from and to the given file. Loaded listings
+	// count as outdated until the server lists them again.
+	void EnablePersistence(fz::native_string const& file);
+
+	directory_cache_stats GetStats() const;
+
 protected:
+	class CServerEntry;
 
 	class CCacheEntry final
 	{
 	public:
-		CCacheEntry() = default;
-		CCacheEntry(CCacheEntry const& entry) = default;
-		CCacheEntry(CCacheEntry && entry) noexcept = default;
-
-		explicit CCacheEntry(CDirectoryListing const& l)
+		CCacheEntry(CServerEntry & s, CDirectoryListing const& l)
 			: listing(l)
 			, modificationTime(fz::monotonic_clock::now())
+			, server(s)
 		{}
 
+		CCacheEntry(CCacheEntry const&) = delete;
+		CCacheEntry& operator=(CCacheEntry const&) = delete;
+
+		// If compacted, listing has no entries, they are held by compact.
 		CDirectoryListing listing;
+		std::shared_ptr<CCompactListing const> compact;
+		bool compacted{};
+
 		fz::monotonic_clock modificationTime;
 
-		CCacheEntry& operator=(CCacheEntry const& a) = default;
-		CCacheEntry& operator=(CCacheEntry && a) noexcept = default;
+		// Loaded from the persistent cache and not yet confirmed by the
+		// server. Such entries always count as outdated.
+		bool persisted{};
+
+		CServerEntry & server;
+
+		// Estimated memory use
+		size_t bytes{};
+
+		// Intrusive LRU list, least recently used first
+		CCacheEntry* lru_prev{};
+		CCacheEntry* lru_next{};
+
+		// Set by lookups under the shared lock
+		std::atomic<bool> referenced{};
 
-		void* lruIt{}; // void* to break cyclic declaration dependency
+		// The listing builds its search maps on demand, serializes concurrent
+		// lookups of the same listing.
+		mutable fz::mutex find_mutex{false};
 
-		bool operator<(CCacheEntry const& op) const noexcept {
-			return listing.path < op.listing.path;
-		}
+		size_t file_count() const { return compacted ? compact->size() : listing.size(); }
+		size_t expanded_count() const { return compacted ? 0 : listing.size(); }
+
+		size_t find(std::wstring const& name, bool cmpCase) const;
+		CDirentry entry(size_t index) const;
+	};
+
+	struct path_hash final
+	{
+		size_t operator()(CServerPath const& path) const { return path.HashNoCase(); }
 	};
 
+	// The hash is case-insensitive, so all paths only differing in case
+	// share a bucket.
+	typedef std::unordered_map<CServerPath, CCacheEntry, path_hash> tEntries;
+
 	class CServerEntry final
 	{
 	public:
-		CServerEntry() {}
 		explicit CServerEntry(CServer const& s)
 			: server(s)
 		{}
 
-		CServer server;
-		std::set<CCacheEntry> cacheList;
+		CServerEntry(CServerEntry const&) = delete;
+		CServerEntry& operator=(CServerEntry const&) = delete;
+
+		CServer const server;
+		tEntries entries;
+	};
+
+	// Keyed by a hash of the server, see CServer::SameContent
+	typedef std::unordered_multimap<size_t, CServerEntry> tServers;
+
+	CServerEntry& CreateServerEntry(CServer const& server);
+	CServerEntry* GetServerEntry(CServer const& server);
+
+	// Takes the shared lock, or the exclusive lock if the listing first needs
+	// to be loaded from the persistent store.
+	class read_lock final
+	{
+	public:
+		read_lock(CDirectoryCache & cache, CServer const& server, CServerPath const& path);
+		~read_lock();
+
+		read_lock(read_lock const&) = delete;
+		read_lock& operator=(read_lock const&) = delete;
+
+	private:
+		fz::rwmutex & mutex_;
+		bool exclusive_{};
 	};
 
-	typedef std::list<CServerEntry>::iterator tServerIter;
+	// Flags the listing as used and updates the statistics. Only requires the
+	// shared lock.
+	CCacheEntry* Lookup(CServer const& server, CServerPath const& path, bool allowUnsureEntries, bool& is_outdated);
+
+	// Calls the function for all listings of the server whose path matches
+	// case-insensitively
+	template<typename F>
+	void ForEachNoCase(CServerEntry & s, CServerPath const& path, F && f);
+
+	// The functions below require the exclusive lock
+
+	// If replace is not set, an existing listing is retained
+	void DoStore(CDirectoryListing const& listing, CServer const& server, bool replace);
+	bool DoUpdateFile(CServer const& server, CServerPath const& path, std::wstring const& filename, bool mayCreate, Filetype type, int64_t size = -1, std::wstring const& ownerGroup = std::wstring{});
+	void DoRemoveFile(CServer const& server, CServerPath const& path, std::wstring const& filename);
+	void DoRemoveDir(CServer const& server, CServerPath const& path, std::wstring const& filename);
+	void DoInvalidateServer(CServer const& server);
+
+	tEntries::iterator Remove(tEntries::iterator it);
+	void RemoveServer(CServerEntry & s);
 
-	tServerIter CreateServerEntry(const CServer& server);
-	tServerIter GetServerEntry(const CServer& server);
+	// Moves listings of the path, and optionally its subdirectories, from
+	// the persistent store into memory. With nocase, also those of paths
+	// differing only in case.
+	void LoadPersisted(CServer const& server, CServerPath const& path, bool subtree, bool nocase = false);
+	void SavePersisted();
 
-	typedef std::set<CCacheEntry>::iterator tCacheIter;
-	typedef std::set<CCacheEntry>::const_iterator tCacheConstIter;
+	mutable fz::rwmutex mutex_;
 
-	bool Lookup(tCacheIter &cacheIter, tServerIter &sit, CServerPath const& path, bool allowUnsureEntries, bool& is_outdated);
+	CStringPool & pool_;
 
-	fz::mutex mutex_;
+	tServers m_servers;
 
-	std::list<CServerEntry> m_serverList;
+	void UpdateLru(CCacheEntry & entry);
+	void UnlinkLru(CCacheEntry & entry);
 
-	void UpdateLru(tServerIter const& sit, tCacheIter const& cit);
+	// Re-estimates the memory use of the entry after changes
+	void UpdateSize(CCacheEntry & entry);
 
 	void Prune();
 
-	typedef std::pair<tServerIter, tCacheIter> tFullEntryPosition;
-	typedef std::list<tFullEntryPosition> tLruList;
-	tLruList m_leastRecentlyUsedList;
+	// Turns the entry back into a regular listing
+	CDirectoryListing& Expand(CCacheEntry & entry);
 
+	// Compacts listings once too many entries are expanded
+	void CompactColdEntries();
+
+	CCacheEntry* lru_first_{};
+	CCacheEntry* lru_last_{};
+
+	size_t m_listingCount{};
 	int64_t m_totalFileCount{};
+	int64_t m_expandedFileCount{};
+	size_t m_totalBytes{};
+	size_t maxBytes_{256 * 1024 * 1024};
+
+	std::atomic<uint64_t> hits_{};
+	std::atomic<uint64_t> misses_{};
+	uint64_t evictions_{};
 
 	fz::duration ttl_{fz::duration::from_seconds(600)};
+
+	std::unique_ptr<CDirectoryCacheStore> store_;
 };
 
 #endif
@@ -0,0 +1,508 @@
+#include "filezilla.h"
+#include "directorycachestore.h"
+#include "stringpool.h"
+
+#include <libfilezilla/hash.hpp>
+#include <libfilezilla/local_filesys.hpp>
+
+namespace {
+char const magic[] = "FZDC";
+uint32_t const version = 1;
+
+// Listings older than this are not worth keeping
+fz::duration const max_age = fz::duration::from_days(30);
+
+void put_u32(std::string & out, uint32_t v)
+{
+	for (int i = 0; i < 4; ++i) {
+		out += static_cast<char>((v >> (i * 8)) & 0xff);
+	}
+}
+
+void put_i64(std::string & out, int64_t v)
+{
+	uint64_t const u = static_cast<uint64_t>(v);
+	for (int i = 0; i < 8; ++i) {
+		out += static_cast<char>((u >> (i * 8)) & 0xff);
+	}
+}
+
+void put_str(std::string & out, std::wstring const& s)
+{
+	std::string const utf8 = fz::to_utf8(s);
+	put_u32(out, static_cast<uint32_t>(utf8.size()));
+	out += utf8;
+}
+
+class reader final
+{
+public:
+	explicit reader(std::string_view data)
+		: data_(data)
+	{}
+
+	bool u8(uint8_t & v)
+	{
+		if (data_.size() < 1) {
+			return false;
+		}
+		v = static_cast<uint8_t>(data_[0]);
+		data_.remove_prefix(1);
+		return true;
+	}
+
+	bool u32(uint32_t & v)
+	{
+		if (data_.size() < 4) {
+			return false;
+		}
+		v = 0;
+		for (int i = 0; i < 4; ++i) {
+			v |= static_cast<uint32_t>(static_cast<uint8_t>(data_[i])) << (i * 8);
+		}
+		data_.remove_prefix(4);
+		return true;
+	}
+
+	bool i64(int64_t & v)
+	{
+		if (data_.size() < 8) {
+			return false;
+		}
+		uint64_t u{};
+		for (int i = 0; i < 8; ++i) {
+			u |= static_cast<uint64_t>(static_cast<uint8_t>(data_[i])) << (i * 8);
+		}
+		v = static_cast<int64_t>(u);
+		data_.remove_prefix(8);
+		return true;
+	}
+
+	bool raw(std::string_view & v, size_t len)
+	{
+		if (data_.size() < len) {
+			return false;
+		}
+		v = data_.substr(0, len);
+		data_.remove_prefix(len);
+		return true;
+	}
+
+	bool str(std::wstring & v)
+	{
+		uint32_t len{};
+		std::string_view s;
+		if (!u32(len) || !raw(s, len)) {
+			return false;
+		}
+		v = fz::to_wstring_from_utf8(s);
+		return true;
+	}
+
+private:
+	std::string_view data_;
+};
+
+int64_t floor_div(int64_t a, int64_t b)
+{
+	int64_t q = a / b;
+	if ((a % b) && ((a < 0) != (b < 0))) {
+		--q;
+	}
+	return q;
+}
+
+void put_time(std::string & out, fz::datetime const& t)
+{
+	if (t.empty()) {
+		put_i64(out, 0);
+		out += static_cast<char>(0xff);
+		return;
+	}
+	put_i64(out, static_cast<int64_t>(t.get_time_t()) * 1000 + t.get_milliseconds());
+	out += static_cast<char>(t.get_accuracy());
+}
+
+bool get_time(reader & r, fz::datetime & t)
+{
+	int64_t ms{};
+	uint8_t accuracy{};
+	if (!r.i64(ms) || !r.u8(accuracy)) {
+		return false;
+	}
+	if (accuracy == 0xff) {
+		t.clear();
+		return true;
+	}
+	if (accuracy > fz::datetime::milliseconds) {
+		return false;
+	}
+
+	time_t const seconds = static_cast<time_t>(floor_div(ms, 1000));
+	if (accuracy != fz::datetime::milliseconds) {
+		t = fz::datetime(seconds, static_cast<fz::datetime::accuracy>(accuracy));
+	}
+	else {
+		tm const tm = fz::datetime(seconds, fz::datetime::seconds).get_tm(fz::datetime::utc);
+		t = fz::datetime(fz::datetime::utc, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, static_cast<int>(ms - static_cast<int64_t>(seconds) * 1000));
+	}
+	return true;
+}
+
+// Record header: key, path, list time. Followed by the listing
+std::string serialize(std::string const& key, CDirectoryListing const& listing)
+{
+	std::string out;
+	out += key;
+	put_str(out, listing.path.GetSafePath());
+
+	auto const age = fz::monotonic_clock::now() - listing.m_firstListTime;
+	put_i64(out, (fz::datetime::now() - age).get_time_t());
+
+	put_u32(out, static_cast<uint32_t>(listing.m_flags));
+	put_u32(out, static_cast<uint32_t>(listing.size()));
+	for (size_t i = 0; i < listing.size(); ++i) {
+		CDirentry const& entry = listing[i];
+		put_str(out, entry.name);
+		put_i64(out, entry.size);
+		put_str(out, *entry.permissions);
+		put_str(out, *entry.ownerGroup);
+		put_time(out, entry.time);
+		out += static_cast<char>(entry.flags);
+		if (entry.is_link()) {
+			put_str(out, entry.target ? *entry.target : std::wstring());
+		}
+	}
+	return out;
+}
+
+size_t const key_size = 32;
+
+bool read_header(reader & r, std::string_view & key, CServerPath & path, fz::datetime & listTime)
+{
+	std::wstring safepath;
+	int64_t t{};
+	if (!r.raw(key, key_size) || !r.str(safepath) || !r.i64(t)) {
+		return false;
+	}
+	if (!path.SetSafePath(safepath)) {
+		return false;
+	}
+	listTime = fz::datetime(static_cast<time_t>(t), fz::datetime::seconds);
+	return true;
+}
+
+bool deserialize(std::string_view data, CDirectoryListing & listing, CStringPool & pool)
+{
+	reader r(data);
+
+	std::string_view key;
+	fz::datetime listTime;
+	if (!read_header(r, key, listing.path, listTime)) {
+		return false;
+	}
+
+	uint32_t flags{};
+	uint32_t count{};
+	if (!r.u32(flags) || !r.u32(count)) {
+		return false;
+	}
+
+	std::vector<fz::shared_value<CDirentry>> entries;
+	entries.reserve(count);
+	std::wstring perms;
+	std::wstring ownerGroup;
+	for (uint32_t i = 0; i < count; ++i) {
+		CDirentry entry;
+		uint8_t entryFlags{};
+		if (!r.str(entry.name) || !r.i64(entry.size) || !r.str(perms) || !r.str(ownerGroup) || !get_time(r, entry.time) || !r.u8(entryFlags)) {
+			return false;
+		}
+		entry.permissions = pool.Get(perms);
+		entry.ownerGroup = pool.Get(ownerGroup);
+		entry.flags = entryFlags;
+		if (entry.is_link()) {
+			std::wstring target;
+			if (!r.str(target)) {
+				return false;
+			}
+			if (!target.empty()) {
+				entry.target = fz::sparse_optional<std::wstring>(std::move(target));
+			}
+		}
+		entries.emplace_back(std::move(entry));
+	}
+
+	listing.Assign(std::move(entries));
+	listing.m_flags = static_cast<int>(flags);
+	listing.m_firstListTime = fz::monotonic_clock::now();
+	listing.m_firstListTime -= fz::datetime::now() - listTime;
+
+	return true;
+}
+
+bool read_at(fz::file & f, int64_t offset, std::string & out, size_t len)
+{
+	out.resize(len);
+	if (f.seek(offset, fz::file::begin) != offset) {
+		return false;
+	}
+	size_t done{};
+	while (done < len) {
+		int64_t const r = f.read(&out[done], static_cast<int64_t>(len - done));
+		if (r <= 0) {
+			return false;
+		}
+		done += static_cast<size_t>(r);
+	}
+	return true;
+}
+
+bool write_all(fz::file & f, std::string_view data)
+{
+	while (!data.empty()) {
+		int64_t const w = f.write(data.data(), static_cast<int64_t>(data.size()));
+		if (w <= 0) {
+			return false;
+		}
+		data.remove_prefix(static_cast<size_t>(w));
+	}
+	return true;
+}
+}
+
+CDirectoryCacheStore::CDirectoryCacheStore(fz::native_string const& file, CStringPool & pool)
+	: file_(file)
+	, pool_(pool)
+{
+	if (!reader_.open(file_, fz::file::reading)) {
+		return;
+	}
+
+	std::string buf;
+	uint32_t v{};
+	if (!read_at(reader_, 0, buf, 8) || buf.compare(0, 4, magic, 4) || !reader(std::string_view(buf).substr(4)).u32(v) || v != version) {
+		reader_.close();
+		return;
+	}
+
+	// Only read the headers, the listings get read once needed.
+	auto const now = fz::datetime::now();
+	int64_t const size = reader_.size();
+	int64_t offset = 8;
+	while (offset + 4 <= size) {
+		uint32_t length{};
+		if (!read_at(reader_, offset, buf, 4) || !reader(buf).u32(length) || offset + 4 + length > size) {
+			break;
+		}
+
+		std::string_view key;
+		CServerPath path;
+		fz::datetime listTime;
+		size_t const headerLength = std::min(size_t(length), size_t(4096));
+		bool ok = read_at(reader_, offset + 4, buf, headerLength);
+		if (ok) {
+			reader r(buf);
+			ok = read_header(r, key, path, listTime);
+			if (!ok && headerLength < length && read_at(reader_, offset + 4, buf, length)) {
+				reader full(buf);
+				ok = read_header(full, key, path, listTime);
+			}
+		}
+		if (ok && now - listTime < max_age) {
+			index_[std::string(key)][path.GetSafePath()] = record{offset, length};
+		}
+
+		offset += 4 + int64_t(length);
+	}
+}
+
+std::string CDirectoryCacheStore::GetServerKey(CServer const& server) const
+{
+	fz::scoped_lock lock(mutex_);
+
+	for (auto const& key : server_keys_) {
+		if (key.first.SameContent(server)) {
+			return key.second;
+		}
+	}
+
+	std::string data;
+	auto const add = [&data](std::wstring const& v) {
+		data += fz::to_utf8(v);
+		data += '\0';
+	};
+	add(std::to_wstring(server.GetProtocol()));
+	add(server.GetHost());
+	add(std::to_wstring(server.GetPort()));
+	add(server.GetUser());
+	for (auto const& command : server.GetPostLoginCommands()) {
+		add(command);
+	}
+	add(std::wstring());
+	for (auto const& trait : ExtraServerParameterTraits(server.GetProtocol())) {
+		if (!(trait.flags_ & ParameterTraits::content_transparent)) {
+			add(server.GetExtraParameter(trait.name_));
+		}
+	}
+	add(std::to_wstring(server.GetTimezoneOffset()));
+	add(std::to_wstring(server.GetEncodingType()));
+	add(server.GetCustomEncoding());
+
+	auto const hash = fz::sha256(data);
+	server_keys_.emplace_back(server, std::string(hash.cbegin(), hash.cend()));
+	return server_keys_.back().second;
+}
+
+bool CDirectoryCacheStore::Contains(CServer const& server, CServerPath const& path) const
+{
+	if (index_.empty()) {
+		return false;
+	}
+
+	auto sit = index_.find(GetServerKey(server));
+	if (sit == index_.end()) {
+		return false;
+	}
+	return sit->second.find(path.GetSafePath()) != sit->second.end();
+}
+
+std::vector<CDirectoryCacheStore::server_records::iterator> CDirectoryCacheStore::Find(server_records & records, CServerPath const& path, bool subtree, bool nocase)
+{
+	std::vector<server_records::iterator> ret;
+
+	std::wstring const key = path.GetSafePath();
+	if (!nocase) {
+		// In safe paths, the paths of all subdirectories start with the path of
+		// their parent, so they directly follow it.
+		auto it = records.lower_bound(key);
+		while (it != records.end() && !it->first.compare(0, key.size(), key)) {
+			if (!subtree && it->first.size() != key.size()) {
+				break;
+			}
+			ret.push_back(it++);
+		}
+	}
+	else {
+		// Case variants are not adjacent, but this is only needed when
+		// modifying listings.
+		std::wstring const lower = fz::str_tolower(key);
+		for (auto it = records.begin(); it != records.end(); ++it) {
+			if (it->first.size() < lower.size() || (!subtree && it->first.size() != lower.size())) {
+				continue;
+			}
+			if (!fz::str_tolower(it->first).compare(0, lower.size(), lower)) {
+				ret.push_back(it);
+			}
+		}
+	}
+
+	return ret;
+}
+
+std::vector<CDirectoryListing> CDirectoryCacheStore::Take(CServer const& server, CServerPath const& path, bool subtree, bool nocase)
+{
+	std::vector<CDirectoryListing> ret;
+	if (index_.empty()) {
+		return ret;
+	}
+
+	auto sit = index_.find(GetServerKey(server));
+	if (sit == index_.end()) {
+		return ret;
+	}
+	auto & records = sit->second;
+
+	for (auto it : Find(records, path, subtree, nocase)) {
+		std::string data;
+		CDirectoryListing listing;
+		if (read_at(reader_, it->second.offset + 4, data, it->second.length) && deserialize(data, listing, pool_)) {
+			ret.emplace_back(std::move(listing));
+		}
+		records.erase(it);
+	}
+
+	if (records.empty()) {
+		index_.erase(sit);
+	}
+
+	return ret;
+}
+
+void CDirectoryCacheStore::Forget(CServer const& server, CServerPath const& path, bool subtree, bool nocase)
+{
+	if (index_.empty()) {
+		return;
+	}
+
+	auto sit = index_.find(GetServerKey(server));
+	if (sit == index_.end()) {
+		return;
+	}
+	auto & records = sit->second;
+
+	for (auto it : Find(records, path, subtree, nocase)) {
+		records.erase(it);
+	}
+
+	if (records.empty()) {
+		index_.erase(sit);
+	}
+}
+
+void CDirectoryCacheStore::Forget(CServer const& server)
+{
+	if (!index_.empty()) {
+		index_.erase(GetServerKey(server));
+	}
+}
+
+bool CDirectoryCacheStore::Save(std::vector<std::pair<CServer, CDirectoryListing>> const& listings)
+{
+	fz::native_string const tmp = file_ + fzT(".tmp");
+	fz::file out(tmp, fz::file::writing, fz::file::creation_flags(fz::file::empty | fz::file::current_user_only));
+	if (!out) {
+		return false;
+	}
+
+	std::string data(magic, 4);
+	put_u32(data, version);
+	bool ok = write_all(out, data);
+
+	auto const now = fz::monotonic_clock::now();
+	for (auto const& [server, listing] : listings) {
+		if (!ok) {
+			break;
+		}
+		if (listing.failed() || now - listing.m_firstListTime > max_age) {
+			continue;
+		}
+		std::string const body = serialize(GetServerKey(server), listing);
+		data.clear();
+		put_u32(data, static_cast<uint32_t>(body.size()));
+		data += body;
+		ok = write_all(out, data);
+	}
+
+	// Copy those never loaded as-is
+	for (auto const& records : index_) {
+		for (auto const& r : records.second) {
+			if (!ok) {
+				break;
+			}
+			ok = read_at(reader_, r.second.offset, data, 4 + size_t(r.second.length)) && write_all(out, data);
+		}
+	}
+
+	out.close();
+	reader_.close();
+	index_.clear();
+
+	if (ok) {
+		ok = static_cast<bool>(fz::rename_file(tmp, file_, false));
+	}
+	if (!ok) {
+		fz::remove_file(tmp);
+	}
+	return ok;
+}
@@ -0,0 +1,84 @@
+#ifndef FILEZILLA_ENGINE_DIRECTORYCACHESTORE_HEADER
+#define FILEZILLA_ENGINE_DIRECTORYCACHESTORE_HEADER
+
+#include "../include/directorylisting.h"
+#include "../include/server.h"
+
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/mutex.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+On-disk backing store for the directory cache so that listings survive
+restarts.
+
+On startup only an index of the file is read. Listings get loaded once the
+cache asks for them, at which point ownership passes to the in-memory cache.
+On exit, the in-memory listings together with those never loaded are written
+to a new file replacing the old one.
+
+Servers are identified by a hash of the properties that decide whether two
+servers have the same content, see CServer::SameContent. Listing times are
+stored as wall-clock time so that the cache TTL still applies after a
+restart.
+
+Contains may be called concurrently, all other functions require exclusive
+access. The directory cache takes care of that.
+*/
+class CStringPool;
+
+class CDirectoryCacheStore final
+{
+public:
+	CDirectoryCacheStore(fz::native_string const& file, CStringPool & pool);
+
+	CDirectoryCacheStore(CDirectoryCacheStore const&) = delete;
+	CDirectoryCacheStore& operator=(CDirectoryCacheStore const&) = delete;
+
+	bool empty() const { return index_.empty(); }
+
+	// Whether there is a listing for the path
+	bool Contains(CServer const& server, CServerPath const& path) const;
+
+	// Removes the listing of the path from the store and returns it. If
+	// subtree is set, also returns the listings of all subdirectories.
+	// With nocase, paths are matched case-insensitively, like the directory
+	// cache does when modifying listings.
+	std::vector<CDirectoryListing> Take(CServer const& server, CServerPath const& path, bool subtree, bool nocase = false);
+
+	// Drops a listing from the store, e.g. as a newer one is in memory.
+	void Forget(CServer const& server, CServerPath const& path, bool subtree = false, bool nocase = false);
+	void Forget(CServer const& server);
+
+	// Replaces the file with the passed listings plus all listings still
+	// in the store. Empties the store.
+	bool Save(std::vector<std::pair<CServer, CDirectoryListing>> const& listings);
+
+private:
+	std::string GetServerKey(CServer const& server) const;
+
+	struct record
+	{
+		int64_t offset{};
+		uint32_t length{};
+	};
+
+	// Per server key, keyed by the safe path
+	typedef std::map<std::wstring, record> server_records;
+	std::map<std::string, server_records> index_;
+
+	std::vector<server_records::iterator> Find(server_records & records, CServerPath const& path, bool subtree, bool nocase);
+
+	mutable fz::mutex mutex_{false};
+	mutable std::vector<std::pair<CServer, std::string>> server_keys_;
+
+	fz::native_string const file_;
+	fz::file reader_;
+
+	CStringPool & pool_;
+};
+
+#endif
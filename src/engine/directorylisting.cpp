@@ -1,8 +1,10 @@
 #include "filezilla.h"
+#include "compactlisting.h"
 
 #include <libfilezilla/format.hpp>
 
 #include <algorithm>
+#include <mutex>
 
 void CDirentry::clear()
 {
@@ -55,8 +57,35 @@ bool CDirentry::operator==(const CDirentry &op) const
 	return true;
 }
 
+// Entries of a compact listing, expanded on first access. Never changes
+// afterwards, so the returned entries stay valid for as long as any copy of
+// the listing holds on to it.
+struct CDirectoryListing::compact_entries final
+{
+	std::vector<fz::shared_value<CDirentry>> const& get(CCompactListing const& compact)
+	{
+		std::call_once(once_, [&] { entries_ = compact.Expand(); });
+		return entries_;
+	}
+
+private:
+	std::once_flag once_;
+	std::vector<fz::shared_value<CDirentry>> entries_;
+};
+
+size_t CDirectoryListing::size() const
+{
+	if (m_compact) {
+		return m_compact->size();
+	}
+	return m_entries ? m_entries->size() : 0;
+}
+
 const CDirentry& CDirectoryListing::operator[](size_t index) const
 {
+	if (m_compact) {
+		return *m_compact_entries->get(*m_compact)[index];
+	}
 	return *(*m_entries)[index];
 }
 
@@ -64,11 +93,47 @@ CDirentry& CDirectoryListing::get(size_t index)
 {
 	// Commented out, too heavy speed penalty
 	// assert(index < m_entryCount);
+	Materialize();
 	return m_entries.get()[index].get();
 }
 
+void CDirectoryListing::Materialize()
+{
+	if (!m_compact) {
+		return;
+	}
+
+	// Entries are shared, references previously returned by operator[]
+	// remain valid unless the entry itself gets modified.
+	m_entries.get() = m_compact_entries->get(*m_compact);
+
+	m_compact.reset();
+	m_compact_entries.reset();
+}
+
+void CDirectoryListing::Assign(std::shared_ptr<CCompactListing const> const& compact)
+{
+	if (!compact) {
+		Assign(std::vector<fz::shared_value<CDirentry>>());
+		return;
+	}
+
+	m_entries.clear();
+	m_compact = compact;
+	m_compact_entries = std::make_shared<compact_entries>();
+
+	m_flags &= ~(listing_has_dirs | listing_has_perms | listing_has_usergroup);
+	m_flags |= compact->listing_flags();
+
+	m_searchmap_case.clear();
+	m_searchmap_nocase.clear();
+}
+
 void CDirectoryListing::Assign(std::vector<fz::shared_value<CDirentry>> && entries)
 {
+	m_compact.reset();
+	m_compact_entries.reset();
+
 	std::vector<fz::shared_value<CDirentry>> & own_entries = m_entries.get();
 	own_entries = std::move(entries);
 
@@ -99,6 +164,7 @@ bool CDirectoryListing::RemoveEntry(size_t index)
 	m_searchmap_case.clear();
 	m_searchmap_nocase.clear();
 
+	Materialize();
 	std::vector<fz::shared_value<CDirentry> >& entries = m_entries.get();
 	std::vector<fz::shared_value<CDirentry> >::iterator iter = entries.begin() + index;
 	if ((*iter)->is_dir()) {
@@ -115,6 +181,12 @@ bool CDirectoryListing::RemoveEntry(size_t index)
 void CDirectoryListing::GetFilenames(std::vector<std::wstring> &names) const
 {
 	names.reserve(size());
+	if (m_compact) {
+		for (size_t i = 0; i < m_compact->size(); ++i) {
+			names.push_back((*m_compact)[i].name());
+		}
+		return;
+	}
 	for (size_t i = 0; i < size(); ++i) {
 		names.push_back((*m_entries)[i]->name);
 	}
@@ -122,6 +194,10 @@ void CDirectoryListing::GetFilenames(std::vector<std::wstring> &names) const
 
 size_t CDirectoryListing::FindFile_CmpCase(std::wstring const& name) const
 {
+	if (m_compact) {
+		return m_compact->FindFile_CmpCase(name);
+	}
+
 	if (!m_entries || m_entries->empty()) {
 		return std::string::npos;
 	}
@@ -160,6 +236,10 @@ size_t CDirectoryListing::FindFile_CmpCase(std::wstring const& name) const
 
 size_t CDirectoryListing::FindFile_CmpNoCase(std::wstring const& name) const
 {
+	if (m_compact) {
+		return m_compact->FindFile_CmpNoCase(name);
+	}
+
 	if (!m_entries || m_entries->empty()) {
 		return std::string::npos;
 	}
@@ -210,6 +290,7 @@ void CDirectoryListing::ClearFindMap()
 
 void CDirectoryListing::Append(CDirentry&& entry)
 {
+	Materialize();
 	m_entries.get().emplace_back(entry);
 }
 
@@ -1,6 +1,10 @@
 #include "filezilla.h"
 #include "directorylistingparser.h"
 #include "controlsocket.h"
+#include "engineprivate.h"
+#include "listing_scan.h"
+#include "servercapabilities.h"
+#include "stringpool.h"
 
 #include <libfilezilla/format.hpp>
 
@@ -22,39 +26,6 @@ static char const data[][150]={
 
 #endif
 
-namespace {
-struct ObjectCache
-{
-	fz::shared_value<std::wstring> const& get(std::wstring const& v)
-	{
-		auto it = std::lower_bound(cache.begin(), cache.end(), v);
-
-		if (it == cache.end() || !(*it == v)) {
-			it = cache.emplace(it, v);
-		}
-		return *it;
-	}
-
-	fz::shared_value<std::wstring> const& get(std::wstring && v)
-	{
-		auto it = std::lower_bound(cache.begin(), cache.end(), v);
-
-		if (it == cache.end() || !(*it == v)) {
-			it = cache.emplace(it, std::move(v));
-		}
-		return *it;
-	}
-
-	// Vector coupled with binary search and sorted insertion is fastest
-	// alternative as we expect a relatively low amount of inserts.
-	// Note that we cannot use set, as it it cannot search based on a different type.
-	std::vector<fz::shared_value<std::wstring>> cache;
-};
-
-
-ObjectCache objcache;
-}
-
 class CToken final
 {
 protected:
@@ -451,6 +422,15 @@ CDirectoryListingParser::CDirectoryListingParser(CControlSocket* pControlSocket,
 	, m_server(server)
 	, m_listingEncoding(encoding)
 {
+	if (m_pControlSocket) {
+		pool_ = &m_pControlSocket->GetEngine().GetContext().GetStringPool();
+	}
+
+	int format{};
+	if (CServerCapabilities::GetCapability(m_server, listing_format, &format) == yes && format > listingFormat::none && format < listingFormat::count) {
+		m_preferredFormat = static_cast<listingFormat::type>(format);
+	}
+
 	if (m_MonthNamesMap.empty()) {
 		//Fill the month names map
 
@@ -672,22 +652,97 @@ CDirectoryListingParser::CDirectoryListingParser(CControlSocket* pControlSocket,
 
 #ifdef LISTDEBUG
 	for (unsigned int i = 0; data[i][0]; ++i) {
-		unsigned int len = (unsigned int)strlen(data[i]);
-		char *pData = new char[len + 3];
-		strcpy(pData, data[i]);
-		strcat(pData, "\r\n");
-		AddData(pData, len + 2);
+		AddData(data[i], strlen(data[i]));
+		AddData("\r\n", 2);
 	}
 #endif
 }
 
 CDirectoryListingParser::~CDirectoryListingParser()
 {
-	for (auto iter = m_DataList.begin(); iter != m_DataList.end(); ++iter) {
-		delete [] iter->p;
+	StopWorker();
+	delete m_prevLine;
+}
+
+void CDirectoryListingParser::EnablePipelining(fz::thread_pool& pool)
+{
+	pool_for_worker_ = &pool;
+	if (!worker_) {
+		StartWorker();
 	}
+}
 
-	delete m_prevLine;
+void CDirectoryListingParser::StartWorker()
+{
+	worker_final_ = false;
+	worker_quit_ = false;
+	worker_done_ = false;
+	worker_result_ = true;
+
+	worker_ = pool_for_worker_->spawn([this]() { RunWorker(); });
+	if (!worker_) {
+		// Fall back to parsing synchronously
+		pool_for_worker_ = nullptr;
+	}
+}
+
+void CDirectoryListingParser::StopWorker()
+{
+	if (!worker_) {
+		return;
+	}
+
+	{
+		fz::scoped_lock l(worker_mutex_);
+		worker_quit_ = true;
+		worker_cond_.signal(l);
+	}
+	worker_.join();
+}
+
+void CDirectoryListingParser::RunWorker()
+{
+	fz::scoped_lock l(worker_mutex_);
+	while (!worker_quit_) {
+		if (incoming_.empty() && !worker_final_) {
+			worker_cond_.wait(l);
+			continue;
+		}
+
+		bool const final = worker_final_;
+		size_t const len = incoming_.size();
+		if (data_.empty()) {
+			std::swap(data_, incoming_);
+		}
+		else {
+			data_.append(incoming_);
+			incoming_.clear();
+		}
+
+		// Parse without holding the lock so that the socket can keep adding data
+		l.unlock();
+		bool const res = ProcessData(len, final);
+		l.lock();
+
+		if (!res || final) {
+			worker_result_ = res;
+			worker_done_ = true;
+			break;
+		}
+	}
+}
+
+bool CDirectoryListingParser::ProcessData(size_t len, bool final)
+{
+	ConvertEncoding(data_.get() + data_.size() - len, len);
+
+	m_totalData += len;
+
+	if (!final && m_totalData < 512) {
+		return true;
+	}
+
+	return ParseData(!final);
 }
 
 bool CDirectoryListingParser::ParseData(bool partial)
@@ -734,7 +789,21 @@ CDirectoryListing CDirectoryListingParser::Parse(const CServerPath &path)
 	listing.path = path;
 	listing.m_firstListTime = fz::monotonic_clock::now();
 
-	if (!ParseData(false)) {
+	bool res;
+	if (worker_) {
+		{
+			fz::scoped_lock l(worker_mutex_);
+			worker_final_ = true;
+			worker_cond_.signal(l);
+		}
+		worker_.join();
+		res = worker_result_;
+	}
+	else {
+		res = ParseData(false);
+	}
+
+	if (!res) {
 		listing.m_flags |= CDirectoryListing::listing_failed;
 		return listing;
 	}
@@ -754,97 +823,162 @@ CDirectoryListing CDirectoryListingParser::Parse(const CServerPath &path)
 
 	listing.Assign(std::move(entries_));
 
+	if (m_formatHits || m_formatMisses) {
+		if (m_pControlSocket) {
+			m_pControlSocket->log(logmsg::debug_info, L"Listing format %d matched %d of %d lines on first attempt", static_cast<int>(m_preferredFormat), m_formatHits, m_formatHits + m_formatMisses);
+		}
+		if (m_formatMisses > m_formatHits) {
+			// Server no longer seems to use this format
+			m_preferredFormat = listingFormat::none;
+			CServerCapabilities::SetCapability(m_server, listing_format, unknown);
+		}
+	}
+
 	return listing;
 }
 
+int CDirectoryListingParser::ParseAs(listingFormat::type format, CLine &line, CDirentry &entry)
+{
+	switch (format) {
+	case listingFormat::zvm:
+		return ParseAsZVM(line, entry) ? 1 : 0;
+	case listingFormat::hpnonstop:
+		return ParseAsHPNonstop(line, entry) ? 1 : 0;
+	case listingFormat::mlsd:
+		return ParseAsMlsd(line, entry);
+	case listingFormat::unix_date:
+		return ParseAsUnix(line, entry, true) ? 1 : 0; // Common 'ls -l'
+	case listingFormat::dos:
+		return ParseAsDos(line, entry) ? 1 : 0;
+	case listingFormat::eplf:
+		return ParseAsEplf(line, entry) ? 1 : 0;
+	case listingFormat::vms:
+		return ParseAsVms(line, entry) ? 1 : 0;
+	case listingFormat::other:
+		return ParseOther(line, entry) ? 1 : 0;
+	case listingFormat::ibm:
+		return ParseAsIbm(line, entry) ? 1 : 0;
+	case listingFormat::wfftp:
+		return ParseAsWfFtp(line, entry) ? 1 : 0;
+	case listingFormat::ibm_mvs:
+		return ParseAsIBM_MVS(line, entry) ? 1 : 0;
+	case listingFormat::ibm_mvs_pds:
+		return ParseAsIBM_MVS_PDS(line, entry) ? 1 : 0;
+	case listingFormat::os9:
+		return ParseAsOS9(line, entry) ? 1 : 0;
+	case listingFormat::ibm_mvs_migrated:
+		return ParseAsIBM_MVS_Migrated(line, entry) ? 1 : 0;
+	case listingFormat::ibm_mvs_pds2:
+		return ParseAsIBM_MVS_PDS2(line, entry) ? 1 : 0;
+	case listingFormat::ibm_mvs_tape:
+		return ParseAsIBM_MVS_Tape(line, entry) ? 1 : 0;
+	case listingFormat::unix_nodate:
+		return ParseAsUnix(line, entry, false) ? 1 : 0; // 'ls -l' but without the date/time
+	default:
+		return 0;
+	}
+}
+
+bool CDirectoryListingParser::IsFormatApplicable(listingFormat::type format, ServerType const serverType)
+{
+	switch (format) {
+	case listingFormat::none:
+	case listingFormat::count:
+		return false;
+	case listingFormat::zvm:
+		return serverType == ZVM;
+	case listingFormat::hpnonstop:
+		return serverType == HPNONSTOP;
+	case listingFormat::ibm_mvs_migrated:
+	case listingFormat::ibm_mvs_pds2:
+	case listingFormat::ibm_mvs_tape:
+#ifndef LISTDEBUG_MVS
+		return serverType == MVS;
+#else
+		return true;
+#endif
+	default:
+		return true;
+	}
+}
+
+void CDirectoryListingParser::LearnFormat(listingFormat::type format)
+{
+	int const sample_lines = 8;
+
+	if (m_sampleCount < 0 || m_sampleCount >= sample_lines || format <= listingFormat::mlsd) {
+		return;
+	}
+
+	if (m_sampleCount && format != m_sampleFormat) {
+		// Mixed formats, keep trying everything
+		m_sampleCount = -1;
+		return;
+	}
+
+	m_sampleFormat = format;
+	if (++m_sampleCount == sample_lines && format != m_preferredFormat && format != listingFormat::unix_nodate) {
+		// Unix listings without date are never preferred, that would shadow
+		// the regular Unix format.
+		m_preferredFormat = format;
+		m_formatHits = 0;
+		m_formatMisses = 0;
+		CServerCapabilities::SetCapability(m_server, listing_format, yes, static_cast<int>(format));
+		if (m_pControlSocket) {
+			m_pControlSocket->log(logmsg::debug_info, L"Detected listing format %d", static_cast<int>(format));
+		}
+	}
+}
+
 bool CDirectoryListingParser::ParseLine(CLine &line, ServerType const serverType, bool concatenated, CDirentry const* override)
 {
 	fz::shared_value<CDirentry> refEntry;
 	CDirentry & entry = refEntry.get();
 
-	bool res;
-	int ires;
+	// Parts of multiline entries are excluded from sniffing, only complete
+	// lines are representative.
+	bool const sniff = !concatenated || override;
+
+	// The formats up to MLSD are either specific to the server type or
+	// unambiguous, they always come first.
+	listingFormat::type preferred = listingFormat::none;
+	if (sniff && m_preferredFormat > listingFormat::mlsd && IsFormatApplicable(m_preferredFormat, serverType)) {
+		preferred = m_preferredFormat;
+	}
+
+	int res = 0;
+	listingFormat::type format = listingFormat::none;
+	for (int i = listingFormat::none + 1; i < listingFormat::count; ++i) {
+		if (i == listingFormat::mlsd + 1 && preferred != listingFormat::none) {
+			res = ParseAs(preferred, line, entry);
+			if (res) {
+				++m_formatHits;
+				format = preferred;
+				break;
+			}
+			++m_formatMisses;
+		}
 
-	if (serverType == ZVM) {
-		res = ParseAsZVM(line, entry);
-		if (res) {
-			goto done;
+		format = static_cast<listingFormat::type>(i);
+		if (format == preferred || !IsFormatApplicable(format, serverType)) {
+			continue;
 		}
-	}
-	else if (serverType == HPNONSTOP) {
-		res = ParseAsHPNonstop(line, entry);
+
+		res = ParseAs(format, line, entry);
 		if (res) {
-			goto done;
+			break;
 		}
 	}
 
-	ires = ParseAsMlsd(line, entry);
-	if (ires == 1) {
-		goto done;
-	}
-	else if (ires == 2) {
-		goto skip;
-	}
-	res = ParseAsUnix(line, entry, true); // Common 'ls -l'
-	if (res) {
-		goto done;
-	}
-	res = ParseAsDos(line, entry);
-	if (res) {
-		goto done;
-	}
-	res = ParseAsEplf(line, entry);
-	if (res) {
-		goto done;
-	}
-	res = ParseAsVms(line, entry);
-	if (res) {
-		goto done;
-	}
-	res = ParseOther(line, entry);
-	if (res) {
-		goto done;
+	if (res == 1 && sniff) {
+		LearnFormat(format);
 	}
-	res = ParseAsIbm(line, entry);
-	if (res) {
-		goto done;
-	}
-	res = ParseAsWfFtp(line, entry);
-	if (res) {
-		goto done;
-	}
-	res = ParseAsIBM_MVS(line, entry);
-	if (res) {
-		goto done;
-	}
-	res = ParseAsIBM_MVS_PDS(line, entry);
-	if (res) {
-		goto done;
-	}
-	res = ParseAsOS9(line, entry);
-	if (res) {
+
+	if (res == 1) {
 		goto done;
 	}
-#ifndef LISTDEBUG_MVS
-	if (serverType == MVS)
-#endif //LISTDEBUG_MVS
-	{
-		res = ParseAsIBM_MVS_Migrated(line, entry);
-		if (res) {
-			goto done;
-		}
-		res = ParseAsIBM_MVS_PDS2(line, entry);
-		if (res) {
-			goto done;
-		}
-		res = ParseAsIBM_MVS_Tape(line, entry);
-		if (res) {
-			goto done;
-		}
-	}
-	res = ParseAsUnix(line, entry, false); // 'ls -l' but without the date/time
-	if (res) {
-		goto done;
+	else if (res == 2) {
+		goto skip;
 	}
 
 	// Some servers just send a list of filenames. If a line could not be parsed,
@@ -1055,8 +1189,8 @@ bool CDirectoryListingParser::ParseAsUnix(CLine &line, CDirentry &entry, bool ex
 
 		entry.time += m_timezoneOffset;
 
-		entry.permissions = objcache.get(permissions);
-		entry.ownerGroup = objcache.get(ownerGroup);
+		entry.permissions = Intern(permissions);
+		entry.ownerGroup = Intern(ownerGroup);
 		return true;
 	}
 	while (numOwnerGroup--);
@@ -1553,7 +1687,7 @@ bool CDirectoryListingParser::ParseAsDos(CLine &line, CDirentry &entry)
 	entry.name = token.GetString();
 
 	entry.target.clear();
-	entry.ownerGroup = objcache.get(std::wstring());
+	entry.ownerGroup = Intern(std::wstring_view());
 	entry.permissions = entry.ownerGroup;
 	entry.time += m_timezoneOffset;
 
@@ -1668,8 +1802,8 @@ bool CDirectoryListingParser::ParseAsEplf(CLine &line, CDirentry &entry)
 		fact += len + 1;
 	}
 
-	entry.permissions = objcache.get(permissions);
-	entry.ownerGroup = objcache.get(std::wstring());
+	entry.permissions = Intern(permissions);
+	entry.ownerGroup = Intern(std::wstring_view());
 	return true;
 }
 
@@ -1832,8 +1966,8 @@ bool CDirectoryListingParser::ParseAsVms(CLine &line, CDirentry &entry)
 			ownerGroup += token.GetString();
 		}
 	}
-	entry.permissions = objcache.get(permissions);
-	entry.ownerGroup = objcache.get(ownerGroup);
+	entry.permissions = Intern(permissions);
+	entry.ownerGroup = Intern(ownerGroup);
 
 	entry.time += m_timezoneOffset;
 
@@ -1885,8 +2019,8 @@ bool CDirectoryListingParser::ParseAsIbm(CLine &line, CDirentry &entry)
 		entry.flags |= CDirentry::flag_dir;
 	}
 
-	entry.ownerGroup = objcache.get(ownerGroupToken.GetString());
-	entry.permissions = objcache.get(std::wstring());
+	entry.ownerGroup = Intern(ownerGroupToken.get_view());
+	entry.permissions = Intern(std::wstring_view());
 
 	entry.time += m_timezoneOffset;
 
@@ -1960,8 +2094,8 @@ bool CDirectoryListingParser::ParseOther(CLine &line, CDirentry &entry)
 		entry.name = token.GetString();
 		entry.target.clear();
 
-		entry.permissions = objcache.get(firstToken.GetString());
-		entry.ownerGroup = objcache.get(ownerGroup);
+		entry.permissions = Intern(firstToken.get_view());
+		entry.ownerGroup = Intern(ownerGroup);
 	}
 	else {
 		// Possible conflict with multiline VMS listings
@@ -2081,7 +2215,7 @@ bool CDirectoryListingParser::ParseOther(CLine &line, CDirentry &entry)
 			}
 		}
 		entry.target.clear();
-		entry.ownerGroup = objcache.get(std::wstring());
+		entry.ownerGroup = Intern(std::wstring_view());
 		entry.permissions = entry.ownerGroup;
 		entry.time += m_timezoneOffset;
 	}
@@ -2089,18 +2223,49 @@ bool CDirectoryListingParser::ParseOther(CLine &line, CDirentry &entry)
 	return true;
 }
 
-bool CDirectoryListingParser::AddData(char *pData, int len)
+bool CDirectoryListingParser::AddData(char const* data, size_t len)
+{
+	if (!len) {
+		return true;
+	}
+
+	memcpy(GetDataBuffer(len), data, len);
+	return AddData(len);
+}
+
+unsigned char* CDirectoryListingParser::GetDataBuffer(size_t len)
 {
-	ConvertEncoding(pData, len);
+	return worker_ ? recv_.get(len) : data_.get(len);
+}
 
-	m_DataList.emplace_back(pData, len);
-	m_totalData += len;
+bool CDirectoryListingParser::AddData(size_t len)
+{
+	if (!len) {
+		return true;
+	}
+
+	if (worker_) {
+		recv_.add(len);
 
-	if (m_totalData < 512) {
+		fz::scoped_lock l(worker_mutex_);
+		if (worker_done_) {
+			// Worker only stops early on errors
+			recv_.clear();
+			return false;
+		}
+		if (incoming_.empty()) {
+			std::swap(incoming_, recv_);
+		}
+		else {
+			incoming_.append(recv_);
+			recv_.clear();
+		}
+		worker_cond_.signal(l);
 		return true;
 	}
 
-	return ParseData(true);
+	data_.add(len);
+	return ProcessData(len, false);
 }
 
 bool CDirectoryListingParser::AddLine(std::wstring && line, std::wstring && name, fz::datetime const& time)
@@ -2118,126 +2283,83 @@ bool CDirectoryListingParser::AddLine(std::wstring && line, std::wstring && name
 	return true;
 }
 
+bool CDirectoryListingParser::AddEntry(CDirentry && entry, std::wstring_view const& permissions, std::wstring_view const& ownerGroup)
+{
+	m_fileList.clear();
+	m_fileListOnly = false;
+
+	if (entry.name == L"." || entry.name == L"..") {
+		return true;
+	}
+
+	auto const timezoneOffset = m_server.GetTimezoneOffset();
+	if (timezoneOffset && !entry.time.empty()) {
+		entry.time += fz::duration::from_minutes(timezoneOffset);
+	}
+
+	entry.permissions = Intern(permissions);
+	entry.ownerGroup = Intern(ownerGroup);
+	entries_.emplace_back(std::move(entry));
+
+	return true;
+}
+
 CLine *CDirectoryListingParser::GetLine(bool breakAtEnd, bool &error)
 {
-	while (!m_DataList.empty()) {
+	while (!data_.empty()) {
 		// Trim empty lines and spaces
-		auto iter = m_DataList.begin();
-		int len = iter->len;
-		while (iter->p[m_currentOffset] == '\r' || iter->p[m_currentOffset] == '\n'
-			|| iter->p[m_currentOffset] == ' ' || iter->p[m_currentOffset] == '\t'
-			|| !iter->p[m_currentOffset])
+		size_t skip = 0;
+		while (skip < data_.size() && (data_[skip] == '\r' || data_[skip] == '\n'
+			|| data_[skip] == ' ' || data_[skip] == '\t' || !data_[skip]))
 		{
-			++m_currentOffset;
-			if (m_currentOffset >= len) {
-				delete [] iter->p;
-				++iter;
-				m_currentOffset = 0;
-				if (iter == m_DataList.end()) {
-					m_DataList.clear();
-					return nullptr;
-				}
-				len = iter->len;
-			}
+			++skip;
 		}
-		m_DataList.erase(m_DataList.begin(), iter);
-		iter = m_DataList.begin();
-
-		// Remember start offset and find next linebreak
-		int startpos = m_currentOffset;
-		int reslen = 0;
-
-		int currentOffset = m_currentOffset;
-		while (iter->p[currentOffset] != '\n' && iter->p[currentOffset] != '\r' && iter->p[currentOffset]) {
-			++reslen;
-
-			++currentOffset;
-			if (currentOffset >= len) {
-				++iter;
-				if (iter == m_DataList.end()) {
-					if (reslen > 10000) {
-						if (m_pControlSocket) {
-							m_pControlSocket->log(logmsg::error, _("Received a line exceeding 10000 characters, aborting."));
-						}
-						error = true;
-						return nullptr;
-					}
-					if (breakAtEnd) {
-						return nullptr;
-					}
-					break;
-				}
-				len = iter->len;
-				currentOffset = 0;
-			}
+		data_.consume(skip);
+		if (data_.empty()) {
+			break;
 		}
 
-		if (reslen > 10000) {
+		// Find next linebreak. As the data is contiguous, the line can be
+		// converted in place without assembling it from fragments first.
+		char const* const p = reinterpret_cast<char const*>(data_.get());
+		size_t const size = data_.size();
+		bool ascii{};
+		size_t const len = listing_scan::find_line_end(p, size, ascii);
+
+		if (len > 10000) {
 			if (m_pControlSocket) {
 				m_pControlSocket->log(logmsg::error, _("Received a line exceeding 10000 characters, aborting."));
 			}
 			error = true;
 			return nullptr;
 		}
-		m_currentOffset = currentOffset;
-
-		// Reslen is now the length of the line, including any terminating whitespace
-		int const buflen = reslen;
-		char *res = new char[buflen + 1];
-		res[buflen] = 0;
-
-		int respos = 0;
-
-		// Copy line data
-		auto i = m_DataList.begin();
-		while (i != iter && reslen) {
-			int copylen = i->len - startpos;
-			if (copylen > reslen) {
-				copylen = reslen;
-			}
-			memcpy(&res[respos], &i->p[startpos], copylen);
-			reslen -= copylen;
-			respos += i->len - startpos;
-			startpos = 0;
-
-			delete [] i->p;
-			++i;
-		};
-
-		// Copy last chunk
-		if (iter != m_DataList.end() && reslen) {
-			int copylen = m_currentOffset-startpos;
-			if (copylen > reslen) {
-				copylen = reslen;
-			}
-			memcpy(&res[respos], &iter->p[startpos], copylen);
-			if (reslen >= iter->len) {
-				delete [] iter->p;
-				m_DataList.erase(m_DataList.begin(), ++iter);
-			}
-			else {
-				m_DataList.erase(m_DataList.begin(), iter);
-			}
-		}
-		else {
-			m_DataList.erase(m_DataList.begin(), iter);
+		if (len == size && breakAtEnd) {
+			return nullptr;
 		}
 
 		std::wstring buffer;
-		if (m_pControlSocket) {
-			buffer = m_pControlSocket->ConvToLocal(res, buflen);
+		if (ascii && m_server.GetEncodingType() != ENCODING_CUSTOM) {
+			// Plain ASCII is the same in every encoding we handle, simply widen it.
+			buffer.assign(p, p + len);
+			if (m_pControlSocket) {
+				m_pControlSocket->log_raw(logmsg::listing, buffer);
+			}
+		}
+		else if (m_pControlSocket) {
+			buffer = m_pControlSocket->ConvToLocal(p, len);
 			m_pControlSocket->log_raw(logmsg::listing, buffer);
 		}
 		else {
-			buffer = fz::to_wstring_from_utf8(res);
+			std::string_view const line(p, len);
+			buffer = fz::to_wstring_from_utf8(line);
 			if (buffer.empty()) {
-				buffer = fz::to_wstring(res);
+				buffer = fz::to_wstring(line);
 				if (buffer.empty()) {
-					buffer = std::wstring(res, res + strlen(res));
+					buffer = std::wstring(line.begin(), line.end());
 				}
 			}
 		}
-		delete [] res;
+		data_.consume(len);
 
 		// Strip BOM
 		if (buffer[0] == 0xfeff) {
@@ -2295,7 +2417,7 @@ bool CDirectoryListingParser::ParseAsWfFtp(CLine &line, CDirentry &entry)
 	if (!ParseTime(token, entry))
 		return false;
 
-	entry.ownerGroup = objcache.get(std::wstring());
+	entry.ownerGroup = Intern(std::wstring_view());
 	entry.permissions = entry.ownerGroup;
 	entry.time += m_timezoneOffset;
 
@@ -2334,7 +2456,7 @@ bool CDirectoryListingParser::ParseAsIBM_MVS(CLine &line, CDirentry &entry)
 			return false;
 
 		entry.size = -1;
-		entry.ownerGroup = objcache.get(std::wstring());
+		entry.ownerGroup = Intern(std::wstring_view());
 		entry.permissions = entry.ownerGroup;
 
 		return true;
@@ -2393,7 +2515,7 @@ bool CDirectoryListingParser::ParseAsIBM_MVS(CLine &line, CDirentry &entry)
 
 	entry.name = token.GetString();
 
-	entry.ownerGroup = objcache.get(std::wstring());
+	entry.ownerGroup = Intern(std::wstring_view());
 	entry.permissions = entry.ownerGroup;
 
 	return true;
@@ -2456,7 +2578,7 @@ bool CDirectoryListingParser::ParseAsIBM_MVS_PDS(CLine &line, CDirentry &entry)
 	if (!line.GetToken(index++, token, true))
 		return false;
 
-	entry.ownerGroup = objcache.get(std::wstring());
+	entry.ownerGroup = Intern(std::wstring_view());
 	entry.permissions = entry.ownerGroup;
 	entry.time += m_timezoneOffset;
 
@@ -2487,7 +2609,7 @@ bool CDirectoryListingParser::ParseAsIBM_MVS_Migrated(CLine &line, CDirentry &en
 
 	entry.flags = 0;
 	entry.size = -1;
-	entry.ownerGroup = objcache.get(std::wstring());
+	entry.ownerGroup = Intern(std::wstring_view());
 	entry.permissions = entry.ownerGroup;
 
 	return true;
@@ -2504,7 +2626,7 @@ bool CDirectoryListingParser::ParseAsIBM_MVS_PDS2(CLine &line, CDirentry &entry)
 	entry.name = token.GetString();
 
 	entry.flags = 0;
-	entry.ownerGroup = objcache.get(std::wstring());
+	entry.ownerGroup = Intern(std::wstring_view());
 	entry.permissions = entry.ownerGroup;
 	entry.size = -1;
 
@@ -2598,8 +2720,8 @@ bool CDirectoryListingParser::ParseAsIBM_MVS_Tape(CLine &line, CDirentry &entry)
 
 	entry.name = token.GetString();
 	entry.flags = 0;
-	entry.ownerGroup = objcache.get(std::wstring());
-	entry.permissions = objcache.get(std::wstring());
+	entry.ownerGroup = Intern(std::wstring_view());
+	entry.permissions = Intern(std::wstring_view());
 	entry.size = -1;
 
 	if (line.GetToken(index++, token)) {
@@ -2872,8 +2994,8 @@ int CDirectoryListingParser::ParseAsMlsd(CLine &line, CDirentry &entry)
 	}
 
 	entry.name = nameToken.GetString();
-	entry.ownerGroup = objcache.get(std::move(ownerGroup));
-	entry.permissions = objcache.get(std::move(permissions));
+	entry.ownerGroup = Intern(ownerGroup);
+	entry.permissions = Intern(permissions);
 
 	return 1;
 }
@@ -2938,27 +3060,55 @@ bool CDirectoryListingParser::ParseAsOS9(CLine &line, CDirentry &entry)
 		return false;
 
 	entry.name = token.GetString();
-	entry.ownerGroup = objcache.get(ownerGroupToken.GetString());
-	entry.permissions = objcache.get(permToken.GetString());
+	entry.ownerGroup = Intern(ownerGroupToken.get_view());
+	entry.permissions = Intern(permToken.get_view());
 
 	return true;
 }
 
-void CDirectoryListingParser::Reset()
+fz::shared_value<std::wstring> CDirectoryListingParser::Intern(std::wstring_view const& v)
 {
-	for (auto & item : m_DataList) {
-		delete [] item.p;
+	// Listings usually contain only a handful of distinct values, look them
+	// up locally first so that the shared pool is only consulted once for each.
+	auto const less = [](fz::shared_value<std::wstring> const& a, std::wstring_view const& b) {
+		return std::wstring_view(*a) < b;
+	};
+	auto it = std::lower_bound(interned_.begin(), interned_.end(), v, less);
+	if (it != interned_.end() && std::wstring_view(**it) == v) {
+		return *it;
+	}
+
+	fz::shared_value<std::wstring> value = pool_ ? pool_->Get(v) : fz::shared_value<std::wstring>(std::wstring(v));
+	if (interned_.size() < 1024) {
+		interned_.insert(it, value);
 	}
-	m_DataList.clear();
+	return value;
+}
+
+void CDirectoryListingParser::Reset()
+{
+	StopWorker();
+
+	data_.clear();
+	recv_.clear();
+	incoming_.clear();
 
 	delete m_prevLine;
 	m_prevLine = nullptr;
 
 	entries_.clear();
 	m_fileList.clear();
-	m_currentOffset = 0;
 	m_fileListOnly = true;
 	m_maybeMultilineVms = false;
+
+	m_sampleFormat = listingFormat::none;
+	m_sampleCount = 0;
+	m_formatHits = 0;
+	m_formatMisses = 0;
+
+	if (pool_for_worker_) {
+		StartWorker();
+	}
 }
 
 bool CDirectoryListingParser::ParseAsZVM(CLine &line, CDirentry &entry)
@@ -3034,8 +3184,8 @@ bool CDirectoryListingParser::ParseAsZVM(CLine &line, CDirentry &entry)
 	if (line.GetToken(++index, token))
 		return false;
 
-	entry.ownerGroup = objcache.get(ownerGroupToken.GetString());
-	entry.permissions = objcache.get(std::wstring());
+	entry.ownerGroup = Intern(ownerGroupToken.get_view());
+	entry.permissions = Intern(std::wstring_view());
 	entry.target.clear();
 	entry.time += m_timezoneOffset;
 
@@ -3102,8 +3252,8 @@ bool CDirectoryListingParser::ParseAsHPNonstop(CLine &line, CDirentry &entry)
 	if (line.GetToken(++index, token))
 		return false;
 
-	entry.permissions = objcache.get(permToken.GetString());
-	entry.ownerGroup = objcache.get(ownerGroup);
+	entry.permissions = Intern(permToken.get_view());
+	entry.ownerGroup = Intern(ownerGroup);
 
 	return true;
 }
@@ -3139,14 +3289,14 @@ char const ebcdic_table[256] = {
 	'0',  '1',  '2',  '3',  '4',  '5',  '6',  '7',  '8',  '9',  ' ',  ' ',  ' ',  ' ',  ' ',  ' '   // f
 };
 
-void CDirectoryListingParser::ConvertEncoding(char *pData, int len)
+void CDirectoryListingParser::ConvertEncoding(unsigned char *pData, size_t len)
 {
 	if (m_listingEncoding != listingEncoding::ebcdic) {
 		return;
 	}
 
-	for (int i = 0; i < len; ++i) {
-		pData[i] = ebcdic_table[static_cast<unsigned char>(pData[i])];
+	for (size_t i = 0; i < len; ++i) {
+		pData[i] = ebcdic_table[pData[i]];
 	}
 }
 
@@ -3160,10 +3310,8 @@ void CDirectoryListingParser::DeduceEncoding()
 
 	memset(&count, 0, sizeof(int)*256);
 
-	for (auto const& data : m_DataList) {
-		for (int i = 0; i < data.len; ++i) {
-			++count[static_cast<unsigned char>(data.p[i])];
-		}
+	for (size_t i = 0; i < data_.size(); ++i) {
+		++count[data_[i]];
 	}
 
 	int count_normal = 0;
@@ -3206,8 +3354,8 @@ void CDirectoryListingParser::DeduceEncoding()
 			m_pControlSocket->log(logmsg::status, _("Received a directory listing which appears to be encoded in EBCDIC."));
 		}
 		m_listingEncoding = listingEncoding::ebcdic;
-		for (auto & data : m_DataList) {
-			ConvertEncoding(data.p, data.len);
+		if (!data_.empty()) {
+			ConvertEncoding(data_.get(), data_.size());
 		}
 	}
 	else {
@@ -30,17 +30,31 @@
  * Lines not containing a recognized format (e.g. a part of a multiline
  * entry) are rememberd and if the next line cannot be parsed either, they
  * get concatenated to be parsed again (and discarded if not recognized).
+ *
+ * Servers rarely mix formats within a listing. If the first few lines all
+ * get recognized as the same format, that format is tried first for all
+ * subsequent lines, falling back to the full sequence if it doesn't match.
+ * The format is remembered in the server capabilities for future listings.
+ *
+ * With pipelining enabled, decomposing and parsing happens on a worker
+ * thread while the transfer is still running. The socket thread only hands
+ * over the received data, Parse() then just waits for the worker to finish
+ * the remainder.
  */
 
 #include "../include/directorylisting.h"
 #include "../include/server.h"
 
-#include <deque>
+#include <libfilezilla/buffer.hpp>
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/thread_pool.hpp>
+
 #include <vector>
 
 class CLine;
 class CToken;
 class CControlSocket;
+class CStringPool;
 
 namespace listingEncoding
 {
@@ -52,6 +66,33 @@ namespace listingEncoding
 	};
 }
 
+namespace listingFormat
+{
+	// In the order they get tried
+	enum type
+	{
+		none,
+		zvm,
+		hpnonstop,
+		mlsd,
+		unix_date,
+		dos,
+		eplf,
+		vms,
+		other,
+		ibm,
+		wfftp,
+		ibm_mvs,
+		ibm_mvs_pds,
+		os9,
+		ibm_mvs_migrated,
+		ibm_mvs_pds2,
+		ibm_mvs_tape,
+		unix_nodate,
+		count
+	};
+}
+
 
 class FZC_PUBLIC_SYMBOL CDirectoryListingParser final
 {
@@ -64,11 +105,25 @@ public:
 
 	CDirectoryListing Parse(const CServerPath &path);
 
-	bool AddData(char *pData, int len);
+	// Copies the passed data into the parser's input buffer.
+	bool AddData(char const* data, size_t len);
+
+	// Avoids the copy: Fill the region returned by GetDataBuffer, then
+	// call AddData with the amount of bytes actually written.
+	unsigned char* GetDataBuffer(size_t len);
+	bool AddData(size_t len);
 	bool AddLine(std::wstring && line, std::wstring && name, fz::datetime const& time);
 
+	// Adds an entry whose fields are already known, e.g. from SFTP attributes.
+	// The time is in server time.
+	bool AddEntry(CDirentry && entry, std::wstring_view const& permissions, std::wstring_view const& ownerGroup);
+
 	void Reset();
 
+	// Parse received data on a thread from the passed pool, see the comment
+	// at the top. Call before adding any data.
+	void EnablePipelining(fz::thread_pool& pool);
+
 	void SetTimezoneOffset(fz::duration const& span) { m_timezoneOffset = span; }
 
 	void SetServer(const CServer& server) { m_server = server; };
@@ -80,6 +135,12 @@ protected:
 
 	bool ParseLine(CLine &line, ServerType const serverType, bool concatenated, CDirentry const* override = nullptr);
 
+	// Returns 0 if the line does not match the format, 1 on success and 2 if
+	// the line is to be skipped.
+	int ParseAs(listingFormat::type format, CLine &line, CDirentry &entry);
+	static bool IsFormatApplicable(listingFormat::type format, ServerType const serverType);
+	void LearnFormat(listingFormat::type format);
+
 	bool ParseAsUnix(CLine &line, CDirentry &entry, bool expect_date);
 	bool ParseAsDos(CLine &line, CDirentry &entry);
 	bool ParseAsEplf(CLine &line, CDirentry &entry);
@@ -113,27 +174,43 @@ protected:
 
 	bool GetMonthFromName(std::wstring const& name, int &month);
 
+	fz::shared_value<std::wstring> Intern(std::wstring_view const& v);
+
 	void DeduceEncoding();
-	void ConvertEncoding(char *pData, int len);
+	void ConvertEncoding(unsigned char *pData, size_t len);
 
-	CControlSocket* m_pControlSocket;
+	// Takes data added so far, runs ParseData on it if enough has been
+	// received or if final is set.
+	bool ProcessData(size_t len, bool final);
 
-	static std::map<std::wstring, int> m_MonthNamesMap;
+	void StartWorker();
+	void StopWorker();
+	void RunWorker();
 
-	struct t_list
-	{
-		t_list() = default;
-		t_list(char* s, int l)
-			: p(s), len(l)
-		{}
+	CControlSocket* m_pControlSocket;
 
-		char *p;
-		int len;
-	};
+	CStringPool* pool_{};
+	std::vector<fz::shared_value<std::wstring>> interned_;
 
-	int m_currentOffset{};
+	static std::map<std::wstring, int> m_MonthNamesMap;
+
+	// Received data not yet decomposed into lines. Consumed lines get
+	// discarded from the front, its storage gets reused for new data.
+	fz::buffer data_;
+
+	// Pipelining. recv_ is only used by the thread adding data, incoming_
+	// gets handed over to the worker under worker_mutex_.
+	fz::thread_pool* pool_for_worker_{};
+	fz::async_task worker_;
+	fz::mutex worker_mutex_{false};
+	fz::condition worker_cond_;
+	fz::buffer recv_;
+	fz::buffer incoming_;
+	bool worker_final_{};
+	bool worker_quit_{};
+	bool worker_done_{};
+	bool worker_result_{true};
 
-	std::deque<t_list> m_DataList;
 	std::vector<fz::shared_value<CDirentry>> entries_;
 	int64_t m_totalData{};
 
@@ -146,6 +223,13 @@ protected:
 
 	bool m_maybeMultilineVms{};
 
+	// Format sniffing, see the comment at the top
+	listingFormat::type m_preferredFormat{listingFormat::none};
+	listingFormat::type m_sampleFormat{listingFormat::none};
+	int m_sampleCount{};
+	int m_formatHits{};
+	int m_formatMisses{};
+
 	fz::duration m_timezoneOffset;
 
 	listingEncoding::type m_listingEncoding;
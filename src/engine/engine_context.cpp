@@ -8,27 +8,36 @@
 #include "logging_private.h"
 #include "oplock_manager.h"
 #include "pathcache.h"
+#include "stringpool.h"
+#include "tls_session_cache.h"
 
 #include <libfilezilla/event_loop.hpp>
 #include <libfilezilla/rate_limiter.hpp>
 #include <libfilezilla/thread_pool.hpp>
 #include <libfilezilla/tls_system_trust_store.hpp>
 
+#include <algorithm>
+#include <limits>
+
 namespace {
 class option_change_handler final : public fz::event_handler
 {
 public:
-	option_change_handler(COptionsBase& options, fz::event_loop & loop, fz::rate_limit_manager & rate_limit_mgr, fz::rate_limiter & rate_limiter)
+	option_change_handler(COptionsBase& options, fz::event_loop & loop, fz::rate_limit_manager & rate_limit_mgr, fz::rate_limiter & rate_limiter, CDirectoryCache & directory_cache)
 		: fz::event_handler(loop)
 		, options_(options)
 		, rate_limit_mgr_(rate_limit_mgr)
 		, rate_limiter_(rate_limiter)
+		, directory_cache_(directory_cache)
 	{
 		UpdateRateLimit();
+		UpdateDirectoryCache();
 		options_.watch(OPTION_SPEEDLIMIT_ENABLE, this);
 		options_.watch(OPTION_SPEEDLIMIT_INBOUND, this);
 		options_.watch(OPTION_SPEEDLIMIT_OUTBOUND, this);
 		options_.watch(OPTION_SPEEDLIMIT_BURSTTOLERANCE, this);
+		options_.watch(OPTION_CACHE_TTL, this);
+		options_.watch(OPTION_CACHE_MEMORY_LIMIT, this);
 	}
 
 	~option_change_handler()
@@ -45,13 +54,16 @@ private:
 	void on_options_changed(watched_options const&)
 	{
 		UpdateRateLimit();
+		UpdateDirectoryCache();
 	}
 
 	void UpdateRateLimit();
+	void UpdateDirectoryCache();
 
 	COptionsBase & options_;
 	fz::rate_limit_manager & rate_limit_mgr_;
 	fz::rate_limiter & rate_limiter_;
+	CDirectoryCache & directory_cache_;
 };
 
 void option_change_handler::UpdateRateLimit()
@@ -82,6 +94,15 @@ void option_change_handler::UpdateRateLimit()
 	}
 	rate_limiter_.set_limits(limits[0], limits[1]);
 }
+
+void option_change_handler::UpdateDirectoryCache()
+{
+	directory_cache_.SetTtl(fz::duration::from_seconds(options_.get_int(OPTION_CACHE_TTL)));
+
+	// The limit is in MiB, which can exceed size_t on 32-bit systems
+	uint64_t const limit = static_cast<uint64_t>(options_.get_int(OPTION_CACHE_MEMORY_LIMIT)) * 1024 * 1024;
+	directory_cache_.SetMemoryLimit(static_cast<size_t>(std::min(limit, static_cast<uint64_t>(std::numeric_limits<size_t>::max()))));
+}
 }
 
 class CFileZillaEngineContext::Impl final
@@ -92,7 +113,23 @@ public:
 		, rate_limit_mgr_(loop_)
 		, tlsSystemTrustStore_(pool_)
 	{
-		directory_cache_.SetTtl(fz::duration::from_seconds(options.get_int(OPTION_CACHE_TTL)));
+		if (options.get_bool(OPTION_CACHE_PERSIST)) {
+			std::wstring const file = options.get_string(OPTION_CACHE_FILE);
+			if (!file.empty()) {
+				directory_cache_.EnablePersistence(fz::to_native(file));
+			}
+		}
+		if (options.get_bool(OPTION_TLS_SESSION_PERSIST)) {
+			std::wstring const file = options.get_string(OPTION_TLS_SESSION_FILE);
+			if (!file.empty()) {
+				auto key = fz::symmetric_key::from_base64(options.get_string(OPTION_TLS_SESSION_KEY));
+				if (!key) {
+					key = fz::symmetric_key::generate();
+					options.set(OPTION_TLS_SESSION_KEY, fz::to_wstring(key.to_base64()));
+				}
+				tls_session_cache_.EnablePersistence(fz::to_native(file), key);
+			}
+		}
 		rate_limit_mgr_.add(&rate_limiter_);
 	}
 
@@ -106,11 +143,13 @@ public:
 	fz::event_loop loop_{pool_};
 	fz::rate_limit_manager rate_limit_mgr_;
 	fz::rate_limiter rate_limiter_;
-	option_change_handler option_change_handler_{options_, loop_, rate_limit_mgr_, rate_limiter_};
-	CDirectoryCache directory_cache_;
+	CStringPool string_pool_;
+	CDirectoryCache directory_cache_{string_pool_};
+	option_change_handler option_change_handler_{options_, loop_, rate_limit_mgr_, rate_limiter_, directory_cache_};
 	CPathCache path_cache_;
 	OpLockManager opLockManager_;
 	fz::tls_system_trust_store tlsSystemTrustStore_;
+	CTlsSessionCache tls_session_cache_{loop_};
 	activity_logger activity_logger_;
 };
 
@@ -145,11 +184,29 @@ CDirectoryCache& CFileZillaEngineContext::GetDirectoryCache()
 	return impl_->directory_cache_;
 }
 
+directory_cache_stats CFileZillaEngineContext::GetDirectoryCacheStats()
+{
+	directory_cache_stats ret = impl_->directory_cache_.GetStats();
+
+	auto const pool = impl_->string_pool_.GetStats();
+	ret.pool_lookups = pool.lookups;
+	ret.pool_hits = pool.hits;
+	ret.pool_evictions = pool.evictions;
+	ret.pool_strings = pool.size;
+
+	return ret;
+}
+
 CPathCache& CFileZillaEngineContext::GetPathCache()
 {
 	return impl_->path_cache_;
 }
 
+CStringPool& CFileZillaEngineContext::GetStringPool()
+{
+	return impl_->string_pool_;
+}
+
 OpLockManager& CFileZillaEngineContext::GetOpLockManager()
 {
 	return impl_->opLockManager_;
@@ -160,6 +217,11 @@ fz::tls_system_trust_store& CFileZillaEngineContext::GetTlsSystemTrustStore()
 	return impl_->tlsSystemTrustStore_;
 }
 
+CTlsSessionCache& CFileZillaEngineContext::GetTlsSessionCache()
+{
+	return impl_->tls_session_cache_;
+}
+
 activity_logger& CFileZillaEngineContext::GetActivityLogger()
 {
 	return impl_->activity_logger_;
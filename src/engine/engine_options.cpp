@@ -36,6 +36,7 @@ unsigned int register_engine_options()
 		{ "Speedlimit outbound", 100, option_flags::numeric_clamp, 0, 999999999 },
 		{ "Speedlimit burst tolerance", 0, option_flags::normal, 0, 2 },
 		{ "Preallocate space", false, option_flags::normal },
+		{ "Verify checksums", false, option_flags::normal },
 		{ "View hidden files", false, option_flags::normal },
 		{ "Preserve timestamps", false, option_flags::normal },
 
@@ -58,6 +59,9 @@ unsigned int register_engine_options()
 			}
 		},
 		{ "FTP Keep-alive commands", false, option_flags::normal },
+		{ "FTP MODE Z", false, option_flags::normal },
+		{ "FTP MODE Z level", 6, option_flags::numeric_clamp, 1, 9 },
+		{ "FTP pipeline depth", 1, option_flags::numeric_clamp, 1, 64 },
 		{ "FTP Proxy type", 0, option_flags::normal, 0, 4 },
 		{ "FTP Proxy host", L"", option_flags::normal },
 		{ "FTP Proxy user", L"", option_flags::normal },
@@ -65,6 +69,7 @@ unsigned int register_engine_options()
 		{ "FTP Proxy login sequence", L"", option_flags::normal },
 		{ "SFTP keyfiles", L"", option_flags::platform },
 		{ "SFTP compression", false, option_flags::normal },
+		{ "SFTP buffer ring depth", 8, option_flags::numeric_clamp, 2, 64 },
 		{ "Proxy type", 0, option_flags::normal, 0, 3 },
 		{ "Proxy host", L"", option_flags::normal },
 		{ "Proxy port", 0, option_flags::normal, 1, 65535 },
@@ -78,7 +83,13 @@ unsigned int register_engine_options()
 		{ "Size decimal places", 1, option_flags::numeric_clamp, 0, 3 },
 		{ "TCP Keepalive Interval", 15, option_flags::numeric_clamp, 1, 10000 },
 		{ "Cache TTL", 600, option_flags::numeric_clamp, 30, 60*60*24 },
-		{ "Minimum TLS Version", 2, option_flags::numeric_clamp, 0, 3 }
+		{ "Persistent directory cache", false, option_flags::normal },
+		{ "Directory cache file", L"", option_flags::internal },
+		{ "Directory cache memory limit", 256, option_flags::numeric_clamp, 16, 1024*1024 },
+		{ "Minimum TLS Version", 2, option_flags::numeric_clamp, 0, 3 },
+		{ "Persistent TLS sessions", false, option_flags::normal },
+		{ "TLS session cache file", L"", option_flags::internal },
+		{ "TLS session cache key", L"", option_flags::sensitive_data }
 	});
 	return value;
 }
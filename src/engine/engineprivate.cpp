@@ -121,10 +121,8 @@ void CFileZillaEnginePrivate::shutdown()
 	{
 		fz::scoped_lock lock(notification_mutex_);
 		// Delete notification list
-		for (auto & notification : m_NotificationList) {
-			delete notification;
-		}
 		m_NotificationList.clear();
+		m_notificationPos = 0;
 	}
 
 	// Remove ourself from the engine list
@@ -158,10 +156,45 @@ bool CFileZillaEnginePrivate::IsConnected() const
 	return controlSocket_ != nullptr;
 }
 
-void CFileZillaEnginePrivate::AddNotification(fz::scoped_lock&, std::unique_ptr<CNotification> && notification)
+bool CFileZillaEnginePrivate::Coalesce(fz::scoped_lock&, std::unique_ptr<CNotification> & notification)
+{
+	if (m_NotificationList.size() <= m_notificationPos) {
+		return false;
+	}
+
+	auto & last = m_NotificationList.back();
+	if (last->GetID() != notification->GetID()) {
+		return false;
+	}
+
+	switch (notification->GetID()) {
+	case nId_transferstatus:
+		// Only the latest status is of interest
+		last = std::move(notification);
+		return true;
+	case nId_listing:
+		{
+			auto const& prev = static_cast<CDirectoryListingNotification const&>(*last);
+			auto const& cur = static_cast<CDirectoryListingNotification const&>(*notification);
+			if (prev.GetPath() != cur.GetPath() || prev.Primary() != cur.Primary()) {
+				return false;
+			}
+			// Either a duplicate or a fresh listing following a stale one
+			if (prev.Stale() || (prev.Failed() == cur.Failed() && !cur.Stale())) {
+				last = std::move(notification);
+				return true;
+			}
+		}
+		return false;
+	default:
+		return false;
+	}
+}
+
+void CFileZillaEnginePrivate::AddNotification(fz::scoped_lock& lock, std::unique_ptr<CNotification> && notification)
 {
-	if (notification) {
-		m_NotificationList.push_back(notification.release());
+	if (notification && !Coalesce(lock, notification)) {
+		m_NotificationList.push_back(std::move(notification));
 	}
 
 	if (m_maySendNotificationEvent && notification_cb_) {
@@ -183,7 +216,9 @@ void CFileZillaEnginePrivate::AddLogNotification(std::unique_ptr<CLogmsgNotifica
 	if (notification->msgType == logmsg::error) {
 		queue_logs_ = false;
 
-		m_NotificationList.insert(m_NotificationList.end(), queued_logs_.begin(), queued_logs_.end());
+		for (auto & msg : queued_logs_) {
+			m_NotificationList.push_back(std::move(msg));
+		}
 		queued_logs_.clear();
 		AddNotification(lock, std::move(notification));
 	}
@@ -195,21 +230,23 @@ void CFileZillaEnginePrivate::AddLogNotification(std::unique_ptr<CLogmsgNotifica
 		AddNotification(lock, std::move(notification));
 	}
 	else {
-		queued_logs_.push_back(notification.release());
+		queued_logs_.push_back(std::move(notification));
 	}
 }
 
 void CFileZillaEnginePrivate::SendQueuedLogs(bool reset_flag)
 {
 	fz::scoped_lock lock(notification_mutex_);
-	m_NotificationList.insert(m_NotificationList.end(), queued_logs_.begin(), queued_logs_.end());
+	for (auto & msg : queued_logs_) {
+		m_NotificationList.push_back(std::move(msg));
+	}
 	queued_logs_.clear();
 
 	if (reset_flag) {
 		queue_logs_ = ShouldQueueLogsFromOptions();
 	}
 
-	if (!m_maySendNotificationEvent || m_NotificationList.empty() || !notification_cb_) {
+	if (!m_maySendNotificationEvent || m_NotificationList.size() <= m_notificationPos || !notification_cb_) {
 		return;
 	}
 	m_maySendNotificationEvent = false;
@@ -219,9 +256,6 @@ void CFileZillaEnginePrivate::SendQueuedLogs(bool reset_flag)
 
 void CFileZillaEnginePrivate::ClearQueuedLogs(fz::scoped_lock&, bool reset_flag)
 {
-	for (auto msg : queued_logs_) {
-		delete msg;
-	}
 	queued_logs_.clear();
 
 	if (reset_flag) {
@@ -371,6 +405,10 @@ int CFileZillaEnginePrivate::List(CListCommand const& command)
 				}
 				if (is_outdated) {
 					flags |= LIST_FLAG_REFRESH;
+					if (!avoid) {
+						// Let the outdated listing be browsed while it gets refreshed
+						AddNotification(std::make_unique<CDirectoryListingNotification>(listing.path, true, false, true));
+					}
 				}
 			}
 		}
@@ -762,14 +800,35 @@ std::unique_ptr<CNotification> CFileZillaEnginePrivate::GetNextNotification()
 {
 	fz::scoped_lock lock(notification_mutex_);
 
-	if (m_NotificationList.empty()) {
+	if (m_notificationPos >= m_NotificationList.size()) {
+		m_NotificationList.clear();
+		m_notificationPos = 0;
 		m_maySendNotificationEvent = true;
 		return nullptr;
 	}
-	std::unique_ptr<CNotification> pNotification(m_NotificationList.front());
-	m_NotificationList.pop_front();
 
-	return pNotification;
+	return std::move(m_NotificationList[m_notificationPos++]);
+}
+
+bool CFileZillaEnginePrivate::GetNotifications(std::vector<std::unique_ptr<CNotification>> & notifications)
+{
+	notifications.clear();
+
+	fz::scoped_lock lock(notification_mutex_);
+
+	if (m_notificationPos) {
+		m_NotificationList.erase(m_NotificationList.begin(), m_NotificationList.begin() + m_notificationPos);
+		m_notificationPos = 0;
+	}
+	if (m_NotificationList.empty()) {
+		m_maySendNotificationEvent = true;
+		return false;
+	}
+
+	// Both vectors keep their capacity, so in the steady state nothing
+	// gets allocated here.
+	m_NotificationList.swap(notifications);
+	return true;
 }
 
 bool CFileZillaEnginePrivate::SetAsyncRequestReply(std::unique_ptr<CAsyncRequestNotification> && pNotification)
@@ -857,11 +916,24 @@ CTransferStatusManager::CTransferStatusManager(CFileZillaEnginePrivate& engine)
 {
 }
 
+void CTransferStatusManager::BeginWrite()
+{
+	seq_.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+void CTransferStatusManager::EndWrite()
+{
+	seq_.fetch_add(1, std::memory_order_release);
+}
+
 void CTransferStatusManager::Reset()
 {
 	{
 		fz::scoped_lock lock(mutex_);
-		status_.clear();
+		BeginWrite();
+		startOffset_.store(-1, std::memory_order_relaxed);
+		EndWrite();
 		send_state_ = 0;
 	}
 
@@ -875,19 +947,27 @@ void CTransferStatusManager::Init(int64_t totalSize, int64_t startOffset, bool l
 		startOffset = 0;
 	}
 
-	status_ = CTransferStatus(totalSize, startOffset, list);
-	currentOffset_ = 0;
-	made_progress_ = false;
+	BeginWrite();
+	totalSize_.store(totalSize, std::memory_order_relaxed);
+	startOffset_.store(startOffset, std::memory_order_relaxed);
+	started_.store(0, std::memory_order_relaxed);
+	list_.store(list, std::memory_order_relaxed);
+	currentOffset_.store(0, std::memory_order_relaxed);
+	made_progress_.store(false, std::memory_order_relaxed);
+	EndWrite();
 }
 
 void CTransferStatusManager::SetStartTime()
 {
 	fz::scoped_lock lock(mutex_);
-	if (!status_) {
+	if (empty()) {
 		return;
 	}
 
-	status_.started = fz::datetime::now();
+	fz::datetime const now = fz::datetime::now();
+	BeginWrite();
+	started_.store(static_cast<int64_t>(now.get_time_t()) * 1000 + now.get_milliseconds(), std::memory_order_relaxed);
+	EndWrite();
 }
 
 void CTransferStatusManager::SetMadeProgress()
@@ -897,53 +977,79 @@ void CTransferStatusManager::SetMadeProgress()
 
 void CTransferStatusManager::Update(int64_t transferredBytes)
 {
-	std::unique_ptr<CNotification> notification;
+	if (empty()) {
+		return;
+	}
 
-	{
-		int64_t oldOffset = currentOffset_.fetch_add(transferredBytes);
-		if (!oldOffset) {
-			fz::scoped_lock lock(mutex_);
-			if (!status_) {
-				return;
-			}
+	currentOffset_.fetch_add(transferredBytes, std::memory_order_relaxed);
+	if (!send_state_.exchange(2)) {
+		CTransferStatus const status = Peek();
+		if (status) {
+			engine_.AddNotification(std::make_unique<CTransferStatusNotification>(status));
+		}
+	}
+}
 
-			if (!send_state_) {
-				status_.currentOffset += currentOffset_.exchange(0);
-				status_.madeProgress = made_progress_;
-				notification = std::make_unique<CTransferStatusNotification>(status_);
-			}
-			send_state_ = 2;
+CTransferStatus CTransferStatusManager::Peek() const
+{
+	CTransferStatus status;
+	int64_t started{};
+	int64_t offset{};
+	while (true) {
+		uint32_t const seq = seq_.load(std::memory_order_acquire);
+		if (seq & 1) {
+			continue;
+		}
+
+		status.totalSize = totalSize_.load(std::memory_order_relaxed);
+		status.startOffset = startOffset_.load(std::memory_order_relaxed);
+		status.list = list_.load(std::memory_order_relaxed);
+		status.madeProgress = made_progress_.load(std::memory_order_relaxed);
+		started = started_.load(std::memory_order_relaxed);
+		offset = currentOffset_.load(std::memory_order_relaxed);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (seq_.load(std::memory_order_relaxed) == seq) {
+			break;
 		}
 	}
 
-	if (notification) {
-		engine_.AddNotification(std::move(notification));
+	if (status) {
+		status.currentOffset = status.startOffset + offset;
+		if (started) {
+			status.started = fz::datetime(static_cast<time_t>(started / 1000), fz::datetime::milliseconds);
+			status.started += fz::duration::from_milliseconds(started % 1000);
+		}
 	}
+	return status;
 }
 
 CTransferStatus CTransferStatusManager::Get(bool &changed)
 {
-	fz::scoped_lock lock(mutex_);
-	if (!status_) {
+	CTransferStatus const status = Peek();
+	if (!status) {
 		changed = false;
 		send_state_ = 0;
+		return status;
 	}
-	else {
-		status_.currentOffset += currentOffset_.exchange(0);
-		if (send_state_ == 2) {
-			changed = true;
-			send_state_ = 1;
+
+	int state = send_state_.load();
+	while (true) {
+		if (state == 2) {
+			if (send_state_.compare_exchange_weak(state, 1)) {
+				changed = true;
+				break;
+			}
 		}
-		else {
+		else if (send_state_.compare_exchange_weak(state, 0)) {
 			changed = false;
-			send_state_ = 0;
+			break;
 		}
 	}
-	return status_;
+	return status;
 }
 
-bool CTransferStatusManager::empty()
+bool CTransferStatusManager::empty() const
 {
-	fz::scoped_lock lock(mutex_);
-	return status_.empty();
+	return startOffset_.load(std::memory_order_relaxed) < 0;
 }
@@ -12,7 +12,7 @@
 
 #include <atomic>
 #include <list>
-#include <deque>
+#include <vector>
 
 class CControlSocket;
 class CLogging;
@@ -34,7 +34,7 @@ public:
 	CTransferStatusManager(CTransferStatusManager const&) = delete;
 	CTransferStatusManager& operator=(CTransferStatusManager const&) = delete;
 
-	bool empty();
+	bool empty() const;
 
 	void Init(int64_t totalSize, int64_t startOffset, bool list);
 	void Reset();
@@ -44,13 +44,32 @@ public:
 
 	CTransferStatus Get(bool &changed);
 
+	// Like Get, but leaves the changed state alone
+	CTransferStatus Peek() const;
+
 protected:
+	// The status is published through a seqlock: Update only touches
+	// atomics, readers retry if a write happened while they sampled the
+	// fields. Writers other than Update are serialized by mutex_.
+	void BeginWrite();
+	void EndWrite();
+
 	fz::mutex mutex_;
+	std::atomic<uint32_t> seq_{};
+
+	std::atomic<int64_t> totalSize_{-1};
+	std::atomic<int64_t> startOffset_{-1};
+	std::atomic<int64_t> started_{};	// In milliseconds since the epoch, 0 if not started
+	std::atomic_bool list_{};
 
-	CTransferStatus status_;
+	// Bytes transferred since Init
 	std::atomic<int64_t> currentOffset_{};
-	int send_state_{};
-	std::atomic_bool made_progress_;
+	std::atomic_bool made_progress_{};
+
+	// 0: Nobody is polling, the next update sends a notification
+	// 1: Polled and unchanged since
+	// 2: Changed since last poll
+	std::atomic<int> send_state_{};
 
 	CFileZillaEnginePrivate& engine_;
 };
@@ -81,6 +100,7 @@ public:
 	void AddNotification(std::unique_ptr<CNotification> && notification);
 	void AddLogNotification(std::unique_ptr<CLogmsgNotification> && notification);
 	std::unique_ptr<CNotification> GetNextNotification();
+	bool GetNotifications(std::vector<std::unique_ptr<CNotification>> & notifications);
 
 	COptionsBase& GetOptions() { return options_; }
 	fz::rate_limiter& GetRateLimiter() { return rate_limiter_; }
@@ -165,11 +185,18 @@ protected:
 
 	std::unique_ptr<CCommand> currentCommand_;
 
+	// Whether the notification supersedes the last pending one, in which
+	// case that one gets replaced.
+	bool Coalesce(fz::scoped_lock& lock, std::unique_ptr<CNotification> & notification);
+
 	// Protect access to these with notification_mutex_
-	std::deque<CNotification*> m_NotificationList;
+	// Entries before m_notificationPos have already been handed out by
+	// GetNextNotification.
+	std::vector<std::unique_ptr<CNotification>> m_NotificationList;
+	size_t m_notificationPos{};
 	bool m_maySendNotificationEvent{true};
 	bool queue_logs_{true};
-	std::vector<CLogmsgNotification*> queued_logs_;
+	std::vector<std::unique_ptr<CLogmsgNotification>> queued_logs_;
 
 
 	std::atomic<unsigned int> asyncRequestCounter_{};
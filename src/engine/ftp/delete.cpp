@@ -2,6 +2,7 @@
 
 #include "delete.h"
 #include "../directorycache.h"
+#include "../servercapabilities.h"
 
 enum rmdStates
 {
@@ -18,21 +19,36 @@ int CFtpDeleteOpData::Send()
 		return FZ_REPLY_CONTINUE;
 	}
 	else if (opState == del_del) {
-		std::wstring const& file = files_.back();
-		if (file.empty()) {
-			log(logmsg::debug_info, L"Empty filename");
-			return FZ_REPLY_INTERNALERROR;
-		}
-
-		std::wstring filename = path_.FormatFilename(file, omitPath_);
-		if (filename.empty()) {
-			log(logmsg::error, _("Filename cannot be constructed for directory %s and filename %s"), path_.GetPath(), file);
-			return FZ_REPLY_ERROR;
+		size_t const window = controlSocket_.GetPipelineWindow();
+		while (inFlight_ < files_.size() && inFlight_ < window) {
+			std::wstring const& file = files_[files_.size() - 1 - inFlight_];
+			if (file.empty()) {
+				log(logmsg::debug_info, L"Empty filename");
+				return FZ_REPLY_INTERNALERROR;
+			}
+
+			std::wstring filename = path_.FormatFilename(file, omitPath_);
+			if (filename.empty()) {
+				log(logmsg::error, _("Filename cannot be constructed for directory %s and filename %s"), path_.GetPath(), file);
+				return FZ_REPLY_ERROR;
+			}
+
+			if (inFlight_ == 1 && CServerCapabilities::GetCapability(currentServer_, ftp_pipelining) == unknown) {
+				// Should the server choke on it, the next connection won't try again.
+				log(logmsg::debug_info, L"Checking whether server supports command pipelining");
+				CServerCapabilities::SetCapability(currentServer_, ftp_pipelining, no);
+				probing_ = true;
+			}
+
+			engine_.GetDirectoryCache().InvalidateFile(currentServer_, path_, file);
+
+			int res = controlSocket_.SendCommand(L"DELE " + filename, false, !inFlight_);
+			if (res != FZ_REPLY_WOULDBLOCK) {
+				return res;
+			}
+			++inFlight_;
 		}
-
-		engine_.GetDirectoryCache().InvalidateFile(currentServer_, path_, file);
-
-		return controlSocket_.SendCommand(L"DELE " + filename);
+		return FZ_REPLY_WOULDBLOCK;
 	}
 
 	log(logmsg::debug_warning, L"Unkown op state %d", opState);
@@ -62,8 +78,19 @@ int CFtpDeleteOpData::ParseResponse()
 	}
 
 	files_.pop_back();
+	if (inFlight_) {
+		--inFlight_;
+	}
+
+	if (probing_ && !inFlight_) {
+		probing_ = false;
+		CServerCapabilities::SetCapability(currentServer_, ftp_pipelining, yes);
+	}
 
 	if (!files_.empty()) {
+		if (inFlight_ >= files_.size()) {
+			return FZ_REPLY_WOULDBLOCK;
+		}
 		return FZ_REPLY_CONTINUE;
 	}
 
@@ -89,6 +116,10 @@ int CFtpDeleteOpData::SubcommandResult(int prevResult, COpData const&)
 
 int CFtpDeleteOpData::Reset(int result)
 {
+	if (probing_ && !(result & FZ_REPLY_DISCONNECTED)) {
+		// Aborted for other reasons, the server did not fail
+		CServerCapabilities::SetCapability(currentServer_, ftp_pipelining, unknown);
+	}
 	if (needSendListing_ && !(result & FZ_REPLY_DISCONNECTED)) {
 		controlSocket_.SendDirectoryListingNotification(path_, false);
 	}
@@ -30,6 +30,13 @@ public:
 
 	// Set to true if deletion of at least one file failed
 	bool deleteFailed_{};
+
+	// DELE commands awaiting their reply, these are for the last
+	// entries in files_.
+	size_t inFlight_{};
+
+	// Set while finding out whether the server can handle pipelining
+	bool probing_{};
 };
 
 #endif
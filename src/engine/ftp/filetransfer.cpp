@@ -12,11 +12,48 @@
 
 #include <assert.h>
 
+namespace {
+// Picks the command to get the checksum of a file, preferring HASH over the
+// non-standard X commands.
+std::wstring checksum_command(CServer const& server, fz::hash_algorithm & alg)
+{
+	std::wstring selected;
+	if (CServerCapabilities::GetCapability(server, hash_command, &selected) == yes) {
+		if (selected == L"SHA-256") {
+			alg = fz::hash_algorithm::sha256;
+			return L"HASH";
+		}
+		if (selected == L"SHA-512") {
+			alg = fz::hash_algorithm::sha512;
+			return L"HASH";
+		}
+		if (selected == L"SHA-1") {
+			alg = fz::hash_algorithm::sha1;
+			return L"HASH";
+		}
+		if (selected == L"MD5") {
+			alg = fz::hash_algorithm::md5;
+			return L"HASH";
+		}
+	}
+	if (CServerCapabilities::GetCapability(server, xsha256_command) == yes) {
+		alg = fz::hash_algorithm::sha256;
+		return L"XSHA256";
+	}
+	if (CServerCapabilities::GetCapability(server, xmd5_command) == yes) {
+		alg = fz::hash_algorithm::md5;
+		return L"XMD5";
+	}
+	return {};
+}
+}
+
 CFtpFileTransferOpData::CFtpFileTransferOpData(CFtpControlSocket& controlSocket, CFileTransferCommand const& cmd)
 	: CFileTransferOpData(L"CFtpFileTransferOpData", cmd)
 	, CFtpOpData(controlSocket)
 {
 	binary = !(cmd.GetFlags() & ftp_transfer_flags::ascii);
+	moreFollow = cmd.GetFlags() & transfer_flags::more_follow;
 }
 
 int CFtpFileTransferOpData::Send()
@@ -60,7 +97,11 @@ int CFtpFileTransferOpData::Send()
 
 		{
 			resumeOffset = 0;
-			if (download()) {
+			if (download() && segmentSize_) {
+				resumeOffset = static_cast<int64_t>(segmentOffset_);
+				engine_.transfer_status_.Init(static_cast<int64_t>(segmentSize_), 0, false);
+			}
+			else if (download()) {
 				// Potentially racy
 				localFileSize_ = writer_factory_.size(); 
 				fileDidExist_ = localFileSize_ != fz::aio_base::nosize;
@@ -110,11 +151,15 @@ int CFtpFileTransferOpData::Send()
 			controlSocket_.m_pTransferSocket = std::make_unique<CTransferSocket>(engine_, controlSocket_, download() ? TransferMode::download : TransferMode::upload);
 			controlSocket_.m_pTransferSocket->m_binaryMode = binary;
 			if (download()) {
-				auto writer = controlSocket_.OpenWriter(writer_factory_, resumeOffset, true);
+				auto writer = controlSocket_.OpenWriter(writer_factory_, segmentSize_ ? 0 : resumeOffset, true);
 				if (!writer) {
 					return FZ_REPLY_CRITICALERROR;
 				}
-				if (options_.get_int(OPTION_PREALLOCATE_SPACE)) {
+				if (segmentSize_) {
+					// Stop once the segment is complete, the server notices the closed data connection.
+					controlSocket_.m_pTransferSocket->SetDownloadLimit(segmentSize_);
+				}
+				else if (options_.get_int(OPTION_PREALLOCATE_SPACE)) {
 					if (remoteFileSize_ >= 0 && remoteFileSize_ > resumeOffset) {
 						if (writer->preallocate(static_cast<uint64_t>(remoteFileSize_ - resumeOffset)) != fz::aio_result::ok) {
 							return FZ_REPLY_ERROR;
@@ -130,6 +175,15 @@ int CFtpFileTransferOpData::Send()
 				}
 				controlSocket_.m_pTransferSocket->set_reader(std::move(reader), flags_ & ftp_transfer_flags::ascii);
 			}
+
+			hasher_.reset();
+			if (controlSocket_.WantChecksum(*this, binary, resumeOffset)) {
+				checksumCommand_ = checksum_command(currentServer_, hashAlgorithm_);
+				if (!checksumCommand_.empty()) {
+					hasher_ = std::make_unique<fz::hash_accumulator>(hashAlgorithm_);
+					controlSocket_.m_pTransferSocket->set_hasher(hasher_.get());
+				}
+			}
 		}
 
 		if (download()) {
@@ -151,6 +205,10 @@ int CFtpFileTransferOpData::Send()
 		opState = filetransfer_waittransfer;
 		controlSocket_.Transfer(cmd, this);
 		return FZ_REPLY_CONTINUE;
+	case filetransfer_checksum:
+		cmd = checksumCommand_ + L" " + remotePath_.FormatFilename(remoteFile_, !tryAbsolutePath_);
+		checksumPending_ = true;
+		break;
 	case filetransfer_mfmt:
 	{
 		cmd = L"MFMT ";
@@ -173,6 +231,27 @@ int CFtpFileTransferOpData::Send()
 	return FZ_REPLY_WOULDBLOCK;
 }
 
+int CFtpFileTransferOpData::PreserveTimestamp()
+{
+	if (options_.get_int(OPTION_PRESERVE_TIMESTAMPS)) {
+		if (!download() &&
+			CServerCapabilities::GetCapability(currentServer_, mfmt_command) == yes)
+		{
+			localFileTime_ = reader_factory_.mtime();
+			if (!localFileTime_.empty()) {
+				opState = filetransfer_mfmt;
+				return FZ_REPLY_CONTINUE;
+			}
+		}
+		else if (download() && !remoteFileTime_.empty()) {
+			if (!writer_factory_->set_mtime(remoteFileTime_)) {
+				log(logmsg::debug_warning, L"Could not set modification time");
+			}
+		}
+	}
+	return FZ_REPLY_OK;
+}
+
 int CFtpFileTransferOpData::TestResumeCapability()
 {
 	log(logmsg::debug_verbose, L"CFtpFileTransferOpData::TestResumeCapability()");
@@ -291,6 +370,19 @@ int CFtpFileTransferOpData::ParseResponse()
 		break;
 	case filetransfer_mfmt:
 		return FZ_REPLY_OK;
+	case filetransfer_checksum:
+		checksumPending_ = false;
+		if (code != 2) {
+			log(logmsg::status, _("Server could not compute the checksum, transferred file not verified."));
+			hasher_.reset();
+		}
+		else {
+			int res = controlSocket_.VerifyChecksum(response);
+			if (res != FZ_REPLY_OK) {
+				return res;
+			}
+		}
+		return PreserveTimestamp();
 	default:
 		log(logmsg::debug_warning, L"Unknown op state");
 		return FZ_REPLY_INTERNALERROR;
@@ -416,23 +508,14 @@ int CFtpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 		}
 	}
 	else if (opState == filetransfer_waittransfer) {
-		if (prevResult == FZ_REPLY_OK && options_.get_int(OPTION_PRESERVE_TIMESTAMPS)) {
-			if (!download() &&
-				CServerCapabilities::GetCapability(currentServer_, mfmt_command) == yes)
-			{
-				localFileTime_ = reader_factory_.mtime();
-				if (!localFileTime_.empty()) {
-					opState = filetransfer_mfmt;
-					return FZ_REPLY_CONTINUE;
-				}
-			}
-			else if (download() && !remoteFileTime_.empty()) {
-				if (!writer_factory_->set_mtime(remoteFileTime_)) {
-					log(logmsg::debug_warning, L"Could not set modification time");
-				}
-			}
+		if (prevResult != FZ_REPLY_OK) {
+			return prevResult;
+		}
+		if (hasher_) {
+			opState = filetransfer_checksum;
+			return FZ_REPLY_CONTINUE;
 		}
-		return prevResult;
+		return PreserveTimestamp();
 	}
 	else if (opState == filetransfer_waitresumetest) {
 		if (prevResult != FZ_REPLY_OK) {
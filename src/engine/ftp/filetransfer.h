@@ -14,7 +14,8 @@ enum filetransferStates
 	filetransfer_transfer,
 	filetransfer_waittransfer,
 	filetransfer_waitresumetest,
-	filetransfer_mfmt
+	filetransfer_mfmt,
+	filetransfer_checksum
 };
 
 class CFtpFileTransferOpData final : public CFileTransferOpData, public CFtpTransferOpData, public CFtpOpData
@@ -28,7 +29,13 @@ public:
 
 	int TestResumeCapability();
 
+	// Sets the modification time after a successful transfer
+	int PreserveTimestamp();
+
 	bool fileDidExist_{true};
+
+	// HASH, XSHA256 or XMD5 if verifying the transfer
+	std::wstring checksumCommand_;
 };
 
 #endif
@@ -21,7 +21,9 @@
 #include "../proxy.h"
 #include "../servercapabilities.h"
 #include "../tls.h"
+#include "../tls_session_cache.h"
 
+#include "../../include/activity_logger.h"
 #include "../../include/externalipresolver.h"
 #include "../../include/engine_options.h"
 
@@ -178,6 +180,8 @@ void CFtpControlSocket::ParseLine(std::wstring line)
 void CFtpControlSocket::OnConnect()
 {
 	m_lastTypeBinary = -1;
+	m_lastModeZ = 0;
+	m_modeZLevelSent = false;
 	m_sentRestartOffset = false;
 
 	SetAlive();
@@ -191,17 +195,19 @@ void CFtpControlSocket::OnConnect()
 
 			tls_layer_->set_alpn("ftp");
 			tls_layer_->set_min_tls_ver(get_min_tls_ver(engine_.GetOptions()));
-			if (!tls_layer_->client_handshake(this)) {
+			if (!StartTlsHandshake()) {
 				DoClose();
 			}
 
 			return;
 		}
 		else {
+			OnTlsHandshakeDone();
 			log(logmsg::status, _("TLS connection established, waiting for welcome message..."));
 		}
 	}
 	else if ((currentServer_.GetProtocol() == FTPES || currentServer_.GetProtocol() == FTP) && tls_layer_) {
+		OnTlsHandshakeDone();
 		log(logmsg::status, _("TLS connection established."));
 		SendNextCommand();
 		return;
@@ -227,6 +233,11 @@ void CFtpControlSocket::ParseResponse()
 			log(logmsg::debug_warning, L"Unexpected reply, no reply was pending.");
 			return;
 		}
+
+		if (m_nextPasvReply && !--m_nextPasvReply) {
+			ParseNextPasvReply();
+			return;
+		}
 	}
 
 	if (m_repliesToSkip) {
@@ -240,7 +251,7 @@ void CFtpControlSocket::ParseResponse()
 			if (operations_.empty()) {
 				StartKeepaliveTimer();
 			}
-			else if (!m_pendingReplies) {
+			else if (m_pendingReplies == (m_nextPasvReply ? 1 : 0)) {
 				SendNextCommand();
 			}
 		}
@@ -275,6 +286,44 @@ void CFtpControlSocket::ParseResponse()
 	}
 }
 
+void CFtpControlSocket::ParseNextPasvReply()
+{
+	if (m_nextPasvProbing) {
+		m_nextPasvProbing = false;
+		CServerCapabilities::SetCapability(currentServer_, ftp_pipelining, yes);
+	}
+
+	if (m_nextPasvDiscard) {
+		m_nextPasvDiscard = false;
+		log(logmsg::debug_info, L"Discarding late reply to passive mode command sent ahead of time");
+	}
+	else {
+		std::wstring host;
+		int port{};
+		bool parsed{};
+		if (GetReplyCode() == 2) {
+			parsed = m_nextPasvEpsv ? ParseEpsvResponse(host, port) : ParsePasvResponse(host, port, false);
+		}
+		if (parsed) {
+			m_preparedPasv.host_ = host;
+			m_preparedPasv.port_ = port;
+			m_preparedPasv.time_ = fz::monotonic_clock::now();
+		}
+		else {
+			// Only costs the round trip it was meant to save
+			log(logmsg::debug_info, L"Passive mode command sent ahead of time failed");
+		}
+	}
+
+	if (operations_.empty()) {
+		StartKeepaliveTimer();
+	}
+	else if (m_nextPasvAwaited) {
+		m_nextPasvAwaited = false;
+		SendNextCommand();
+	}
+}
+
 int CFtpControlSocket::GetReplyCode() const
 {
 	if (m_Response.empty()) {
@@ -317,6 +366,15 @@ int CFtpControlSocket::SendCommand(std::wstring const& str, bool maskArgs, bool
 	return res ? FZ_REPLY_WOULDBLOCK : FZ_REPLY_ERROR;
 }
 
+size_t CFtpControlSocket::GetPipelineWindow()
+{
+	int const depth = engine_.GetOptions().get_int(OPTION_FTP_PIPELINE_DEPTH);
+	if (depth <= 1 || CServerCapabilities::GetCapability(currentServer_, ftp_pipelining) == no) {
+		return 1;
+	}
+	return static_cast<size_t>(depth);
+}
+
 void CFtpControlSocket::List(CServerPath const& path, std::wstring const& subDir, int flags)
 {
 	Push(std::make_unique<CFtpListOpData>(*this, path, subDir, flags));
@@ -329,7 +387,9 @@ int CFtpControlSocket::ResetOperation(int nErrorCode)
 	m_pTransferSocket.reset();
 	m_pIPResolver.reset();
 
-	m_repliesToSkip = m_pendingReplies;
+	// Unless needed by the next transfer, see ParseNextPasvReply
+	m_repliesToSkip = m_pendingReplies - (m_nextPasvReply ? 1 : 0);
+	m_nextPasvAwaited = false;
 
 	if (!operations_.empty() && operations_.back()->opId == Command::transfer) {
 		auto & data = static_cast<CFtpFileTransferOpData &>(*operations_.back());
@@ -377,6 +437,103 @@ int CFtpControlSocket::ResetOperation(int nErrorCode)
 	return CControlSocket::ResetOperation(nErrorCode);
 }
 
+bool CFtpControlSocket::ParseEpsvResponse(std::wstring & host, int & port)
+{
+	size_t pos = m_Response.find(L"(|||");
+	if (pos == std::wstring::npos) {
+		return false;
+	}
+
+	size_t pos2 = m_Response.find(L"|)", pos + 4);
+	if (pos2 == std::wstring::npos || pos2 == pos + 4) {
+		return false;
+	}
+
+	std::wstring number = m_Response.substr(pos + 4, pos2 - pos - 4);
+	auto const value = fz::to_integral<unsigned int>(number);
+
+	if (value == 0 || value > 65535) {
+		return false;
+	}
+
+	port = value;
+
+	if (proxy_layer_) {
+		host = currentServer_.GetHost();
+	}
+	else {
+		host = fz::to_wstring(socket_->peer_ip());
+	}
+	return true;
+}
+
+bool CFtpControlSocket::ParsePasvResponse(std::wstring & host, int & port, bool triedActive)
+{
+	// Validate ip address
+	if (!m_pasvReplyRegex) {
+		std::wstring digit = L"0*[0-9]{1,3}";
+		wchar_t const* const  dot = L",";
+		std::wstring exp = L"( |\\()(" + digit + dot + digit + dot + digit + dot + digit + dot + digit + dot + digit + L")( |\\)|$)";
+		m_pasvReplyRegex = std::make_unique<std::wregex>(exp);
+	}
+
+	std::wsmatch m;
+	if (!std::regex_search(m_Response, m, *m_pasvReplyRegex)) {
+		return false;
+	}
+
+	host = m[2].str();
+
+	size_t i = host.rfind(',');
+	if (i == std::wstring::npos) {
+		return false;
+	}
+	auto number = fz::to_integral<unsigned int>(host.substr(i + 1));
+	if (number > 255) {
+		return false;
+	}
+
+	port = number; //get ls byte of server socket
+	host = host.substr(0, i);
+	i = host.rfind(',');
+	if (i == std::string::npos) {
+		return false;
+	}
+	number = fz::to_integral<unsigned int>(host.substr(i + 1));
+	if (number > 255) {
+		return false;
+	}
+
+	port += 256 * number; //add ms byte of server socket
+	host = host.substr(0, i);
+	fz::replace_substrings(host, L",", L".");
+
+	if (proxy_layer_) {
+		// We do not have any information about the proxy's inner workings
+		return true;
+	}
+
+	std::wstring const peerIP = fz::to_wstring(socket_->peer_ip());
+	if (!fz::is_routable_address(host) && fz::is_routable_address(peerIP)) {
+		if (engine_.GetOptions().get_int(OPTION_PASVREPLYFALLBACKMODE) != 1 || triedActive) {
+			log(logmsg::status, _("Server sent passive reply with unroutable address. Using server address instead."));
+			log(logmsg::debug_info, L"  Reply: %s, peer: %s", host, peerIP);
+			host = peerIP;
+		}
+		else {
+			log(logmsg::status, _("Server sent passive reply with unroutable address. Passive mode failed."));
+			log(logmsg::debug_info, L"  Reply: %s, peer: %s", host, peerIP);
+			return false;
+		}
+	}
+	else if (engine_.GetOptions().get_int(OPTION_PASVREPLYFALLBACKMODE) == 2) {
+		// Always use server address
+		host = peerIP;
+	}
+
+	return true;
+}
+
 bool CFtpControlSocket::CanSendNextCommand()
 {
 	if (m_repliesToSkip) {
@@ -453,6 +610,12 @@ void CFtpControlSocket::TransferEnd()
 		break;
 	case rawtransfer_waitfinish:
 		data.opState = rawtransfer_waittransfer;
+		if (reason == TransferEndReason::successful) {
+			int res = data.SendNextPassiveCommand();
+			if (res != FZ_REPLY_WOULDBLOCK) {
+				ResetOperation(res);
+			}
+		}
 		break;
 	case rawtransfer_waitsocket:
 		ResetOperation((reason == TransferEndReason::successful) ? FZ_REPLY_OK : FZ_REPLY_ERROR);
@@ -807,6 +970,11 @@ void CFtpControlSocket::ResetSocket()
 	m_MultilineResponseCode.clear();;
 	m_MultilineResponseLines.clear();
 	m_protectDataChannel = false;
+	m_preparedPasv = prepared_pasv();
+	m_nextPasvReply = 0;
+	m_nextPasvProbing = false;
+	m_nextPasvAwaited = false;
+	m_nextPasvDiscard = false;
 
 	CRealControlSocket::ResetSocket();
 }
@@ -820,6 +988,37 @@ void CFtpControlSocket::OnVerifyCert(fz::tls_layer* source, fz::tls_session_info
 	SendAsyncRequest(std::make_unique<CCertificateNotification>(std::move(info)));
 }
 
+bool CFtpControlSocket::StartTlsHandshake()
+{
+	offeredTlsSession_ = engine_.GetContext().GetTlsSessionCache().Get(fz::to_utf8(currentServer_.GetHost()), currentServer_.GetPort());
+	if (!offeredTlsSession_.empty()) {
+		log(logmsg::debug_verbose, L"Trying to resume cached TLS session");
+	}
+	return tls_layer_->client_handshake(this, offeredTlsSession_);
+}
+
+void CFtpControlSocket::OnTlsHandshakeDone()
+{
+	bool const resumed = tls_layer_->resumed_session();
+	if (!resumed && !offeredTlsSession_.empty()) {
+		// The server rejected the cached session, don't let other connections try it
+		engine_.GetContext().GetTlsSessionCache().Remove(fz::to_utf8(currentServer_.GetHost()), currentServer_.GetPort(), offeredTlsSession_);
+	}
+	offeredTlsSession_.clear();
+
+	auto & logger = engine_.GetContext().GetActivityLogger();
+	logger.record_tls_handshake(resumed);
+	auto const handshakes = logger.tls_handshakes();
+	log(logmsg::debug_info, L"TLS handshakes so far: %u full, %u resumed", handshakes.first, handshakes.second);
+}
+
+void CFtpControlSocket::StoreTlsSession()
+{
+	if (tls_layer_) {
+		engine_.GetContext().GetTlsSessionCache().Store(fz::to_utf8(currentServer_.GetHost()), currentServer_.GetPort(), tls_layer_->get_session_parameters());
+	}
+}
+
 void CFtpControlSocket::Push(std::unique_ptr<COpData> && pNewOpData)
 {
 	CRealControlSocket::Push(std::move(pNewOpData));
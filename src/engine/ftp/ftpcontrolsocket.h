@@ -75,10 +75,20 @@ protected:
 
 	void OnVerifyCert(fz::tls_layer* source, fz::tls_session_info& info);
 
+	// Offers the session of an earlier control connection to the same
+	// server, see CTlsSessionCache.
+	bool StartTlsHandshake();
+	void OnTlsHandshakeDone();
+	void StoreTlsSession();
+
 	virtual void ResetSocket() override;
 
 	int SendCommand(std::wstring const& str, bool maskArgs = false, bool measureRTT = true);
 
+	// How many commands of a bulk operation may await their reply at the
+	// same time. Replies arrive in order of the commands.
+	size_t GetPipelineWindow();
+
 	// Parse the latest reply line from the server
 	void ParseLine(std::wstring line);
 
@@ -112,10 +122,47 @@ protected:
 	std::unique_ptr<CExternalIPResolver> m_pIPResolver;
 
 	std::unique_ptr<fz::tls_layer> tls_layer_;
+	// Session offered by StartTlsHandshake, empty if none
+	std::vector<uint8_t> offeredTlsSession_;
 	bool m_protectDataChannel{};
 
 	int m_lastTypeBinary{-1};
 
+	// Reply to a passive mode command sent ahead of time for the next
+	// transfer, see CFtpRawTransferOpData::SendNextPassiveCommand.
+	// Empty host if there is none.
+	struct prepared_pasv final
+	{
+		std::wstring host_;
+		int port_{};
+		fz::monotonic_clock time_;
+	};
+	prepared_pasv m_preparedPasv;
+
+	// Position of the reply to that command among the pending replies, 0 if
+	// none is pending. ParseResponse hands it to ParseNextPasvReply,
+	// whichever operation is active by then.
+	int m_nextPasvReply{};
+	bool m_nextPasvEpsv{};
+	bool m_nextPasvProbing{};
+
+	// Set by a transfer waiting for the reply instead of sending its own
+	// passive mode command
+	bool m_nextPasvAwaited{};
+
+	// Set if a transfer sent its own passive mode command before the reply
+	// arrived, the server only listens on the latest port
+	bool m_nextPasvDiscard{};
+
+	void ParseNextPasvReply();
+
+	bool ParsePasvResponse(std::wstring & host, int & port, bool triedActive);
+	bool ParseEpsvResponse(std::wstring & host, int & port);
+
+	// Whether MODE Z is active, -1 if unknown
+	int m_lastModeZ{-1};
+	bool m_modeZLevelSent{};
+
 	// Used by keepalive code so that we're not using keep alive
 	// till the end of time. Stop after a couple of minutes.
 	fz::monotonic_clock m_lastCommandCompletionTime;
@@ -158,6 +205,9 @@ public:
 
 	int64_t resumeOffset{};
 	bool binary{true};
+
+	// Whether another transfer in the same directory follows
+	bool moreFollow{};
 };
 
 #endif
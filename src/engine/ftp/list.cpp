@@ -97,6 +97,7 @@ int CFtpListOpData::Send()
 		listing_parser_ = std::make_unique<CDirectoryListingParser>(&controlSocket_, currentServer_, encoding);
 
 		listing_parser_->SetTimezoneOffset(controlSocket_.GetInferredTimezoneOffset());
+		listing_parser_->EnablePipelining(engine_.GetThreadPool());
 		controlSocket_.m_pTransferSocket->m_pDirectoryListingParser = listing_parser_.get();
 
 		engine_.transfer_status_.Init(-1, 0, true);
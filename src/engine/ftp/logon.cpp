@@ -300,7 +300,7 @@ int CFtpLogonOpData::ParseResponse()
 
 			controlSocket_.tls_layer_->set_alpn({"ftp", "x-filezilla-ftp"});
 			controlSocket_.tls_layer_->set_min_tls_ver(get_min_tls_ver(options_));
-			if (!controlSocket_.tls_layer_->client_handshake(&controlSocket_)) {
+			if (!controlSocket_.StartTlsHandshake()) {
 				return FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED;
 			}
 
@@ -479,6 +479,8 @@ int CFtpLogonOpData::ParseResponse()
 
 		if (opState == LOGON_DONE) {
 			log(logmsg::status, _("Logged in"));
+			// TLS 1.3 tickets arrive after the handshake, by now they are there.
+			controlSocket_.StoreTlsSession();
 			log(logmsg::debug_info, L"Measured latency of %d ms", controlSocket_.m_rtt.GetLatency());
 			return FZ_REPLY_OK;
 		}
@@ -897,6 +899,24 @@ void CFtpLogonOpData::ParseFeat(std::wstring line)
 	else if (HasFeature(up, L"EPSV")) {
 		CServerCapabilities::SetCapability(currentServer_, epsv_command, yes);
 	}
+	else if (HasFeature(up, L"HASH")) {
+		// The algorithm currently in use is marked with an asterisk
+		std::wstring selected;
+		if (up.size() > 5) {
+			for (auto const& alg : fz::strtok_view(std::wstring_view(up).substr(5), L';')) {
+				if (!alg.empty() && alg.back() == '*') {
+					selected = alg.substr(0, alg.size() - 1);
+				}
+			}
+		}
+		CServerCapabilities::SetCapability(currentServer_, hash_command, selected.empty() ? no : yes, selected);
+	}
+	else if (HasFeature(up, L"XSHA256")) {
+		CServerCapabilities::SetCapability(currentServer_, xsha256_command, yes);
+	}
+	else if (HasFeature(up, L"XMD5")) {
+		CServerCapabilities::SetCapability(currentServer_, xmd5_command, yes);
+	}
 }
 
 void CFtpLogonOpData::tls_handshake_finished()
@@ -5,8 +5,6 @@
 #include "transfersocket.h"
 #include "../../include/engine_options.h"
 
-#include <libfilezilla/iputils.hpp>
-
 #include <assert.h>
 
 int CFtpRawTransferOpData::Send()
@@ -21,10 +19,11 @@ int CFtpRawTransferOpData::Send()
 	switch (opState)
 	{
 	case rawtransfer_init:
+		modeZ_ = UseModeZ();
 		if ((pOldData->binary && controlSocket_.m_lastTypeBinary == 1) ||
 			(!pOldData->binary && controlSocket_.m_lastTypeBinary == 0))
 		{
-			opState = rawtransfer_port_pasv;
+			opState = GetModeState();
 		}
 		else {
 			opState = rawtransfer_type;
@@ -65,7 +64,37 @@ int CFtpRawTransferOpData::Send()
 		}
 		measureRTT = true;
 		break;
+	case rawtransfer_mode:
+		if (modeZ_) {
+			cmd = L"MODE Z";
+		}
+		else {
+			cmd = L"MODE S";
+		}
+		measureRTT = true;
+		break;
+	case rawtransfer_mode_level:
+		controlSocket_.m_modeZLevelSent = true;
+		cmd = fz::sprintf(L"OPT MODE Z LEVEL %d", options_.get_int(OPTION_FTP_MODE_Z_LEVEL));
+		break;
 	case rawtransfer_port_pasv:
+		if (bPasv && controlSocket_.m_nextPasvReply && !controlSocket_.m_nextPasvProbing) {
+			// Sent by the previous transfer, no need to send another one.
+			// Not while probing, the server might never reply.
+			log(logmsg::debug_info, L"Waiting for reply to passive mode command sent ahead of time");
+			controlSocket_.m_nextPasvAwaited = true;
+			controlSocket_.SetWait(true);
+			return FZ_REPLY_WOULDBLOCK;
+		}
+		if (UsePreparedPassiveReply()) {
+			if (pOldData->resumeOffset > 0 || controlSocket_.m_sentRestartOffset) {
+				opState = rawtransfer_rest;
+			}
+			else {
+				opState = rawtransfer_transfer;
+			}
+			return FZ_REPLY_CONTINUE;
+		}
 		if (bPasv) {
 			cmd = GetPassiveCommand();
 		}
@@ -107,6 +136,7 @@ int CFtpRawTransferOpData::Send()
 		measureRTT = true;
 		break;
 	case rawtransfer_transfer:
+		controlSocket_.m_pTransferSocket->SetCompression(modeZ_, options_.get_int(OPTION_FTP_MODE_Z_LEVEL));
 		if (bPasv) {
 			if (!controlSocket_.m_pTransferSocket->SetupPassiveTransfer(host_, port_)) {
 				log(logmsg::error, _("Could not establish connection to server"));
@@ -152,10 +182,35 @@ int CFtpRawTransferOpData::ParseResponse()
 			error = true;
 		}
 		else {
-			opState = rawtransfer_port_pasv;
+			opState = GetModeState();
 			controlSocket_.m_lastTypeBinary = pOldData->binary ? 1 : 0;
 		}
 		break;
+	case rawtransfer_mode:
+		if (code == 2 || code == 3) {
+			controlSocket_.m_lastModeZ = modeZ_ ? 1 : 0;
+			if (modeZ_ && !controlSocket_.m_modeZLevelSent) {
+				opState = rawtransfer_mode_level;
+			}
+			else {
+				opState = rawtransfer_port_pasv;
+			}
+		}
+		else if (modeZ_) {
+			// Despite announcing it, the server does not want to compress.
+			log(logmsg::debug_warning, L"MODE Z rejected, transferring uncompressed");
+			CServerCapabilities::SetCapability(currentServer_, mode_z_support, no);
+			modeZ_ = false;
+			opState = GetModeState();
+		}
+		else {
+			error = true;
+		}
+		break;
+	case rawtransfer_mode_level:
+		// Not all servers support setting the level, that's fine.
+		opState = rawtransfer_port_pasv;
+		break;
 	case rawtransfer_port_pasv:
 		if (code != 2 && code != 3) {
 			if (!options_.get_int(OPTION_ALLOW_TRANSFERMODEFALLBACK)) {
@@ -179,10 +234,10 @@ int CFtpRawTransferOpData::ParseResponse()
 		if (bPasv) {
 			bool parsed;
 			if (GetPassiveCommand() == L"EPSV") {
-				parsed = ParseEpsvResponse();
+				parsed = controlSocket_.ParseEpsvResponse(host_, port_);
 			}
 			else {
-				parsed = ParsePasvResponse();
+				parsed = controlSocket_.ParsePasvResponse(host_, port_, bTriedActive);
 			}
 			if (!parsed) {
 				if (!options_.get_int(OPTION_ALLOW_TRANSFERMODEFALLBACK)) {
@@ -253,7 +308,11 @@ int CFtpRawTransferOpData::ParseResponse()
 		}
 		break;
 	case rawtransfer_waitfinish:
-		if (code != 2 && code != 3) {
+		if (code == 4 && controlSocket_.m_pTransferSocket->DownloadLimitReached()) {
+			// Server complaining about the data connection closed by us after a segment
+			opState = rawtransfer_waitsocket;
+		}
+		else if (code != 2 && code != 3) {
 			if (pOldData->transferEndReason == TransferEndReason::successful) {
 				pOldData->transferEndReason = TransferEndReason::transfer_command_failure;
 			}
@@ -264,6 +323,9 @@ int CFtpRawTransferOpData::ParseResponse()
 		}
 		break;
 	case rawtransfer_waittransfer:
+		if (code == 4 && controlSocket_.m_pTransferSocket->DownloadLimitReached() && pOldData->transferEndReason == TransferEndReason::successful) {
+			return FZ_REPLY_OK;
+		}
 		if (code != 2 && code != 3) {
 			if (pOldData->transferEndReason == TransferEndReason::successful) {
 				pOldData->transferEndReason = TransferEndReason::transfer_command_failure;
@@ -276,6 +338,8 @@ int CFtpRawTransferOpData::ParseResponse()
 				break;
 			}
 
+			// Doesn't wait for the reply to a passive mode command sent
+			// ahead of time, the control socket takes it.
 			return FZ_REPLY_OK;
 		}
 		break;
@@ -294,101 +358,83 @@ int CFtpRawTransferOpData::ParseResponse()
 	return FZ_REPLY_CONTINUE;
 }
 
-bool CFtpRawTransferOpData::ParseEpsvResponse()
+int CFtpRawTransferOpData::SendNextPassiveCommand()
 {
-	size_t pos = controlSocket_.m_Response.find(L"(|||");
-	if (pos == std::wstring::npos) {
-		return false;
+	if (!pOldData->moreFollow || !bPasv || nextPasvSent_) {
+		return FZ_REPLY_WOULDBLOCK;
 	}
-
-	size_t pos2 = controlSocket_.m_Response.find(L"|)", pos + 4);
-	if (pos2 == std::wstring::npos || pos2 == pos + 4) {
-		return false;
+	if (controlSocket_.GetPipelineWindow() < 2) {
+		return FZ_REPLY_WOULDBLOCK;
 	}
 
-	std::wstring number = controlSocket_.m_Response.substr(pos + 4, pos2 - pos - 4);
-	auto port = fz::to_integral<unsigned int>(number);
-
-	if (port == 0 || port > 65535) {
-		return false;
+	bool probing{};
+	if (CServerCapabilities::GetCapability(currentServer_, ftp_pipelining) == unknown) {
+		// Should the server choke on it, the next connection won't try again.
+		log(logmsg::debug_info, L"Checking whether server supports command pipelining");
+		CServerCapabilities::SetCapability(currentServer_, ftp_pipelining, no);
+		probing = true;
 	}
 
-	port_ = port;
-
-	if (controlSocket_.proxy_layer_) {
-		host_ = currentServer_.GetHost();
+	nextPasvSent_ = true;
+	std::wstring const cmd = GetPassiveCommand();
+	int res = controlSocket_.SendCommand(cmd, false, false);
+	if (res == FZ_REPLY_WOULDBLOCK) {
+		controlSocket_.m_nextPasvReply = controlSocket_.m_pendingReplies;
+		controlSocket_.m_nextPasvEpsv = cmd == L"EPSV";
+		controlSocket_.m_nextPasvProbing = probing;
 	}
-	else {
-		host_ = fz::to_wstring(controlSocket_.socket_->peer_ip());
-	}
-	return true;
+	return res;
 }
 
-bool CFtpRawTransferOpData::ParsePasvResponse()
+bool CFtpRawTransferOpData::UsePreparedPassiveReply()
 {
-	// Validate ip address
-	if (!controlSocket_.m_pasvReplyRegex) {
-		std::wstring digit = L"0*[0-9]{1,3}";
-		wchar_t const* const  dot = L",";
-		std::wstring exp = L"( |\\()(" + digit + dot + digit + dot + digit + dot + digit + dot + digit + dot + digit + L")( |\\)|$)";
-		controlSocket_.m_pasvReplyRegex = std::make_unique<std::wregex>(exp);
-	}
+	auto const prepared = std::move(controlSocket_.m_preparedPasv);
+	controlSocket_.m_preparedPasv = CFtpControlSocket::prepared_pasv();
 
-	std::wsmatch m;
-	if (!std::regex_search(controlSocket_.m_Response, m, *controlSocket_.m_pasvReplyRegex)) {
-		return false;
-	}
+	// Superseded by the command this transfer sends instead
+	controlSocket_.m_nextPasvDiscard = controlSocket_.m_nextPasvReply != 0;
 
-	host_ = m[2].str();
-
-	size_t i = host_.rfind(',');
-	if (i == std::wstring::npos) {
+	if (!bPasv || prepared.host_.empty()) {
 		return false;
 	}
-	auto number = fz::to_integral<unsigned int>(host_.substr(i + 1));
-	if (number > 255) {
+
+	// Servers do not keep the data port open for long
+	if (fz::monotonic_clock::now() - prepared.time_ > fz::duration::from_seconds(10)) {
+		log(logmsg::debug_info, L"Passive mode reply from previous transfer is too old, not using it");
 		return false;
 	}
 
-	port_ = number; //get ls byte of server socket
-	host_ = host_.substr(0, i);
-	i = host_.rfind(',');
-	if (i == std::string::npos) {
+	log(logmsg::debug_info, L"Using passive mode reply received during previous transfer");
+	bTriedPasv = true;
+	host_ = prepared.host_;
+	port_ = prepared.port_;
+	return true;
+}
+
+bool CFtpRawTransferOpData::UseModeZ() const
+{
+	if (controlSocket_.m_pTransferSocket->GetTransferMode() == TransferMode::resumetest) {
 		return false;
 	}
-	number = fz::to_integral<unsigned int>(host_.substr(i + 1));
-	if (number > 255) {
+
+	if (CServerCapabilities::GetCapability(currentServer_, mode_z_support) != yes) {
 		return false;
 	}
 
-	port_ += 256 * number; //add ms byte of server socket
-	host_ = host_.substr(0, i);
-	fz::replace_substrings(host_, L",", L".");
-
-	if (controlSocket_.proxy_layer_) {
-		// We do not have any information about the proxy's inner workings
-		return true;
+	auto const site = currentServer_.GetExtraParameter("mode_z");
+	if (!site.empty()) {
+		return site == L"1";
 	}
 
-	std::wstring const peerIP = fz::to_wstring(controlSocket_.socket_->peer_ip());
-	if (!fz::is_routable_address(host_) && fz::is_routable_address(peerIP)) {
-		if (options_.get_int(OPTION_PASVREPLYFALLBACKMODE) != 1 || bTriedActive) {
-			log(logmsg::status, _("Server sent passive reply with unroutable address. Using server address instead."));
-			log(logmsg::debug_info, L"  Reply: %s, peer: %s", host_, peerIP);
-			host_ = peerIP;
-		}
-		else {
-			log(logmsg::status, _("Server sent passive reply with unroutable address. Passive mode failed."));
-			log(logmsg::debug_info, L"  Reply: %s, peer: %s", host_, peerIP);
-			return false;
-		}
-	}
-	else if (options_.get_int(OPTION_PASVREPLYFALLBACKMODE) == 2) {
-		// Always use server address
-		host_ = peerIP;
-	}
+	return options_.get_bool(OPTION_FTP_MODE_Z);
+}
 
-	return true;
+int CFtpRawTransferOpData::GetModeState() const
+{
+	if (controlSocket_.m_lastModeZ == (modeZ_ ? 1 : 0)) {
+		return rawtransfer_port_pasv;
+	}
+	return rawtransfer_mode;
 }
 
 std::wstring CFtpRawTransferOpData::GetPassiveCommand()
@@ -7,6 +7,8 @@ enum rawtransferStates
 {
 	rawtransfer_init = 0,
 	rawtransfer_type,
+	rawtransfer_mode,
+	rawtransfer_mode_level,
 	rawtransfer_port_pasv,
 	rawtransfer_rest,
 	rawtransfer_transfer,
@@ -29,8 +31,22 @@ public:
 	virtual int ParseResponse() override;
 
 	std::wstring GetPassiveCommand();
-	bool ParsePasvResponse();
-	bool ParseEpsvResponse();
+
+	bool UseModeZ() const;
+
+	// rawtransfer_mode if the transmission mode needs to be changed,
+	// rawtransfer_port_pasv otherwise
+	int GetModeState() const;
+
+	// If another transfer follows, sends its passive mode command once the
+	// data connection is done, without waiting for the reply to the
+	// transfer command. Needs command pipelining. The control socket takes
+	// the reply, see CFtpControlSocket::ParseNextPasvReply.
+	int SendNextPassiveCommand();
+
+	// Takes the reply to the passive mode command sent ahead of time by the
+	// previous transfer, if any.
+	bool UsePreparedPassiveReply();
 
 	std::wstring cmd_;
 
@@ -40,6 +56,10 @@ public:
 	bool bTriedPasv{};
 	bool bTriedActive{};
 
+	bool modeZ_{};
+
+	bool nextPasvSent_{};
+
 	std::wstring host_;
 	int port_{};
 };
@@ -8,6 +8,7 @@
 
 #include "ftpcontrolsocket.h"
 #include "transfersocket.h"
+#include "zlib_layer.h"
 
 #include "../../include/engine_options.h"
 
@@ -65,6 +66,7 @@ void CTransferSocket::ResetSocket()
 #if HAVE_ASCII_TRANSFORM
 	ascii_layer_.reset();
 #endif
+	zlib_layer_.reset();
 	tls_layer_.reset();
 	proxy_layer_.reset();
 	ratelimit_layer_.reset();
@@ -276,11 +278,11 @@ void CTransferSocket::OnReceive()
 		if (m_transferMode == TransferMode::list) {
 			// See comment in download loop
 			for (int i = 0; i < 100; ++i) {
-				char *pBuffer = new char[4096];
+				// Read straight into the parser's input buffer
+				unsigned char* buffer = m_pDirectoryListingParser->GetDataBuffer(4096);
 				int error;
-				int numread = active_layer_->read(pBuffer, 4096, error);
+				int numread = active_layer_->read(buffer, 4096, error);
 				if (numread < 0) {
-					delete [] pBuffer;
 					if (error != EAGAIN) {
 						controlSocket_.log(logmsg::error, L"Could not read from transfer socket: %s", fz::socket_error_description(error));
 						TransferEnd(TransferEndReason::transfer_failure);
@@ -289,7 +291,7 @@ void CTransferSocket::OnReceive()
 				}
 
 				if (numread > 0) {
-					if (!m_pDirectoryListingParser->AddData(pBuffer, numread)) {
+					if (!m_pDirectoryListingParser->AddData(static_cast<size_t>(numread))) {
 						TransferEnd(TransferEndReason::transfer_failure);
 						return;
 					}
@@ -302,7 +304,6 @@ void CTransferSocket::OnReceive()
 					engine_.transfer_status_.Update(numread);
 				}
 				else {
-					delete [] pBuffer;
 					TransferEnd(TransferEndReason::successful);
 					return;
 				}
@@ -323,10 +324,22 @@ void CTransferSocket::OnReceive()
 				}
 
 				size_t to_read = buffer_->capacity() - buffer_->size();
+				if (remaining_ != fz::aio_base::nosize) {
+					if (!remaining_) {
+						numread = 0;
+						break;
+					}
+					if (to_read > remaining_) {
+						to_read = static_cast<size_t>(remaining_);
+					}
+				}
 				numread = active_layer_->read(buffer_->get(to_read), static_cast<unsigned int>(to_read), error);
 				if (numread <= 0) {
 					break;
 				}
+				if (remaining_ != fz::aio_base::nosize) {
+					remaining_ -= static_cast<uint64_t>(numread);
+				}
 
 				controlSocket_.SetAlive();
 				if (!m_madeProgress) {
@@ -568,6 +581,11 @@ bool CTransferSocket::InitLayers(bool active)
 		}
 	}
 
+	if (use_compression_) {
+		zlib_layer_ = std::make_unique<zlib_layer>(nullptr, *active_layer_, m_transferMode == TransferMode::upload, compression_level_);
+		active_layer_ = zlib_layer_.get();
+	}
+
 #if HAVE_ASCII_TRANSFORM
 	if (use_ascii_) {
 		ascii_layer_ = std::make_unique<fz::ascii_layer>(event_loop_, nullptr, *active_layer_);
@@ -608,7 +626,13 @@ void CTransferSocket::TransferEnd(TransferEndReason reason)
 	}
 	m_transferEndReason = reason;
 
-	if (reason != TransferEndReason::successful) {
+	if (zlib_layer_ && zlib_layer_->payload_bytes()) {
+		int64_t const wire = zlib_layer_->wire_bytes();
+		int64_t const payload = zlib_layer_->payload_bytes();
+		controlSocket_.log(logmsg::status, _("Compressed data connection: %d bytes transferred for %d bytes of data (%d%%)"), wire, payload, wire * 100 / payload);
+	}
+
+	if (reason != TransferEndReason::successful || !remaining_) {
 		ResetSocket();
 	}
 	else {
@@ -682,6 +706,9 @@ bool CTransferSocket::CheckGetNextWriteBuffer()
 {
 	auto res = fz::aio_result::ok;
 	if (buffer_ && buffer_->size() >= buffer_->capacity()) {
+		if (hasher_) {
+			hasher_->update(buffer_->get(), buffer_->size());
+		}
 		res = writer_->add_buffer(std::move(buffer_), *this);
 	}
 	if (res == fz::aio_result::ok && !buffer_) {
@@ -716,6 +743,10 @@ bool CTransferSocket::CheckGetNextReadBuffer()
 			return false;
 		}
 
+		if (hasher_) {
+			hasher_->update(buffer_->get(), buffer_->size());
+		}
+
 		if (buffer_->empty()) {
 			int r = active_layer_->shutdown();
 			if (r) {
@@ -750,6 +781,9 @@ void CTransferSocket::FinalizeWrite()
 
 	auto res = fz::aio_result::ok;
 	if (!buffer_->empty()) {
+		if (hasher_) {
+			hasher_->update(buffer_->get(), buffer_->size());
+		}
 		res = writer_->add_buffer(std::move(buffer_), *this);
 	}
 	if (res == fz::aio_result::ok) {
@@ -819,6 +853,12 @@ void CTransferSocket::OnTimer(fz::timer_id)
 #endif
 }
 
+void CTransferSocket::SetCompression(bool compress, int level)
+{
+	use_compression_ = compress;
+	compression_level_ = level;
+}
+
 void CTransferSocket::ContinueWithoutSesssionResumption()
 {
 	if (activity_block_) {
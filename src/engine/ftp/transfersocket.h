@@ -6,6 +6,7 @@
 class CFileZillaEnginePrivate;
 class CFtpControlSocket;
 class CDirectoryListingParser;
+class zlib_layer;
 
 enum class TransferMode
 {
@@ -46,6 +47,20 @@ public:
 
 	void ContinueWithoutSesssionResumption();
 
+	TransferMode GetTransferMode() const { return m_transferMode; }
+
+	// Enables MODE Z, level is the compression level used for uploads.
+	// Must be called before the data connection gets established.
+	void SetCompression(bool compress, int level);
+
+	// Downloads stop after the given amount of data, closing the data
+	// connection without waiting for the server.
+	void SetDownloadLimit(uint64_t limit) { remaining_ = limit; }
+	bool DownloadLimitReached() const { return !remaining_; }
+
+	// All data passed to the writer or taken from the reader gets added to the hasher.
+	void set_hasher(fz::hash_accumulator * hasher) { hasher_ = hasher; }
+
 protected:
 	bool CheckGetNextWriteBuffer();
 	bool CheckGetNextReadBuffer();
@@ -94,6 +109,9 @@ protected:
 	std::unique_ptr<fz::rate_limited_layer> ratelimit_layer_;
 	std::unique_ptr<CProxySocket> proxy_layer_;
 	std::unique_ptr<fz::tls_layer> tls_layer_;
+	std::unique_ptr<zlib_layer> zlib_layer_;
+	bool use_compression_{};
+	int compression_level_{};
 #if HAVE_ASCII_TRANSFORM
 	std::unique_ptr<fz::ascii_layer> ascii_layer_;
 	bool use_ascii_{};
@@ -110,6 +128,11 @@ protected:
 	std::unique_ptr<fz::writer_base> writer_;
 	fz::buffer_lease buffer_;
 	size_t resumetest_{};
+
+	// Data still to download, nosize if unlimited
+	uint64_t remaining_{fz::aio_base::nosize};
+
+	fz::hash_accumulator * hasher_{};
 };
 
 #endif
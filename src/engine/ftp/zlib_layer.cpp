@@ -0,0 +1,210 @@
+#include "../filezilla.h"
+#include "zlib_layer.h"
+
+#include <zlib.h>
+
+namespace {
+unsigned int const buffer_size = 64 * 1024;
+}
+
+struct zlib_layer::impl final
+{
+	z_stream z{};
+	bool initialized{};
+
+	// Set once the end of the zlib stream has been reached
+	bool finished{};
+
+	// Set if inflate cannot make progress without further input
+	bool drained{true};
+
+	// Compressed data, on compression from pos to len is still pending.
+	std::unique_ptr<unsigned char[]> buffer{new unsigned char[buffer_size]};
+	unsigned int pos{};
+	unsigned int len{};
+};
+
+zlib_layer::zlib_layer(fz::event_handler* handler, fz::socket_interface& next_layer, bool compress, int level)
+	: fz::socket_layer(handler, next_layer, true)
+	, impl_(std::make_unique<impl>())
+	, compress_(compress)
+{
+	next_layer.set_event_handler(handler);
+
+	if (compress_) {
+		impl_->initialized = deflateInit(&impl_->z, level) == Z_OK;
+	}
+	else {
+		impl_->initialized = inflateInit(&impl_->z) == Z_OK;
+	}
+}
+
+zlib_layer::~zlib_layer()
+{
+	if (impl_->initialized) {
+		if (compress_) {
+			deflateEnd(&impl_->z);
+		}
+		else {
+			inflateEnd(&impl_->z);
+		}
+	}
+	next_layer_.set_event_handler(nullptr);
+}
+
+int zlib_layer::read(void* buffer, unsigned int size, int& error)
+{
+	if (compress_) {
+		return next_layer_.read(buffer, size, error);
+	}
+	if (!impl_->initialized) {
+		error = ENOMEM;
+		return -1;
+	}
+
+	auto & z = impl_->z;
+	while (true) {
+		if (impl_->finished) {
+			// Nothing may follow the end of the stream, discard it.
+			int const read = next_layer_.read(impl_->buffer.get(), buffer_size, error);
+			if (read <= 0) {
+				return read;
+			}
+			wire_bytes_ += read;
+			continue;
+		}
+
+		if (!impl_->drained) {
+			// Even with all input consumed, inflate may still hold output
+			// that did not fit into the last buffer.
+			z.next_out = static_cast<Bytef*>(buffer);
+			z.avail_out = size;
+			int const res = inflate(&z, Z_NO_FLUSH);
+			unsigned int const produced = size - z.avail_out;
+			if (res == Z_STREAM_END) {
+				impl_->finished = true;
+			}
+			else if (res != Z_OK && res != Z_BUF_ERROR) {
+				error = EPROTO;
+				return -1;
+			}
+
+			if (produced) {
+				payload_bytes_ += produced;
+				return static_cast<int>(produced);
+			}
+			if (impl_->finished || res == Z_OK) {
+				continue;
+			}
+			impl_->drained = true;
+		}
+
+		int const read = next_layer_.read(impl_->buffer.get(), buffer_size, error);
+		if (read < 0) {
+			return read;
+		}
+		if (!read) {
+			if (!wire_bytes_) {
+				// Some servers send nothing at all instead of an empty stream
+				return 0;
+			}
+			// Stream ended prematurely
+			error = ECONNABORTED;
+			return -1;
+		}
+		wire_bytes_ += read;
+		z.next_in = impl_->buffer.get();
+		z.avail_in = static_cast<unsigned int>(read);
+		impl_->drained = false;
+	}
+}
+
+int zlib_layer::write(void const* buffer, unsigned int size, int& error)
+{
+	if (!compress_) {
+		return next_layer_.write(buffer, size, error);
+	}
+	if (!impl_->initialized || impl_->finished) {
+		error = impl_->initialized ? EINVAL : ENOMEM;
+		return -1;
+	}
+
+	if (flush(error)) {
+		return -1;
+	}
+
+	auto & z = impl_->z;
+	z.next_in = static_cast<Bytef*>(const_cast<void*>(buffer));
+	z.avail_in = size;
+	z.next_out = impl_->buffer.get();
+	z.avail_out = buffer_size;
+	int const res = deflate(&z, Z_NO_FLUSH);
+	if (res != Z_OK && res != Z_BUF_ERROR) {
+		error = EPROTO;
+		return -1;
+	}
+	impl_->len = buffer_size - z.avail_out;
+
+	unsigned int const consumed = size - z.avail_in;
+	payload_bytes_ += consumed;
+
+	// Pass on what is there already, if the next layer would block,
+	// the remainder goes out on the next call.
+	int flush_error;
+	if (flush(flush_error) && flush_error != EAGAIN) {
+		error = flush_error;
+		return -1;
+	}
+
+	return static_cast<int>(consumed);
+}
+
+int zlib_layer::flush(int& error)
+{
+	while (impl_->pos < impl_->len) {
+		int const written = next_layer_.write(impl_->buffer.get() + impl_->pos, impl_->len - impl_->pos, error);
+		if (written <= 0) {
+			if (!written) {
+				error = EAGAIN;
+			}
+			return -1;
+		}
+		impl_->pos += static_cast<unsigned int>(written);
+		wire_bytes_ += written;
+	}
+	impl_->pos = 0;
+	impl_->len = 0;
+
+	return 0;
+}
+
+int zlib_layer::shutdown()
+{
+	if (compress_ && impl_->initialized) {
+		auto & z = impl_->z;
+		while (true) {
+			int error;
+			if (flush(error)) {
+				return error;
+			}
+			if (impl_->finished) {
+				break;
+			}
+
+			z.next_in = nullptr;
+			z.avail_in = 0;
+			z.next_out = impl_->buffer.get();
+			z.avail_out = buffer_size;
+			int const res = deflate(&z, Z_FINISH);
+			impl_->len = buffer_size - z.avail_out;
+			if (res == Z_STREAM_END) {
+				impl_->finished = true;
+			}
+			else if (res != Z_OK && res != Z_BUF_ERROR) {
+				return EPROTO;
+			}
+		}
+	}
+
+	return next_layer_.shutdown();
+}
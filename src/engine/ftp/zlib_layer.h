@@ -0,0 +1,49 @@
+#ifndef FILEZILLA_ENGINE_FTP_ZLIB_LAYER_HEADER
+#define FILEZILLA_ENGINE_FTP_ZLIB_LAYER_HEADER
+
+#include "../../include/visibility.h"
+
+#include <libfilezilla/socket.hpp>
+
+#include <memory>
+
+/*
+Socket layer implementing the deflate transmission mode (MODE Z) for FTP
+data connections.
+
+A layer only ever works in one direction: it either compresses everything
+written to it, or decompresses everything read from it. Calling shutdown on
+a compressing layer terminates the zlib stream before shutting down the next
+layer.
+*/
+class FZC_PUBLIC_SYMBOL zlib_layer final : public fz::socket_layer
+{
+public:
+	// level is only used for compressing layers
+	zlib_layer(fz::event_handler* handler, fz::socket_interface& next_layer, bool compress, int level);
+	virtual ~zlib_layer();
+
+	virtual int read(void* buffer, unsigned int size, int& error) override;
+	virtual int write(void const* buffer, unsigned int size, int& error) override;
+
+	virtual int shutdown() override;
+
+	// Bytes passed to or from the next layer
+	int64_t wire_bytes() const { return wire_bytes_; }
+
+	// Uncompressed bytes passed to or from the caller
+	int64_t payload_bytes() const { return payload_bytes_; }
+
+private:
+	int flush(int& error);
+
+	struct impl;
+	std::unique_ptr<impl> impl_;
+
+	bool const compress_;
+
+	int64_t wire_bytes_{};
+	int64_t payload_bytes_{};
+};
+
+#endif
@@ -14,6 +14,29 @@ enum filetransferStates
 	filetransfer_waittransfer
 };
 
+namespace {
+// Content-Range of a 206 reply: bytes first-last/complete
+bool parse_content_range(std::string const& header, uint64_t & first, uint64_t & last)
+{
+	std::string_view v = header;
+	if (v.size() < 6 || fz::str_tolower_ascii(v.substr(0, 6)) != "bytes ") {
+		return false;
+	}
+	v = v.substr(6);
+
+	auto const dash = v.find('-');
+	auto const slash = v.find('/');
+	if (dash == std::string_view::npos || slash == std::string_view::npos || dash > slash) {
+		return false;
+	}
+
+	uint64_t const invalid = static_cast<uint64_t>(-1);
+	first = fz::to_integral<uint64_t>(v.substr(0, dash), invalid);
+	last = fz::to_integral<uint64_t>(v.substr(dash + 1, slash - dash - 1), invalid);
+	return first != invalid && last != invalid && first <= last;
+}
+}
+
 CHttpFileTransferOpData::CHttpFileTransferOpData(CHttpControlSocket & controlSocket, CFileTransferCommand const& cmd)
 	: CFileTransferOpData(L"CHttpFileTransferOpData", cmd)
 	, CHttpOpData(controlSocket)
@@ -71,7 +94,10 @@ int CHttpFileTransferOpData::Send()
 		}
 		return FZ_REPLY_CONTINUE;
 	case filetransfer_transfer:
-		if (resume_) {
+		if (segmentSize_) {
+			rr_.request_.headers_["Range"] = fz::sprintf("bytes=%d-%d", segmentOffset_, segmentOffset_ + segmentSize_ - 1);
+		}
+		else if (resume_) {
 			rr_.request_.headers_["Range"] = fz::sprintf("bytes=%d-", localFileSize_);
 		}
 
@@ -143,11 +169,37 @@ int CHttpFileTransferOpData::OnHeader()
 		return FZ_REPLY_OK;
 	}
 
+	if (segmentSize_ && rr_.response_.code_ != 206) {
+		log(logmsg::error, _("Server does not support range requests, cannot download the file in segments."));
+		return FZ_REPLY_CRITICALERROR;
+	}
+
 	// Check if the server disallowed resume
 	if (resume_ && rr_.response_.code_ != 206) {
 		resume_ = false;
 	}
 
+	// The data gets written at the offset that was requested, so the
+	// server has to send exactly that range.
+	if (rr_.response_.code_ == 206 && (segmentSize_ || resume_)) {
+		uint64_t first{};
+		uint64_t last{};
+		std::string const range = rr_.response_.get_header("Content-Range");
+		bool match = parse_content_range(range, first, last);
+		if (match) {
+			if (segmentSize_) {
+				match = first == segmentOffset_ && last == segmentOffset_ + segmentSize_ - 1;
+			}
+			else {
+				match = first == localFileSize_;
+			}
+		}
+		if (!match) {
+			log(logmsg::error, _("Server sent a different range than requested: %s"), range);
+			return FZ_REPLY_CRITICALERROR;
+		}
+	}
+
 	if (writer_factory_) {
 		auto writer = controlSocket_.OpenWriter(writer_factory_, resume_ ? localFileSize_ : 0, true);
 		if (!writer) {
@@ -0,0 +1,176 @@
+#include "filezilla.h"
+#include "listing_scan.h"
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_X64) || defined(_M_IX86)
+#define HAVE_LISTING_SIMD 1
+#endif
+
+#if HAVE_LISTING_SIMD
+#ifdef _MSC_VER
+#include <intrin.h>
+#define LISTING_SCAN_TARGET(x)
+#else
+#define LISTING_SCAN_TARGET(x) __attribute__((target(x)))
+#endif
+#include <immintrin.h>
+#endif
+
+namespace listing_scan {
+
+namespace {
+bool is_line_end(char c)
+{
+	return c == '\r' || c == '\n' || !c;
+}
+
+#if HAVE_LISTING_SIMD
+unsigned int lowest_bit(unsigned int v)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, v);
+	return index;
+#else
+	return static_cast<unsigned int>(__builtin_ctz(v));
+#endif
+}
+
+// In both vectorized variants, match is the bitmask of line end characters in
+// the current block and high the bitmask of bytes with the top bit set.
+
+LISTING_SCAN_TARGET("sse2")
+size_t find_line_end_sse2(char const* p, size_t len, bool& ascii)
+{
+	__m128i const cr = _mm_set1_epi8('\r');
+	__m128i const lf = _mm_set1_epi8('\n');
+	__m128i const nul = _mm_setzero_si128();
+
+	unsigned int seen_high{};
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + i));
+		__m128i const eol = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)), _mm_cmpeq_epi8(v, nul));
+		unsigned int const match = static_cast<unsigned int>(_mm_movemask_epi8(eol));
+		unsigned int const high = static_cast<unsigned int>(_mm_movemask_epi8(v));
+		if (match) {
+			unsigned int const pos = lowest_bit(match);
+			seen_high |= high & ((1u << pos) - 1);
+			ascii = !seen_high;
+			return i + pos;
+		}
+		seen_high |= high;
+	}
+
+	bool tail_ascii{};
+	size_t const res = i + find_line_end_scalar(p + i, len - i, tail_ascii);
+	ascii = !seen_high && tail_ascii;
+	return res;
+}
+
+LISTING_SCAN_TARGET("avx2")
+size_t find_line_end_avx2(char const* p, size_t len, bool& ascii)
+{
+	__m256i const cr = _mm256_set1_epi8('\r');
+	__m256i const lf = _mm256_set1_epi8('\n');
+	__m256i const nul = _mm256_setzero_si256();
+
+	unsigned int seen_high{};
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p + i));
+		__m256i const eol = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)), _mm256_cmpeq_epi8(v, nul));
+		unsigned int const match = static_cast<unsigned int>(_mm256_movemask_epi8(eol));
+		unsigned int const high = static_cast<unsigned int>(_mm256_movemask_epi8(v));
+		if (match) {
+			unsigned int const pos = lowest_bit(match);
+			seen_high |= high & ((1u << pos) - 1);
+			ascii = !seen_high;
+			return i + pos;
+		}
+		seen_high |= high;
+	}
+
+	// Finish the remainder with at most one SSE2 block plus scalar code
+	bool tail_ascii{};
+	size_t const res = i + find_line_end_sse2(p + i, len - i, tail_ascii);
+	ascii = !seen_high && tail_ascii;
+	return res;
+}
+
+simd_level detect_simd_level()
+{
+#ifdef _MSC_VER
+	int reg[4];
+	__cpuid(reg, 0);
+	int const max = reg[0];
+
+	__cpuid(reg, 1);
+	bool const sse2 = (reg[3] & (1 << 26)) != 0;
+	bool const osxsave = (reg[2] & (1 << 27)) != 0;
+	bool const avx = (reg[2] & (1 << 28)) != 0;
+
+	if (max >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6) {
+		__cpuidex(reg, 7, 0);
+		if (reg[1] & (1 << 5)) {
+			return simd_level::avx2;
+		}
+	}
+	return sse2 ? simd_level::sse2 : simd_level::none;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return simd_level::avx2;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		return simd_level::sse2;
+	}
+	return simd_level::none;
+#endif
+}
+#endif
+
+typedef size_t (*find_line_end_func)(char const*, size_t, bool&);
+
+find_line_end_func select_find_line_end()
+{
+#if HAVE_LISTING_SIMD
+	switch (get_simd_level()) {
+	case simd_level::avx2:
+		return &find_line_end_avx2;
+	case simd_level::sse2:
+		return &find_line_end_sse2;
+	default:
+		break;
+	}
+#endif
+	return &find_line_end_scalar;
+}
+}
+
+simd_level get_simd_level()
+{
+#if HAVE_LISTING_SIMD
+	static simd_level const level = detect_simd_level();
+	return level;
+#else
+	return simd_level::none;
+#endif
+}
+
+size_t find_line_end_scalar(char const* p, size_t len, bool& ascii)
+{
+	unsigned char high{};
+	size_t i = 0;
+	for (; i < len && !is_line_end(p[i]); ++i) {
+		high |= static_cast<unsigned char>(p[i]);
+	}
+	ascii = !(high & 0x80);
+	return i;
+}
+
+size_t find_line_end(char const* p, size_t len, bool& ascii)
+{
+	static find_line_end_func const func = select_find_line_end();
+	return func(p, len, ascii);
+}
+}
@@ -0,0 +1,36 @@
+#ifndef FILEZILLA_ENGINE_LISTING_SCAN_HEADER
+#define FILEZILLA_ENGINE_LISTING_SCAN_HEADER
+
+#include "../include/visibility.h"
+
+#include <stddef.h>
+
+/* Scanning primitives operating on the raw bytes of a directory listing.
+ *
+ * Line breaks are located before the line gets converted into a wide
+ * string. Since directory listings can be huge, this uses SSE2 or AVX2
+ * where the CPU supports it. The implementation is selected at runtime,
+ * the scalar variant is used everywhere else.
+ */
+namespace listing_scan {
+
+enum class simd_level
+{
+	none,
+	sse2,
+	avx2
+};
+
+// The instruction set used by find_line_end
+simd_level FZC_PUBLIC_SYMBOL get_simd_level();
+
+// Returns the offset of the first CR, LF or NUL byte, or len if there is
+// none. Sets ascii to whether all bytes before the returned offset are
+// 7-bit ASCII.
+size_t FZC_PUBLIC_SYMBOL find_line_end(char const* p, size_t len, bool& ascii);
+
+// Same as above but never vectorized, for reference and for benchmarking.
+size_t FZC_PUBLIC_SYMBOL find_line_end_scalar(char const* p, size_t len, bool& ascii);
+}
+
+#endif
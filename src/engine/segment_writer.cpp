@@ -0,0 +1,172 @@
+#include "filezilla.h"
+
+#include "../include/segment_writer.h"
+
+namespace {
+fz::file open_shared(std::wstring const& name)
+{
+#ifdef FZ_WINDOWS
+	// fz::file denies write sharing, but every segment has its own handle.
+	HANDLE h = CreateFileW(name.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (h == INVALID_HANDLE_VALUE) {
+		return fz::file();
+	}
+	return fz::file(h);
+#else
+	return fz::file(fz::to_native(name), fz::file::writing, fz::file::existing);
+#endif
+}
+}
+
+segment_writer::segment_writer(std::wstring const& name, fz::aio_buffer_pool & pool, fz::file && f, uint64_t size, fz::thread_pool & tpool, bool fsync, progress_cb_t && progress_cb, size_t max_buffers) noexcept
+	: threaded_writer(name, pool, std::move(progress_cb), max_buffers)
+	, file_(std::move(f))
+	, remaining_(size)
+	, fsync_(fsync)
+{
+	if (file_) {
+		task_ = tpool.spawn([this]{ entry(); });
+	}
+	if (!file_ || !task_) {
+		file_.close();
+		error_ = true;
+	}
+}
+
+segment_writer::~segment_writer()
+{
+	close();
+}
+
+void segment_writer::do_close(fz::scoped_lock & l)
+{
+	threaded_writer::do_close(l);
+	file_.close();
+}
+
+fz::aio_result segment_writer::continue_finalize(fz::scoped_lock & l)
+{
+	if (!file_) {
+		error_ = true;
+		return fz::aio_result::error;
+	}
+
+	if (!buffers_.empty() || fsync_) {
+		if (buffers_.empty()) {
+			wakeup(l);
+		}
+		return fz::aio_result::wait;
+	}
+
+	if (remaining_) {
+		buffer_pool_.logger().log(logmsg::error, _("Segment of '%s' ended %d bytes early."), name_, remaining_);
+		error_ = true;
+		return fz::aio_result::error;
+	}
+	return fz::aio_result::ok;
+}
+
+void segment_writer::entry()
+{
+	fz::scoped_lock l(mtx_);
+	while (!quit_ && !error_) {
+		if (buffers_.empty()) {
+			if (finalizing_ == 1) {
+				finalizing_ = 2;
+				if (remaining_) {
+					buffer_pool_.logger().log(logmsg::error, _("Segment of '%s' ended %d bytes early."), name_, remaining_);
+					error_ = true;
+				}
+				else if (fsync_ && !file_.fsync()) {
+					buffer_pool_.logger().log(logmsg::error, _("Could not sync '%s' to disk."), name_);
+					error_ = true;
+				}
+
+				signal_availibility();
+				break;
+			}
+			cond_.wait(l);
+			continue;
+		}
+
+		auto & b = buffers_.front();
+		if (b->size() > remaining_) {
+			buffer_pool_.logger().log(logmsg::error, _("Received more data than requested for a segment of '%s'."), name_);
+			error_ = true;
+			signal_availibility();
+			return;
+		}
+		while (!b->empty()) {
+			l.unlock();
+			int64_t written = file_.write(b->get(), b->size());
+			l.lock();
+			if (quit_ || error_) {
+				return;
+			}
+			if (written <= 0) {
+				error_ = true;
+				signal_availibility();
+				return;
+			}
+			b->consume(static_cast<size_t>(written));
+			remaining_ -= static_cast<uint64_t>(written);
+			if (progress_cb_) {
+				progress_cb_(this, static_cast<uint64_t>(written));
+			}
+		}
+		bool const signal = buffers_.size() == max_buffers_;
+		buffers_.erase(buffers_.begin());
+		if (signal) {
+			signal_availibility();
+		}
+	}
+}
+
+segment_writer_factory::segment_writer_factory(std::wstring const& file, fz::thread_pool & tpool, uint64_t offset, uint64_t size, bool fsync)
+	: fz::writer_factory(file)
+	, thread_pool_(tpool)
+	, offset_(offset)
+	, size_(size)
+	, fsync_(fsync)
+{
+}
+
+std::unique_ptr<fz::writer_base> segment_writer_factory::open(fz::aio_buffer_pool & pool, uint64_t offset, fz::writer_base::progress_cb_t progress_cb, size_t max_buffers)
+{
+	if (offset > size_) {
+		return {};
+	}
+	if (!max_buffers) {
+		max_buffers = preferred_buffer_count();
+	}
+
+	auto f = open_shared(name());
+	if (!f) {
+		pool.logger().log(logmsg::error, _("Could not open '%s' for writing."), name());
+		return {};
+	}
+
+	auto const seek = static_cast<int64_t>(offset_ + offset);
+	if (f.seek(seek, fz::file::begin) != seek) {
+		pool.logger().log(logmsg::error, _("Could not seek to offset %d within '%s'."), seek, name());
+		return {};
+	}
+
+	return std::make_unique<segment_writer>(name(), pool, std::move(f), size_ - offset, thread_pool_, fsync_, std::move(progress_cb), max_buffers);
+}
+
+std::unique_ptr<fz::writer_factory> segment_writer_factory::clone() const
+{
+	return std::make_unique<segment_writer_factory>(*this);
+}
+
+bool segment_writer_factory::preallocate(std::wstring const& file, uint64_t size)
+{
+	fz::file f(fz::to_native(file), fz::file::writing, fz::file::existing);
+	if (!f) {
+		return false;
+	}
+
+	auto const s = static_cast<int64_t>(size);
+	return f.seek(s, fz::file::begin) == s && f.truncate();
+}
@@ -900,6 +900,17 @@ std::vector<ParameterTraits> const& ExtraServerParameterTraits(ServerProtocol pr
 			static std::vector<ParameterTraits> const ret = []() {
 				std::vector<ParameterTraits> ret;
 				ret.emplace_back(ParameterTraits{"otp_code", ParameterSection::credentials, ParameterTraits::optional | ParameterTraits::custom, std::wstring(), std::wstring()});
+				ret.emplace_back(ParameterTraits{"mode_z", ParameterSection::extra, ParameterTraits::optional | ParameterTraits::content_transparent | ParameterTraits::custom, std::wstring(), std::wstring()});
+				return ret;
+			}();
+			return ret;
+		}
+	case FTPES:
+	case INSECURE_FTP:
+		{
+			static std::vector<ParameterTraits> const ret = []() {
+				std::vector<ParameterTraits> ret;
+				ret.emplace_back(ParameterTraits{"mode_z", ParameterSection::extra, ParameterTraits::optional | ParameterTraits::content_transparent | ParameterTraits::custom, std::wstring(), std::wstring()});
 				return ret;
 			}();
 			return ret;
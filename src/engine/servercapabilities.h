@@ -34,6 +34,9 @@ enum capabilityNames
 	list_hidden_support, // LIST -a command
 	rest_stream, // supports REST+STOR in addition to APPE
 	epsv_command,
+	hash_command, // HASH command, algorithm currently selected on the server as option
+	xsha256_command,
+	xmd5_command,
 
 	// Server timezone offset. If using FTP, LIST details are unspecified and
 	// can return different times than the UTC based times using the MLST or
@@ -46,7 +49,19 @@ enum capabilityNames
 	auth_tls_command,
 	auth_ssl_command,
 
-	tls_resumption
+	tls_resumption,
+
+	// Whether the server answers commands sent before the reply to the
+	// previous one arrived. Set to 'no' while probing.
+	ftp_pipelining,
+
+	// Directory listing format the server has been observed to use, as
+	// listingFormat::type in the numeric option.
+	listing_format,
+
+	// SFTP: Algorithms still worth requesting through the check-file
+	// extension as comma-separated option. Cleared on failure.
+	check_file_algorithms
 };
 
 class CCapabilities final
@@ -1,6 +1,8 @@
 #include "filezilla.h"
 #include "../include/serverpath.h"
 
+#include <cwctype>
+
 #define FTP_MVS_DOUBLE_QUOTE (wchar_t)0xDC
 
 struct CServerTypeTraits
@@ -990,6 +992,28 @@ int CServerPath::CmpNoCase(CServerPath const& op) const
 	return 0;
 }
 
+size_t CServerPath::HashNoCase() const
+{
+	if (empty()) {
+		return 0;
+	}
+
+	// FNV-1a over the lowercase characters, the same folding stricmp uses
+	size_t h = static_cast<size_t>(14695981039346656037ull);
+	auto const add = [&h](size_t v) {
+		h ^= v;
+		h *= static_cast<size_t>(1099511628211ull);
+	};
+	add(m_type);
+	for (auto const& segment : m_data->m_segments) {
+		for (auto const& c : segment) {
+			add(static_cast<size_t>(towlower(static_cast<wint_t>(c))));
+		}
+		add(0x110000); // Not a code point
+	}
+	return h;
+}
+
 bool CServerPath::AddSegment(std::wstring const& segment)
 {
 	if (empty()) {
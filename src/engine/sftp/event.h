@@ -5,7 +5,7 @@
 
 #include <string>
 
-#define FZSFTP_PROTOCOL_VERSION 11
+#define FZSFTP_PROTOCOL_VERSION 17
 
 enum class sftpEvent {
 	Unknown = -1,
@@ -39,6 +39,10 @@ enum class sftpEvent {
 	io_open,
 	io_nextbuf,
 	io_finalize,
+	io_release,
+	Pipelining,
+	ListentryRecord,
+	CheckFile,
 
 	count
 };
@@ -57,6 +61,12 @@ struct sftp_list_message
 	mutable std::wstring text;
 	mutable std::wstring name;
 	uint64_t mtime;
+
+	// Only for ListentryRecord, text is empty then
+	bool record{};
+	uint32_t mode{};
+	int64_t size{-1};
+	mutable std::wstring ownerGroup;
 };
 
 struct sftp_list_event_type;
@@ -1,6 +1,7 @@
 #include "../filezilla.h"
 
 #include "../directorycache.h"
+#include "../servercapabilities.h"
 #include "filetransfer.h"
 
 #include "../../include/engine_options.h"
@@ -17,12 +18,38 @@ enum filetransferStates
 	filetransfer_waitlist,
 	filetransfer_mtime,
 	filetransfer_transfer,
-	filetransfer_chmtime
+	filetransfer_chmtime,
+	filetransfer_checksum
 };
 
+namespace {
+// fzsftp requests only the algorithm the data got hashed with, others are
+// tried on later transfers if the server cannot use it.
+std::wstring const default_check_file_algorithms = L"sha256,sha1,md5";
+
+bool parse_check_file_algorithm(std::wstring_view name, fz::hash_algorithm & alg)
+{
+	if (name == L"sha256") {
+		alg = fz::hash_algorithm::sha256;
+	}
+	else if (name == L"sha1") {
+		alg = fz::hash_algorithm::sha1;
+	}
+	else if (name == L"md5") {
+		alg = fz::hash_algorithm::md5;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+}
+
 CSftpFileTransferOpData::~CSftpFileTransferOpData()
 {
 	remove_handler();
+	published_.clear();
+	filled_.clear();
 	reader_.reset();
 }
 
@@ -55,12 +82,18 @@ int CSftpFileTransferOpData::Send()
 		// whereas we need to use server encoding for remote filenames.
 		std::string cmd;
 		std::wstring logstr;
-		if (resume_) {
+		if (resume_ || segmentSize_) {
+			// fzsftp asks for the offset when restarting
 			cmd = "re";
 			logstr = L"re";
 		}
 		if (download()) {
-			engine_.transfer_status_.Init(remoteFileSize_, resume_ ? localFileSize_ : 0, false);
+			if (segmentSize_) {
+				engine_.transfer_status_.Init(static_cast<int64_t>(segmentSize_), 0, false);
+			}
+			else {
+				engine_.transfer_status_.Init(remoteFileSize_, resume_ ? localFileSize_ : 0, false);
+			}
 			cmd += "get ";
 			logstr += L"get ";
 			
@@ -93,6 +126,28 @@ int CSftpFileTransferOpData::Send()
 			cmd += remoteFile;
 			logstr += controlSocket_.QuoteFilename(remotePath_.FormatFilename(remoteFile_, !tryAbsolutePath_));
 		}
+		hasher_.reset();
+		int64_t resumeOffset{};
+		if (resume_) {
+			// Where fzsftp restarts, a missing local file is downloaded
+			// from the start. Unknown remote sizes could be anything.
+			if (download()) {
+				resumeOffset = (localFileSize_ != fz::aio_base::nosize) ? static_cast<int64_t>(localFileSize_) : 0;
+			}
+			else {
+				resumeOffset = remoteFileSize_;
+			}
+		}
+		if (controlSocket_.WantChecksum(*this, true, resumeOffset)) {
+			std::wstring algorithms = default_check_file_algorithms;
+			if (CServerCapabilities::GetCapability(currentServer_, check_file_algorithms, &algorithms) != no) {
+				checksumAlgorithm_ = algorithms.substr(0, algorithms.find(','));
+				if (parse_check_file_algorithm(checksumAlgorithm_, hashAlgorithm_)) {
+					hasher_ = std::make_unique<fz::hash_accumulator>(hashAlgorithm_);
+				}
+			}
+		}
+
 		engine_.transfer_status_.SetStartTime();
 		transferInitiated_ = true;
 		controlSocket_.SetWait(true);
@@ -104,6 +159,10 @@ int CSftpFileTransferOpData::Send()
 		std::wstring quotedFilename = controlSocket_.QuoteFilename(remotePath_.FormatFilename(remoteFile_, !tryAbsolutePath_));
 		return controlSocket_.SendCommand(L"mtime " + quotedFilename);
 	}
+	else if (opState == filetransfer_checksum) {
+		std::wstring quotedFilename = controlSocket_.QuoteFilename(remotePath_.FormatFilename(remoteFile_, !tryAbsolutePath_));
+		return controlSocket_.SendCommand(L"checksum " + checksumAlgorithm_ + L" " + quotedFilename);
+	}
 	else if (opState == filetransfer_chmtime) {
 		assert(!localFileTime_.empty());
 		if (download()) {
@@ -128,23 +187,43 @@ int CSftpFileTransferOpData::Send()
 int CSftpFileTransferOpData::ParseResponse()
 {
 	if (opState == filetransfer_transfer) {
+		published_.clear();
+		filled_.clear();
 		writer_.reset();
-		if (controlSocket_.result_ == FZ_REPLY_OK && options_.get_int(OPTION_PRESERVE_TIMESTAMPS)) {
-			if (download()) {
-				if (!remoteFileTime_.empty()) {
-					if (!writer_factory_->set_mtime(remoteFileTime_)) {
-						log(logmsg::debug_warning, L"Could not set modification time");
-					}
-				}
+		if (ring_requests_) {
+			log(logmsg::debug_info, L"Buffer ring: %u requests, %u buffers, %u stalls", ring_requests_, ring_buffers_, ring_stalls_);
+		}
+		if (controlSocket_.result_ != FZ_REPLY_OK) {
+			return controlSocket_.result_;
+		}
+		if (hasher_) {
+			opState = filetransfer_checksum;
+			return FZ_REPLY_CONTINUE;
+		}
+		return PreserveTimestamp();
+	}
+	else if (opState == filetransfer_checksum) {
+		if (controlSocket_.result_ != FZ_REPLY_OK) {
+			log(logmsg::status, _("Server could not compute the checksum, transferred file not verified."));
+			hasher_.reset();
+
+			std::wstring algorithms = default_check_file_algorithms;
+			CServerCapabilities::GetCapability(currentServer_, check_file_algorithms, &algorithms);
+			size_t const pos = algorithms.find(',');
+			if (pos == std::wstring::npos) {
+				CServerCapabilities::SetCapability(currentServer_, check_file_algorithms, no);
 			}
 			else {
-				if (!localFileTime_.empty()) {
-					opState = filetransfer_chmtime;
-					return FZ_REPLY_CONTINUE;
-				}
+				CServerCapabilities::SetCapability(currentServer_, check_file_algorithms, yes, algorithms.substr(pos + 1));
+			}
+		}
+		else {
+			int res = controlSocket_.VerifyChecksum(controlSocket_.response_);
+			if (res != FZ_REPLY_OK) {
+				return res;
 			}
 		}
-		return controlSocket_.result_;
+		return PreserveTimestamp();
 	}
 	else if (opState == filetransfer_mtime) {
 		if (controlSocket_.result_ == FZ_REPLY_OK && !controlSocket_.response_.empty()) {
@@ -188,6 +267,26 @@ int CSftpFileTransferOpData::ParseResponse()
 	return FZ_REPLY_INTERNALERROR;
 }
 
+int CSftpFileTransferOpData::PreserveTimestamp()
+{
+	if (options_.get_int(OPTION_PRESERVE_TIMESTAMPS)) {
+		if (download()) {
+			if (!remoteFileTime_.empty()) {
+				if (!writer_factory_->set_mtime(remoteFileTime_)) {
+					log(logmsg::debug_warning, L"Could not set modification time");
+				}
+			}
+		}
+		else {
+			if (!localFileTime_.empty()) {
+				opState = filetransfer_chmtime;
+				return FZ_REPLY_CONTINUE;
+			}
+		}
+	}
+	return FZ_REPLY_OK;
+}
+
 int CSftpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 {
 	if (opState == filetransfer_waitcwd) {
@@ -313,18 +412,26 @@ void CSftpFileTransferOpData::OnOpenRequested(uint64_t offset)
 		return;
 	}
 
+	uint64_t length{};
 	if (download()) {
-		if (resume_) {
+		// Segment writers take offsets relative to the segment
+		uint64_t writeOffset{};
+		if (segmentSize_) {
+			offset = segmentOffset_;
+			length = segmentSize_;
+		}
+		else if (resume_) {
 			offset = writer_factory_.size();
 			if (offset == fz::aio_base::nosize) {
 				controlSocket_.AddToSendBuffer("-1\n");
 				return;
 			}
+			writeOffset = offset;
 		}
 		else {
 			offset = 0;
 		}
-		writer_ = controlSocket_.OpenWriter(writer_factory_, offset, true);
+		writer_ = controlSocket_.OpenWriter(writer_factory_, writeOffset, true);
 		if (!writer_) {
 			controlSocket_.AddToSendBuffer("--\n");
 			return;
@@ -346,64 +453,152 @@ void CSftpFileTransferOpData::OnOpenRequested(uint64_t offset)
 		controlSocket_.ResetOperation(FZ_REPLY_ERROR);
 		return;
 	}
-	controlSocket_.AddToSendBuffer(fz::sprintf("-%u %u %u\n", reinterpret_cast<uintptr_t>(target), std::get<2>(info), offset));
+	controlSocket_.AddToSendBuffer(fz::sprintf("-%u %u %u %u\n", reinterpret_cast<uintptr_t>(target), std::get<2>(info), offset, length));
 #else
-	controlSocket_.AddToSendBuffer(fz::sprintf("-%d %u %u\n", std::get<0>(info), std::get<2>(info), offset));
+	controlSocket_.AddToSendBuffer(fz::sprintf("-%d %u %u %u\n", std::get<0>(info), std::get<2>(info), offset, length));
 #endif
 	base_address_ = std::get<1>(info);
 }
 
 
+void CSftpFileTransferOpData::RetireCurrent(uint64_t processed)
+{
+	if (published_.empty()) {
+		return;
+	}
+	if (writer_) {
+		published_.front()->resize(processed);
+		filled_.emplace_back(std::move(published_.front()));
+	}
+	published_.pop_front();
+}
+
 void CSftpFileTransferOpData::OnNextBufferRequested(uint64_t processed)
 {
-	if (reader_) {
-		fz::aio_result r;
-		std::tie(r, buffer_) = reader_->get_buffer(*this);
+	++ring_requests_;
+
+	// fzsftp only asks once it has used up all published buffers
+	RetireCurrent(processed);
+	published_.clear();
+
+	request_pending_ = true;
+	PublishBuffers();
+	if (request_pending_) {
+		++ring_stalls_;
+	}
+}
+
+void CSftpFileTransferOpData::OnBufferReleased(uint64_t processed)
+{
+	RetireCurrent(processed);
+	if (writer_ && !finalizing_) {
+		WriteFilled();
+	}
+}
+
+void CSftpFileTransferOpData::WriteFilled()
+{
+	while (!writer_waiting_ && !io_error_ && !filled_.empty()) {
+		if (hasher_) {
+			hasher_->update(filled_.front()->get(), filled_.front()->size());
+		}
+		auto r = writer_->add_buffer(std::move(filled_.front()), *this);
+		filled_.pop_front();
 		if (r == fz::aio_result::wait) {
-			return;
+			writer_waiting_ = true;
 		}
-		if (r == fz::aio_result::error) {
-			controlSocket_.AddToSendBuffer("--1\n");
-			return;
+		else if (r == fz::aio_result::error) {
+			io_error_ = true;
 		}
-		if (buffer_->size()) {
-			controlSocket_.AddToSendBuffer(fz::sprintf("-%d %d\n", buffer_->get() - base_address_, buffer_->size()));
+	}
+}
+
+void CSftpFileTransferOpData::PublishBuffers()
+{
+	if (writer_) {
+		WriteFilled();
+	}
+	else if (!reader_) {
+		io_error_ = true;
+	}
+
+	if (io_error_ && (writer_ || published_.empty())) {
+		request_pending_ = false;
+		published_.clear();
+		controlSocket_.AddToSendBuffer("--1\n");
+		return;
+	}
+
+	size_t const depth = controlSocket_.buffer_pool_->buffer_count();
+	while (!eof_ && !io_error_ && published_.size() < depth) {
+		fz::buffer_lease buffer;
+		if (reader_) {
+			fz::aio_result r;
+			std::tie(r, buffer) = reader_->get_buffer(*this);
+			if (r == fz::aio_result::wait) {
+				break;
+			}
+			if (r == fz::aio_result::error) {
+				io_error_ = true;
+				break;
+			}
+			if (!buffer->size()) {
+				eof_ = true;
+				break;
+			}
+			if (hasher_) {
+				hasher_->update(buffer->get(), buffer->size());
+			}
 		}
 		else {
-			controlSocket_.AddToSendBuffer(fz::sprintf("-0\n"));
-		}
-	}
-	else if (writer_) {
-		buffer_->resize(processed);
-		auto r = writer_->add_buffer(std::move(buffer_), *this);
-		if (r == fz::aio_result::ok) {
-			buffer_ = controlSocket_.buffer_pool_->get_buffer(*this);
-			if (!buffer_) {
-				r = fz::aio_result::wait;
+			buffer = controlSocket_.buffer_pool_->get_buffer(*this);
+			if (!buffer) {
+				break;
 			}
 		}
-		if (r == fz::aio_result::wait) {
-			return;
+		published_.emplace_back(std::move(buffer));
+	}
+
+	std::string reply = "-";
+	if (published_.empty()) {
+		if (io_error_) {
+			reply += "-1";
 		}
-		if (r == fz::aio_result::error) {
-			controlSocket_.AddToSendBuffer("--1\n");
+		else if (!eof_) {
+			// Wait for buffers to become available
 			return;
 		}
-		controlSocket_.AddToSendBuffer(fz::sprintf("-%d %d\n", buffer_->get() - base_address_, buffer_->capacity()));
 	}
-	else {
-		controlSocket_.AddToSendBuffer("--1\n");
-		return;
+	for (auto const& buffer : published_) {
+		if (reply.size() > 1) {
+			reply += ' ';
+		}
+		reply += fz::sprintf("%d %d", buffer->get() - base_address_, reader_ ? buffer->size() : buffer->capacity());
 	}
+	ring_buffers_ += published_.size();
+	request_pending_ = false;
+	controlSocket_.AddToSendBuffer(reply + "\n");
 }
 
 void CSftpFileTransferOpData::OnFinalizeRequested(uint64_t lastWrite)
 {
 	finalizing_ = true;
-	buffer_->resize(lastWrite);
-	auto r = writer_->add_buffer(std::move(buffer_), *this);
-	if (r == fz::aio_result::ok) {
-		r = writer_->finalize(*this);
+	RetireCurrent(lastWrite);
+	published_.clear();
+	Finalize();
+}
+
+void CSftpFileTransferOpData::Finalize()
+{
+	auto r = fz::aio_result::error;
+	if (writer_ && !io_error_) {
+		WriteFilled();
+		if (writer_waiting_) {
+			return;
+		}
+		if (!io_error_) {
+			r = writer_->finalize(*this);
+		}
 	}
 	if (r == fz::aio_result::wait) {
 		return;
@@ -442,15 +637,21 @@ void CSftpFileTransferOpData::operator()(fz::event_base const& ev)
 
 void CSftpFileTransferOpData::OnBufferAvailability(fz::aio_waitable const* w)
 {
-	if (w == reader_.get()) {
-		OnNextBufferRequested(0);
-	}
-	else if (w == writer_.get()) {
+	if (w == writer_.get()) {
+		writer_waiting_ = false;
 		if (finalizing_) {
-			OnFinalizeRequested(0);
-		}
-		else {
-			OnNextBufferRequested(0);
+			Finalize();
+			return;
 		}
 	}
+	else if (finalizing_) {
+		return;
+	}
+
+	if (request_pending_) {
+		PublishBuffers();
+	}
+	else if (writer_) {
+		WriteFilled();
+	}
 }
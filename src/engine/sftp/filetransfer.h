@@ -3,6 +3,8 @@
 
 #include "sftpcontrolsocket.h"
 
+#include <deque>
+
 class CSftpFileTransferOpData final : public CFileTransferOpData, public CSftpOpData, public fz::event_handler
 {
 public:
@@ -17,6 +19,7 @@ public:
 	void OnSizeRequested();
 	void OnOpenRequested(uint64_t offset);
 	void OnNextBufferRequested(uint64_t processed);
+	void OnBufferReleased(uint64_t processed);
 	void OnFinalizeRequested(uint64_t lastWrite);
 
 	virtual int Send() override;
@@ -24,15 +27,47 @@ public:
 	virtual int SubcommandResult(int, COpData const&) override;
 
 private:
+	// Sets the modification time after a successful transfer
+	int PreserveTimestamp();
+
 	virtual void operator()(fz::event_base const& ev) override;
 	void OnBufferAvailability(fz::aio_waitable const* w);
 
+	// Answers a pending buffer request with as many buffers as are available
+	void PublishBuffers();
+
+	// Passes buffers filled by fzsftp on to the writer
+	void WriteFilled();
+
+	void Finalize();
+
+	// Returns the buffer fzsftp is currently working on, resized to processed if downloading
+	void RetireCurrent(uint64_t processed);
+
 	std::unique_ptr<fz::reader_base> reader_;
 	std::unique_ptr<fz::writer_base> writer_;
 	bool finalizing_{};
 
 	uint8_t const* base_address_{};
-	fz::buffer_lease buffer_;
+
+	// Buffers handed to fzsftp, in the order it uses them. The front one is
+	// the one it currently works on.
+	std::deque<fz::buffer_lease> published_;
+
+	// Filled buffers yet to be passed to the writer
+	std::deque<fz::buffer_lease> filled_;
+
+	bool request_pending_{};
+	bool writer_waiting_{};
+	bool eof_{};
+	bool io_error_{};
+
+	uint64_t ring_requests_{};
+	uint64_t ring_buffers_{};
+	uint64_t ring_stalls_{};
+
+	// Passed to fzsftp's checksum command if verifying the transfer
+	std::wstring checksumAlgorithm_;
 };
 
 #endif
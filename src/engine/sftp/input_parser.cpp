@@ -50,6 +50,10 @@ size_t SftpInputParser::lines(sftpEvent eventType) const
 	case sftpEvent::io_open:
 	case sftpEvent::io_finalize:
 	case sftpEvent::io_nextbuf:
+	case sftpEvent::io_release:
+	case sftpEvent::Pipelining:
+	case sftpEvent::ListentryRecord:
+	case sftpEvent::CheckFile:
 		return 1;
 	case sftpEvent::AskHostkey:
 	case sftpEvent::AskHostkeyChanged:
@@ -90,7 +94,7 @@ int SftpInputParser::OnData()
 		}
 
 		else if (event_ || listEvent_) {
-			auto const type = listEvent_ ? sftpEvent::Listentry : std::get<0>(event_->v_).type;
+			auto const type = listEvent_ ? (std::get<0>(listEvent_->v_).record ? sftpEvent::ListentryRecord : sftpEvent::Listentry) : std::get<0>(event_->v_).type;
 			while (pending_lines_) {
 				std::string_view v = recv_buffer_.to_view();
 				size_t pos = v.find('\n', search_offset_);
@@ -118,6 +122,12 @@ int SftpInputParser::OnData()
 
 					std::get<0>(event_->v_).text[i] = std::move(converted);
 				}
+				else if (type == sftpEvent::ListentryRecord) {
+					if (!ParseRecord(line)) {
+						owner_.log(logmsg::error, _("Received malformed directory entry."));
+						return FZ_REPLY_DISCONNECTED;
+					}
+				}
 				else {
 					if (i == 1) {
 						std::get<0>(listEvent_->v_).mtime = fz::to_integral<uint64_t>(line);
@@ -157,8 +167,9 @@ int SftpInputParser::OnData()
 				break;
 			}
 
-			if (eventType == sftpEvent::Listentry) {
+			if (eventType == sftpEvent::Listentry || eventType == sftpEvent::ListentryRecord) {
 				listEvent_ = std::make_unique<CSftpListEvent>();
+				std::get<0>(listEvent_->v_).record = eventType == sftpEvent::ListentryRecord;
 			}
 			else {
 				event_ = std::make_unique<CSftpEvent>();
@@ -172,3 +183,46 @@ int SftpInputParser::OnData()
 	}
 	return FZ_REPLY_WOULDBLOCK;
 }
+
+bool SftpInputParser::ParseRecord(std::string_view line)
+{
+	auto & message = std::get<0>(listEvent_->v_);
+
+	auto const next_field = [&line]() {
+		size_t pos = line.find(' ');
+		if (pos == std::string_view::npos) {
+			pos = line.size();
+		}
+		auto field = line.substr(0, pos);
+		line = line.substr(std::min(pos + 1, line.size()));
+		return field;
+	};
+
+	auto const mode = next_field();
+	if (mode.empty()) {
+		return false;
+	}
+	for (auto const& c : mode) {
+		if (c < '0' || c > '7') {
+			return false;
+		}
+		message.mode = message.mode * 8 + (c - '0');
+	}
+
+	auto const size = next_field();
+	message.size = size == "-1" ? -1 : fz::to_integral<int64_t>(size, -2);
+	message.mtime = fz::to_integral<uint64_t>(next_field(), uint64_t(-1));
+	if (message.size == -2 || message.mtime == uint64_t(-1)) {
+		return false;
+	}
+
+	auto const owner = next_field();
+	auto const group = next_field();
+	if (owner.empty() || group.empty() || line.empty()) {
+		return false;
+	}
+	message.ownerGroup = owner_.ConvToLocal(owner.data(), owner.size()) + L" " + owner_.ConvToLocal(group.data(), group.size());
+	message.name = owner_.ConvToLocal(line.data(), line.size());
+
+	return !message.name.empty();
+}
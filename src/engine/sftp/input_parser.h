@@ -23,6 +23,9 @@ protected:
 
 	size_t lines(sftpEvent eventType) const;
 
+	// Parses a ListentryRecord line into listEvent_
+	bool ParseRecord(std::string_view line);
+
 	fz::process& process_;
 	CSftpControlSocket& owner_;
 
@@ -1,6 +1,7 @@
 #include "../filezilla.h"
 
 #include "../directorycache.h"
+#include "event.h"
 #include "list.h"
 
 #include <assert.h>
@@ -145,3 +146,77 @@ int CSftpListOpData::ParseEntry(std::wstring && entry, uint64_t mtime, std::wstr
 
 	return FZ_REPLY_WOULDBLOCK;
 }
+
+namespace {
+// Formats a mode the way ls -l does
+std::wstring FormatPermissions(uint32_t mode)
+{
+	std::wstring ret(10, '-');
+	switch (mode & 0170000) {
+	case 0040000:
+		ret[0] = 'd';
+		break;
+	case 0020000:
+		ret[0] = 'c';
+		break;
+	case 0060000:
+		ret[0] = 'b';
+		break;
+	case 0010000:
+		ret[0] = 'p';
+		break;
+	case 0140000:
+		ret[0] = 's';
+		break;
+	}
+
+	wchar_t const rwx[] = L"rwx";
+	for (int i = 0; i < 9; ++i) {
+		if (mode & (0400 >> i)) {
+			ret[i + 1] = rwx[i % 3];
+		}
+	}
+
+	auto const special = [&](uint32_t bit, size_t pos, wchar_t set, wchar_t unset) {
+		if (mode & bit) {
+			ret[pos] = ret[pos] == 'x' ? set : unset;
+		}
+	};
+	special(04000, 3, 's', 'S');
+	special(02000, 6, 's', 'S');
+	special(01000, 9, 't', 'T');
+
+	return ret;
+}
+}
+
+int CSftpListOpData::ParseEntry(sftp_list_message const& record)
+{
+	if (opState != list_list || !listing_parser_) {
+		log(logmsg::debug_warning, L"CSftpListOpData::ParseEntry called at improper time: %d", opState);
+		return FZ_REPLY_INTERNALERROR;
+	}
+
+	if (record.name.size() > 65536 || record.ownerGroup.size() > 65536) {
+		log(fz::logmsg::error, _("Received too long response line from server, closing connection."));
+		return FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED;
+	}
+
+	CDirentry entry;
+	entry.name = std::move(record.name);
+	entry.size = record.size;
+	entry.flags = ((record.mode & 0170000) == 0040000) ? CDirentry::flag_dir : 0;
+	if (record.mtime) {
+		entry.time = fz::datetime(static_cast<time_t>(record.mtime), fz::datetime::seconds);
+	}
+
+	std::wstring const permissions = FormatPermissions(record.mode);
+	if (controlSocket_.logger_.should_log(logmsg::listing)) {
+		controlSocket_.log_raw(logmsg::listing, fz::sprintf(L"%s %s %d %s %s", permissions, record.ownerGroup, entry.size,
+			entry.time.empty() ? std::wstring(L"-") : entry.time.format(L"%Y-%m-%d %H:%M:%S", fz::datetime::utc), entry.name));
+	}
+
+	listing_parser_->AddEntry(std::move(entry), permissions, record.ownerGroup);
+
+	return FZ_REPLY_WOULDBLOCK;
+}
@@ -20,6 +20,7 @@ public:
 	virtual int SubcommandResult(int prevResult, COpData const& previousOperation) override;
 
 	int ParseEntry(std::wstring && entry, uint64_t mtime, std::wstring && name);
+	int ParseEntry(sftp_list_message const& record);
 
 private:
 	std::unique_ptr<CDirectoryListingParser> listing_parser_;
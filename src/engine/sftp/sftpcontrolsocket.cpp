@@ -115,8 +115,7 @@ void CSftpControlSocket::OnSftpEvent(sftp_message const& message)
 		{
 			auto value = fz::to_integral<int64_t>(message.text[0]);
 
-			bool tmp;
-			CTransferStatus status = engine_.transfer_status_.Get(tmp);
+			CTransferStatus status = engine_.transfer_status_.Peek();
 			if (!status.empty()) {
 				if (!operations_.empty() && operations_.back()->opId == Command::transfer) {
 					auto & data = static_cast<CSftpFileTransferOpData &>(*operations_.back());
@@ -263,6 +262,27 @@ void CSftpControlSocket::OnSftpEvent(sftp_message const& message)
 			data.OnNextBufferRequested(fz::to_integral<uint64_t>(message.text[0]));
 		}
 		break;
+	case sftpEvent::Pipelining:
+		{
+			auto tokens = fz::strtok_view(message.text[0], ' ');
+			if (tokens.size() == 3) {
+				log(logmsg::debug_info, L"Pipelined %d byte requests, up to %d bytes outstanding, minimum round trip time %d ms",
+					fz::to_integral<int>(tokens[0]), fz::to_integral<int>(tokens[1]), fz::to_integral<int>(tokens[2]));
+			}
+		}
+		break;
+	case sftpEvent::CheckFile:
+		if (message.text[0] == L"0") {
+			// Spares each transfer a request failing for every algorithm
+			CServerCapabilities::SetCapability(currentServer_, check_file_algorithms, no);
+		}
+		break;
+	case sftpEvent::io_release:
+		if (!operations_.empty() && operations_.back()->opId == Command::transfer) {
+			auto & data = static_cast<CSftpFileTransferOpData&>(*operations_.back());
+			data.OnBufferReleased(fz::to_integral<uint64_t>(message.text[0]));
+		}
+		break;
 	case sftpEvent::io_open:
 		if (!operations_.empty() && operations_.back()->opId == Command::transfer) {
 			auto & data = static_cast<CSftpFileTransferOpData&>(*operations_.back());
@@ -302,7 +322,8 @@ void CSftpControlSocket::OnSftpListEvent(sftp_list_message const& message)
 		return;
 	}
 	else {
-		int res = static_cast<CSftpListOpData&>(*operations_.back()).ParseEntry(std::move(message.text), message.mtime, std::move(message.name));
+		auto & data = static_cast<CSftpListOpData&>(*operations_.back());
+		int res = message.record ? data.ParseEntry(message) : data.ParseEntry(std::move(message.text), message.mtime, std::move(message.name));
 		if (res != FZ_REPLY_WOULDBLOCK) {
 			ResetOperation(res);
 		}
@@ -153,8 +153,7 @@ void CStorjControlSocket::OnStorjEvent(storj_message const& message)
 
 				RecordActivity(data.download() ? activity_logger::recv : activity_logger::send, value);
 
-				bool tmp{};
-				CTransferStatus status = engine_.transfer_status_.Get(tmp);
+				CTransferStatus status = engine_.transfer_status_.Peek();
 				if (!status.empty() && !status.madeProgress) {
 					if (data.download()) {
 						if (value > 0) {
@@ -0,0 +1,57 @@
+#include "filezilla.h"
+#include "stringpool.h"
+
+#include <algorithm>
+
+CStringPool::CStringPool(size_t max_size)
+	: generation_size_(std::max(size_t(16), max_size / shard_count / 2))
+{
+}
+
+fz::shared_value<std::wstring> CStringPool::Get(std::wstring_view const& v)
+{
+	++lookups_;
+
+	size_t const hash = std::hash<std::wstring_view>()(v);
+	shard & s = shards_[hash % shard_count];
+
+	fz::scoped_lock l(s.mutex_);
+
+	auto it = s.current_.find(v);
+	if (it != s.current_.end()) {
+		++hits_;
+		return it->second;
+	}
+
+	fz::shared_value<std::wstring> value;
+	it = s.previous_.find(v);
+	if (it != s.previous_.end()) {
+		++hits_;
+		value = it->second;
+	}
+	else {
+		value = fz::shared_value<std::wstring>(std::wstring(v));
+	}
+
+	if (s.current_.size() >= generation_size_) {
+		evictions_ += s.previous_.size();
+		s.previous_ = std::move(s.current_);
+		s.current_.clear();
+	}
+	s.current_.emplace(std::wstring_view(*value), value);
+
+	return value;
+}
+
+CStringPool::stats CStringPool::GetStats() const
+{
+	stats ret;
+	ret.lookups = lookups_;
+	ret.hits = hits_;
+	ret.evictions = evictions_;
+	for (auto const& s : shards_) {
+		fz::scoped_lock l(s.mutex_);
+		ret.size += s.current_.size() + s.previous_.size();
+	}
+	return ret;
+}
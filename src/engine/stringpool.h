@@ -0,0 +1,64 @@
+#ifndef FILEZILLA_ENGINE_STRINGPOOL_HEADER
+#define FILEZILLA_ENGINE_STRINGPOOL_HEADER
+
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/shared.hpp>
+
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/*
+Interns strings such as permissions and owner/group of directory entries
+so that identical values across all listings share the same storage.
+
+The pool is shared by all engines of a context. It is split into
+independently locked shards to keep contention low. Each shard holds two
+generations of strings; once the current generation is full, it replaces the
+previous one which gets dropped. That bounds memory use while keeping
+frequently used strings. Strings dropped from the pool stay valid, later
+lookups merely create a new copy.
+*/
+class CStringPool final
+{
+public:
+	explicit CStringPool(size_t max_size = 65536);
+
+	CStringPool(CStringPool const&) = delete;
+	CStringPool& operator=(CStringPool const&) = delete;
+
+	fz::shared_value<std::wstring> Get(std::wstring_view const& v);
+
+	struct stats
+	{
+		uint64_t lookups{};
+		uint64_t hits{};
+		uint64_t evictions{};
+		size_t size{};
+	};
+	stats GetStats() const;
+
+private:
+	typedef std::unordered_map<std::wstring_view, fz::shared_value<std::wstring>> generation;
+
+	struct shard
+	{
+		mutable fz::mutex mutex_{false};
+
+		// The keys point into the stored strings
+		generation current_;
+		generation previous_;
+	};
+
+	static constexpr size_t shard_count = 16;
+	shard shards_[shard_count];
+
+	size_t const generation_size_;
+
+	std::atomic<uint64_t> lookups_{};
+	std::atomic<uint64_t> hits_{};
+	std::atomic<uint64_t> evictions_{};
+};
+
+#endif
@@ -0,0 +1,313 @@
+#include "filezilla.h"
+#include "tls_session_cache.h"
+
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/local_filesys.hpp>
+
+#include <cstring>
+
+namespace {
+char const magic[] = "FZTS";
+uint32_t const version = 1;
+
+// Servers rarely accept tickets older than this
+fz::duration const max_age = fz::duration::from_days(1);
+
+size_t const max_entries = 256;
+
+// Collects the changes of connections established at about the same time
+fz::duration const save_delay = fz::duration::from_seconds(5);
+
+// Sessions are small, anything bigger is not ours
+int64_t const max_file_size = 16 * 1024 * 1024;
+
+void put_u32(std::vector<uint8_t> & out, uint32_t v)
+{
+	for (int i = 0; i < 4; ++i) {
+		out.push_back(static_cast<uint8_t>((v >> (i * 8)) & 0xff));
+	}
+}
+
+void put_i64(std::vector<uint8_t> & out, int64_t v)
+{
+	uint64_t const u = static_cast<uint64_t>(v);
+	for (int i = 0; i < 8; ++i) {
+		out.push_back(static_cast<uint8_t>((u >> (i * 8)) & 0xff));
+	}
+}
+
+void put_bytes(std::vector<uint8_t> & out, uint8_t const* data, size_t len)
+{
+	put_u32(out, static_cast<uint32_t>(len));
+	out.insert(out.end(), data, data + len);
+}
+
+class reader final
+{
+public:
+	explicit reader(std::vector<uint8_t> const& data)
+		: p_(data.data())
+		, end_(data.data() + data.size())
+	{}
+
+	bool u32(uint32_t & v)
+	{
+		if (end_ - p_ < 4) {
+			return false;
+		}
+		v = 0;
+		for (int i = 0; i < 4; ++i) {
+			v |= static_cast<uint32_t>(*p_++) << (i * 8);
+		}
+		return true;
+	}
+
+	bool i64(int64_t & v)
+	{
+		if (end_ - p_ < 8) {
+			return false;
+		}
+		uint64_t u{};
+		for (int i = 0; i < 8; ++i) {
+			u |= static_cast<uint64_t>(*p_++) << (i * 8);
+		}
+		v = static_cast<int64_t>(u);
+		return true;
+	}
+
+	bool bytes(std::vector<uint8_t> & v)
+	{
+		uint32_t len{};
+		if (!u32(len) || static_cast<size_t>(end_ - p_) < len) {
+			return false;
+		}
+		v.assign(p_, p_ + len);
+		p_ += len;
+		return true;
+	}
+
+private:
+	uint8_t const* p_;
+	uint8_t const* const end_;
+};
+}
+
+CTlsSessionCache::CTlsSessionCache(fz::event_loop & loop)
+	: fz::event_handler(loop)
+{
+}
+
+CTlsSessionCache::~CTlsSessionCache()
+{
+	remove_handler();
+	if (!file_.empty()) {
+		Save();
+	}
+}
+
+void CTlsSessionCache::operator()(fz::event_base const& ev)
+{
+	fz::dispatch<fz::timer_event>(ev, this, &CTlsSessionCache::OnTimer);
+}
+
+void CTlsSessionCache::OnTimer(fz::timer_id)
+{
+	{
+		fz::scoped_lock l(mutex_);
+		saveTimer_ = 0;
+	}
+	Save();
+}
+
+void CTlsSessionCache::ScheduleSave()
+{
+	if (!file_.empty() && !saveTimer_) {
+		saveTimer_ = add_timer(save_delay, true);
+	}
+}
+
+void CTlsSessionCache::EnablePersistence(fz::native_string const& file, fz::symmetric_key const& key)
+{
+	fz::scoped_lock l(mutex_);
+	if (!file_.empty() || file.empty() || !key) {
+		return;
+	}
+
+	file_ = file;
+	key_ = key;
+	Load();
+}
+
+CTlsSessionCache::key_type CTlsSessionCache::MakeKey(std::string const& host, unsigned int port) const
+{
+	return key_type(fz::str_tolower_ascii(host), port);
+}
+
+std::vector<uint8_t> CTlsSessionCache::Get(std::string const& host, unsigned int port)
+{
+	fz::scoped_lock l(mutex_);
+
+	auto it = sessions_.find(MakeKey(host, port));
+	if (it == sessions_.end()) {
+		return {};
+	}
+	if (fz::datetime::now() - it->second.stored > max_age) {
+		sessions_.erase(it);
+		return {};
+	}
+	return it->second.session;
+}
+
+void CTlsSessionCache::Store(std::string const& host, unsigned int port, std::vector<uint8_t> && session)
+{
+	if (session.empty()) {
+		return;
+	}
+
+	fz::scoped_lock l(mutex_);
+
+	auto & e = sessions_[MakeKey(host, port)];
+	e.session = std::move(session);
+	e.stored = fz::datetime::now();
+
+	if (sessions_.size() > max_entries) {
+		Prune();
+	}
+	ScheduleSave();
+}
+
+void CTlsSessionCache::Remove(std::string const& host, unsigned int port, std::vector<uint8_t> const& session)
+{
+	fz::scoped_lock l(mutex_);
+	auto it = sessions_.find(MakeKey(host, port));
+	if (it != sessions_.end() && it->second.session == session) {
+		sessions_.erase(it);
+		ScheduleSave();
+	}
+}
+
+void CTlsSessionCache::Prune()
+{
+	auto const now = fz::datetime::now();
+	for (auto it = sessions_.begin(); it != sessions_.end(); ) {
+		if (now - it->second.stored > max_age) {
+			it = sessions_.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+
+	while (sessions_.size() > max_entries) {
+		auto oldest = sessions_.begin();
+		for (auto it = sessions_.begin(); it != sessions_.end(); ++it) {
+			if (it->second.stored < oldest->second.stored) {
+				oldest = it;
+			}
+		}
+		sessions_.erase(oldest);
+	}
+}
+
+void CTlsSessionCache::Load()
+{
+	fz::file f(file_, fz::file::reading);
+	if (!f) {
+		return;
+	}
+
+	int64_t const size = f.size();
+	if (size < 8 || size > max_file_size) {
+		return;
+	}
+
+	std::vector<uint8_t> data(static_cast<size_t>(size));
+	int64_t done{};
+	while (done < size) {
+		int64_t const r = f.read(data.data() + done, size - done);
+		if (r <= 0) {
+			return;
+		}
+		done += r;
+	}
+
+	reader header(data);
+	uint32_t m{};
+	uint32_t v{};
+	if (memcmp(data.data(), magic, 4) || !header.u32(m) || !header.u32(v) || v != version) {
+		return;
+	}
+
+	// Fails if the key has changed, e.g. after private data got cleared.
+	auto const plain = fz::decrypt(data.data() + 8, data.size() - 8, key_);
+	if (plain.empty()) {
+		return;
+	}
+
+	reader r(plain);
+	uint32_t count{};
+	if (!r.u32(count)) {
+		return;
+	}
+
+	auto const now = fz::datetime::now();
+	for (uint32_t i = 0; i < count; ++i) {
+		std::vector<uint8_t> host;
+		uint32_t port{};
+		int64_t stored{};
+		entry e;
+		if (!r.bytes(host) || !r.u32(port) || !r.i64(stored) || !r.bytes(e.session)) {
+			sessions_.clear();
+			return;
+		}
+		e.stored = fz::datetime(static_cast<time_t>(stored), fz::datetime::seconds);
+		if (e.session.empty() || e.stored.empty() || now - e.stored > max_age) {
+			continue;
+		}
+		sessions_[key_type(std::string(host.begin(), host.end()), port)] = std::move(e);
+	}
+	Prune();
+}
+
+void CTlsSessionCache::Save()
+{
+	// Only called from the event loop and on destruction, file writes
+	// don't overlap.
+	std::vector<uint8_t> out(magic, magic + 4);
+	{
+		fz::scoped_lock l(mutex_);
+
+		Prune();
+
+		std::vector<uint8_t> plain;
+		put_u32(plain, static_cast<uint32_t>(sessions_.size()));
+		for (auto const& s : sessions_) {
+			put_bytes(plain, reinterpret_cast<uint8_t const*>(s.first.first.data()), s.first.first.size());
+			put_u32(plain, s.first.second);
+			put_i64(plain, static_cast<int64_t>(s.second.stored.get_time_t()));
+			put_bytes(plain, s.second.session.data(), s.second.session.size());
+		}
+
+		put_u32(out, version);
+		auto const cipher = fz::encrypt(plain, key_);
+		if (cipher.empty()) {
+			return;
+		}
+		out.insert(out.end(), cipher.begin(), cipher.end());
+	}
+
+	fz::native_string const tmp = file_ + fzT(".tmp");
+	fz::file f(tmp, fz::file::writing, fz::file::creation_flags(fz::file::empty | fz::file::current_user_only));
+	if (!f) {
+		return;
+	}
+
+	bool ok = f.write(out.data(), static_cast<int64_t>(out.size())) == static_cast<int64_t>(out.size());
+	f.close();
+	if (ok) {
+		ok = static_cast<bool>(fz::rename_file(tmp, file_, false));
+	}
+	if (!ok) {
+		fz::remove_file(tmp);
+	}
+}
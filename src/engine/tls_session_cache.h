@@ -0,0 +1,77 @@
+#ifndef FILEZILLA_ENGINE_TLS_SESSION_CACHE_HEADER
+#define FILEZILLA_ENGINE_TLS_SESSION_CACHE_HEADER
+
+#include <libfilezilla/encryption.hpp>
+#include <libfilezilla/event_handler.hpp>
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/time.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+TLS session parameters of FTP control connections, shared by all engines of
+a context.
+
+Entries are keyed by hostname and port, the hostname doubling as SNI name. A
+new control connection to the same server can then resume the session of an
+earlier one instead of doing a full handshake.
+
+If persistence is enabled, the cache is loaded from a file when enabling it.
+Changes are written back shortly after they happen and on destruction.
+
+Session parameters contain the session secrets. The file is encrypted, but the
+key is stored in the settings next to it, so this only keeps the secrets out of
+plain sight. The file needs the same protection as the settings directory. The
+interface does not enable persistence while a master password is set.
+*/
+class CTlsSessionCache final : public fz::event_handler
+{
+public:
+	explicit CTlsSessionCache(fz::event_loop & loop);
+	virtual ~CTlsSessionCache();
+
+	CTlsSessionCache(CTlsSessionCache const&) = delete;
+	CTlsSessionCache& operator=(CTlsSessionCache const&) = delete;
+
+	void EnablePersistence(fz::native_string const& file, fz::symmetric_key const& key);
+
+	// Returns an empty vector if there is no usable session.
+	std::vector<uint8_t> Get(std::string const& host, unsigned int port);
+
+	void Store(std::string const& host, unsigned int port, std::vector<uint8_t> && session);
+
+	// Only removes the entry if it still holds the passed session, it may
+	// already have been replaced by a newer one.
+	void Remove(std::string const& host, unsigned int port, std::vector<uint8_t> const& session);
+
+private:
+	typedef std::pair<std::string, unsigned int> key_type;
+	key_type MakeKey(std::string const& host, unsigned int port) const;
+
+	virtual void operator()(fz::event_base const& ev) override;
+	void OnTimer(fz::timer_id);
+
+	// mutex_ must be held
+	void ScheduleSave();
+
+	void Load();
+	void Save();
+	void Prune();
+
+	struct entry
+	{
+		std::vector<uint8_t> session;
+		fz::datetime stored;
+	};
+	std::map<key_type, entry> sessions_;
+
+	fz::mutex mutex_{false};
+
+	fz::native_string file_;
+	fz::symmetric_key key_;
+	fz::timer_id saveTimer_{};
+};
+
+#endif
@@ -37,6 +37,13 @@ public:
 	// See notification.h for details.
 	std::unique_ptr<CNotification> GetNextNotification();
 
+	// Moves all pending notifications into the passed vector, replacing its
+	// contents. Returns false if there were none. Same rules as above apply,
+	// call it until it returns false.
+	// Superseded transfer status and directory listing notifications are
+	// dropped as they get added.
+	bool GetNotifications(std::vector<std::unique_ptr<CNotification>> & notifications);
+
 	// Sets the reply to an async request, e.g. a file exists request.
 	// See notifiction.h for details.
 	bool IsPendingAsyncRequestReply(std::unique_ptr<CAsyncRequestNotification> const& pNotification);
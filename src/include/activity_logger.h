@@ -27,8 +27,15 @@ public:
 
 	void set_notifier(std::function<void()> && notification_cb);
 
+	// TLS handshakes of control connections
+	void record_tls_handshake(bool resumed);
+
+	// Full and resumed handshakes so far
+	std::pair<uint64_t, uint64_t> tls_handshakes() const;
+
 private:
 	std::atomic_uint64_t amounts_[2]{};
+	std::atomic_uint64_t handshakes_[2]{};
 
 	fz::mutex mtx_;
 	std::function<void()> notification_cb_;
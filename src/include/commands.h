@@ -178,6 +178,10 @@ enum class transfer_flags : unsigned short
 	download = 0x10,
 	fsync = 0x20,
 
+	// Another transfer in the same remote directory follows on this
+	// connection, protocols may prepare it ahead of time.
+	more_follow = 0x40,
+
 	// Free bits in the middle
 
 	protocol_reserved_mask = 0xff00,
@@ -7,6 +7,7 @@
 #include <libfilezilla/shared.hpp>
 #include <libfilezilla/time.hpp>
 
+#include <memory>
 #include <unordered_map>
 
 class FZC_PUBLIC_SYMBOL CDirentry
@@ -70,6 +71,8 @@ public:
 	bool operator==(const CDirentry &op) const;
 };
 
+class CCompactListing;
+
 class FZC_PUBLIC_SYMBOL CDirectoryListing final
 {
 public:
@@ -88,7 +91,7 @@ public:
 	// entry if you do not call ClearFindMap afterwards
 	CDirentry& get(size_t index);
 
-	size_t size() const { return m_entries ? m_entries->size() : 0; }
+	size_t size() const;
 
 	void Append(CDirentry&& entry);
 
@@ -138,14 +141,27 @@ public:
 
 	void Assign(std::vector<fz::shared_value<CDirentry>> && entries);
 
+	// Serves the entries from the compact listing. Searches use the compact
+	// listing, the entries get materialized once on first access and are
+	// shared by all copies of the listing. Modifications detach the listing
+	// from the compact one.
+	void Assign(std::shared_ptr<CCompactListing const> const& compact);
+
 	bool RemoveEntry(size_t index);
 
 	void GetFilenames(std::vector<std::wstring> &names) const;
 
 protected:
 
+	void Materialize();
+
 	fz::shared_optional<std::vector<fz::shared_value<CDirentry>>> m_entries;
 
+	// If set, m_entries is unused
+	std::shared_ptr<CCompactListing const> m_compact;
+	struct compact_entries;
+	std::shared_ptr<compact_entries> m_compact_entries;
+
 	mutable fz::shared_optional<std::unordered_multimap<std::wstring, size_t>> m_searchmap_case;
 	mutable fz::shared_optional<std::unordered_multimap<std::wstring, size_t>> m_searchmap_nocase;
 
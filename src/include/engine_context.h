@@ -5,10 +5,14 @@
 
 #include <memory>
 
+#include <stdint.h>
+
 class activity_logger;
 class CDirectoryCache;
 class COptionsBase;
 class CPathCache;
+class CStringPool;
+class CTlsSessionCache;
 class OpLockManager;
 
 namespace fz {
@@ -28,6 +32,23 @@ public:
 	virtual std::string toServer(std::wstring const& encoding, wchar_t const* buffer, size_t len) const = 0;
 };
 
+struct FZC_PUBLIC_SYMBOL directory_cache_stats
+{
+	uint64_t hits{};
+	uint64_t misses{};
+	uint64_t evictions{};
+	size_t listings{};
+	int64_t files{};
+	size_t bytes{};
+	size_t max_bytes{};
+
+	// Of the string pool shared by the listings
+	uint64_t pool_lookups{};
+	uint64_t pool_hits{};
+	uint64_t pool_evictions{};
+	size_t pool_strings{};
+};
+
 // There can be multiple engines, but there can be at most one context
 class FZC_PUBLIC_SYMBOL CFileZillaEngineContext final
 {
@@ -40,10 +61,13 @@ public:
 	fz::event_loop& GetEventLoop();
 	fz::rate_limiter& GetRateLimiter();
 	CDirectoryCache& GetDirectoryCache();
+	directory_cache_stats GetDirectoryCacheStats();
 	CPathCache& GetPathCache();
+	CStringPool& GetStringPool();
 	CustomEncodingConverterBase const& GetCustomEncodingConverter() { return customEncodingConverter_; }
 	OpLockManager& GetOpLockManager();
 	fz::tls_system_trust_store& GetTlsSystemTrustStore();
+	CTlsSessionCache& GetTlsSessionCache();
 	activity_logger& GetActivityLogger();
 
 protected:
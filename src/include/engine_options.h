@@ -42,6 +42,7 @@ enum engineOptions : unsigned int
 	OPTION_SPEEDLIMIT_BURSTTOLERANCE,
 
 	OPTION_PREALLOCATE_SPACE,
+	OPTION_VERIFY_CHECKSUMS,	// Compare with server-side checksums after transfers
 
 	OPTION_VIEW_HIDDEN_FILES,
 
@@ -51,6 +52,9 @@ enum engineOptions : unsigned int
 	OPTION_SOCKET_BUFFERSIZE_SEND,
 
 	OPTION_FTP_SENDKEEPALIVE,
+	OPTION_FTP_MODE_Z,
+	OPTION_FTP_MODE_Z_LEVEL,
+	OPTION_FTP_PIPELINE_DEPTH,	// Commands in flight for bulk operations, 1 disables pipelining
 
 	OPTION_FTP_PROXY_TYPE,
 	OPTION_FTP_PROXY_HOST,
@@ -60,6 +64,7 @@ enum engineOptions : unsigned int
 
 	OPTION_SFTP_KEYFILES,
 	OPTION_SFTP_COMPRESSION,
+	OPTION_SFTP_RING_DEPTH,
 
 	OPTION_PROXY_TYPE,
 	OPTION_PROXY_HOST,
@@ -78,8 +83,14 @@ enum engineOptions : unsigned int
 	OPTION_TCP_KEEPALIVE_INTERVAL,
 
 	OPTION_CACHE_TTL,
+	OPTION_CACHE_PERSIST,
+	OPTION_CACHE_FILE,			// Set by the interface
+	OPTION_CACHE_MEMORY_LIMIT,	// In MiB
 
 	OPTION_MIN_TLS_VER,
+	OPTION_TLS_SESSION_PERSIST,
+	OPTION_TLS_SESSION_FILE,	// Set by the interface
+	OPTION_TLS_SESSION_KEY,		// Generated by the engine, obfuscation only
 
 	OPTIONS_ENGINE_NUM
 };
@@ -119,18 +119,23 @@ public:
 //
 // Primary notifications are those resulting from a CListCommand, other ones
 // can happen spontanously through other actions.
+//
+// Stale notifications refer to an outdated listing from the cache which can
+// be shown while it is being refreshed. Another notification follows.
 class CDirectoryListing;
 class FZC_PUBLIC_SYMBOL CDirectoryListingNotification final : public CNotificationHelper<nId_listing>
 {
 public:
-	explicit CDirectoryListingNotification(CServerPath const& path, bool const primary, bool const failed = false);
+	explicit CDirectoryListingNotification(CServerPath const& path, bool const primary, bool const failed = false, bool const stale = false);
 	bool Primary() const { return primary_; }
 	bool Failed() const { return m_failed; }
+	bool Stale() const { return stale_; }
 	const CServerPath GetPath() const { return m_path; }
 
 protected:
 	bool const primary_{};
 	bool m_failed{};
+	bool const stale_{};
 	CServerPath m_path;
 };
 
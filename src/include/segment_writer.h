@@ -0,0 +1,67 @@
+#ifndef FILEZILLA_ENGINE_SEGMENT_WRITER_HEADER
+#define FILEZILLA_ENGINE_SEGMENT_WRITER_HEADER
+
+#include "visibility.h"
+
+#include <libfilezilla/aio/writer.hpp>
+#include <libfilezilla/file.hpp>
+
+/*
+Writes one byte range of a file that gets downloaded in several segments at
+the same time.
+
+All segments write into the same, preallocated local file. Unlike
+fz::file_writer, opening a segment never truncates the file and closing it
+neither truncates nor deletes it, as other segments may still be writing.
+The file is opened with write sharing so that this also works on Windows.
+
+Finalizing fails unless exactly the size of the segment has been written.
+*/
+class FZC_PUBLIC_SYMBOL segment_writer final : public fz::threaded_writer
+{
+public:
+	segment_writer(std::wstring const& name, fz::aio_buffer_pool & pool, fz::file && f, uint64_t size, fz::thread_pool & tpool, bool fsync, progress_cb_t && progress_cb, size_t max_buffers) noexcept;
+	virtual ~segment_writer() override;
+
+protected:
+	virtual void do_close(fz::scoped_lock & l) override;
+	virtual fz::aio_result continue_finalize(fz::scoped_lock & l) override;
+
+private:
+	void entry();
+
+	fz::file file_;
+	uint64_t remaining_{};
+	bool fsync_{};
+};
+
+class FZC_PUBLIC_SYMBOL segment_writer_factory final : public fz::writer_factory
+{
+public:
+	// offset and size of the segment within the file
+	segment_writer_factory(std::wstring const& file, fz::thread_pool & tpool, uint64_t offset, uint64_t size, bool fsync = false);
+
+	// Offsets passed to open are relative to the start of the segment.
+	virtual std::unique_ptr<fz::writer_base> open(fz::aio_buffer_pool & pool, uint64_t offset, fz::writer_base::progress_cb_t progress_cb = nullptr, size_t max_buffers = 0) override;
+	virtual std::unique_ptr<fz::writer_factory> clone() const override;
+
+	virtual bool offsetable() const override { return true; }
+
+	virtual bool multiple_buffer_usage() const override { return true; }
+	virtual size_t preferred_buffer_count() const override { return 4; }
+
+	uint64_t segment_offset() const { return offset_; }
+	uint64_t segment_size() const { return size_; }
+
+	// Creates the file if needed and sets its size, so that the segments
+	// can be written in any order.
+	static bool preallocate(std::wstring const& file, uint64_t size);
+
+private:
+	fz::thread_pool & thread_pool_;
+	uint64_t const offset_;
+	uint64_t const size_;
+	bool const fsync_;
+};
+
+#endif
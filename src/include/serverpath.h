@@ -65,6 +65,9 @@ public:
 
 	int CmpNoCase(CServerPath const& op) const;
 
+	// Paths equal according to CmpNoCase have the same hash
+	size_t HashNoCase() const;
+
 	// omitPath is just a hint. For example dataset member names on MVS servers
 	// always use absolute filenames including the full path
 	std::wstring FormatFilename(std::wstring const& filename, bool omitPath = false) const;
@@ -15,6 +15,7 @@
 #include "renderer.h"
 #include "../commonui/fz_paths.h"
 #include "../include/version.h"
+#include <libfilezilla/file.hpp>
 #include <libfilezilla/local_filesys.hpp>
 #include <libfilezilla/translate.hpp>
 #include <wx/evtloop.h>
@@ -225,6 +226,21 @@ USE AT OWN RISK"), _T("Important Information"));
 
 	themeProvider_ = std::make_unique<CThemeProvider>(*options_);
 	CheckExistsFzsftp();
+	{
+		std::wstring const settingsDir = options_->get_string(OPTION_DEFAULT_SETTINGSDIR);
+		if (!settingsDir.empty()) {
+			options_->set(OPTION_CACHE_FILE, settingsDir + L"dircache.dat");
+			// The session file holds session secrets behind a key kept in the
+			// settings. Don't let it undercut a master password.
+			if (options_->get_string(OPTION_MASTERPASSWORDENCRYPTOR).empty()) {
+				options_->set(OPTION_TLS_SESSION_FILE, settingsDir + L"tlssessions.dat");
+			}
+			else {
+				options_->set(OPTION_TLS_SESSION_FILE, std::wstring());
+				fz::remove_file(fz::to_native(settingsDir + L"tlssessions.dat"));
+			}
+		}
+	}
 #if ENABLE_STORJ
 	CheckExistsFzstorj();
 #endif
@@ -731,6 +731,13 @@ void CMainFrame::OnMenuHandler(wxCommandEvent &event)
 		}
 #endif
 	}
+	else if (event.GetId() == XRCID("ID_DIRCACHE_STATS")) {
+		auto const stats = m_engineContext.GetDirectoryCacheStats();
+		std::wstring msg = fz::sprintf(L"Listings: %d\nFiles: %d\nMemory: %d of %d KiB\n\nHits: %d\nMisses: %d\nEvictions: %d\n\nPooled strings: %d\nPool lookups: %d\nPool hits: %d\nPool evictions: %d",
+			stats.listings, stats.files, stats.bytes / 1024, stats.max_bytes / 1024, stats.hits, stats.misses, stats.evictions,
+			stats.pool_strings, stats.pool_lookups, stats.pool_hits, stats.pool_evictions);
+		wxMessageBoxEx(msg, _T("Directory cache statistics"));
+	}
 	else if (event.GetId() == XRCID("ID_MENU_TRANSFER_FILEEXISTS")) {
 		CDefaultFileExistsDlg dlg;
 		dlg.Run(this, false);
@@ -1004,85 +1011,86 @@ void CMainFrame::OnEngineEvent(CFileZillaEngine* engine)
 		return;
 	}
 
-	std::unique_ptr<CNotification> pNotification = pState->engine_->GetNextNotification();
-	while (pNotification) {
-		switch (pNotification->GetID())
-		{
-		case nId_logmsg:
-			if (m_pStatusView) {
-				m_pStatusView->AddToLog(std::move(static_cast<CLogmsgNotification&>(*pNotification.get())));
-			}
-			if (options_.get_int(OPTION_MESSAGELOG_POSITION) == 2 && m_pQueuePane) {
-				m_pQueuePane->Highlight(3);
-			}
-			break;
-		case nId_operation:
-			if (pState->m_pCommandQueue) {
-				pState->m_pCommandQueue->Finish(unique_static_cast<COperationNotification>(std::move(pNotification)));
-			}
-			if (m_bQuit) {
-				Close();
-				return;
-			}
-			break;
-		case nId_listing:
+	std::vector<std::unique_ptr<CNotification>> notifications;
+	while (pState->engine_->GetNotifications(notifications)) {
+		for (auto & pNotification : notifications) {
+			switch (pNotification->GetID())
 			{
-				auto const& listingNotification = static_cast<CDirectoryListingNotification const&>(*pNotification.get());
+			case nId_logmsg:
+				if (m_pStatusView) {
+					m_pStatusView->AddToLog(std::move(static_cast<CLogmsgNotification&>(*pNotification.get())));
+				}
+				if (options_.get_int(OPTION_MESSAGELOG_POSITION) == 2 && m_pQueuePane) {
+					m_pQueuePane->Highlight(3);
+				}
+				break;
+			case nId_operation:
 				if (pState->m_pCommandQueue) {
-					pState->m_pCommandQueue->ProcessDirectoryListing(listingNotification);
+					pState->m_pCommandQueue->Finish(unique_static_cast<COperationNotification>(std::move(pNotification)));
 				}
-			}
-			break;
-		case nId_asyncrequest:
-			{
-				auto pAsyncRequest = unique_static_cast<CAsyncRequestNotification>(std::move(pNotification));
-				if (pAsyncRequest->GetRequestID() == reqId_fileexists) {
-					if (m_pQueueView) {
-						m_pQueueView->ProcessNotification(pState->engine_.get(), std::move(pAsyncRequest));
+				if (m_bQuit) {
+					Close();
+					return;
+				}
+				break;
+			case nId_listing:
+				{
+					auto const& listingNotification = static_cast<CDirectoryListingNotification const&>(*pNotification.get());
+					if (pState->m_pCommandQueue) {
+						pState->m_pCommandQueue->ProcessDirectoryListing(listingNotification);
 					}
 				}
-				else {
-					if (pAsyncRequest->GetRequestID() == reqId_certificate) {
-						pState->SetSecurityInfo(static_cast<CCertificateNotification&>(*pAsyncRequest));
+				break;
+			case nId_asyncrequest:
+				{
+					auto pAsyncRequest = unique_static_cast<CAsyncRequestNotification>(std::move(pNotification));
+					if (pAsyncRequest->GetRequestID() == reqId_fileexists) {
+						if (m_pQueueView) {
+							m_pQueueView->ProcessNotification(pState->engine_.get(), std::move(pAsyncRequest));
+						}
 					}
-					if (async_request_queue_) {
-						async_request_queue_->AddRequest(pState->engine_.get(), std::move(pAsyncRequest));
+					else {
+						if (pAsyncRequest->GetRequestID() == reqId_certificate) {
+							pState->SetSecurityInfo(static_cast<CCertificateNotification&>(*pAsyncRequest));
+						}
+						if (async_request_queue_) {
+							async_request_queue_->AddRequest(pState->engine_.get(), std::move(pAsyncRequest));
+						}
 					}
 				}
+				break;
+			case nId_transferstatus:
+				if (m_pQueueView) {
+					m_pQueueView->ProcessNotification(pState->engine_.get(), std::move(pNotification));
+				}
+				break;
+			case nId_sftp_encryption:
+				{
+					pState->SetSecurityInfo(static_cast<CSftpEncryptionNotification&>(*pNotification));
+				}
+				break;
+			case nId_local_dir_created:
+				if (pState) {
+					auto const& localDirCreatedNotification = static_cast<CLocalDirCreatedNotification const&>(*pNotification.get());
+					pState->LocalDirCreated(localDirCreatedNotification.dir);
+				}
+				break;
+			case nId_serverchange:
+				if (pState) {
+					auto const& notification = static_cast<ServerChangeNotification const&>(*pNotification.get());
+					pState->ChangeServer(notification.newServer_);
+				}
+				break;
+			case nId_ftp_tls_resumption: {
+				auto const& notification = static_cast<FtpTlsResumptionNotification const&>(*pNotification.get());
+				cert_store_->SetSessionResumptionSupport(fz::to_utf8(notification.server_.GetHost()), notification.server_.GetPort(), true, true);
+				break;
 			}
-			break;
-		case nId_transferstatus:
-			if (m_pQueueView) {
-				m_pQueueView->ProcessNotification(pState->engine_.get(), std::move(pNotification));
-			}
-			break;
-		case nId_sftp_encryption:
-			{
-				pState->SetSecurityInfo(static_cast<CSftpEncryptionNotification&>(*pNotification));
-			}
-			break;
-		case nId_local_dir_created:
-			if (pState) {
-				auto const& localDirCreatedNotification = static_cast<CLocalDirCreatedNotification const&>(*pNotification.get());
-				pState->LocalDirCreated(localDirCreatedNotification.dir);
-			}
-			break;
-		case nId_serverchange:
-			if (pState) {
-				auto const& notification = static_cast<ServerChangeNotification const&>(*pNotification.get());
-				pState->ChangeServer(notification.newServer_);
+			default:
+				break;
 			}
-			break;
-		case nId_ftp_tls_resumption: {
-			auto const& notification = static_cast<FtpTlsResumptionNotification const&>(*pNotification.get());
-			cert_store_->SetSessionResumptionSupport(fz::to_utf8(notification.server_.GetHost()), notification.server_.GetPort(), true, true);
-			break;
-		}
-		default:
-			break;
-		}
 
-		pNotification = pState->engine_.get()->GetNextNotification();
+		}
 	}
 }
 
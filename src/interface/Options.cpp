@@ -44,6 +44,11 @@ static unsigned int register_interface_options()
 		{ "Language Code", L"", option_flags::normal, 50 },
 		{ "Concurrent download limit", 0, option_flags::numeric_clamp, 0, 10 },
 		{ "Concurrent upload limit", 0, option_flags::numeric_clamp, 0, 10 },
+		{ "Download segments", 1, option_flags::numeric_clamp, 1, 10 },
+		{ "Download segment minimum size", 64, option_flags::numeric_clamp, 1, 1024 * 1024 }, // In MiB
+		{ "Warm connections per site", 0, option_flags::numeric_clamp, 0, 10 },
+		{ "Queue files in memory per server", 0, option_flags::numeric_clamp, 0, 1000000 },
+		{ "Adaptive concurrency", false, option_flags::normal },
 		{ "Show debug menu", false, option_flags::normal },
 		{ "File exists action download", 0, option_flags::normal, 0, 7 },
 		{ "File exists action upload", 0, option_flags::normal, 0, 7 },
@@ -16,6 +16,11 @@ enum interfaceOptions : unsigned int
 	OPTION_LANGUAGE,
 	OPTION_CONCURRENTDOWNLOADLIMIT,
 	OPTION_CONCURRENTUPLOADLIMIT,
+	OPTION_DOWNLOAD_SEGMENTS,
+	OPTION_DOWNLOAD_SEGMENT_MINSIZE,
+	OPTION_WARM_CONNECTIONS,
+	OPTION_QUEUE_FILES_IN_MEMORY,
+	OPTION_ADAPTIVE_CONCURRENCY,
 	OPTION_DEBUG_MENU,
 	OPTION_FILEEXISTS_DOWNLOAD,
 	OPTION_FILEEXISTS_UPLOAD,
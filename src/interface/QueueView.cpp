@@ -27,7 +27,10 @@
 #include "../commonui/auto_ascii_files.h"
 #include "../commonui/misc.h"
 
+#include "../include/segment_writer.h"
+
 #include <libfilezilla/glue/wxinvoker.hpp>
+#include <libfilezilla/local_filesys.hpp>
 
 #if WITH_LIBDBUS
 #include "../dbus/desktop_notification.h"
@@ -45,6 +48,9 @@
 #include <powrprof.h>
 #endif
 
+#include <algorithm>
+#include <queue>
+
 class CQueueViewDropTarget final : public CFileDropTarget<wxListCtrlEx>
 {
 public:
@@ -238,6 +244,7 @@ CQueueView::CQueueView(CQueue* parent, int index, CMainFrame* pMainFrame, CAsync
 	options_.watch(OPTION_NUMTRANSFERS, this);
 	options_.watch(OPTION_CONCURRENTDOWNLOADLIMIT, this);
 	options_.watch(OPTION_CONCURRENTUPLOADLIMIT, this);
+	options_.watch(OPTION_ADAPTIVE_CONCURRENCY, this);
 
 	CContextManager::Get()->RegisterHandler(this, STATECHANGE_REWRITE_CREDENTIALS, false);
 	CContextManager::Get()->RegisterHandler(this, STATECHANGE_QUITNOW, false);
@@ -250,6 +257,8 @@ CQueueView::CQueueView(CQueue* parent, int index, CMainFrame* pMainFrame, CAsync
 #endif
 
 	m_resize_timer.SetOwner(this);
+	m_transferStatusTimer.SetOwner(this);
+	m_concurrencyTimer.SetOwner(this);
 }
 
 CQueueView::~CQueueView()
@@ -258,6 +267,8 @@ CQueueView::~CQueueView()
 	DeleteEngines();
 
 	m_resize_timer.Stop();
+	m_transferStatusTimer.Stop();
+	m_concurrencyTimer.Stop();
 }
 
 bool CQueueView::QueueFile(bool const queueOnly, bool const download,
@@ -302,7 +313,9 @@ bool CQueueView::QueueFile(bool const queueOnly, bool const download,
 	}
 
 	fileItem->SetPriorityRaw(priority);
-	InsertItem(pServerItem, fileItem);
+	if (!SpillItem(*pServerItem, fileItem)) {
+		InsertItem(pServerItem, fileItem);
+	}
 
 	return true;
 }
@@ -360,7 +373,9 @@ bool CQueueView::QueueFiles(const bool queueOnly, const CLocalPath& localPath, c
 			fileInfo.name, (fileInfo.name != localFile) ? localFile : std::wstring(),
 			localPath, dataObject.GetServerPath(), fileInfo.size, {});
 
-		InsertItem(pServerItem, fileItem);
+		if (!SpillItem(*pServerItem, fileItem)) {
+			InsertItem(pServerItem, fileItem);
+		}
 	}
 
 	QueueFile_Finish(!queueOnly);
@@ -390,7 +405,9 @@ bool CQueueView::QueueFiles(const bool queueOnly, Site const& site, CLocalRecurs
 				file.name, std::wstring(),
 				listing.localPath, listing.remotePath, file.size, {});
 
-			InsertItem(pServerItem, fileItem);
+			if (!SpillItem(*pServerItem, fileItem)) {
+				InsertItem(pServerItem, fileItem);
+			}
 		}
 
 		// We do not look at dirs here, recursion takes care of it.
@@ -406,15 +423,15 @@ void CQueueView::OnEngineEvent(CFileZillaEngine* engine)
 		return;
 	}
 
-	std::unique_ptr<CNotification> pNotification = pEngineData->pEngine->GetNextNotification();
-	while (pNotification) {
-		ProcessNotification(pEngineData, std::move(pNotification));
+	std::vector<std::unique_ptr<CNotification>> notifications;
+	while (pEngineData->pEngine->GetNotifications(notifications)) {
+		for (auto & notification : notifications) {
+			ProcessNotification(pEngineData, std::move(notification));
 
-		if (m_engineData.empty() || !pEngineData->pEngine) {
-			break;
+			if (m_engineData.empty() || !pEngineData->pEngine) {
+				return;
+			}
 		}
-
-		pNotification = pEngineData->pEngine->GetNextNotification();
 	}
 }
 
@@ -477,6 +494,10 @@ void CQueueView::ProcessNotification(t_EngineData *pEngineData, std::unique_ptr<
 				}
 				m_pAsyncRequestQueue->AddRequest(pEngineData->pEngine, std::move(asyncRequestNotification));
 			}
+			else if (pEngineData->state == t_EngineData::warmup) {
+				// Nobody waits for a spare connection, don't bother the user with it
+				pEngineData->pEngine->Cancel();
+			}
 			else {
 				if (pEngineData->active && asyncRequestNotification->GetRequestID() != reqId_fileexists) {
 					m_pAsyncRequestQueue->AddRequest(pEngineData->pEngine, std::move(asyncRequestNotification));
@@ -531,6 +552,10 @@ void CQueueView::ProcessNotification(t_EngineData *pEngineData, std::unique_ptr<
 
 bool CQueueView::CanStartTransfer(CServerItem const & server_item, t_EngineData *&pEngineData)
 {
+	if (server_item.m_adaptive.limit_ && server_item.m_activeCount >= server_item.m_adaptive.limit_) {
+		return false;
+	}
+
 	Site const& site = server_item.GetSite();
 	const int max_count = site.server.MaximumMultipleConnections();
 	if (!max_count) {
@@ -590,12 +615,39 @@ bool CQueueView::CanStartTransfer(CServerItem const & server_item, t_EngineData
 	return true;
 }
 
-bool CQueueView::TryStartNextTransfer()
+namespace {
+// Order in which servers get to fill free transfer slots: Files with higher
+// priority first. On equal priority the server with fewer active transfers
+// goes first, then the one that waited longest since starting a transfer.
+// This way a single site cannot take all slots.
+struct transfer_candidate final
 {
-	if (m_quit || !m_activeMode) {
-		return false;
+	QueuePriority priority_{};
+	int active_{};
+	uint64_t lastStarted_{};
+	size_t index_{};
+	CServerItem* server_{};
+
+	// Less means lower preference, as std::priority_queue keeps the greatest
+	// element on top.
+	bool operator<(transfer_candidate const& op) const
+	{
+		if (priority_ != op.priority_) {
+			return priority_ < op.priority_;
+		}
+		if (active_ != op.active_) {
+			return active_ > op.active_;
+		}
+		if (lastStarted_ != op.lastStarted_) {
+			return lastStarted_ > op.lastStarted_;
+		}
+		return index_ > op.index_;
 	}
+};
+}
 
+bool CQueueView::GetWantedDirection(TransferDirection & direction) const
+{
 	// Check transfer limit
 	if (m_activeCount >= options_.get_int(OPTION_NUMTRANSFERS)) {
 		return false;
@@ -604,106 +656,173 @@ bool CQueueView::TryStartNextTransfer()
 	// Check limits for concurrent up/downloads
 	const int maxDownloads = options_.get_int(OPTION_CONCURRENTDOWNLOADLIMIT);
 	const int maxUploads = options_.get_int(OPTION_CONCURRENTUPLOADLIMIT);
-	TransferDirection wantedDirection;
 	if (maxDownloads && m_activeCountDown >= maxDownloads) {
 		if (maxUploads && m_activeCountUp >= maxUploads) {
 			return false;
 		}
 		else {
-			wantedDirection = TransferDirection::upload;
+			direction = TransferDirection::upload;
 		}
 	}
 	else if (maxUploads && m_activeCountUp >= maxUploads) {
-		wantedDirection = TransferDirection::download;
+		direction = TransferDirection::download;
 	}
 	else {
-		wantedDirection = TransferDirection::both;
+		direction = TransferDirection::both;
 	}
 
-	struct t_bestMatch
-	{
-		t_bestMatch()
-			: fileItem(), serverItem(), pEngineData()
-		{
+	return true;
+}
+
+CFileItem* CQueueView::GetNextIdleFile(CServerItem & server, TransferDirection direction, std::vector<std::wstring> & folders, bool & removed)
+{
+	removed = false;
+
+	CFileItem* item = server.GetIdleChild(m_activeMode == 1, direction);
+
+	// Downloaded empty directories only need to be created locally
+	while (item && item->Download() && item->GetType() == QueueItemType::Folder) {
+		CLocalPath localPath(item->GetLocalPath());
+		localPath.AddSegment(item->GetLocalFile());
+		wxFileName::Mkdir(localPath.GetPath(), 0777, wxPATH_MKDIR_FULL);
+		folders.push_back(localPath.GetPath());
+		if (RemoveItem(item, true)) {
+			removed = true;
+			return nullptr;
 		}
+		item = server.GetIdleChild(m_activeMode == 1, direction);
+	}
 
-		CFileItem* fileItem;
-		CServerItem* serverItem;
-		t_EngineData* pEngineData;
-	} bestMatch;
+	return item;
+}
 
-	// Find inactive file. Check all servers for
-	// the file with the highest priority
-	for (auto const& currentServerItem : m_serverList) {
-		t_EngineData* pEngineData = 0;
+void CQueueView::StartTransfers()
+{
+	if (m_quit || !m_activeMode) {
+		return;
+	}
 
-		if (!CanStartTransfer(*currentServerItem, pEngineData)) {
-			continue;
+	// Local directories created in the process, the views get refreshed once
+	// all slots are filled.
+	std::vector<std::wstring> folders;
+
+	bool rebuild = true;
+	while (rebuild) {
+		rebuild = false;
+
+		TransferDirection direction;
+		if (!GetWantedDirection(direction)) {
+			break;
 		}
 
-		CFileItem* newFileItem = currentServerItem->GetIdleChild(m_activeMode == 1, wantedDirection);
+		// The servers with an idle file. Priorities are only upper bounds,
+		// they get checked once a server is on top.
+		std::priority_queue<transfer_candidate> candidates;
 
-		while (newFileItem && newFileItem->Download() && newFileItem->GetType() == QueueItemType::Folder) {
-			CLocalPath localPath(newFileItem->GetLocalPath());
-			localPath.AddSegment(newFileItem->GetLocalFile());
-			wxFileName::Mkdir(localPath.GetPath(), 0777, wxPATH_MKDIR_FULL);
-			const std::vector<CState*> *pStates = CContextManager::Get()->GetAllStates();
-			for (auto & state : *pStates) {
-				state->RefreshLocalFile(localPath.GetPath());
+		// Servers without files left get removed from the list in the process
+		std::vector<CServerItem*> const servers = m_serverList;
+		for (size_t i = 0; i < servers.size(); ++i) {
+			t_EngineData* pEngineData{};
+			if (!CanStartTransfer(*servers[i], pEngineData)) {
+				continue;
 			}
-			if (RemoveItem(newFileItem, true)) {
-				// Server got deleted. Unfortunately we have to start over now
-				if (m_serverList.empty()) {
-					return false;
-				}
 
-				return true;
+			bool removed{};
+			CFileItem* item = GetNextIdleFile(*servers[i], direction, folders, removed);
+			if (item) {
+				candidates.push({item->GetPriority(), servers[i]->m_activeCount, servers[i]->m_lastStarted, i, servers[i]});
 			}
-			newFileItem = currentServerItem->GetIdleChild(m_activeMode == 1, wantedDirection);
 		}
 
-		if (!newFileItem) {
-			continue;
-		}
+		while (!candidates.empty() && GetWantedDirection(direction)) {
+			transfer_candidate candidate = candidates.top();
+			candidates.pop();
+
+			CServerItem & server = *candidate.server_;
+
+			t_EngineData* pEngineData{};
+			if (!CanStartTransfer(server, pEngineData)) {
+				continue;
+			}
+
+			bool removed{};
+			CFileItem* item = GetNextIdleFile(server, direction, folders, removed);
+			if (!item) {
+				continue;
+			}
+			if (item->GetPriority() < candidate.priority_) {
+				candidate.priority_ = item->GetPriority();
+				candidates.push(candidate);
+				continue;
+			}
+
+			if (!pEngineData) {
+				pEngineData = GetIdleEngine(server.GetSite());
+				if (!pEngineData) {
+					break;
+				}
+			}
 
-		if (!bestMatch.fileItem || newFileItem->GetPriority() > bestMatch.fileItem->GetPriority()) {
-			bestMatch.serverItem = currentServerItem;
-			bestMatch.fileItem = newFileItem;
-			bestMatch.pEngineData = pEngineData;
-			if (newFileItem->GetPriority() == QueuePriority::highest) {
+			StartTransfer(server, *item, *pEngineData);
+			if (pEngineData->pItem != item) {
+				// Already over, which may have taken the server with it
+				rebuild = true;
 				break;
 			}
+
+			candidate.active_ = server.m_activeCount;
+			candidate.lastStarted_ = server.m_lastStarted;
+			candidates.push(candidate);
 		}
 	}
-	if (!bestMatch.fileItem) {
-		return false;
-	}
 
-	// Find idle engine
-	t_EngineData* pEngineData;
-	if (bestMatch.pEngineData) {
-		pEngineData = bestMatch.pEngineData;
-	}
-	else {
-		pEngineData = GetIdleEngine(bestMatch.serverItem->GetSite());
-		if (!pEngineData) {
-			return false;
+	if (!folders.empty()) {
+		std::sort(folders.begin(), folders.end());
+		folders.erase(std::unique(folders.begin(), folders.end()), folders.end());
+
+		const std::vector<CState*> *pStates = CContextManager::Get()->GetAllStates();
+		for (auto const& folder : folders) {
+			for (auto & state : *pStates) {
+				state->RefreshLocalFile(folder);
+			}
 		}
 	}
+}
+
+void CQueueView::StartTransfer(CServerItem & server, CFileItem & item, t_EngineData & engineData)
+{
+	t_EngineData* const pEngineData = &engineData;
 
-	// Now we have both inactive engine and file.
 	// Assign the file to the engine.
 
-	bestMatch.fileItem->SetActive(true);
+	SplitDownload(server, item);
+
+	item.SetActive(true);
 
-	pEngineData->pItem = bestMatch.fileItem;
-	bestMatch.fileItem->m_pEngineData = pEngineData;
+	pEngineData->pItem = &item;
+	item.m_pEngineData = pEngineData;
 	pEngineData->active = true;
 	delete pEngineData->m_idleDisconnectTimer;
 	pEngineData->m_idleDisconnectTimer = 0;
-	bestMatch.serverItem->m_activeCount++;
+	server.m_activeCount++;
+	server.m_lastStarted = ++m_transferStarts;
 	m_activeCount++;
-	if (bestMatch.fileItem->Download()) {
+	if (options_.get_bool(OPTION_ADAPTIVE_CONCURRENCY)) {
+		if (!server.m_adaptive.limit_) {
+			server.m_adaptive = CServerItem::adaptive_concurrency();
+			server.m_adaptive.limit_ = std::min(2, GetConcurrencyBound(server));
+			server.m_adaptive.saturated_ = true;
+		}
+		if (!m_concurrencyTimer.IsRunning()) {
+			m_concurrencySamples = 0;
+			for (auto * pServerItem : m_serverList) {
+				pServerItem->m_adaptive.bytes_ = 0;
+				pServerItem->m_adaptive.saturated_ = true;
+			}
+			m_concurrencyTimer.Start(1000);
+		}
+	}
+	if (item.Download()) {
 		m_activeCountDown++;
 	}
 	else {
@@ -711,7 +830,7 @@ bool CQueueView::TryStartNextTransfer()
 	}
 
 	Site const oldSite = pEngineData->lastSite;
-	pEngineData->lastSite = bestMatch.serverItem->GetSite();
+	pEngineData->lastSite = server.GetSite();
 
 	if (pEngineData->state != t_EngineData::waitprimary) {
 		if (!pEngineData->pEngine->IsConnected()) {
@@ -722,7 +841,7 @@ bool CQueueView::TryStartNextTransfer()
 				pEngineData->state = t_EngineData::askpassword;
 			}
 		}
-		else if (oldSite != bestMatch.serverItem->GetSite()) {
+		else if (oldSite != server.GetSite()) {
 			pEngineData->state = t_EngineData::disconnect;
 		}
 		else if (pEngineData->pItem->GetType() == QueueItemType::File) {
@@ -733,12 +852,20 @@ bool CQueueView::TryStartNextTransfer()
 		}
 	}
 
-	if (bestMatch.fileItem->GetType() == QueueItemType::File) {
+	if (pEngineData->warmSetupTime_) {
+		if (pEngineData->state == t_EngineData::transfer || pEngineData->state == t_EngineData::mkdir) {
+			++m_warmHits;
+			m_warmSaved += pEngineData->warmSetupTime_;
+		}
+		pEngineData->warmSetupTime_ = fz::duration();
+	}
+
+	if (item.GetType() == QueueItemType::File) {
 		// Create status line
 
 		m_itemCount++;
 		SetItemCount(m_itemCount);
-		int lineIndex = GetItemIndex(bestMatch.fileItem);
+		int lineIndex = GetItemIndex(&item);
 		UpdateSelections_ItemAdded(lineIndex + 1);
 
 		wxRect rect = GetClientRect();
@@ -761,8 +888,6 @@ bool CQueueView::TryStartNextTransfer()
 	}
 
 	SendNextCommand(*pEngineData);
-
-	return true;
 }
 
 void CQueueView::ProcessReply(t_EngineData* pEngineData, COperationNotification const& notification)
@@ -775,6 +900,26 @@ void CQueueView::ProcessReply(t_EngineData* pEngineData, COperationNotification
 	// Process reply from the engine
 	int replyCode = notification.replyCode_;
 
+	if (pEngineData->state == t_EngineData::warmup) {
+		pEngineData->state = t_EngineData::none;
+		CServerItem* pServerItem = GetServerItem(pEngineData->lastSite);
+		if (replyCode == FZ_REPLY_OK) {
+			pEngineData->warmSetupTime_ = fz::monotonic_clock::now() - pEngineData->warmStart_;
+			if (pServerItem) {
+				pServerItem->m_warmupFailures = 0;
+			}
+		}
+		else if (pServerItem) {
+			// Failed or got canceled on an interactive request. Don't try
+			// again right away, that would just keep reconnecting.
+			int const delay = 30 << std::min(pServerItem->m_warmupFailures, 5);
+			pServerItem->m_warmupBlockedUntil = fz::monotonic_clock::now() + fz::duration::from_seconds(delay);
+			++pServerItem->m_warmupFailures;
+		}
+		AdvanceQueue(false);
+		return;
+	}
+
 	if ((replyCode & FZ_REPLY_CANCELED) == FZ_REPLY_CANCELED) {
 		ResetReason reason;
 		if (pEngineData->pItem) {
@@ -959,7 +1104,18 @@ void CQueueView::ProcessReply(t_EngineData* pEngineData, COperationNotification
 	SendNextCommand(*pEngineData);
 }
 
-void CQueueView::ResetEngine(t_EngineData& data, const ResetReason reason)
+bool CQueueView::IsFollowedInSameDirectory(CFileItem & item)
+{
+	CServerItem* pServerItem = static_cast<CServerItem*>(item.GetTopLevelItem());
+	if (!pServerItem || !m_activeMode) {
+		return false;
+	}
+
+	CFileItem* next = pServerItem->GetIdleChild(m_activeMode == 1, TransferDirection::both);
+	return next && next->GetType() == QueueItemType::File && next->GetRemotePath() == item.GetRemotePath();
+}
+
+void CQueueView::ResetEngine(t_EngineData& data, ResetReason reason)
 {
 	if (!data.active) {
 		return;
@@ -993,6 +1149,15 @@ void CQueueView::ResetEngine(t_EngineData& data, const ResetReason reason)
 			SaveSetItemCount(m_itemCount);
 
 			CFileItem* const pFileItem = (CFileItem*)data.pItem;
+			if (reason == ResetReason::success && pFileItem->IsSegment() && !CompleteSegment(*pFileItem)) {
+				reason = ResetReason::failure;
+			}
+
+			int64_t const bytes = data.pStatusLineCtrl->TakeFinalTransferredBytes(reason == ResetReason::success && !pFileItem->IsSegment());
+			if (pServerItem) {
+				pServerItem->m_adaptive.bytes_ += bytes;
+			}
+
 			if (pFileItem->Download()) {
 				const std::vector<CState*> *pStates = CContextManager::Get()->GetAllStates();
 				for (auto *pState : *pStates) {
@@ -1140,7 +1305,15 @@ bool CQueueView::RemoveItem(CQueueItem* item, bool destroy, bool updateItemCount
 		}
 	}
 
+	if (item->GetType() == QueueItemType::File || item->GetType() == QueueItemType::Folder) {
+		ForgetItem(static_cast<CFileItem&>(*item));
+	}
+	int64_t const serverId = item->GetTopLevelItem()->GetStorageId();
+
 	bool didRemoveParent = CQueueViewBase::RemoveItem(item, destroy, updateItemCount, updateSelections, forward);
+	if (didRemoveParent) {
+		m_queue_storage.RemoveServer(serverId);
+	}
 
 	UpdateStatusLinePositions();
 
@@ -1254,15 +1427,25 @@ void CQueueView::SendNextCommand(t_EngineData& engineData)
 				extraFlags = extraData->extraFlags_;
 			}
 
+			transfer_flags flags = fileItem->flags();
+			if (!fileItem->IsSegment() && IsFollowedInSameDirectory(*fileItem)) {
+				flags |= transfer_flags::more_follow;
+			}
+
 			int res;
 			if (!fileItem->Download()) {
 				auto cmd = CFileTransferCommand(fz::file_reader_factory(fileItem->GetLocalPath().GetPath() + fileItem->GetLocalFile(), m_pMainFrame->GetEngineContext().GetThreadPool()),
-					fileItem->GetRemotePath(), fileItem->GetRemoteFile(), fileItem->flags(), extraFlags);
+					fileItem->GetRemotePath(), fileItem->GetRemoteFile(), flags, extraFlags);
+				res = engineData.pEngine->Execute(cmd);
+			}
+			else if (fileItem->IsSegment()) {
+				auto cmd = CFileTransferCommand(segment_writer_factory(extraData->segments_->partFile_, m_pMainFrame->GetEngineContext().GetThreadPool(), extraData->segmentOffset_, extraData->segmentSize_),
+					fileItem->GetRemotePath(), fileItem->GetRemoteFile(), flags, extraFlags);
 				res = engineData.pEngine->Execute(cmd);
 			}
 			else {
 				auto cmd = CFileTransferCommand(fz::file_writer_factory(fileItem->GetLocalPath().GetPath() + fileItem->GetLocalFile(), m_pMainFrame->GetEngineContext().GetThreadPool()),
-					fileItem->GetRemotePath(), fileItem->GetRemoteFile(), fileItem->flags(), extraFlags);
+					fileItem->GetRemotePath(), fileItem->GetRemoteFile(), flags, extraFlags);
 				res = engineData.pEngine->Execute(cmd);
 			}
 
@@ -1420,6 +1603,7 @@ bool CQueueView::Quit()
 	SaveColumnSettings(OPTION_QUEUE_COLUMN_WIDTHS, OPTIONS_NUM, OPTIONS_NUM);
 
 	m_resize_timer.Stop();
+	m_transferStatusTimer.Stop();
 
 	return true;
 }
@@ -1444,6 +1628,12 @@ void CQueueView::CheckQueueState()
 
 	if (m_activeMode) {
 		m_activeMode = 0;
+
+		if (m_warmHits) {
+			m_pMainFrame->GetStatusView()->AddToLog(logmsg::status, fz::sprintf(fztranslate("%d transfers started on spare connections, saving %d ms of connection setup."), m_warmHits, m_warmSaved.get_milliseconds()), fz::datetime::now());
+			m_warmHits = 0;
+			m_warmSaved = fz::duration();
+		}
 		/* Users don't seem to like this, so comment it out for now.
 		 * maybe make it configureable in future?
 		if (!m_pQueue->GetSelection())
@@ -1473,6 +1663,7 @@ bool CQueueView::IncreaseErrorCount(t_EngineData& engineData)
 {
 	++engineData.pItem->m_errorCount;
 	if (engineData.pItem->m_errorCount <= options_.get_int(OPTION_RECONNECTCOUNT)) {
+		StoreItem(*engineData.pItem);
 		return true;
 	}
 
@@ -1520,6 +1711,26 @@ void CQueueView::UpdateStatusLinePositions()
 	}
 }
 
+void CQueueView::StartTransferStatusTimer()
+{
+	if (!m_transferStatusTimer.IsRunning()) {
+		m_transferStatusTimer.Start(100);
+	}
+}
+
+void CQueueView::UpdateTransferStatus()
+{
+	bool polling{};
+	for (auto pCtrl : m_statusLineList) {
+		if (pCtrl->UpdateTransferStatus()) {
+			polling = true;
+		}
+	}
+	if (!polling) {
+		m_transferStatusTimer.Stop();
+	}
+}
+
 void CQueueView::CalculateQueueSize()
 {
 	// Collect total queue size
@@ -1555,7 +1766,9 @@ void CQueueView::SaveQueue(bool silent)
 	// just as extra precaution. Better 'save' than sorry.
 	CInterProcessMutex mutex(MUTEX_QUEUE);
 
-	if (!m_queue_storage.SaveQueue(m_serverList) && !silent) {
+	// If journaled, all changes usually have been written already
+	bool const saved = m_queue_storage.Journaling() ? m_queue_storage.CloseJournal(m_serverList) : m_queue_storage.SaveQueue(m_serverList);
+	if (!saved && !silent) {
 		wxString msg = wxString::Format(_("An error occurred saving the transfer queue to \"%s\".\nSome queue items might not have been saved."), m_queue_storage.GetDatabaseFilename());
 		wxMessageBoxEx(msg, _("Error saving queue"), wxICON_ERROR);
 	}
@@ -1568,32 +1781,83 @@ void CQueueView::LoadQueue()
 	// to the same file or one is reading while the other one writes.
 	CInterProcessMutex mutex(MUTEX_QUEUE);
 
+	// Kiosk mode 2 leaves the stored queue alone
+	bool const persist = options_.get_int(OPTION_DEFAULT_KIOSKMODE) != 2;
+
+	// If another instance has loaded the stored queue, this one only
+	// appends its own queue when quitting.
+	if (persist && !m_queue_storage.Acquire()) {
+		return;
+	}
+
 	bool error = false;
 
+	// Rows of servers without files or merged into an earlier server item
+	std::vector<int64_t> staleServers;
+	bool merged = false;
+
+	// Servers with more files than this only get them loaded by priority, see SpillItem
+	int const limit = persist ? options_.get_int(OPTION_QUEUE_FILES_IN_MEMORY) : 0;
+	std::vector<std::pair<CServerItem*, CFileItem*>> spill;
+
 	if (!m_queue_storage.BeginTransaction()) {
 		error = true;
 	}
 	else {
 		Site site;
-		int64_t const first_id = m_queue_storage.GetServer(site, true);
-		auto id = first_id;
+		auto id = m_queue_storage.GetServer(site, true);
 		for (; id > 0; id = m_queue_storage.GetServer(site, false)) {
 			m_insertionStart = -1;
 			m_insertionCount = 0;
 			CServerItem *pServerItem = CreateServerItem(site);
+			if (!pServerItem->GetStorageId()) {
+				pServerItem->SetStorageId(id);
+			}
+			else {
+				// Its files get stored anew
+				merged = true;
+				staleServers.push_back(id);
+			}
+
+			bool spilled = false;
+			if (persist && pServerItem->GetStorageId() == id) {
+				// Also clears the flags left over by the previous session
+				if (limit && m_queue_storage.SpillFiles(id, true)) {
+					RecountSpilledItems(*pServerItem);
+				}
+				spilled = pServerItem->m_spilled.count_ > limit;
+				if (!spilled) {
+					m_queue_storage.SpillFiles(id, false);
+					RecountSpilledItems(*pServerItem);
+				}
+			}
 
 			CFileItem* fileItem = 0;
-			int64_t fileId;
-			for (fileId = m_queue_storage.GetFile(&fileItem, id); fileItem; fileId = m_queue_storage.GetFile(&fileItem, 0)) {
+			int64_t fileId = 0;
+			if (!spilled) {
+				fileId = m_queue_storage.GetFile(&fileItem, id);
+			}
+			for (; fileItem; fileId = m_queue_storage.GetFile(&fileItem, 0)) {
 				fileItem->SetParent(pServerItem);
 				fileItem->SetPriority(fileItem->GetPriority());
-				InsertItem(pServerItem, fileItem);
+				if (pServerItem->GetStorageId() == id) {
+					fileItem->SetStorageId(fileId);
+					InsertItem(pServerItem, fileItem);
+				}
+				else if (limit && (pServerItem->m_spilled.count_ || static_cast<int>(pServerItem->GetChildrenCount(false)) >= limit)) {
+					// Stored anew behind the files not loaded
+					spill.emplace_back(pServerItem, fileItem);
+				}
+				else {
+					InsertItem(pServerItem, fileItem);
+				}
 			}
 			if (fileId < 0) {
 				error = true;
 			}
 
-			if (!pServerItem->GetChild(0)) {
+			if (!pServerItem->GetChild(0) && !pServerItem->m_spilled.count_) {
+				staleServers.push_back(id);
 				m_itemCount--;
 				m_serverList.pop_back();
 				delete pServerItem;
@@ -1603,24 +1867,59 @@ void CQueueView::LoadQueue()
 			error = true;
 		}
 
-		if (error || first_id > 0) {
-			if (options_.get_int(OPTION_DEFAULT_KIOSKMODE) != 2) {
-				if (!m_queue_storage.Clear()) {
-					error = true;
-				}
-			}
+		// Only the spilled flags got modified
+		if (!m_queue_storage.EndTransaction(false)) {
+			error = true;
+		}
+	}
 
-			if (!m_queue_storage.EndTransaction()) {
-				error = true;
+	if (persist) {
+		// The loaded rows are kept, from now on they get updated as the queue changes.
+		if (m_queue_storage.EnableJournal()) {
+			for (auto const serverId : staleServers) {
+				m_queue_storage.RemoveServer(serverId);
 			}
-
-			if (!m_queue_storage.Vacuum()) {
-				error = true;
+			if (merged) {
+				for (auto * pServerItem : m_serverList) {
+					auto const& children = pServerItem->GetChildren();
+					for (auto it = children.begin() + pServerItem->GetRemovedAtFront(); it != children.end(); ++it) {
+						if (!(*it)->GetStorageId()) {
+							m_queue_storage.Store(static_cast<CFileItem&>(**it), *pServerItem);
+						}
+					}
+				}
+			}
+			for (auto const& item : spill) {
+				if (!SpillItem(*item.first, item.second)) {
+					InsertItem(item.first, item.second);
+				}
 			}
 		}
 		else {
-			// Queue was already empty. No need to commit
-			if (!m_queue_storage.EndTransaction(true)) {
+			// Fall back to saving the whole queue when quitting, which needs
+			// all files loaded.
+			for (auto const& item : spill) {
+				InsertItem(item.first, item.second);
+			}
+			for (auto * pServerItem : m_serverList) {
+				auto & spilled = pServerItem->m_spilled;
+				std::vector<std::pair<int64_t, CFileItem*>> files;
+				CQueueStorage::spilled_position pos;
+				if (spilled.count_ && !m_queue_storage.FetchFiles(pServerItem->GetStorageId(), pos, spilled.count_, files)) {
+					error = true;
+				}
+				for (auto const& file : files) {
+					if (file.second) {
+						file.second->SetParent(pServerItem);
+						InsertItem(pServerItem, file.second);
+					}
+				}
+				m_fileCount -= spilled.count_;
+				m_totalQueueSize -= spilled.size_;
+				m_filesWithUnknownSize -= spilled.unknownSize_;
+				spilled = CServerItem::spilled_files();
+			}
+			if (!m_queue_storage.Clear()) {
 				error = true;
 			}
 		}
@@ -1629,6 +1928,7 @@ void CQueueView::LoadQueue()
 	m_insertionStart = -1;
 	m_insertionCount = 0;
 	CommitChanges();
+	LoadSpilledItems();
 	if (error) {
 		wxString file = CQueueStorage::GetDatabaseFilename();
 		wxString msg = wxString::Format(_("An error occurred loading the transfer queue from \"%s\".\nSome queue items might not have been restored."), file);
@@ -1744,7 +2044,7 @@ void CQueueView::ImportQueue(pugi::xml_node element, bool updateSelections)
 				InsertItem(pServerItem, folderItem);
 			}
 
-			if (!pServerItem->GetChild(0)) {
+			if (!pServerItem->GetChild(0) && !pServerItem->m_spilled.count_) {
 				m_itemCount--;
 				m_serverList.pop_back();
 				delete pServerItem;
@@ -1930,7 +2230,17 @@ void CQueueView::RemoveAll()
 	std::vector<CServerItem*> newServerList;
 	m_itemCount = 0;
 	for (auto iter = m_serverList.begin(); iter != m_serverList.end(); ++iter) {
+		DropSpilledItems(**iter);
+		if (m_queue_storage.Journaling()) {
+			auto const& children = (*iter)->GetChildren();
+			for (auto child = children.begin() + (*iter)->GetRemovedAtFront(); child != children.end(); ++child) {
+				if (((*child)->GetType() == QueueItemType::File || (*child)->GetType() == QueueItemType::Folder) && !static_cast<CFileItem*>(*child)->IsActive()) {
+					ForgetItem(static_cast<CFileItem&>(**child));
+				}
+			}
+		}
 		if ((*iter)->TryRemoveAll()) {
+			m_queue_storage.RemoveServer((*iter)->GetStorageId());
 			delete *iter;
 		}
 		else {
@@ -1987,6 +2297,7 @@ void CQueueView::OnRemoveSelected(wxCommandEvent&)
 		if (pItem->GetType() == QueueItemType::Server) {
 			// Server selected. Don't process individual files, continue with the next server
 			skipTo = item + pItem->GetChildrenCount(true);
+			DropSpilledItems(static_cast<CServerItem&>(*pItem));
 		}
 	}
 
@@ -2034,6 +2345,7 @@ void CQueueView::OnRemoveSelected(wxCommandEvent&)
 		bool forward = selectedItem.first < (topItemIndex + static_cast<int>(pTopLevelItem->GetChildrenCount(false)) / 2);
 		RemoveItem(pItem, true, false, false, forward);
 	}
+	LoadSpilledItems();
 	DisplayNumberQueuedFiles();
 	DisplayQueueSize();
 	SaveSetItemCount(m_itemCount);
@@ -2108,8 +2420,10 @@ bool CQueueView::StopItem(CServerItem* pServerItem, bool updateSelections)
 
 void CQueueView::SetDefaultFileExistsAction(CFileExistsNotification::OverwriteAction action, const TransferDirection direction)
 {
-	for (auto iter = m_serverList.begin(); iter != m_serverList.end(); ++iter)
+	for (auto iter = m_serverList.begin(); iter != m_serverList.end(); ++iter) {
 		(*iter)->SetDefaultFileExistsAction(action, direction);
+		StoreItems(**iter);
+	}
 }
 
 void CQueueView::OnSetDefaultFileExistsAction(wxCommandEvent &)
@@ -2221,6 +2535,7 @@ void CQueueView::OnSetDefaultFileExistsAction(wxCommandEvent &)
 					}
 					pFileItem->m_defaultFileExistsAction = uploadAction;
 				}
+				StoreItem(*pFileItem);
 			}
 			break;
 		case QueueItemType::Server:
@@ -2232,6 +2547,7 @@ void CQueueView::OnSetDefaultFileExistsAction(wxCommandEvent &)
 				if (has_upload) {
 					pServerItem->SetDefaultFileExistsAction(uploadAction, TransferDirection::upload);
 				}
+				StoreItems(*pServerItem);
 			}
 			break;
 		default:
@@ -2259,6 +2575,10 @@ t_EngineData* CQueueView::GetIdleEngine(Site const& site, bool allowTransient)
 			}
 		}
 
+		if (m_engineData[i]->state == t_EngineData::warmup) {
+			continue;
+		}
+
 		if (!site) {
 			return m_engineData[i];
 		}
@@ -2267,15 +2587,16 @@ t_EngineData* CQueueView::GetIdleEngine(Site const& site, bool allowTransient)
 			return m_engineData[i];
 		}
 
-		if (!pFirstIdle) {
+		// Rather take over an unconnected engine than a warm one
+		if (!pFirstIdle || (pFirstIdle->pEngine->IsConnected() && !m_engineData[i]->pEngine->IsConnected())) {
 			pFirstIdle = m_engineData[i];
 		}
 	}
 
-	if (!pFirstIdle) {
+	bool const warm = pFirstIdle && pFirstIdle->pEngine->IsConnected() && options_.get_int(OPTION_WARM_CONNECTIONS);
+	if (!pFirstIdle || warm) {
 		// Check whether we can create another engine
-		const int newEngineCount = options_.get_int(OPTION_NUMTRANSFERS);
-		if (newEngineCount > static_cast<int>(m_engineData.size()) - transient) {
+		if (GetMaxEngineCount() > static_cast<int>(m_engineData.size()) - transient) {
 			pFirstIdle = new t_EngineData;
 			pFirstIdle->pEngine = new CFileZillaEngine(m_pMainFrame->GetEngineContext(), fz::make_invoker(*this, [this](CFileZillaEngine* engine) { OnEngineEvent(engine); }));
 
@@ -2400,6 +2721,170 @@ void CQueueView::OnAskPassword()
 	}
 }
 
+bool CQueueView::SplitDownload(CServerItem & serverItem, CFileItem & item)
+{
+	if (!item.Download() || item.IsSegment() || item.m_edit != CEditHandler::none) {
+		return false;
+	}
+
+	int64_t const size = item.GetSize();
+	std::wstring const target = item.GetLocalPath().GetPath() + item.GetLocalFile();
+	auto segments = std::make_shared<CDownloadSegments>(target, size);
+
+	// Continue an earlier attempt, possibly from before the queue got
+	// reloaded, regardless of the current segment options.
+	std::set<uint64_t> done;
+	int count = segments->LoadState(done);
+	bool const resume = count != 0;
+	if (!resume) {
+		count = options_.get_int(OPTION_DOWNLOAD_SEGMENTS);
+	}
+
+	bool split = count >= 2 && size >= 0 && !(item.flags() & ftp_transfer_flags::ascii);
+	if (split && !resume) {
+		split = size >= static_cast<int64_t>(options_.get_int(OPTION_DOWNLOAD_SEGMENT_MINSIZE)) * 1024 * 1024;
+	}
+	if (split) {
+		switch (serverItem.GetSite().server.GetProtocol()) {
+		case FTP:
+		case FTPS:
+		case FTPES:
+		case INSECURE_FTP:
+		case SFTP:
+		case HTTP:
+		case HTTPS:
+			break;
+		default:
+			split = false;
+		}
+	}
+
+	// Existing files need the regular file exists handling, don't split those.
+	if (split && fz::local_filesys::get_file_type(fz::to_native(target)) != fz::local_filesys::unknown) {
+		split = false;
+	}
+
+	if (!split) {
+		// Don't leave the part file of an earlier attempt behind
+		segments->Discard();
+		return false;
+	}
+
+	if (!resume) {
+		fz::mkdir(fz::to_native(item.GetLocalPath().GetPath()), true);
+		if (!segment_writer_factory::preallocate(segments->partFile_, static_cast<uint64_t>(size))) {
+			return false;
+		}
+		segments->SaveState(count);
+	}
+
+	uint64_t const segmentSize = static_cast<uint64_t>(size) / count;
+
+	std::vector<uint64_t> offsets;
+	for (int i = 0; i < count; ++i) {
+		if (!done.count(segmentSize * i)) {
+			offsets.push_back(segmentSize * i);
+		}
+	}
+	if (offsets.empty()) {
+		// Only the final rename failed last time. Download the first segment
+		// again to get the file completed.
+		offsets.push_back(0);
+	}
+	auto const segment_size = [&](uint64_t offset) {
+		return (offset == segmentSize * (count - 1)) ? static_cast<uint64_t>(size) - offset : segmentSize;
+	};
+
+	// Each segment becomes an item of its own, shown as a row of its own
+	// with its own progress, rather than as progress aggregated under the
+	// original item: Status lines belong to the engine running the transfer
+	// of an item, and segments run on different engines.
+
+	// The row of the item now stands in for all segments
+	segments->storageId_ = item.GetStorageId();
+	segments->queued_ = 1;
+	item.SetStorageId(0);
+
+	std::wstring targetFile;
+	std::wstring extraFlags;
+	if (item.GetExtraData()) {
+		targetFile = item.GetExtraData()->targetFile_;
+		extraFlags = item.GetExtraData()->extraFlags_;
+	}
+
+	transfer_flags flags = item.flags() - queue_flags::mask;
+	if (item.queued()) {
+		flags |= queue_flags::queued;
+	}
+
+	// Added in reverse so that the segments end up in order at the front.
+	// The item itself takes the first segment.
+	std::vector<CFileItem*> parts;
+	for (size_t i = offsets.size() - 1; i > 0; --i) {
+		uint64_t const offset = offsets[i];
+		uint64_t const partSize = segment_size(offset);
+
+		auto part = new CFileItem(&serverItem, flags, item.GetSourceFile(), targetFile, item.GetLocalPath(), item.GetRemotePath(), static_cast<int64_t>(partSize), extraFlags);
+		part->SetPriorityRaw(item.GetPriority());
+		part->m_defaultFileExistsAction = item.m_defaultFileExistsAction;
+		part->SetSegment(segments, offset, partSize);
+		InsertItem(&serverItem, part);
+		parts.push_back(part);
+	}
+	for (auto part : parts) {
+		serverItem.PrioritizeFile(part);
+	}
+
+	UpdateItemSize(&item, static_cast<int64_t>(segment_size(offsets[0])));
+	item.SetSegment(segments, offsets[0], segment_size(offsets[0]));
+
+	CommitChanges();
+
+	return true;
+}
+
+bool CQueueView::CompleteSegment(CFileItem & item)
+{
+	auto const& extraData = item.GetExtraData();
+	auto & segments = *extraData->segments_;
+
+	segments.pending_.erase(extraData->segmentOffset_);
+	segments.SaveDone(extraData->segmentOffset_);
+	if (!segments.pending_.empty()) {
+		return true;
+	}
+
+	if (segments.abandoned_) {
+		m_pMainFrame->GetStatusView()->AddToLog(logmsg::error, fz::sprintf(fztranslate("Not all segments of '%s' have been downloaded, keeping incomplete file '%s'."), segments.target_, segments.partFile_), fz::datetime::now());
+		return true;
+	}
+
+	// Only the size of the assembled file is checked. Checksums get computed
+	// while transferring a whole file, see OPTION_VERIFY_CHECKSUMS, so they
+	// cannot cover segments.
+	if (options_.get_int(OPTION_VERIFY_CHECKSUMS)) {
+		m_pMainFrame->GetStatusView()->AddToLog(logmsg::status, fz::sprintf(fztranslate("Checksum of '%s' not verified, it got downloaded in segments."), segments.target_), fz::datetime::now());
+	}
+
+	std::wstring error;
+	if (fz::local_filesys::get_size(fz::to_native(segments.partFile_)) != segments.size_) {
+		error = fz::sprintf(fztranslate("Size of '%s' does not match after downloading all segments."), segments.partFile_);
+	}
+	else if (!fz::rename_file(fz::to_native(segments.partFile_), fz::to_native(segments.target_))) {
+		error = fz::sprintf(fztranslate("Could not rename '%s' to '%s'."), segments.partFile_, segments.target_);
+	}
+
+	if (!error.empty()) {
+		segments.pending_.insert(extraData->segmentOffset_);
+		m_pMainFrame->GetStatusView()->AddToLog(logmsg::error, std::move(error), fz::datetime::now());
+		return false;
+	}
+
+	segments.RemoveState();
+
+	return true;
+}
+
 void CQueueView::UpdateItemSize(CFileItem* pItem, int64_t size)
 {
 	wxASSERT(pItem);
@@ -2427,6 +2912,7 @@ void CQueueView::UpdateItemSize(CFileItem* pItem, int64_t size)
 	}
 
 	pItem->SetSize(size);
+	StoreItem(*pItem);
 
 	DisplayQueueSize();
 }
@@ -2439,8 +2925,10 @@ void CQueueView::AdvanceQueue(bool refresh)
 	}
 
 	insideAdvanceQueue = true;
-	while (TryStartNextTransfer()) {
-	}
+	LoadSpilledItems();
+	StartTransfers();
+
+	WarmUpEngines();
 
 	// Set timer for connected, idle engines
 	for (unsigned int i = 0; i < m_engineData.size(); ++i) {
@@ -2475,6 +2963,238 @@ void CQueueView::AdvanceQueue(bool refresh)
 	CheckQueueState();
 }
 
+int CQueueView::GetMaxEngineCount() const
+{
+	// Spare engines come on top of the engines needed for the transfers
+	return options_.get_int(OPTION_NUMTRANSFERS) + options_.get_int(OPTION_WARM_CONNECTIONS) * static_cast<int>(m_serverList.size());
+}
+
+void CQueueView::WarmUpEngines()
+{
+	int const spares = options_.get_int(OPTION_WARM_CONNECTIONS);
+	if (!spares || m_quit || !m_activeMode) {
+		return;
+	}
+
+	int transient{};
+	for (auto const& data : m_engineData) {
+		if (data->transient) {
+			++transient;
+		}
+	}
+
+	for (auto const& serverItem : m_serverList) {
+		Site const& site = serverItem->GetSite();
+		if (!serverItem->GetIdleChild(m_activeMode == 1, TransferDirection::both)) {
+			continue;
+		}
+		if (!CLoginManager::Get().GetPassword(site, true)) {
+			continue;
+		}
+		if (serverItem->m_warmupBlockedUntil && fz::monotonic_clock::now() < serverItem->m_warmupBlockedUntil) {
+			continue;
+		}
+
+		int connections{};
+		int warm{};
+		for (auto const& data : m_engineData) {
+			if (data->transient || data->lastSite != site) {
+				continue;
+			}
+			if (data->active) {
+				++connections;
+			}
+			else if (data->state == t_EngineData::warmup || data->pEngine->IsConnected()) {
+				++connections;
+				++warm;
+			}
+		}
+
+		int const maxConnections = site.server.MaximumMultipleConnections();
+		while (warm < spares && (!maxConnections || connections < maxConnections)) {
+			t_EngineData* data{};
+			for (auto const& candidate : m_engineData) {
+				if (!candidate->active && !candidate->transient && candidate->state != t_EngineData::warmup && !candidate->pEngine->IsConnected()) {
+					data = candidate;
+					break;
+				}
+			}
+			if (!data) {
+				if (GetMaxEngineCount() <= static_cast<int>(m_engineData.size()) - transient) {
+					return;
+				}
+
+				data = new t_EngineData;
+				data->pEngine = new CFileZillaEngine(m_pMainFrame->GetEngineContext(), fz::make_invoker(*this, [this](CFileZillaEngine* engine) { OnEngineEvent(engine); }));
+				m_engineData.push_back(data);
+			}
+
+			data->lastSite = site;
+			data->state = t_EngineData::warmup;
+			data->warmStart_ = fz::monotonic_clock::now();
+			int res = data->pEngine->Execute(CConnectCommand(site.server, site.Handle(), site.credentials, false));
+			if (res != FZ_REPLY_WOULDBLOCK) {
+				data->state = t_EngineData::none;
+				return;
+			}
+			++connections;
+			++warm;
+		}
+	}
+}
+
+namespace {
+// In seconds
+int const concurrencyInterval = 5;
+
+// Number of intervals without change after which another transfer gets tried
+int const concurrencyProbeIntervals = 6;
+}
+
+int CQueueView::GetConcurrencyBound(CServerItem const& server) const
+{
+	int bound = options_.get_int(OPTION_NUMTRANSFERS);
+	int const maxConnections = server.GetSite().server.MaximumMultipleConnections();
+	if (maxConnections && maxConnections < bound) {
+		bound = maxConnections;
+	}
+	return std::max(1, bound);
+}
+
+void CQueueView::SampleThroughput()
+{
+	for (auto const& engineData : m_engineData) {
+		if (!engineData->active || !engineData->pItem || !engineData->pStatusLineCtrl) {
+			continue;
+		}
+		if (engineData->pItem->GetType() != QueueItemType::File) {
+			continue;
+		}
+		CServerItem* pServerItem = static_cast<CServerItem*>(engineData->pItem->GetTopLevelItem());
+		if (pServerItem) {
+			pServerItem->m_adaptive.bytes_ += engineData->pStatusLineCtrl->TakeTransferredBytes();
+		}
+	}
+
+	// Only while all allowed transfers are running does the throughput
+	// tell anything about the limit.
+	for (auto * pServerItem : m_serverList) {
+		if (pServerItem->m_activeCount < pServerItem->m_adaptive.limit_) {
+			pServerItem->m_adaptive.saturated_ = false;
+		}
+	}
+
+	if (++m_concurrencySamples >= concurrencyInterval) {
+		m_concurrencySamples = 0;
+		AdaptConcurrency();
+	}
+
+	if (!m_activeCount) {
+		m_concurrencyTimer.Stop();
+		CStatusBar* pStatusBar = dynamic_cast<CStatusBar*>(m_pMainFrame->GetStatusBar());
+		if (pStatusBar) {
+			pStatusBar->DisplayConcurrency(wxString());
+		}
+	}
+}
+
+void CQueueView::AdaptConcurrency()
+{
+	bool changed{};
+	for (auto * pServerItem : m_serverList) {
+		auto & adaptive = pServerItem->m_adaptive;
+		if (!adaptive.limit_) {
+			continue;
+		}
+
+		int const oldLimit = adaptive.limit_;
+		int const bound = GetConcurrencyBound(*pServerItem);
+		int64_t const rate = adaptive.bytes_ / concurrencyInterval;
+
+		if (!adaptive.saturated_) {
+			// Not enough files or other limits in effect
+			adaptive.rate_ = -1;
+			adaptive.probing_ = false;
+		}
+		else if (adaptive.probing_ && rate * 20 < adaptive.rate_ * 21) {
+			// Less than 5% gained, the added transfer only competes with
+			// the others. Keep the previous rate as reference.
+			--adaptive.limit_;
+			adaptive.probing_ = false;
+		}
+		else if (!adaptive.probing_ && adaptive.rate_ >= 0 && rate * 5 < adaptive.rate_ * 4) {
+			// Dropped by more than 20%, back off multiplicatively
+			adaptive.limit_ -= std::max(1, adaptive.limit_ / 4);
+			adaptive.rate_ = rate;
+		}
+		else {
+			bool const probe = adaptive.rate_ < 0 || adaptive.probing_ || adaptive.holds_ >= concurrencyProbeIntervals;
+			adaptive.rate_ = rate;
+			adaptive.probing_ = probe && adaptive.limit_ < bound;
+			if (adaptive.probing_) {
+				++adaptive.limit_;
+			}
+		}
+
+		adaptive.limit_ = std::clamp(adaptive.limit_, 1, bound);
+		if (adaptive.limit_ != oldLimit) {
+			adaptive.holds_ = 0;
+			changed = true;
+		}
+		else {
+			++adaptive.holds_;
+		}
+
+		adaptive.bytes_ = 0;
+		adaptive.saturated_ = true;
+	}
+
+	DisplayConcurrency();
+
+	if (changed && m_activeMode) {
+		AdvanceQueue(false);
+	}
+}
+
+void CQueueView::StopAdaptingConcurrency()
+{
+	m_concurrencyTimer.Stop();
+	for (auto * pServerItem : m_serverList) {
+		pServerItem->m_adaptive = CServerItem::adaptive_concurrency();
+	}
+
+	CStatusBar* pStatusBar = dynamic_cast<CStatusBar*>(m_pMainFrame->GetStatusBar());
+	if (pStatusBar) {
+		pStatusBar->DisplayConcurrency(wxString());
+	}
+}
+
+void CQueueView::DisplayConcurrency()
+{
+	CStatusBar* pStatusBar = dynamic_cast<CStatusBar*>(m_pMainFrame->GetStatusBar());
+	if (!pStatusBar) {
+		return;
+	}
+
+	wxString limits;
+	for (auto const* pServerItem : m_serverList) {
+		if (!pServerItem->m_adaptive.limit_ || !pServerItem->m_activeCount) {
+			continue;
+		}
+		if (!limits.empty()) {
+			limits += _T(", ");
+		}
+		limits += wxString::Format(_("%s: %d of %d"), pServerItem->GetName(), pServerItem->m_adaptive.limit_, GetConcurrencyBound(*pServerItem));
+	}
+
+	if (limits.empty()) {
+		pStatusBar->DisplayConcurrency(wxString());
+	}
+	else {
+		pStatusBar->DisplayConcurrency(wxString::Format(_("Transfers per server: %s"), limits));
+	}
+}
+
 void CQueueView::InsertItem(CServerItem* pServerItem, CQueueItem* pItem)
 {
 	CQueueViewBase::InsertItem(pServerItem, pItem);
@@ -2490,6 +3210,240 @@ void CQueueView::InsertItem(CServerItem* pServerItem, CQueueItem* pItem)
 			m_totalQueueSize += size;
 		}
 	}
+
+	if (pItem->GetType() == QueueItemType::File || pItem->GetType() == QueueItemType::Folder) {
+		CFileItem & item = static_cast<CFileItem&>(*pItem);
+		if (item.IsSegment()) {
+			++item.GetExtraData()->segments_->queued_;
+		}
+		else if (!item.GetStorageId()) {
+			m_queue_storage.Store(item, *pServerItem);
+		}
+	}
+}
+
+void CQueueView::StoreItem(CFileItem & item)
+{
+	if (item.GetStorageId()) {
+		m_queue_storage.Store(item, *static_cast<CServerItem*>(item.GetTopLevelItem()));
+	}
+}
+
+void CQueueView::StoreItems(CServerItem & server)
+{
+	if (!m_queue_storage.Journaling()) {
+		return;
+	}
+
+	auto const& children = server.GetChildren();
+	for (auto it = children.begin() + server.GetRemovedAtFront(); it != children.end(); ++it) {
+		if ((*it)->GetType() != QueueItemType::File && (*it)->GetType() != QueueItemType::Folder) {
+			continue;
+		}
+		CFileItem & item = static_cast<CFileItem&>(**it);
+		if (!item.GetStorageId()) {
+			continue;
+		}
+		m_queue_storage.Store(item, server);
+	}
+}
+
+void CQueueView::ForgetItem(CFileItem & item)
+{
+	if (item.IsSegment()) {
+		auto & segments = *item.GetExtraData()->segments_;
+		if (segments.queued_ > 0 && !--segments.queued_) {
+			m_queue_storage.RemoveFile(segments.storageId_);
+			segments.storageId_ = 0;
+		}
+	}
+	else if (item.GetStorageId()) {
+		m_queue_storage.RemoveFile(item.GetStorageId());
+		item.SetStorageId(0);
+	}
+}
+
+bool CQueueView::SpillItem(CServerItem & server, CFileItem * item)
+{
+	int const limit = options_.get_int(OPTION_QUEUE_FILES_IN_MEMORY);
+	if (!limit || !m_queue_storage.Journaling() || m_queue_storage.Failed() || item->m_edit != CEditHandler::none) {
+		return false;
+	}
+
+	auto & spilled = server.m_spilled;
+	if (!spilled.count_ && static_cast<int>(server.GetChildrenCount(false)) < limit) {
+		return false;
+	}
+
+	m_queue_storage.Store(*item, server, true);
+	if (!item->GetStorageId()) {
+		return false;
+	}
+
+	++spilled.count_;
+
+	if (item->GetType() == QueueItemType::File) {
+		int64_t const size = item->GetSize();
+		if (size < 0) {
+			++spilled.unknownSize_;
+			++m_filesWithUnknownSize;
+		}
+		else {
+			spilled.size_ += size;
+			m_totalQueueSize += size;
+		}
+	}
+	++m_fileCount;
+	m_fileCountChanged = true;
+
+	delete item;
+
+	return true;
+}
+
+void CQueueView::LoadSpilledItems()
+{
+	int const limit = options_.get_int(OPTION_QUEUE_FILES_IN_MEMORY);
+
+	for (auto it = m_serverList.begin(); it != m_serverList.end(); ) {
+		CServerItem & server = **it;
+		auto & spilled = server.m_spilled;
+		if (!spilled.count_) {
+			++it;
+			continue;
+		}
+
+		// Refill once half of the loaded files are done
+		int const loaded = static_cast<int>(server.GetChildrenCount(false));
+		if (limit && loaded > limit / 2) {
+			++it;
+			continue;
+		}
+
+		// Highest priority first
+		int const count = limit ? std::min(limit - loaded, spilled.count_) : spilled.count_;
+		std::vector<std::pair<int64_t, CFileItem*>> files;
+		CQueueStorage::spilled_position pos;
+		bool consistent = m_queue_storage.FetchFiles(server.GetStorageId(), pos, count, files);
+
+		if (m_insertionStart != -1) {
+			CommitChanges();
+		}
+		for (auto const& file : files) {
+			CFileItem* item = file.second;
+			if (!item) {
+				consistent = false;
+				continue;
+			}
+			item->SetParent(&server);
+			item->SetStorageId(file.first);
+
+			// InsertItem accounts for it again
+			--spilled.count_;
+			--m_fileCount;
+			if (item->GetType() == QueueItemType::File) {
+				int64_t const size = item->GetSize();
+				if (size < 0) {
+					--spilled.unknownSize_;
+					--m_filesWithUnknownSize;
+				}
+				else {
+					spilled.size_ -= size;
+					m_totalQueueSize -= size;
+				}
+			}
+			InsertItem(&server, item);
+
+			// No longer spilled
+			m_queue_storage.Store(*item, server);
+		}
+
+		if (!consistent || files.size() < static_cast<size_t>(count) || spilled.count_ < 0 || spilled.unknownSize_ < 0) {
+			RecountSpilledItems(server);
+		}
+		CommitChanges();
+
+		if (server.GetChild(0) || spilled.count_) {
+			++it;
+			continue;
+		}
+
+		// Nothing left after all
+		UpdateSelections_ItemRangeRemoved(GetItemIndex(&server), 1);
+		m_queue_storage.RemoveServer(server.GetStorageId());
+		delete &server;
+		it = m_serverList.erase(it);
+		SaveSetItemCount(--m_itemCount);
+	}
+}
+
+void CQueueView::WriteToFile(pugi::xml_node element)
+{
+	auto queue = element.child("Queue");
+	if (!queue) {
+		queue = element.append_child("Queue");
+	}
+
+	for (auto const* server : m_serverList) {
+		server->SaveItem(queue);
+
+		auto const& spilled = server->m_spilled;
+		if (!spilled.count_) {
+			continue;
+		}
+
+		// Read in batches, there might be far too many to hold all of them
+		auto serverNode = queue.last_child();
+		int const batch = std::max(options_.get_int(OPTION_QUEUE_FILES_IN_MEMORY), 100);
+		CQueueStorage::spilled_position pos;
+		bool more = true;
+		while (more) {
+			std::vector<std::pair<int64_t, CFileItem*>> files;
+			more = m_queue_storage.FetchFiles(server->GetStorageId(), pos, batch, files) && files.size() == static_cast<size_t>(batch);
+			for (auto const& file : files) {
+				if (file.second) {
+					file.second->SaveItem(serverNode);
+					delete file.second;
+				}
+			}
+		}
+	}
+}
+
+void CQueueView::DropSpilledItems(CServerItem & server)
+{
+	auto & spilled = server.m_spilled;
+	if (!spilled.count_) {
+		return;
+	}
+
+	m_queue_storage.RemoveFiles(server.GetStorageId());
+
+	m_fileCount -= spilled.count_;
+	m_fileCountChanged = true;
+	m_totalQueueSize -= spilled.size_;
+	m_filesWithUnknownSize -= spilled.unknownSize_;
+
+	spilled = CServerItem::spilled_files();
+}
+
+void CQueueView::RecountSpilledItems(CServerItem & server)
+{
+	auto & spilled = server.m_spilled;
+
+	int count{};
+	int64_t size{};
+	int unknownSize{};
+	m_queue_storage.CountFiles(server.GetStorageId(), count, size, unknownSize);
+
+	m_fileCount += count - spilled.count_;
+	m_fileCountChanged = true;
+	m_totalQueueSize += size - spilled.size_;
+	m_filesWithUnknownSize += unknownSize - spilled.unknownSize_;
+
+	spilled.count_ = count;
+	spilled.size_ = size;
+	spilled.unknownSize_ = unknownSize;
 }
 
 void CQueueView::CommitChanges()
@@ -2517,6 +3471,16 @@ void CQueueView::OnTimer(wxTimerEvent& event)
 		return;
 	}
 
+	if (id == m_transferStatusTimer.GetId()) {
+		UpdateTransferStatus();
+		return;
+	}
+
+	if (id == m_concurrencyTimer.GetId()) {
+		SampleThroughput();
+		return;
+	}
+
 	for (auto & pData : m_engineData) {
 		if (pData->m_idleDisconnectTimer && !pData->m_idleDisconnectTimer->IsRunning()) {
 			delete pData->m_idleDisconnectTimer;
@@ -2590,6 +3554,16 @@ void CQueueView::OnSetPriority(wxCommandEvent& event)
 		}
 
 		pItem->SetPriority(priority);
+		if (pItem->GetType() == QueueItemType::Server) {
+			auto & server = static_cast<CServerItem&>(*pItem);
+			StoreItems(server);
+			if (server.m_spilled.count_) {
+				m_queue_storage.SetPriority(server.GetStorageId(), static_cast<int>(priority));
+			}
+		}
+		else if (pItem->GetType() == QueueItemType::File || pItem->GetType() == QueueItemType::Folder) {
+			StoreItem(static_cast<CFileItem&>(*pItem));
+		}
 	}
 
 	RefreshListOnly();
@@ -2950,6 +3924,7 @@ void CQueueView::RenameFileInTransfer(CFileZillaEngine *pEngine, std::wstring co
 	else {
 		pFile->SetTargetFile(newName);
 	}
+	StoreItem(*pFile);
 
 	RefreshItem(pFile);
 }
@@ -3021,8 +3996,12 @@ WXLRESULT CQueueView::MSWWindowProc(WXUINT nMsg, WXWPARAM wParam, WXLPARAM lPara
 }
 #endif
 
-void CQueueView::OnOptionsChanged(watched_options const&)
+void CQueueView::OnOptionsChanged(watched_options const& options)
 {
+	if (options.test(OPTION_ADAPTIVE_CONCURRENCY) && !options_.get_bool(OPTION_ADAPTIVE_CONCURRENCY)) {
+		StopAdaptingConcurrency();
+	}
+
 	if (m_activeMode) {
 		AdvanceQueue();
 	}
@@ -3078,6 +4057,9 @@ void CQueueView::OnStateChange(CState*, t_statechange_notifications notification
 			}
 
 			protect((*it)->GetCredentials());
+			if ((*it)->GetStorageId()) {
+				m_queue_storage.Store(**it);
+			}
 			++it;
 		}
 	}
@@ -3094,6 +4076,8 @@ void CQueueView::OnColumnClicked(wxListEvent &event)
 	int const col = event.GetColumn();
 	bool const reverse = wxGetKeyState(WXK_SHIFT);
 
+	// Not stored, rewriting all rows on every click is too expensive. The
+	// stored queue keeps the order in which files got queued.
 	for (auto * serverItem : m_serverList) {
 		serverItem->Sort(col, reverse);
 	}
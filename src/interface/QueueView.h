@@ -73,13 +73,19 @@ struct t_EngineData final
 		list,
 		mkdir,
 		askpassword,
-		waitprimary
+		waitprimary,
+		warmup // Connecting ahead of time, see CQueueView::WarmUpEngines
 	} state;
 
 	CFileItem* pItem;
 	Site lastSite;
 	CStatusLineCtrl* pStatusLineCtrl;
 	wxTimer* m_idleDisconnectTimer;
+
+	// Time it took to establish the connection if connected ahead of time
+	// and not yet used by a transfer
+	fz::duration warmSetupTime_;
+	fz::monotonic_clock warmStart_;
 };
 
 class CMainFrame;
@@ -141,6 +147,9 @@ public:
 
 	void UpdateItemSize(CFileItem* pItem, int64_t size);
 
+	// A single timer polls the transfer status of all status lines
+	void StartTransferStatusTimer();
+
 	void RemoveAll();
 
 	void LoadQueue();
@@ -150,6 +159,9 @@ public:
 
 	virtual void CommitChanges() override;
 
+	// Also writes the files only kept in the stored queue
+	virtual void WriteToFile(pugi::xml_node element) override;
+
 	virtual void ProcessNotification(CFileZillaEngine* pEngine, std::unique_ptr<CNotification>&& pNotification) override;
 
 	void RenameFileInTransfer(CFileZillaEngine *pEngine, std::wstring const& newName, bool local, fz::writer_factory_holder & new_writer);
@@ -167,15 +179,30 @@ protected:
 	virtual void OnOptionsChanged(watched_options const& options) override;
 
 	void AdvanceQueue(bool refresh = true);
-	bool TryStartNextTransfer();
 
-	// Called from TryStartNextTransfer(), checks
+	// Fills the free transfer slots with idle files of all servers
+	void StartTransfers();
+	void StartTransfer(CServerItem & server, CFileItem & item, t_EngineData & engineData);
+
+	// Returns false if no further transfer may be started
+	bool GetWantedDirection(TransferDirection & direction) const;
+
+	// Creates downloaded empty directories on the way, their paths get
+	// added to folders. Sets removed if the server item got deleted.
+	CFileItem* GetNextIdleFile(CServerItem & server, TransferDirection direction, std::vector<std::wstring> & folders, bool & removed);
+
+	// Called from StartTransfers(), checks
 	// whether it is allowed to start another transfer on that server item
 	bool CanStartTransfer(const CServerItem& server_item, t_EngineData *&pEngineData);
 
 	void ProcessReply(t_EngineData* pEngineData, COperationNotification const& notification);
 	void SendNextCommand(t_EngineData& engineData);
 
+	// Whether the file the server would transfer next is in the same remote
+	// directory. If so, the engine gets told to prepare for it while still
+	// transferring the item.
+	bool IsFollowedInSameDirectory(CFileItem & item);
+
 	enum class ResetReason
 	{
 		success,
@@ -185,7 +212,14 @@ protected:
 		remove
 	};
 
-	void ResetEngine(t_EngineData& data, const ResetReason reason);
+	void ResetEngine(t_EngineData& data, ResetReason reason);
+
+	// Splits a large download into several segments downloaded in parallel,
+	// continuing the segments of an earlier attempt if there are any
+	bool SplitDownload(CServerItem & serverItem, CFileItem & item);
+
+	// Returns false if the file could not be put together from its segments
+	bool CompleteSegment(CFileItem & item);
 	void DeleteEngines();
 
 	virtual bool RemoveItem(CQueueItem* item, bool destroy, bool updateItemCount = true, bool updateSelections = true, bool forward = true) override;
@@ -198,6 +232,7 @@ protected:
 	void CheckQueueState();
 	bool IncreaseErrorCount(t_EngineData& engineData);
 	void UpdateStatusLinePositions();
+	void UpdateTransferStatus();
 	void CalculateQueueSize();
 	void DisplayQueueSize();
 	void SaveQueue(bool silent = false);
@@ -221,6 +256,27 @@ protected:
 	bool IsOtherEngineConnected(t_EngineData* pEngineData);
 
 	t_EngineData* GetIdleEngine(Site const& site = Site(), bool allowTransient = false);
+
+	// Connects spare engines to servers with waiting items, so that
+	// transfers can start without connection setup.
+	void WarmUpEngines();
+	int GetMaxEngineCount() const;
+
+	// With OPTION_ADAPTIVE_CONCURRENCY, the number of transfers per server
+	// gets raised one at a time as long as that increases the throughput,
+	// and cut back once the throughput drops.
+	void SampleThroughput();
+	void AdaptConcurrency();
+	void StopAdaptingConcurrency();
+	int GetConcurrencyBound(CServerItem const& server) const;
+	void DisplayConcurrency();
+	wxTimer m_concurrencyTimer;
+	int m_concurrencySamples{};
+
+	// Transfers that started on a warm connection and the connection setup
+	// time saved by them
+	int m_warmHits{};
+	fz::duration m_warmSaved;
 	t_EngineData* GetEngineData(const CFileZillaEngine* pEngine);
 
 	std::vector<t_EngineData*> m_engineData;
@@ -239,6 +295,9 @@ protected:
 	int m_activeCount{};
 	int m_activeCountDown{};
 	int m_activeCountUp{};
+
+	// Incremented on each start, see CServerItem::m_lastStarted
+	uint64_t m_transferStarts{};
 	int m_activeMode{}; // 0 inactive, 1 only immediate transfers, 2 all
 	int m_quit{};
 
@@ -268,6 +327,7 @@ protected:
 #endif
 
 	wxTimer m_resize_timer;
+	wxTimer m_transferStatusTimer;
 
 	void ReleaseExclusiveEngineLock(CFileZillaEngine* pEngine);
 
@@ -279,6 +339,21 @@ protected:
 
 	CQueueStorage m_queue_storage;
 
+	// Keep the rows of the stored queue in sync with the items
+	void StoreItem(CFileItem & item);
+	void StoreItems(CServerItem & server);
+	void ForgetItem(CFileItem & item);
+
+	// Once a server has OPTION_QUEUE_FILES_IN_MEMORY files, further files
+	// are only written to the stored queue. They get loaded by priority as
+	// the loaded files get transferred. Until then they are not listed and
+	// only get reprioritized or removed along with their server.
+	// Takes ownership of the item if it returns true.
+	bool SpillItem(CServerItem & server, CFileItem * item);
+	void LoadSpilledItems();
+	void DropSpilledItems(CServerItem & server);
+	void RecountSpilledItems(CServerItem & server);
+
 	void OnEngineEvent(CFileZillaEngine* engine);
 
 	void OnAskPassword();
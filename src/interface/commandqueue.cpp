@@ -304,6 +304,10 @@ void CCommandQueue::ProcessDirectoryListing(CDirectoryListingNotification const&
 	}
 
 	if (listingIsRecursive) {
+		if (listingNotification.Stale()) {
+			// Only the refreshed listing is of use
+			return;
+		}
 		if (listingNotification.Primary() && m_state.GetRemoteRecursiveOperation()->IsActive()) {
 			m_state.NotifyHandlers(STATECHANGE_REMOTE_DIR_OTHER, std::wstring(), &pListing);
 		}
@@ -312,7 +316,7 @@ void CCommandQueue::ProcessDirectoryListing(CDirectoryListingNotification const&
 		m_state.SetRemoteDir(pListing, listingNotification.Primary());
 	}
 
-	if (pListing && !listingNotification.Failed() && m_state.GetSite()) {
+	if (pListing && !listingNotification.Failed() && !listingNotification.Stale() && m_state.GetSite()) {
 		CContextManager::Get()->ProcessDirectoryListing(m_state.GetSite().server, pListing, listingIsRecursive ? 0 : &m_state);
 	}
 }
@@ -13,7 +13,7 @@ public:
 
 protected:
 	wxWindow* const m_parent;
-	const CQueueView* const m_pQueueView;
+	CQueueView* const m_pQueueView;
 };
 
 #endif
@@ -160,6 +160,7 @@ CMenuBar::CMenuBar(CMainFrame& mainFrame, COptions& options)
 		debug->Append(XRCID("ID_CLEARCACHE_LAYOUT"), _("Clear &layout cache"));
 		debug->Append(XRCID("ID_CIPHERS"), _("&TLS Ciphers"), _("Shows available TLS ciphers"));
 		debug->Append(XRCID("ID_CLEAR_UPDATER"), _("Clear auto&update data"));
+		debug->Append(XRCID("ID_DIRCACHE_STATS"), _("&Directory cache statistics"));
 		Append(debug, _("&Debug"));
 	}
 
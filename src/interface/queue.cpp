@@ -10,6 +10,10 @@
 
 #include <wx/filedlg.h>
 
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/format.hpp>
+#include <libfilezilla/local_filesys.hpp>
+
 CQueueItem::CQueueItem(CQueueItem* parent)
 	: m_parent(parent)
 {
@@ -250,6 +254,9 @@ CFileItem::CFileItem(CServerItem* parent, transfer_flags const& flags,
 
 CFileItem::~CFileItem()
 {
+	if (IsSegment() && extra_data_->segments_->pending_.erase(extra_data_->segmentOffset_)) {
+		extra_data_->segments_->abandoned_ = true;
+	}
 }
 
 void CFileItem::SetPriority(QueuePriority priority)
@@ -295,14 +302,19 @@ void CFileItem::SaveItem(pugi::xml_node& element) const
 		return;
 	}
 
+	int64_t size;
+	if (!GetSaveSize(size)) {
+		return;
+	}
+
 	auto file = element.append_child("File");
 
 	AddTextElement(file, "LocalFile", m_localPath.GetPath() + GetLocalFile());
 	AddTextElement(file, "RemoteFile", GetRemoteFile());
 	AddTextElement(file, "RemotePath", m_remotePath.GetSafePath());
 	AddTextElement(file, "Flags", static_cast<int64_t>(flags_ - queue_flags::mask));
-	if (m_size != -1) {
-		AddTextElement(file, "Size", m_size);
+	if (size != -1) {
+		AddTextElement(file, "Size", size);
 	}
 	if (m_errorCount) {
 		AddTextElement(file, "ErrorCount", m_errorCount);
@@ -330,24 +342,136 @@ bool CFileItem::TryRemoveAll()
 
 void CFileItem::SetTargetFile(std::wstring const& file)
 {
-	std::wstring extraFlags;
+	extra_data data;
 	if (extra_data_) {
-		extraFlags = extra_data_->extraFlags_;
+		data = *extra_data_;
 	}
 
 	if (!file.empty() && file != m_sourceFile) {
-		extra_data_ = fz::sparse_optional<extra_data>({file, extraFlags});
+		data.targetFile_ = file;
 	}
 	else {
-		if (extraFlags.empty()) {
-			extra_data_.clear();
-		}
-		else {
-			extra_data_ = fz::sparse_optional<extra_data>({{}, extraFlags});
+		data.targetFile_.clear();
+	}
+
+	if (data.targetFile_.empty() && data.extraFlags_.empty() && !data.segments_) {
+		extra_data_.clear();
+	}
+	else {
+		extra_data_ = fz::sparse_optional<extra_data>(data);
+	}
+}
+
+void CFileItem::SetSegment(std::shared_ptr<CDownloadSegments> const& segments, uint64_t offset, uint64_t size)
+{
+	extra_data data;
+	if (extra_data_) {
+		data = *extra_data_;
+	}
+	data.segments_ = segments;
+	data.segmentOffset_ = offset;
+	data.segmentSize_ = size;
+	extra_data_ = fz::sparse_optional<extra_data>(data);
+
+	segments->pending_.insert(offset);
+}
+
+int CDownloadSegments::LoadState(std::set<uint64_t> & done) const
+{
+	done.clear();
+
+	fz::file f(fz::to_native(stateFile_), fz::file::reading);
+	if (!f) {
+		return 0;
+	}
+
+	int64_t const len = f.size();
+	if (len <= 0 || len > 64 * 1024) {
+		return 0;
+	}
+	std::string data(static_cast<size_t>(len), '\0');
+	if (f.read(data.data(), len) != len) {
+		return 0;
+	}
+
+	// First line holds file size and segment count, then one completed
+	// offset per line
+	auto const lines = fz::strtok_view(data, '\n');
+	if (lines.empty()) {
+		return 0;
+	}
+	auto const header = fz::strtok_view(lines[0], ' ');
+	if (header.size() != 2 || fz::to_integral<int64_t>(header[0], -1) != size_) {
+		return 0;
+	}
+	int const count = fz::to_integral<int>(header[1]);
+	if (count < 2 || size_ < count) {
+		return 0;
+	}
+	if (fz::local_filesys::get_size(fz::to_native(partFile_)) != size_) {
+		return 0;
+	}
+
+	uint64_t const segmentSize = static_cast<uint64_t>(size_) / count;
+	for (size_t i = 1; i < lines.size(); ++i) {
+		uint64_t const offset = fz::to_integral<uint64_t>(lines[i], static_cast<uint64_t>(-1));
+		if (offset % segmentSize || offset / segmentSize >= static_cast<uint64_t>(count)) {
+			done.clear();
+			return 0;
 		}
+		done.insert(offset);
+	}
+
+	return count;
+}
+
+void CDownloadSegments::SaveState(int count) const
+{
+	fz::file f(fz::to_native(stateFile_), fz::file::writing, fz::file::empty);
+	if (f) {
+		std::string const header = fz::sprintf("%d %d\n", size_, count);
+		f.write(header.c_str(), static_cast<int64_t>(header.size()));
+	}
+}
+
+void CDownloadSegments::SaveDone(uint64_t offset) const
+{
+	fz::file f(fz::to_native(stateFile_), fz::file::writing, fz::file::existing);
+	if (f && f.seek(0, fz::file::end) > 0) {
+		std::string const line = fz::sprintf("%d\n", offset);
+		f.write(line.c_str(), static_cast<int64_t>(line.size()));
+	}
+}
+
+void CDownloadSegments::Discard() const
+{
+	if (fz::local_filesys::get_file_type(fz::to_native(stateFile_)) == fz::local_filesys::file) {
+		fz::remove_file(fz::to_native(partFile_));
+		RemoveState();
 	}
 }
 
+void CDownloadSegments::RemoveState() const
+{
+	fz::remove_file(fz::to_native(stateFile_));
+}
+
+bool CFileItem::GetSaveSize(int64_t & size) const
+{
+	if (!IsSegment()) {
+		size = m_size;
+		return true;
+	}
+
+	// The first segment not yet downloaded stands in for the file.
+	auto const& segments = *extra_data_->segments_;
+	if (segments.pending_.empty() || *segments.pending_.begin() != extra_data_->segmentOffset_) {
+		return false;
+	}
+	size = segments.size_;
+	return true;
+}
+
 void CFileItem::SetStatusMessage(CFileItem::Status status)
 {
 	m_status = status;
@@ -722,6 +846,16 @@ void CServerItem::QueueImmediateFile(CFileItem* pItem)
 	wxASSERT(false);
 }
 
+void CServerItem::PrioritizeFile(CFileItem* pItem)
+{
+	std::deque<CFileItem*>& fileList = m_fileList[pItem->queued() ? 0 : 1][static_cast<int>(pItem->GetPriority())];
+	auto it = std::find(fileList.begin(), fileList.end(), pItem);
+	if (it != fileList.end()) {
+		fileList.erase(it);
+		fileList.push_front(pItem);
+	}
+}
+
 void CServerItem::SaveItem(pugi::xml_node& element) const
 {
 	auto server_node = element.append_child("Server");
@@ -756,7 +890,9 @@ int64_t CServerItem::GetTotalSize(int& filesWithUnknownSize, int& queuedFiles) c
 			queuedFiles++;
 	}
 
-	return totalSize;
+	filesWithUnknownSize += m_spilled.unknownSize_;
+	queuedFiles += m_spilled.count_;
+	return totalSize + m_spilled.size_;
 }
 
 bool CServerItem::TryRemoveAll()
@@ -964,6 +1100,10 @@ wxString CQueueViewBase::OnGetItemText(CQueueItem* pItem, ColumnId column) const
 			if (!column) {
 				return pServerItem->GetName();
 			}
+			else if (column == colRemoteName && pServerItem->m_spilled.count_) {
+				int const count = pServerItem->m_spilled.count_;
+				return wxString::Format(wxPLURAL("%d more file not loaded yet", "%d more files not loaded yet", count), count);
+			}
 		}
 		break;
 	case QueueItemType::File:
@@ -1425,7 +1565,7 @@ bool CQueueViewBase::RemoveItem(CQueueItem* pItem, bool destroy, bool updateItem
 	bool didRemoveParent;
 
 	int oldCount = m_itemCount;
-	if (!topLevelItem->GetChild(0)) {
+	if (!topLevelItem->GetChild(0) && !static_cast<CServerItem*>(topLevelItem)->m_spilled.count_) {
 		std::vector<CServerItem*>::iterator iter;
 		for (iter = m_serverList.begin(); iter != m_serverList.end(); ++iter) {
 			if (*iter == topLevelItem) {
@@ -1564,7 +1704,7 @@ void CQueueViewBase::OnKeyDown(wxKeyEvent& event)
 	}
 }
 
-void CQueueViewBase::WriteToFile(pugi::xml_node element) const
+void CQueueViewBase::WriteToFile(pugi::xml_node element)
 {
 	auto queue = element.child("Queue");
 	if (!queue) {
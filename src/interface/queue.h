@@ -7,6 +7,9 @@
 
 #include <libfilezilla/optional.hpp>
 
+#include <memory>
+#include <set>
+
 enum class QueuePriority : unsigned char {
 	lowest,
 	low,
@@ -60,6 +63,10 @@ public:
 
 	int GetRemovedAtFront() const { return m_removed_at_front; }
 
+	// Row of the item in the queue database, 0 if not stored
+	int64_t GetStorageId() const { return m_storageId; }
+	void SetStorageId(int64_t id) { m_storageId = id; }
+
 protected:
 	CQueueItem(CQueueItem* parent = 0);
 
@@ -76,6 +83,8 @@ private:
 	// Increased instead of calling slow m_children.erase(0),
 	// resetted on insert.
 	int m_removed_at_front{};
+
+	int64_t m_storageId{};
 };
 
 class CFileItem;
@@ -104,6 +113,9 @@ public:
 	void QueueImmediateFiles();
 	void QueueImmediateFile(CFileItem* pItem);
 
+	// Moves the file to the front of the items with the same priority
+	void PrioritizeFile(CFileItem* pItem);
+
 	virtual void SaveItem(pugi::xml_node& element) const override;
 
 	void SetDefaultFileExistsAction(CFileExistsNotification::OverwriteAction action, const TransferDirection direction);
@@ -116,6 +128,38 @@ public:
 
 	int m_activeCount;
 
+	// When the last transfer of this server has been started, used to
+	// share transfer slots fairly between servers.
+	uint64_t m_lastStarted{};
+
+	// Files only kept in the queue database, see CQueueView::SpillItem.
+	// Their rows are flagged as spilled, see CQueueStorage::Store.
+	struct spilled_files final
+	{
+		int count_{};
+		int unknownSize_{};
+		int64_t size_{};
+	};
+	spilled_files m_spilled;
+
+	// Transfer limit found by CQueueView::AdaptConcurrency, limit_ is 0 if
+	// not adapting.
+	struct adaptive_concurrency final
+	{
+		int limit_{};
+		int64_t bytes_{}; // Transferred in the current interval
+		int64_t rate_{-1}; // Bytes per second with the current limit
+		bool saturated_{}; // Whether all slots were used all interval long
+		bool probing_{}; // Whether the limit just got raised
+		int holds_{}; // Intervals since the limit last changed
+	};
+	adaptive_concurrency m_adaptive;
+
+	// Set by CQueueView::ProcessReply if connecting a spare engine failed,
+	// CQueueView::WarmUpEngines leaves the server alone until then.
+	fz::monotonic_clock m_warmupBlockedUntil;
+	int m_warmupFailures{};
+
 	const std::vector<CQueueItem*>& GetChildren() const { return m_children; }
 
 	void Sort(int col, bool reverse);
@@ -155,6 +199,54 @@ namespace queue_flags
 	auto constexpr mask = static_cast<transfer_flags>(0x0f);
 }
 
+// Shared by the items downloading the segments of a single file in parallel,
+// see CQueueView::SplitDownload. The segments get written to partFile_ which
+// is renamed to the target once all of them are complete.
+//
+// The queue only stores the whole file. Next to the part file, stateFile_
+// records the number of segments and the offsets of the completed ones, so
+// that a later attempt, also after reloading the queue, can skip those.
+class CDownloadSegments final
+{
+public:
+	CDownloadSegments(std::wstring const& target, int64_t size)
+		: target_(target)
+		, partFile_(target + L".part")
+		, stateFile_(partFile_ + L".segments")
+		, size_(size)
+	{}
+
+	// Returns the number of segments of an earlier attempt and fills done
+	// with the offsets of its completed segments. Returns 0 if there is no
+	// usable earlier attempt.
+	int LoadState(std::set<uint64_t> & done) const;
+
+	// Starts a new state file. Recording state is best effort, without it
+	// the download just cannot be continued later.
+	void SaveState(int count) const;
+	void SaveDone(uint64_t offset) const;
+
+	// Removes the part file if the state file shows it is one of ours.
+	void Discard() const;
+	void RemoveState() const;
+
+	std::wstring const target_;
+	std::wstring const partFile_;
+	std::wstring const stateFile_;
+	int64_t const size_;
+
+	// Offsets of the segments not yet downloaded
+	std::set<uint64_t> pending_;
+
+	// Set if a segment got removed from the queue before it was downloaded
+	bool abandoned_{};
+
+	// The file is stored as a single row, kept as long as any of its
+	// segments is still in the queue.
+	int64_t storageId_{};
+	int queued_{};
+};
+
 class CFileItem : public CQueueItem
 {
 public:
@@ -172,6 +264,10 @@ public:
 	struct extra_data {
 		std::wstring targetFile_;
 		std::wstring extraFlags_;
+
+		std::shared_ptr<CDownloadSegments> segments_;
+		uint64_t segmentOffset_{};
+		uint64_t segmentSize_{};
 	};
 
 	std::wstring const& GetLocalFile() const { return !Download() ? GetSourceFile() : (extra_data_ && !extra_data_->targetFile_.empty() ? extra_data_->targetFile_ : m_sourceFile); }
@@ -221,6 +317,13 @@ public:
 
 	void SetTargetFile(std::wstring const& file);
 
+	void SetSegment(std::shared_ptr<CDownloadSegments> const& segments, uint64_t offset, uint64_t size);
+	bool IsSegment() const { return extra_data_ && extra_data_->segments_; }
+
+	// All segments of a file get saved as a single item for the whole file.
+	// Returns false if the item does not need to be saved.
+	bool GetSaveSize(int64_t & size) const;
+
 	enum class Status : unsigned char {
 		none,
 		incorrect_password,
@@ -331,7 +434,7 @@ public:
 
 	int GetFileCount() const { return m_fileCount; }
 
-	void WriteToFile(pugi::xml_node element) const;
+	virtual void WriteToFile(pugi::xml_node element);
 
 protected:
 
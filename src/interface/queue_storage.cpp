@@ -3,10 +3,19 @@
 #include "Options.h"
 #include "queue.h"
 
+#include "../commonui/ipcmutex.h"
+
 #include <sqlite3.h>
 
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <set>
 #include <unordered_map>
 
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/thread.hpp>
 #include <libfilezilla/uri.hpp>
 
 #define INVALID_DATA -1
@@ -127,6 +136,113 @@ _column path_table_columns[] = {
 	{ "path", Column_type::text, not_null }
 };
 
+namespace {
+// Row ids of servers and files are bound last in the insert statements, after
+// all other columns. See PrepareInsertStatement.
+int const server_id_param = sizeof(server_table_columns) / sizeof(_column);
+int const file_id_param = sizeof(file_table_columns) / sizeof(_column);
+
+// Range of row ids an instance journaling the queue reserves for itself on
+// startup. Other instances append their queue behind it using the regular
+// autoincrement, so that ids never collide.
+int64_t const server_id_block = 1ll << 20;
+int64_t const file_id_block = 1ll << 32;
+
+// Changes are collected for this long so that they can be written in the
+// same transaction.
+fz::duration const batch_delay = fz::duration::from_milliseconds(250);
+
+// Rows of paths no longer used by any file are removed once this many
+// files were removed.
+int const prune_paths_interval = 1000;
+
+// Set in the flags column of files that are not loaded, see
+// CQueueView::SpillItem. Outside of transfer_flags so that older versions
+// drop it when loading the queue.
+int64_t const spilled_flag = 0x10000;
+
+// Snapshots of queue items. The items are owned by the GUI thread and may
+// be gone by the time the journal writes them.
+struct server_record final
+{
+	int64_t id_{};
+	Site site_;
+	bool kiosk_mode_{};
+};
+
+struct file_record final
+{
+	int64_t id_{};
+	int64_t server_{};
+	bool folder_{};
+	bool download_{};
+	std::wstring sourceFile_;
+	std::wstring targetFile_;
+	std::wstring extraFlags_;
+	CLocalPath localPath_;
+	CServerPath remotePath_;
+	int64_t size_{-1};
+	int errorCount_{};
+	int priority_{};
+	int64_t flags_{};
+	int defaultExistsAction_{CFileExistsNotification::unknown};
+	bool spilled_{};
+};
+
+server_record MakeServerRecord(CServerItem const& item)
+{
+	server_record r;
+	r.id_ = item.GetStorageId();
+	r.site_ = item.GetSite();
+	protect(r.site_.credentials);
+	r.kiosk_mode_ = COptions::Get()->get_int(OPTION_DEFAULT_KIOSKMODE) != 0;
+	return r;
+}
+
+// Returns false if the item does not get stored.
+bool MakeFileRecord(CFileItem const& item, file_record & r)
+{
+	r.id_ = item.GetStorageId();
+	r.folder_ = item.GetType() == QueueItemType::Folder;
+	r.download_ = item.Download();
+	r.errorCount_ = item.m_errorCount;
+	r.priority_ = static_cast<int>(item.GetPriority());
+	// Whether a file is queued only matters to files that are not loaded,
+	// loading the queue on startup queues all files.
+	r.flags_ = static_cast<int64_t>(item.flags() - (queue_flags::mask - queue_flags::queued));
+
+	if (r.folder_) {
+		if (r.download_) {
+			r.localPath_ = item.GetLocalPath();
+		}
+		else {
+			r.sourceFile_ = item.GetSourceFile();
+			r.remotePath_ = item.GetRemotePath();
+		}
+		return true;
+	}
+
+	if (item.m_edit != CEditHandler::none) {
+		return false;
+	}
+	if (!item.GetSaveSize(r.size_)) {
+		return false;
+	}
+
+	r.sourceFile_ = item.GetSourceFile();
+	auto const& extra_data = item.GetExtraData();
+	if (extra_data) {
+		r.targetFile_ = extra_data->targetFile_;
+		r.extraFlags_ = extra_data->extraFlags_;
+	}
+	r.localPath_ = item.GetLocalPath();
+	r.remotePath_ = item.GetRemotePath();
+	r.defaultExistsAction_ = item.m_defaultFileExistsAction;
+
+	return true;
+}
+}
+
 class CQueueStorage::Impl final
 {
 public:
@@ -139,8 +255,13 @@ public:
 	sqlite3_stmt* PrepareInsertStatement(std::string const& name, _column const*, unsigned int count);
 
 	bool SaveServer(CServerItem const& item);
-	bool SaveFile(CFileItem const& item);
-	bool SaveDirectory(CFolderItem const& item);
+
+	bool WriteServer(server_record const& r);
+	bool WriteFile(file_record const& r);
+	bool DeleteServerRows(int64_t id);
+	bool DeleteFileRow(int64_t id);
+	bool DeleteSpilledFiles(int64_t server);
+	bool SetSpilledPriority(int64_t server, int priority);
 
 	int64_t SaveLocalPath(CLocalPath const& path);
 	int64_t SaveRemotePath(CServerPath const& path);
@@ -164,7 +285,10 @@ public:
 	int GetColumnInt(sqlite3_stmt* statement, int index, int def = 0);
 
 	int64_t ParseServerFromRow(Site & site);
-	int64_t ParseFileFromRow(CFileItem** pItem);
+
+	// Files read on startup are always queued. Fetched files of this instance
+	// keep their queued state.
+	int64_t ParseFileFromRow(sqlite3_stmt* statement, CFileItem** pItem, bool fetch);
 
 	bool MigrateSchema();
 
@@ -185,6 +309,18 @@ public:
 	sqlite3_stmt* selectLocalPathQuery_{};
 	sqlite3_stmt* selectRemotePathQuery_{};
 
+	sqlite3_stmt* deleteServerQuery_{};
+	sqlite3_stmt* deleteServerFilesQuery_{};
+	sqlite3_stmt* deleteFileQuery_{};
+
+	// Files not loaded
+	sqlite3_stmt* countSpilledFilesQuery_{};
+	sqlite3_stmt* selectSpilledFilesQuery_{};
+	sqlite3_stmt* deleteSpilledFilesQuery_{};
+	sqlite3_stmt* spillFilesQuery_{};
+	sqlite3_stmt* unspillFilesQuery_{};
+	sqlite3_stmt* spilledPriorityQuery_{};
+
 	// Caches to speed up saving and loading
 	void ClearCaches();
 
@@ -193,6 +329,79 @@ public:
 
 	std::map<int64_t, CLocalPath> reverseLocalPaths_;
 	std::map<int64_t, CServerPath> reverseRemotePaths_;
+
+	// Journal
+	struct operation final
+	{
+		enum class type {
+			server,
+			file,
+			remove_server,
+			remove_file,
+			remove_files,
+			spilled_priority
+		};
+
+		type type_{};
+		int64_t id_{};
+		int priority_{};
+		std::unique_ptr<server_record> server_;
+		std::unique_ptr<file_record> file_;
+	};
+
+	int64_t Reserve(char const* table, int64_t count);
+	void PruneIfEmpty();
+	bool PrunePaths();
+
+	int64_t NextServerId();
+	int64_t NextFileId();
+
+	void Push(operation && op);
+	void Stop();
+	void Fail();
+
+	void entry();
+
+	// Writes the pending changes, db_mtx_ must be held.
+	void Flush();
+	bool WriteBatch(std::vector<operation> const& ops);
+
+	std::unique_ptr<CInterProcessMutex> owner_;
+
+	// Seen while loading
+	std::vector<int64_t> invalidServers_;
+	std::vector<int64_t> invalidFiles_;
+
+	// Servers with rows written or loaded by this instance, only used by
+	// the GUI thread.
+	std::set<int64_t> ownServers_;
+
+	int64_t nextServerId_{};
+	int64_t endServerId_{};
+	int64_t firstFileId_{};
+	int64_t nextFileId_{};
+	int64_t endFileId_{};
+
+	bool journal_{};
+
+	fz::thread thread_;
+
+	// Serializes access to the database and the path caches between the
+	// journal and FetchFiles. Never acquired while holding mtx_.
+	fz::mutex db_mtx_{false};
+
+	// Changes of batches that failed, in order. Written again ahead of the
+	// next batch, guarded by db_mtx_.
+	std::vector<operation> retry_;
+
+	// Since the last PrunePaths, guarded by db_mtx_
+	int removedFiles_{};
+
+	fz::mutex mtx_{false};
+	fz::condition cond_;
+	std::vector<operation> pending_;
+	bool quit_{};
+	bool failed_{};
 };
 
 
@@ -377,6 +586,7 @@ int64_t CQueueStorage::Impl::SaveLocalPath(CLocalPath const& path)
 	if (res == SQLITE_DONE) {
 		int64_t id = sqlite3_last_insert_rowid(db_);
 		localPaths_[path.GetPath()] = id;
+		reverseLocalPaths_[id] = path;
 		return id;
 	}
 
@@ -404,6 +614,7 @@ int64_t CQueueStorage::Impl::SaveRemotePath(CServerPath const& path)
 	if (res == SQLITE_DONE) {
 		int64_t id = sqlite3_last_insert_rowid(db_);
 		remotePaths_[safePath] = id;
+		reverseRemotePaths_[id] = path;
 		return id;
 	}
 
@@ -467,6 +678,12 @@ void CQueueStorage::Impl::CreateTables()
 		if (sqlite3_exec(db_, query.c_str(), 0, 0, 0) != SQLITE_OK)
 		{
 		}
+
+		// Files not loaded get fetched in this order
+		query = "CREATE INDEX IF NOT EXISTS server_priority_index ON files (server, priority DESC, id)";
+		if (sqlite3_exec(db_, query.c_str(), 0, 0, 0) != SQLITE_OK)
+		{
+		}
 	}
 
 	{
@@ -494,21 +711,22 @@ sqlite3_stmt* CQueueStorage::Impl::PrepareInsertStatement(std::string const& nam
 		return 0;
 	}
 
-	std::string query = "INSERT INTO " + name + " (";
+	// The id comes last so that the parameter indexes of the other columns
+	// match their column index. If left NULL, a new id is assigned.
+	std::string query = "INSERT OR REPLACE INTO " + name + " (";
 	for (unsigned int i = 1; i < count; ++i) {
-		if (i > 1) {
-			query += ", ";
-		}
 		query += columns[i].name;
+		query += ", ";
 	}
+	query += columns[0].name;
 	query += ") VALUES (";
 	for (unsigned int i = 1; i < count; ++i) {
-		if (i > 1) {
-			query += ",";
-		}
 		query += ":";
 		query += columns[i].name;
+		query += ",";
 	}
+	query += ":";
+	query += columns[0].name;
 
 	query += ")";
 
@@ -592,6 +810,41 @@ bool CQueueStorage::Impl::PrepareStatements()
 			return false;
 		}
 	}
+
+	deleteServerQuery_ = PrepareStatement("DELETE FROM servers WHERE id=:id");
+	deleteServerFilesQuery_ = PrepareStatement("DELETE FROM files WHERE server=:server");
+	deleteFileQuery_ = PrepareStatement("DELETE FROM files WHERE id=:id");
+	if (!deleteServerQuery_ || !deleteServerFilesQuery_ || !deleteFileQuery_) {
+		return false;
+	}
+
+	{
+		std::string query = "SELECT ";
+		for (unsigned int i = 0; i < (sizeof(file_table_columns) / sizeof(_column)); ++i) {
+			if (i > 0) {
+				query += ", ";
+			}
+			query += file_table_columns[i].name;
+		}
+
+		query += fz::sprintf(" FROM files WHERE server=:server AND flags&%d AND (priority<:priority OR (priority=:priority AND id>:id)) ORDER BY priority DESC, id ASC LIMIT :count", spilled_flag);
+
+		if (!(selectSpilledFilesQuery_ = PrepareStatement(query))) {
+			return false;
+		}
+	}
+
+	// Folders have neither a size nor both paths
+	countSpilledFilesQuery_ = PrepareStatement(fz::sprintf("SELECT COUNT(*), IFNULL(SUM(size), 0), IFNULL(SUM(size IS NULL AND local_path<>-1 AND remote_path<>-1), 0) FROM files WHERE server=:server AND flags&%d", spilled_flag));
+	deleteSpilledFilesQuery_ = PrepareStatement(fz::sprintf("DELETE FROM files WHERE server=:server AND flags&%d", spilled_flag));
+	// Rows without priority would never get fetched
+	spillFilesQuery_ = PrepareStatement(fz::sprintf("UPDATE files SET flags=flags|%d, priority=IFNULL(priority, %d) WHERE server=:server", spilled_flag, static_cast<int>(QueuePriority::normal)));
+	unspillFilesQuery_ = PrepareStatement(fz::sprintf("UPDATE files SET flags=flags&~%d WHERE server=:server AND flags&%d", spilled_flag, spilled_flag));
+	spilledPriorityQuery_ = PrepareStatement(fz::sprintf("UPDATE files SET priority=:priority WHERE server=:server AND flags&%d", spilled_flag));
+	if (!countSpilledFilesQuery_ || !deleteSpilledFilesQuery_ || !spillFilesQuery_ || !unspillFilesQuery_ || !spilledPriorityQuery_) {
+		return false;
+	}
+
 	return true;
 }
 
@@ -637,26 +890,30 @@ bool CQueueStorage::Impl::BindNull(sqlite3_stmt* statement, int index)
 }
 
 
-bool CQueueStorage::Impl::SaveServer(CServerItem const& item)
+bool CQueueStorage::Impl::WriteServer(server_record const& r)
 {
-	bool kiosk_mode = COptions::Get()->get_int(OPTION_DEFAULT_KIOSKMODE) != 0;
+	Site const& site = r.site_;
 
-	Site const& site = item.GetSite();
+	if (r.id_) {
+		Bind(insertServerQuery_, server_id_param, r.id_);
+	}
+	else {
+		BindNull(insertServerQuery_, server_id_param);
+	}
 
 	Bind(insertServerQuery_, server_table_column_names::host, site.server.GetHost());
 	Bind(insertServerQuery_, server_table_column_names::port, static_cast<int>(site.server.GetPort()));
 	Bind(insertServerQuery_, server_table_column_names::protocol, static_cast<int>(site.server.GetProtocol()));
 	Bind(insertServerQuery_, server_table_column_names::type, static_cast<int>(site.server.GetType()));
 
-	ProtectedCredentials credentials = site.credentials;
-	protect(credentials);
+	ProtectedCredentials const& credentials = site.credentials;
 
 	LogonType logonType = credentials.logonType_;
 	if (logonType != LogonType::anonymous) {
 		Bind(insertServerQuery_, server_table_column_names::user, site.server.GetUser());
 
 		if (logonType == LogonType::normal || logonType == LogonType::account || logonType == LogonType::profile) {
-			if (kiosk_mode) {
+			if (r.kiosk_mode_) {
 				logonType = LogonType::ask;
 				BindNull(insertServerQuery_, server_table_column_names::password);
 				BindNull(insertServerQuery_, server_table_column_names::account);
@@ -772,6 +1029,9 @@ bool CQueueStorage::Impl::SaveServer(CServerItem const& item)
 		}
 		Bind(insertServerQuery_, server_table_column_names::parameters, qs.to_string(false));
 	}
+	else {
+		BindNull(insertServerQuery_, server_table_column_names::parameters);
+	}
 
 	auto const& site_path = site.SitePath();
 	if (site_path.empty()) {
@@ -788,19 +1048,31 @@ bool CQueueStorage::Impl::SaveServer(CServerItem const& item)
 
 	sqlite3_reset(insertServerQuery_);
 
-	bool ret = res == SQLITE_DONE;
-	if (ret) {
-		sqlite3_int64 serverId = sqlite3_last_insert_rowid(db_);
-		Bind(insertFileQuery_, file_table_column_names::server, static_cast<int64_t>(serverId));
-
-		const std::vector<CQueueItem*>& children = item.GetChildren();
-		for (std::vector<CQueueItem*>::const_iterator it = children.begin() + item.GetRemovedAtFront(); it != children.end(); ++it) {
-			CQueueItem & childItem = **it;
-			if (childItem.GetType() == QueueItemType::File) {
-				ret &= SaveFile(static_cast<CFileItem&>(childItem));
-			}
-			else if (childItem.GetType() == QueueItemType::Folder) {
-				ret &= SaveDirectory(static_cast<CFolderItem&>(childItem));
+	return res == SQLITE_DONE;
+}
+
+
+bool CQueueStorage::Impl::SaveServer(CServerItem const& item)
+{
+	server_record r = MakeServerRecord(item);
+	r.id_ = 0;
+	if (!WriteServer(r)) {
+		return false;
+	}
+
+	bool ret = true;
+
+	int64_t const serverId = sqlite3_last_insert_rowid(db_);
+
+	const std::vector<CQueueItem*>& children = item.GetChildren();
+	for (std::vector<CQueueItem*>::const_iterator it = children.begin() + item.GetRemovedAtFront(); it != children.end(); ++it) {
+		CQueueItem & childItem = **it;
+		if (childItem.GetType() == QueueItemType::File || childItem.GetType() == QueueItemType::Folder) {
+			file_record fr;
+			if (MakeFileRecord(static_cast<CFileItem&>(childItem), fr)) {
+				fr.id_ = 0;
+				fr.server_ = serverId;
+				ret &= WriteFile(fr);
 			}
 		}
 	}
@@ -808,60 +1080,72 @@ bool CQueueStorage::Impl::SaveServer(CServerItem const& item)
 }
 
 
-bool CQueueStorage::Impl::SaveFile(CFileItem const& file)
+bool CQueueStorage::Impl::WriteFile(file_record const& r)
 {
-	if (file.m_edit != CEditHandler::none) {
-		return true;
+	if (r.id_) {
+		Bind(insertFileQuery_, file_id_param, r.id_);
 	}
+	else {
+		BindNull(insertFileQuery_, file_id_param);
+	}
+	Bind(insertFileQuery_, file_table_column_names::server, r.server_);
 
-	Bind(insertFileQuery_, file_table_column_names::source_file, file.GetSourceFile());
-	auto const& extra_data = file.GetExtraData();
-	if (extra_data) {
-		if (!extra_data->targetFile_.empty()) {
-			Bind(insertFileQuery_, file_table_column_names::target_file, extra_data->targetFile_);
-		}
-		else {
-			BindNull(insertFileQuery_, file_table_column_names::target_file);
-		}
-
-		if (!extra_data->extraFlags_.empty()) {
-			Bind(insertFileQuery_, file_table_column_names::extra_flags, extra_data->extraFlags_);
-		}
-		else {
-			BindNull(insertFileQuery_, file_table_column_names::extra_flags);
-		}
+	if (r.sourceFile_.empty()) {
+		BindNull(insertFileQuery_, file_table_column_names::source_file);
 	}
 	else {
+		Bind(insertFileQuery_, file_table_column_names::source_file, r.sourceFile_);
+	}
+	if (r.targetFile_.empty()) {
 		BindNull(insertFileQuery_, file_table_column_names::target_file);
+	}
+	else {
+		Bind(insertFileQuery_, file_table_column_names::target_file, r.targetFile_);
+	}
+	if (r.extraFlags_.empty()) {
 		BindNull(insertFileQuery_, file_table_column_names::extra_flags);
 	}
+	else {
+		Bind(insertFileQuery_, file_table_column_names::extra_flags, r.extraFlags_);
+	}
 
-	int64_t localPathId = SaveLocalPath(file.GetLocalPath());
-	int64_t remotePathId = SaveRemotePath(file.GetRemotePath());
-	if (localPathId == -1 || remotePathId == -1) {
-		return false;
+	int64_t localPathId;
+	int64_t remotePathId;
+	if (r.folder_) {
+		localPathId = r.download_ ? SaveLocalPath(r.localPath_) : -1;
+		remotePathId = r.download_ ? -1 : SaveRemotePath(r.remotePath_);
+		if (localPathId == -1 && remotePathId == -1) {
+			return false;
+		}
+	}
+	else {
+		localPathId = SaveLocalPath(r.localPath_);
+		remotePathId = SaveRemotePath(r.remotePath_);
+		if (localPathId == -1 || remotePathId == -1) {
+			return false;
+		}
 	}
 
 	Bind(insertFileQuery_, file_table_column_names::local_path, localPathId);
 	Bind(insertFileQuery_, file_table_column_names::remote_path, remotePathId);
 
-	if (file.GetSize() != -1) {
-		Bind(insertFileQuery_, file_table_column_names::size, file.GetSize());
+	if (!r.folder_ && r.size_ != -1) {
+		Bind(insertFileQuery_, file_table_column_names::size, r.size_);
 	}
 	else {
 		BindNull(insertFileQuery_, file_table_column_names::size);
 	}
-	if (file.m_errorCount) {
-		Bind(insertFileQuery_, file_table_column_names::error_count, file.m_errorCount);
+	if (r.errorCount_) {
+		Bind(insertFileQuery_, file_table_column_names::error_count, r.errorCount_);
 	}
 	else {
 		BindNull(insertFileQuery_, file_table_column_names::error_count);
 	}
-	Bind(insertFileQuery_, file_table_column_names::priority, static_cast<int>(file.GetPriority()));
-	Bind(insertFileQuery_, file_table_column_names::flags, static_cast<int64_t>(file.flags() - queue_flags::mask));
+	Bind(insertFileQuery_, file_table_column_names::priority, r.priority_);
+	Bind(insertFileQuery_, file_table_column_names::flags, r.spilled_ ? (r.flags_ | spilled_flag) : r.flags_);
 
-	if (file.m_defaultFileExistsAction != CFileExistsNotification::unknown) {
-		Bind(insertFileQuery_, file_table_column_names::default_exists_action, file.m_defaultFileExistsAction);
+	if (r.defaultExistsAction_ != CFileExistsNotification::unknown) {
+		Bind(insertFileQuery_, file_table_column_names::default_exists_action, r.defaultExistsAction_);
 	}
 	else {
 		BindNull(insertFileQuery_, file_table_column_names::default_exists_action);
@@ -878,43 +1162,77 @@ bool CQueueStorage::Impl::SaveFile(CFileItem const& file)
 }
 
 
-bool CQueueStorage::Impl::SaveDirectory(CFolderItem const& directory)
+bool CQueueStorage::Impl::DeleteServerRows(int64_t id)
 {
-	if (directory.Download()) {
-		BindNull(insertFileQuery_, file_table_column_names::source_file);
-	}
-	else {
-		Bind(insertFileQuery_, file_table_column_names::source_file, directory.GetSourceFile());
-	}
-	BindNull(insertFileQuery_, file_table_column_names::target_file);
+	Bind(deleteServerFilesQuery_, 1, id);
+	Bind(deleteServerQuery_, 1, id);
+
+	int res;
+	do {
+		res = sqlite3_step(deleteServerFilesQuery_);
+	} while (res == SQLITE_BUSY);
+	sqlite3_reset(deleteServerFilesQuery_);
 
-	int64_t localPathId = directory.Download() ? SaveLocalPath(directory.GetLocalPath()) : -1;
-	int64_t remotePathId = directory.Download() ? -1 : SaveRemotePath(directory.GetRemotePath());
-	if (localPathId == -1 && remotePathId == -1) {
+	if (res != SQLITE_DONE) {
 		return false;
 	}
+	removedFiles_ += sqlite3_changes(db_);
 
-	Bind(insertFileQuery_, file_table_column_names::local_path, localPathId);
-	Bind(insertFileQuery_, file_table_column_names::remote_path, remotePathId);
+	do {
+		res = sqlite3_step(deleteServerQuery_);
+	} while (res == SQLITE_BUSY);
+	sqlite3_reset(deleteServerQuery_);
 
-	BindNull(insertFileQuery_, file_table_column_names::size);
-	if (directory.m_errorCount) {
-		Bind(insertFileQuery_, file_table_column_names::error_count, directory.m_errorCount);
-	}
-	else {
-		BindNull(insertFileQuery_, file_table_column_names::error_count);
+	return res == SQLITE_DONE;
+}
+
+
+bool CQueueStorage::Impl::DeleteFileRow(int64_t id)
+{
+	Bind(deleteFileQuery_, 1, id);
+
+	int res;
+	do {
+		res = sqlite3_step(deleteFileQuery_);
+	} while (res == SQLITE_BUSY);
+	sqlite3_reset(deleteFileQuery_);
+
+	if (res != SQLITE_DONE) {
+		return false;
 	}
-	Bind(insertFileQuery_, file_table_column_names::priority, static_cast<int>(directory.GetPriority()));
-	Bind(insertFileQuery_, file_table_column_names::flags, static_cast<int>(directory.flags() - queue_flags::mask));
+	removedFiles_ += sqlite3_changes(db_);
+	return true;
+}
 
-	BindNull(insertFileQuery_, file_table_column_names::default_exists_action);
+
+bool CQueueStorage::Impl::DeleteSpilledFiles(int64_t server)
+{
+	Bind(deleteSpilledFilesQuery_, 1, server);
 
 	int res;
 	do {
-		res = sqlite3_step(insertFileQuery_);
+		res = sqlite3_step(deleteSpilledFilesQuery_);
 	} while (res == SQLITE_BUSY);
+	sqlite3_reset(deleteSpilledFilesQuery_);
 
-	sqlite3_reset(insertFileQuery_);
+	if (res != SQLITE_DONE) {
+		return false;
+	}
+	removedFiles_ += sqlite3_changes(db_);
+	return true;
+}
+
+
+bool CQueueStorage::Impl::SetSpilledPriority(int64_t server, int priority)
+{
+	Bind(spilledPriorityQuery_, 1, priority);
+	Bind(spilledPriorityQuery_, 2, server);
+
+	int res;
+	do {
+		res = sqlite3_step(spilledPriorityQuery_);
+	} while (res == SQLITE_BUSY);
+	sqlite3_reset(spilledPriorityQuery_);
 
 	return res == SQLITE_DONE;
 }
@@ -1102,19 +1420,25 @@ int64_t CQueueStorage::Impl::ParseServerFromRow(Site & site)
 }
 
 
-int64_t CQueueStorage::Impl::ParseFileFromRow(CFileItem** pItem)
+int64_t CQueueStorage::Impl::ParseFileFromRow(sqlite3_stmt* statement, CFileItem** pItem, bool fetch)
 {
-	std::wstring sourceFile = GetColumnText(selectFilesQuery_, file_table_column_names::source_file);
-	std::wstring targetFile = GetColumnText(selectFilesQuery_, file_table_column_names::target_file);
+	std::wstring sourceFile = GetColumnText(statement, file_table_column_names::source_file);
+	std::wstring targetFile = GetColumnText(statement, file_table_column_names::target_file);
 
-	int64_t localPathId = GetColumnInt64(selectFilesQuery_, file_table_column_names::local_path, false);
-	int64_t remotePathId = GetColumnInt64(selectFilesQuery_, file_table_column_names::remote_path, false);
+	int64_t localPathId = GetColumnInt64(statement, file_table_column_names::local_path, false);
+	int64_t remotePathId = GetColumnInt64(statement, file_table_column_names::remote_path, false);
 
 	CLocalPath const localPath(GetLocalPath(localPathId));
 	CServerPath const remotePath(GetRemotePath(remotePathId));
 
-	auto flags = static_cast<transfer_flags>(GetColumnInt(selectFilesQuery_, file_table_column_names::flags));
+	int64_t const id = GetColumnInt64(statement, file_table_column_names::id);
+
+	auto flags = static_cast<transfer_flags>(GetColumnInt(statement, file_table_column_names::flags));
 	bool const download = flags & transfer_flags::download;
+	flags -= queue_flags::mask - queue_flags::queued;
+	if (!fetch || !firstFileId_ || id < firstFileId_) {
+		flags |= queue_flags::queued;
+	}
 
 	if (localPathId == -1 || remotePathId == -1) {
 		// QueueItemType::Folder
@@ -1125,20 +1449,20 @@ int64_t CQueueStorage::Impl::ParseFileFromRow(CFileItem** pItem)
 		}
 
 		if (download) {
-			*pItem = new CFolderItem(0, true, localPath);
+			*pItem = new CFolderItem(0, flags & queue_flags::queued, localPath);
 		}
 		else {
-			*pItem = new CFolderItem(0, true, remotePath, sourceFile);
+			*pItem = new CFolderItem(0, flags & queue_flags::queued, remotePath, sourceFile);
 		}
 	}
 	else {
-		int64_t size = GetColumnInt64(selectFilesQuery_, file_table_column_names::size);
-		unsigned char errorCount = static_cast<unsigned char>(GetColumnInt(selectFilesQuery_, file_table_column_names::error_count));
-		int priority = GetColumnInt(selectFilesQuery_, file_table_column_names::priority, static_cast<int>(QueuePriority::normal));
+		int64_t size = GetColumnInt64(statement, file_table_column_names::size);
+		unsigned char errorCount = static_cast<unsigned char>(GetColumnInt(statement, file_table_column_names::error_count));
+		int priority = GetColumnInt(statement, file_table_column_names::priority, static_cast<int>(QueuePriority::normal));
 
-		std::wstring extraFlags = GetColumnText(selectFilesQuery_, file_table_column_names::extra_flags);
+		std::wstring extraFlags = GetColumnText(statement, file_table_column_names::extra_flags);
 
-		int overwrite_action = GetColumnInt(selectFilesQuery_, file_table_column_names::default_exists_action, CFileExistsNotification::unknown);
+		int overwrite_action = GetColumnInt(statement, file_table_column_names::default_exists_action, CFileExistsNotification::unknown);
 
 		if (sourceFile.empty() || localPath.empty() ||
 			remotePath.empty() ||
@@ -1148,7 +1472,7 @@ int64_t CQueueStorage::Impl::ParseFileFromRow(CFileItem** pItem)
 			return INVALID_DATA;
 		}
 
-		CFileItem* fileItem = new CFileItem(0, flags | queue_flags::queued, sourceFile, targetFile, localPath, remotePath, size, extraFlags);
+		CFileItem* fileItem = new CFileItem(0, flags, sourceFile, targetFile, localPath, remotePath, size, extraFlags);
 		*pItem = fileItem;
 		fileItem->SetPriorityRaw(QueuePriority(priority));
 		fileItem->m_errorCount = errorCount;
@@ -1158,7 +1482,7 @@ int64_t CQueueStorage::Impl::ParseFileFromRow(CFileItem** pItem)
 		}
 	}
 
-	return GetColumnInt64(selectFilesQuery_, file_table_column_names::id);
+	return id;
 }
 
 bool CQueueStorage::Impl::BeginTransaction()
@@ -1187,6 +1511,15 @@ void CQueueStorage::Impl::Close()
 	sqlite3_finalize(selectFilesQuery_);
 	sqlite3_finalize(selectLocalPathQuery_);
 	sqlite3_finalize(selectRemotePathQuery_);
+	sqlite3_finalize(deleteServerQuery_);
+	sqlite3_finalize(deleteServerFilesQuery_);
+	sqlite3_finalize(deleteFileQuery_);
+	sqlite3_finalize(countSpilledFilesQuery_);
+	sqlite3_finalize(selectSpilledFilesQuery_);
+	sqlite3_finalize(deleteSpilledFilesQuery_);
+	sqlite3_finalize(spillFilesQuery_);
+	sqlite3_finalize(unspillFilesQuery_);
+	sqlite3_finalize(spilledPriorityQuery_);
 	insertServerQuery_ = 0;
 	insertFileQuery_ = 0;
 	insertLocalPathQuery_ = 0;
@@ -1195,10 +1528,259 @@ void CQueueStorage::Impl::Close()
 	selectFilesQuery_ = 0;
 	selectLocalPathQuery_ = 0;
 	selectRemotePathQuery_ = 0;
+	deleteServerQuery_ = 0;
+	deleteServerFilesQuery_ = 0;
+	deleteFileQuery_ = 0;
+	countSpilledFilesQuery_ = 0;
+	selectSpilledFilesQuery_ = 0;
+	deleteSpilledFilesQuery_ = 0;
+	spillFilesQuery_ = 0;
+	unspillFilesQuery_ = 0;
+	spilledPriorityQuery_ = 0;
 	sqlite3_close(db_);
 	db_ = 0;
 }
 
+static int int64_callback(void* p, int n, char** v, char**)
+{
+	int64_t* i = static_cast<int64_t*>(p);
+	if (!i || !n || !v || !*v) {
+		return -1;
+	}
+
+	*i = strtoll(*v, nullptr, 10);
+	return 0;
+}
+
+int64_t CQueueStorage::Impl::Reserve(char const* table, int64_t count)
+{
+	int64_t last = -1;
+	std::string query = fz::sprintf("SELECT MAX((SELECT IFNULL(MAX(seq), 0) FROM sqlite_sequence WHERE name='%s'), (SELECT IFNULL(MAX(id), 0) FROM %s))", table, table);
+	if (sqlite3_exec(db_, query.c_str(), int64_callback, &last, 0) != SQLITE_OK || last < 0) {
+		return 0;
+	}
+
+	// Autoincrement never hands out ids below the stored sequence value
+	query = fz::sprintf("UPDATE sqlite_sequence SET seq=%d WHERE name='%s'", last + count, table);
+	if (sqlite3_exec(db_, query.c_str(), 0, 0, 0) != SQLITE_OK) {
+		return 0;
+	}
+	if (!sqlite3_changes(db_)) {
+		query = fz::sprintf("INSERT INTO sqlite_sequence (name, seq) VALUES ('%s', %d)", table, last + count);
+		if (sqlite3_exec(db_, query.c_str(), 0, 0, 0) != SQLITE_OK) {
+			return 0;
+		}
+	}
+
+	return last + 1;
+}
+
+void CQueueStorage::Impl::PruneIfEmpty()
+{
+	// Once the queue is empty, also the server rows can go. While the
+	// journal runs, unused paths get removed by PrunePaths.
+	int files = 1;
+	if (sqlite3_exec(db_, "SELECT EXISTS (SELECT 1 FROM files)", int_callback, &files, 0) != SQLITE_OK || files) {
+		return;
+	}
+
+	sqlite3_exec(db_, "DELETE FROM servers", 0, 0, 0);
+	sqlite3_exec(db_, "DELETE FROM local_paths", 0, 0, 0);
+	sqlite3_exec(db_, "DELETE FROM remote_paths", 0, 0, 0);
+	ClearCaches();
+}
+
+namespace {
+int int64_vector_callback(void* p, int n, char** v, char**)
+{
+	auto* ids = static_cast<std::vector<int64_t>*>(p);
+	if (!ids || !n || !v || !*v) {
+		return -1;
+	}
+
+	ids->push_back(strtoll(*v, nullptr, 10));
+	return 0;
+}
+}
+
+bool CQueueStorage::Impl::PrunePaths()
+{
+	// The caches must not hand out the ids of removed rows
+	std::vector<int64_t> ids;
+	if (sqlite3_exec(db_, "SELECT id FROM local_paths WHERE id NOT IN (SELECT local_path FROM files WHERE local_path IS NOT NULL)", int64_vector_callback, &ids, 0) != SQLITE_OK) {
+		return false;
+	}
+	for (auto const id : ids) {
+		auto const it = reverseLocalPaths_.find(id);
+		if (it != reverseLocalPaths_.end()) {
+			localPaths_.erase(it->second.GetPath());
+			reverseLocalPaths_.erase(it);
+		}
+	}
+	if (sqlite3_exec(db_, "DELETE FROM local_paths WHERE id NOT IN (SELECT local_path FROM files WHERE local_path IS NOT NULL)", 0, 0, 0) != SQLITE_OK) {
+		return false;
+	}
+
+	ids.clear();
+	if (sqlite3_exec(db_, "SELECT id FROM remote_paths WHERE id NOT IN (SELECT remote_path FROM files WHERE remote_path IS NOT NULL)", int64_vector_callback, &ids, 0) != SQLITE_OK) {
+		return false;
+	}
+	for (auto const id : ids) {
+		auto const it = reverseRemotePaths_.find(id);
+		if (it != reverseRemotePaths_.end()) {
+			remotePaths_.erase(it->second.GetSafePath());
+			reverseRemotePaths_.erase(it);
+		}
+	}
+	return sqlite3_exec(db_, "DELETE FROM remote_paths WHERE id NOT IN (SELECT remote_path FROM files WHERE remote_path IS NOT NULL)", 0, 0, 0) == SQLITE_OK;
+}
+
+int64_t CQueueStorage::Impl::NextServerId()
+{
+	if (nextServerId_ >= endServerId_) {
+		Fail();
+		return 0;
+	}
+	return nextServerId_++;
+}
+
+int64_t CQueueStorage::Impl::NextFileId()
+{
+	if (nextFileId_ >= endFileId_) {
+		Fail();
+		return 0;
+	}
+	return nextFileId_++;
+}
+
+void CQueueStorage::Impl::Push(operation && op)
+{
+	fz::scoped_lock l(mtx_);
+	if (pending_.empty()) {
+		cond_.signal(l);
+	}
+	pending_.push_back(std::move(op));
+}
+
+void CQueueStorage::Impl::Fail()
+{
+	fz::scoped_lock l(mtx_);
+	failed_ = true;
+}
+
+void CQueueStorage::Impl::Stop()
+{
+	if (!journal_) {
+		return;
+	}
+
+	{
+		fz::scoped_lock l(mtx_);
+		quit_ = true;
+		cond_.signal(l);
+	}
+	thread_.join();
+
+	journal_ = false;
+}
+
+void CQueueStorage::Impl::entry()
+{
+	fz::scoped_lock l(mtx_);
+	for (;;) {
+		if (pending_.empty()) {
+			if (quit_) {
+				break;
+			}
+			cond_.wait(l);
+			continue;
+		}
+
+		if (!quit_) {
+			// Give further changes the chance to end up in the same transaction
+			cond_.wait(l, batch_delay);
+		}
+
+		l.unlock();
+		{
+			fz::scoped_lock dl(db_mtx_);
+			Flush();
+		}
+		l.lock();
+	}
+}
+
+void CQueueStorage::Impl::Flush()
+{
+	std::vector<operation> ops;
+	{
+		fz::scoped_lock l(mtx_);
+		ops.swap(pending_);
+	}
+
+	if (!retry_.empty()) {
+		// Rows and deletions get written as a whole, replaying the older
+		// changes first is safe even if some of them made it.
+		std::move(ops.begin(), ops.end(), std::back_inserter(retry_));
+		ops.swap(retry_);
+		retry_.clear();
+	}
+
+	if (ops.empty()) {
+		return;
+	}
+
+	if (!WriteBatch(ops)) {
+		Fail();
+		retry_ = std::move(ops);
+	}
+}
+
+bool CQueueStorage::Impl::WriteBatch(std::vector<operation> const& ops)
+{
+	if (sqlite3_exec(db_, "BEGIN IMMEDIATE", 0, 0, 0) != SQLITE_OK) {
+		return false;
+	}
+
+	bool ret = true;
+	for (auto const& op : ops) {
+		switch (op.type_) {
+		case operation::type::server:
+			ret &= WriteServer(*op.server_);
+			break;
+		case operation::type::file:
+			ret &= WriteFile(*op.file_);
+			break;
+		case operation::type::remove_server:
+			ret &= DeleteServerRows(op.id_);
+			break;
+		case operation::type::remove_file:
+			ret &= DeleteFileRow(op.id_);
+			break;
+		case operation::type::remove_files:
+			ret &= DeleteSpilledFiles(op.id_);
+			break;
+		case operation::type::spilled_priority:
+			ret &= SetSpilledPriority(op.id_, op.priority_);
+			break;
+		}
+	}
+
+	// Removing a row that is still used would break files, only when
+	// everything got written.
+	if (ret && removedFiles_ >= prune_paths_interval && PrunePaths()) {
+		removedFiles_ = 0;
+	}
+
+	// Even on previous failure, we want to at least try to commit the data we have so far
+	if (!EndTransaction(false)) {
+		EndTransaction(true);
+		ret = false;
+	}
+
+	return ret;
+}
+
 CQueueStorage::CQueueStorage()
 : d_(new Impl)
 {
@@ -1208,6 +1790,12 @@ CQueueStorage::CQueueStorage()
 	}
 
 	if (sqlite3_exec(d_->db_, "PRAGMA encoding=\"UTF-16le\"", 0, 0, 0) == SQLITE_OK) {
+		// The queue gets written while FileZilla is running, see EnableJournal.
+		// Other instances only write when quitting.
+		sqlite3_exec(d_->db_, "PRAGMA journal_mode=WAL", 0, 0, 0);
+		sqlite3_exec(d_->db_, "PRAGMA synchronous=NORMAL", 0, 0, 0);
+		sqlite3_busy_timeout(d_->db_, 5000);
+
 		d_->MigrateSchema();
 		d_->CreateTables();
 		d_->PrepareStatements();
@@ -1216,6 +1804,7 @@ CQueueStorage::CQueueStorage()
 
 CQueueStorage::~CQueueStorage()
 {
+	d_->Stop();
 	d_->Close();
 	delete d_;
 }
@@ -1263,8 +1852,10 @@ int64_t CQueueStorage::GetServer(Site& site, bool fromBeginning)
 			if (res == SQLITE_ROW) {
 				ret = d_->ParseServerFromRow(site);
 				if (ret > 0) {
+					d_->ownServers_.insert(ret);
 					break;
 				}
+				d_->invalidServers_.push_back(d_->GetColumnInt64(d_->selectServersQuery_, server_table_column_names::id));
 			}
 			else if (res == SQLITE_DONE) {
 				ret = 0;
@@ -1305,10 +1896,11 @@ int64_t CQueueStorage::GetFile(CFileItem** pItem, int64_t server)
 			while (res == SQLITE_BUSY);
 
 			if (res == SQLITE_ROW) {
-				ret = d_->ParseFileFromRow(pItem);
+				ret = d_->ParseFileFromRow(d_->selectFilesQuery_, pItem, false);
 				if (ret > 0) {
 					break;
 				}
+				d_->invalidFiles_.push_back(d_->GetColumnInt64(d_->selectFilesQuery_, file_table_column_names::id));
 			}
 			else if (res == SQLITE_DONE) {
 				ret = 0;
@@ -1371,7 +1963,362 @@ bool CQueueStorage::EndTransaction(bool rollback)
 	return d_->EndTransaction(rollback);
 }
 
-bool CQueueStorage::Vacuum()
+bool CQueueStorage::Acquire()
+{
+	if (!d_->owner_) {
+		auto owner = std::make_unique<CInterProcessMutex>(MUTEX_QUEUE_OWNER, false);
+		int const res = owner->TryLock();
+		if (!res) {
+			return false;
+		}
+		if (res == 1) {
+			d_->owner_ = std::move(owner);
+		}
+	}
+	return true;
+}
+
+bool CQueueStorage::EnableJournal()
+{
+	if (d_->journal_ || !d_->db_ || !d_->owner_) {
+		return false;
+	}
+
+	if (sqlite3_exec(d_->db_, "BEGIN IMMEDIATE", 0, 0, 0) != SQLITE_OK) {
+		return false;
+	}
+	d_->PruneIfEmpty();
+	d_->nextServerId_ = d_->Reserve("servers", server_id_block);
+	d_->nextFileId_ = d_->Reserve("files", file_id_block);
+	bool const reserved = d_->nextServerId_ > 0 && d_->nextFileId_ > 0;
+	if (!d_->EndTransaction(!reserved) || !reserved) {
+		return false;
+	}
+	d_->endServerId_ = d_->nextServerId_ + server_id_block;
+	d_->endFileId_ = d_->nextFileId_ + file_id_block;
+	d_->firstFileId_ = d_->nextFileId_;
+
+	d_->quit_ = false;
+	d_->failed_ = false;
+	if (!d_->thread_.run([this]() { d_->entry(); })) {
+		return false;
+	}
+	d_->journal_ = true;
+
+	for (auto const id : d_->invalidServers_) {
+		RemoveServer(id);
+	}
+	for (auto const id : d_->invalidFiles_) {
+		RemoveFile(id);
+	}
+	d_->invalidServers_.clear();
+	d_->invalidFiles_.clear();
+
+	return true;
+}
+
+bool CQueueStorage::Journaling() const
+{
+	return d_->journal_;
+}
+
+bool CQueueStorage::Failed() const
+{
+	fz::scoped_lock l(d_->mtx_);
+	return d_->failed_;
+}
+
+void CQueueStorage::Store(CServerItem & server)
+{
+	if (!d_->journal_) {
+		return;
+	}
+
+	if (!server.GetStorageId()) {
+		int64_t const id = d_->NextServerId();
+		if (!id) {
+			return;
+		}
+		server.SetStorageId(id);
+		d_->ownServers_.insert(id);
+	}
+
+	Impl::operation op;
+	op.type_ = Impl::operation::type::server;
+	op.server_ = std::make_unique<server_record>(MakeServerRecord(server));
+	d_->Push(std::move(op));
+}
+
+void CQueueStorage::Store(CFileItem & item, CServerItem & server, bool spilled)
+{
+	if (!d_->journal_) {
+		return;
+	}
+
+	auto r = std::make_unique<file_record>();
+	if (!MakeFileRecord(item, *r)) {
+		return;
+	}
+	r->spilled_ = spilled;
+
+	if (!server.GetStorageId()) {
+		Store(server);
+		if (!server.GetStorageId()) {
+			return;
+		}
+	}
+	if (!r->id_) {
+		r->id_ = d_->NextFileId();
+		if (!r->id_) {
+			return;
+		}
+		item.SetStorageId(r->id_);
+	}
+	r->server_ = server.GetStorageId();
+
+	Impl::operation op;
+	op.type_ = Impl::operation::type::file;
+	op.file_ = std::move(r);
+	d_->Push(std::move(op));
+}
+
+void CQueueStorage::RemoveServer(int64_t id)
+{
+	if (!d_->journal_ || id <= 0) {
+		return;
+	}
+
+	d_->ownServers_.erase(id);
+
+	Impl::operation op;
+	op.type_ = Impl::operation::type::remove_server;
+	op.id_ = id;
+	d_->Push(std::move(op));
+}
+
+void CQueueStorage::RemoveFile(int64_t id)
+{
+	if (!d_->journal_ || id <= 0) {
+		return;
+	}
+
+	Impl::operation op;
+	op.type_ = Impl::operation::type::remove_file;
+	op.id_ = id;
+	d_->Push(std::move(op));
+}
+
+void CQueueStorage::RemoveFiles(int64_t server)
+{
+	if (!d_->journal_ || server <= 0) {
+		return;
+	}
+
+	Impl::operation op;
+	op.type_ = Impl::operation::type::remove_files;
+	op.id_ = server;
+	d_->Push(std::move(op));
+}
+
+void CQueueStorage::SetPriority(int64_t server, int priority)
+{
+	if (!d_->journal_ || server <= 0) {
+		return;
+	}
+
+	Impl::operation op;
+	op.type_ = Impl::operation::type::spilled_priority;
+	op.id_ = server;
+	op.priority_ = priority;
+	d_->Push(std::move(op));
+}
+
+bool CQueueStorage::SpillFiles(int64_t server, bool spill)
+{
+	auto * const statement = spill ? d_->spillFilesQuery_ : d_->unspillFilesQuery_;
+	if (!statement || d_->journal_) {
+		return false;
+	}
+
+	d_->Bind(statement, 1, server);
+
+	int res;
+	do {
+		res = sqlite3_step(statement);
+	} while (res == SQLITE_BUSY);
+	sqlite3_reset(statement);
+
+	return res == SQLITE_DONE;
+}
+
+bool CQueueStorage::CountFiles(int64_t server, int & count, int64_t & size, int & unknownSize)
+{
+	count = 0;
+	size = 0;
+	unknownSize = 0;
+
+	if (!d_->countSpilledFilesQuery_) {
+		return false;
+	}
+
+	fz::scoped_lock l(d_->db_mtx_);
+	d_->Flush();
+
+	auto * const statement = d_->countSpilledFilesQuery_;
+	d_->Bind(statement, 1, server);
+
+	int res;
+	do {
+		res = sqlite3_step(statement);
+	} while (res == SQLITE_BUSY);
+
+	if (res == SQLITE_ROW) {
+		count = d_->GetColumnInt(statement, 0);
+		size = d_->GetColumnInt64(statement, 1);
+		unknownSize = d_->GetColumnInt(statement, 2);
+	}
+	sqlite3_reset(statement);
+
+	return res == SQLITE_ROW;
+}
+
+bool CQueueStorage::FetchFiles(int64_t server, spilled_position & pos, int count, std::vector<std::pair<int64_t, CFileItem*>> & files)
+{
+	if (!d_->selectSpilledFilesQuery_) {
+		return false;
+	}
+
+	fz::scoped_lock l(d_->db_mtx_);
+	d_->Flush();
+
+	auto * const statement = d_->selectSpilledFilesQuery_;
+	d_->Bind(statement, 1, server);
+	d_->Bind(statement, 2, pos.priority_);
+	d_->Bind(statement, 3, pos.id_);
+	d_->Bind(statement, 4, count);
+
+	int res;
+	for (;;) {
+		do {
+			res = sqlite3_step(statement);
+		} while (res == SQLITE_BUSY);
+
+		if (res != SQLITE_ROW) {
+			break;
+		}
+
+		pos.priority_ = d_->GetColumnInt(statement, file_table_column_names::priority);
+		pos.id_ = d_->GetColumnInt64(statement, file_table_column_names::id);
+
+		CFileItem* item{};
+		int64_t const id = d_->ParseFileFromRow(statement, &item, true);
+		if (id > 0) {
+			files.emplace_back(id, item);
+		}
+		else {
+			// Skipped, but it still moves the position past it
+			int64_t const invalid = d_->GetColumnInt64(statement, file_table_column_names::id);
+			files.emplace_back(invalid, nullptr);
+			RemoveFile(invalid);
+		}
+	}
+	sqlite3_reset(statement);
+
+	return res == SQLITE_DONE;
+}
+
+bool CQueueStorage::CloseJournal(std::vector<CServerItem*> const& queue)
 {
-	return sqlite3_exec(d_->db_, "VACUUM", 0, 0, 0) == SQLITE_OK;
+	if (!d_->journal_) {
+		return false;
+	}
+
+	d_->Stop();
+	if (!d_->failed_) {
+		return true;
+	}
+
+	// Files not loaded only exist in the database, their rows are kept
+	// along with the server row. Loaded files might not have gotten their
+	// flag cleared.
+	std::set<int64_t> spilled;
+	std::vector<int64_t> loaded;
+	for (auto const* server : queue) {
+		if (server->m_spilled.count_ && server->GetStorageId()) {
+			spilled.insert(server->GetStorageId());
+			auto const& children = server->GetChildren();
+			for (auto it = children.cbegin() + server->GetRemovedAtFront(); it != children.cend(); ++it) {
+				if ((*it)->GetStorageId()) {
+					loaded.push_back((*it)->GetStorageId());
+				}
+			}
+		}
+	}
+
+	// Files not loaded whose rows could not be written exist nowhere else,
+	// in the state of their last change.
+	std::map<int64_t, file_record*> unwritten;
+	for (auto const& op : d_->retry_) {
+		switch (op.type_) {
+		case Impl::operation::type::file:
+			unwritten[op.file_->id_] = op.file_.get();
+			break;
+		case Impl::operation::type::remove_file:
+			unwritten.erase(op.id_);
+			break;
+		case Impl::operation::type::remove_files:
+		case Impl::operation::type::spilled_priority:
+			for (auto it = unwritten.begin(); it != unwritten.end(); ) {
+				if (it->second->server_ != op.id_ || !it->second->spilled_) {
+					++it;
+				}
+				else if (op.type_ == Impl::operation::type::remove_files) {
+					it = unwritten.erase(it);
+				}
+				else {
+					it->second->priority_ = op.priority_;
+					++it;
+				}
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	// Some changes are missing, replace everything this instance has
+	// written or loaded.
+	bool ret = d_->BeginTransaction();
+	if (ret) {
+		for (auto const id : d_->ownServers_) {
+			if (!spilled.count(id)) {
+				ret &= d_->DeleteServerRows(id);
+			}
+			else {
+				std::string const query = fz::sprintf("DELETE FROM files WHERE server=%d AND NOT flags&%d", id, spilled_flag);
+				ret &= sqlite3_exec(d_->db_, query.c_str(), 0, 0, 0) == SQLITE_OK;
+			}
+		}
+		for (auto const id : loaded) {
+			ret &= d_->DeleteFileRow(id);
+		}
+
+		// Ahead of the unwritten rows, they already have their priority
+		for (auto const& op : d_->retry_) {
+			if (op.type_ == Impl::operation::type::spilled_priority && spilled.count(op.id_)) {
+				ret &= d_->SetSpilledPriority(op.id_, op.priority_);
+			}
+		}
+		std::sort(loaded.begin(), loaded.end());
+		for (auto const& file : unwritten) {
+			if (file.second->spilled_ && spilled.count(file.second->server_) && !std::binary_search(loaded.cbegin(), loaded.cend(), file.first)) {
+				ret &= d_->WriteFile(*file.second);
+			}
+		}
+		d_->retry_.clear();
+		ret = d_->EndTransaction(!ret) && ret;
+	}
+	d_->ownServers_.clear();
+
+	return ret && SaveQueue(queue);
 }
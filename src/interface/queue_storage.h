@@ -1,9 +1,11 @@
 #ifndef FILEZILLA_INTERFACE_QUEUE_STORAGE_HEADER
 #define FILEZILLA_INTERFACE_QUEUE_STORAGE_HEADER
 
+#include <limits>
 #include <vector>
 #include <stdint.h>
 #include <string>
+#include <utility>
 
 class CFileItem;
 class CServerItem;
@@ -28,8 +30,7 @@ public:
 
 	bool Clear(); // Also clears caches
 
-	bool Vacuum();
-
+	// Appends the whole queue, used if the queue is not journaled.
 	bool SaveQueue(std::vector<CServerItem*> const& queue);
 
 	// > 0 = server id
@@ -39,6 +40,63 @@ public:
 
 	int64_t GetFile(CFileItem** pItem, int64_t server);
 
+	// Only one instance of FileZilla at a time gets to load and journal the
+	// stored queue. Returns false if another instance has it. If locking is
+	// not available, the queue still gets loaded but isn't journaled.
+	bool Acquire();
+
+	// Call after loading. From then on, changes to the queue are written
+	// in batches by a background thread instead of saving the whole queue
+	// when quitting. Rows found to be invalid while loading get removed.
+	bool EnableJournal();
+	bool Journaling() const;
+
+	// Whether changes could not be written. They get retried with the next
+	// batch, but files should no longer be left to the database only.
+	bool Failed() const;
+
+	// Assigns a row id to the item if it has none yet and schedules writing it.
+	// A spilled file is not loaded, its row is all that is left of it.
+	// Storing it again unspilled once loaded clears that.
+	void Store(CServerItem & server);
+	void Store(CFileItem & item, CServerItem & server, bool spilled = false);
+
+	// Removing a server also removes its files.
+	void RemoveServer(int64_t id);
+	void RemoveFile(int64_t id);
+
+	// The following only affect spilled files.
+
+	// Removes the spilled files of the server.
+	void RemoveFiles(int64_t server);
+
+	// Changes the priority of the spilled files of the server.
+	void SetPriority(int64_t server, int priority);
+
+	// Marks all files of the server as spilled, or none of them. Only while
+	// loading, before the journal is enabled.
+	bool SpillFiles(int64_t server, bool spill);
+
+	// Counts the spilled files of the server and sums up their sizes.
+	bool CountFiles(int64_t server, int & count, int64_t & size, int & unknownSize);
+
+	// Position in the spilled files of a server, ordered by descending
+	// priority and then by id.
+	struct spilled_position final
+	{
+		int priority_{std::numeric_limits<int>::max()};
+		int64_t id_{};
+	};
+
+	// Reads up to count spilled files of the server after pos and advances
+	// pos past them. Pending changes get written first.
+	bool FetchFiles(int64_t server, spilled_position & pos, int count, std::vector<std::pair<int64_t, CFileItem*>> & files);
+
+	// Waits for all pending changes to be written and stops the journal.
+	// If any of the writes has failed, the rows of this instance get
+	// replaced by the passed queue, except for files not loaded.
+	bool CloseJournal(std::vector<CServerItem*> const& queue);
+
 	static std::wstring GetDatabaseFilename();
 
 private:
@@ -4,6 +4,7 @@
 #include "optionspage.h"
 #include "optionspage_connection_ftp.h"
 #include "../netconfwizard.h"
+#include "../wxext/spinctrlex.h"
 
 #include <wx/statbox.h>
 
@@ -13,6 +14,10 @@ struct COptionsPageConnectionFTP::impl final
 	wxRadioButton* active_{};
 	wxCheckBox* fallback_{};
 	wxCheckBox* keepalive_{};
+	wxCheckBox* mode_z_{};
+	wxSpinCtrlEx* mode_z_level_{};
+	wxSpinCtrlEx* pipeline_depth_{};
+	wxCheckBox* tls_session_persist_{};
 };
 
 COptionsPageConnectionFTP::COptionsPageConnectionFTP()
@@ -64,6 +69,40 @@ bool COptionsPageConnectionFTP::CreateControls(wxWindow* parent)
 		inner->Add(impl_->keepalive_);
 		inner->Add(new wxStaticText(box, nullID, _("A proper server does not require this. Contact the server administrator if you need this.")));
 	}
+	{
+		auto [box, inner] = lay.createStatBox(main, _("Compression"), 1);
+		impl_->mode_z_ = new wxCheckBox(box, nullID, _("Use MODE Z &compression if supported by the server"));
+		inner->Add(impl_->mode_z_);
+		auto row = lay.createFlex(2);
+		inner->Add(row, 0, wxLEFT, lay.indent);
+		row->Add(new wxStaticText(box, nullID, _("Compression &level (1-9):")), lay.valign);
+		impl_->mode_z_level_ = new wxSpinCtrlEx(box, nullID, wxString(), wxDefaultPosition, wxSize(lay.dlgUnits(26), -1));
+		impl_->mode_z_level_->SetRange(1, 9);
+		impl_->mode_z_level_->SetMaxLength(1);
+		row->Add(impl_->mode_z_level_, lay.valign);
+		inner->Add(new wxStaticText(box, nullID, _("Compression can be enabled or disabled for individual sites in the Site Manager.")));
+	}
+	{
+		auto [box, inner] = lay.createStatBox(main, _("Command pipelining"), 1);
+		auto row = lay.createFlex(2);
+		inner->Add(row);
+		row->Add(new wxStaticText(box, nullID, _("Maximum &commands in flight when deleting files (1-64):")), lay.valign);
+		impl_->pipeline_depth_ = new wxSpinCtrlEx(box, nullID, wxString(), wxDefaultPosition, wxSize(lay.dlgUnits(26), -1));
+		impl_->pipeline_depth_->SetRange(1, 64);
+		impl_->pipeline_depth_->SetMaxLength(2);
+		row->Add(impl_->pipeline_depth_, lay.valign);
+		inner->Add(new wxStaticText(box, nullID, _("1 waits for each reply before sending the next command. If a server fails to handle pipelined commands, FileZilla goes back to that after reconnecting.")));
+		inner->Add(new wxStaticText(box, nullID, _("Above 1, transfers of several files in the same directory also overlap the passive mode command for the next file with the end of the current transfer.")));
+	}
+	{
+		auto [box, inner] = lay.createStatBox(main, _("TLS session resumption"), 1);
+		impl_->tls_session_persist_ = new wxCheckBox(box, nullID, _("R&emember TLS sessions across restarts"));
+		inner->Add(impl_->tls_session_persist_);
+		inner->Add(new wxStaticText(box, nullID, _("The sessions are stored in the settings directory. Anyone able to read them can decrypt recorded traffic of these sessions. They are not stored while a master password is set. Takes effect after restarting FileZilla.")));
+		if (!m_pOptions->get_string(OPTION_MASTERPASSWORDENCRYPTOR).empty()) {
+			impl_->tls_session_persist_->Disable();
+		}
+	}
 	return true;
 }
 
@@ -74,6 +113,10 @@ bool COptionsPageConnectionFTP::LoadPage()
 	impl_->active_->SetValue(!use_pasv);
 	impl_->fallback_->SetValue(m_pOptions->get_bool(OPTION_ALLOW_TRANSFERMODEFALLBACK));
 	impl_->keepalive_->SetValue(m_pOptions->get_bool(OPTION_FTP_SENDKEEPALIVE));
+	impl_->mode_z_->SetValue(m_pOptions->get_bool(OPTION_FTP_MODE_Z));
+	impl_->mode_z_level_->SetValue(m_pOptions->get_int(OPTION_FTP_MODE_Z_LEVEL));
+	impl_->pipeline_depth_->SetValue(m_pOptions->get_int(OPTION_FTP_PIPELINE_DEPTH));
+	impl_->tls_session_persist_->SetValue(m_pOptions->get_bool(OPTION_TLS_SESSION_PERSIST));
 	return true;
 }
 
@@ -82,5 +125,9 @@ bool COptionsPageConnectionFTP::SavePage()
 	m_pOptions->set(OPTION_USEPASV, impl_->passive_->GetValue() ? 1 : 0);
 	m_pOptions->set(OPTION_ALLOW_TRANSFERMODEFALLBACK, impl_->fallback_->GetValue() ? 1 : 0);
 	m_pOptions->set(OPTION_FTP_SENDKEEPALIVE, impl_->keepalive_->GetValue() ? 1 : 0);
+	m_pOptions->set(OPTION_FTP_MODE_Z, impl_->mode_z_->GetValue() ? 1 : 0);
+	m_pOptions->set(OPTION_FTP_MODE_Z_LEVEL, impl_->mode_z_level_->GetValue());
+	m_pOptions->set(OPTION_FTP_PIPELINE_DEPTH, impl_->pipeline_depth_->GetValue());
+	m_pOptions->set(OPTION_TLS_SESSION_PERSIST, impl_->tls_session_persist_->GetValue());
 	return true;
 }
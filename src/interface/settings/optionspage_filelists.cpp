@@ -3,7 +3,10 @@
 #include "settingsdialog.h"
 #include "optionspage.h"
 #include "optionspage_filelists.h"
+#include "../sizeformatting.h"
 #include "../textctrlex.h"
+#include "../wxext/spinctrlex.h"
+#include "../../include/engine_context.h"
 
 #include <wx/statbox.h>
 
@@ -16,6 +19,9 @@ struct COptionsPageFilelists::impl final
 
 	wxChoice* doubleClickFileAction_{};
 	wxChoice* doubleClickDirAction_{};
+
+	wxSpinCtrlEx* cacheMemoryLimit_{};
+	wxCheckBox* cachePersist_{};
 };
 
 COptionsPageFilelists::COptionsPageFilelists()
@@ -91,6 +97,28 @@ bool COptionsPageFilelists::CreateControls(wxWindow* parent)
 		inner->Add(impl_->doubleClickDirAction_, lay.valign);
 	}
 
+	{
+		auto [box, inner] = lay.createStatBox(main, _("Directory cache"), 1);
+
+		auto row = lay.createFlex(2);
+		inner->Add(row);
+		row->Add(new wxStaticText(box, nullID, _("Memory _("&Memory limit for cached listings (in MiB):")limit for cached listings (in MiB):")), lay.valign);
+		impl_->cacheMemoryLimit_ = new wxSpinCtrlEx(box, nullID, wxString(), wxDefaultPosition, wxSize(lay.dlgUnits(40), -1));
+		impl_->cacheMemoryLimit_->SetRange(16, 1024 * 1024);
+		impl_->cacheMemoryLimit_->SetMaxLength(7);
+		row->Add(impl_->cacheMemoryLimit_, lay.valign);
+
+		impl_->cachePersist_ = new wxCheckBox(box, nullID, _("&Keep cached listings across restarts"));
+		inner->Add(impl_->cachePersist_);
+		inner->Add(new wxStaticText(box, nullID, _("Kept listings are shown right away and refreshed from the server when first used. Takes effect after restarting FileZilla.")));
+
+		auto const stats = m_pOwner->GetEngineContext().GetDirectoryCacheStats();
+		inner->Add(new wxStaticText(box, nullID, wxString::Format(_("Currently cached: %s listings with %s files, using %s."),
+			CSizeFormat::FormatNumber(static_cast<int64_t>(stats.listings)), CSizeFormat::FormatNumber(stats.files), CSizeFormat::Format(static_cast<int64_t>(stats.bytes), true))));
+		inner->Add(new wxStaticText(box, nullID, wxString::Format(_("Since startup: %s hits, %s misses, %s listings evicted to stay within the limit."),
+			CSizeFormat::FormatNumber(static_cast<int64_t>(stats.hits)), CSizeFormat::FormatNumber(static_cast<int64_t>(stats.misses)), CSizeFormat::FormatNumber(static_cast<int64_t>(stats.evictions)))));
+	}
+
 	return true;
 }
 
@@ -104,6 +132,9 @@ bool COptionsPageFilelists::LoadPage()
 	impl_->doubleClickFileAction_->Select(m_pOptions->get_int(OPTION_DOUBLECLICK_ACTION_FILE));
 	impl_->doubleClickDirAction_->Select(m_pOptions->get_int(OPTION_DOUBLECLICK_ACTION_DIRECTORY));
 
+	impl_->cacheMemoryLimit_->SetValue(m_pOptions->get_int(OPTION_CACHE_MEMORY_LIMIT));
+	impl_->cachePersist_->SetValue(m_pOptions->get_bool(OPTION_CACHE_PERSIST));
+
 	return true;
 }
 
@@ -117,6 +148,9 @@ bool COptionsPageFilelists::SavePage()
 	m_pOptions->set(OPTION_DOUBLECLICK_ACTION_FILE, impl_->doubleClickFileAction_->GetSelection());
 	m_pOptions->set(OPTION_DOUBLECLICK_ACTION_DIRECTORY, impl_->doubleClickDirAction_->GetSelection());
 
+	m_pOptions->set(OPTION_CACHE_MEMORY_LIMIT, impl_->cacheMemoryLimit_->GetValue());
+	m_pOptions->set(OPTION_CACHE_PERSIST, impl_->cachePersist_->GetValue());
+
 	return true;
 }
 
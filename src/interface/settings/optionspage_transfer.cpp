@@ -14,6 +14,11 @@ struct COptionsPageTransfer::impl final
 	wxSpinCtrlEx* transfers_{};
 	wxSpinCtrlEx* downloads_{};
 	wxSpinCtrlEx* uploads_{};
+	wxSpinCtrlEx* segments_{};
+	wxSpinCtrlEx* warm_{};
+	wxSpinCtrlEx* files_in_memory_{};
+
+	wxCheckBox* adaptive_{};
 
 	wxChoice* burst_tolerance_{};
 
@@ -25,6 +30,7 @@ struct COptionsPageTransfer::impl final
 	wxTextCtrlEx* replace_{};
 
 	wxCheckBox* preallocate_{};
+	wxCheckBox* verify_checksums_{};
 };
 
 COptionsPageTransfer::COptionsPageTransfer()
@@ -65,6 +71,22 @@ bool COptionsPageTransfer::CreateControls(wxWindow* parent)
 		impl_->uploads_->SetMaxLength(2);
 		inner->Add(impl_->uploads_, lay.valign);
 		inner->Add(new wxStaticText(box, nullID, _("(0 for no limit)")), lay.valign);
+		inner->Add(new wxStaticText(box, nullID, _("Download large files in &segments:")), lay.valign);
+		impl_->segments_ = new wxSpinCtrlEx(box, nullID, wxString(), wxDefaultPosition, wxSize(lay.dlgUnits(26), -1));
+		impl_->segments_->SetRange(1, 10);
+		impl_->segments_->SetMaxLength(2);
+		inner->Add(impl_->segments_, lay.valign);
+		inner->Add(new wxStaticText(box, nullID, _("(1 to disable)")), lay.valign);
+		inner->Add(new wxStaticText(box, nullID, _("Spare &connections kept ready per server:")), lay.valign);
+		impl_->warm_ = new wxSpinCtrlEx(box, nullID, wxString(), wxDefaultPosition, wxSize(lay.dlgUnits(26), -1));
+		impl_->warm_->SetRange(0, 10);
+		impl_->warm_->SetMaxLength(2);
+		inner->Add(impl_->warm_, lay.valign);
+		inner->Add(new wxStaticText(box, nullID, _("(0 to disable)")), lay.valign);
+		impl_->adaptive_ = new wxCheckBox(box, nullID, _("&Adapt to measured throughput"));
+		inner->Add(impl_->adaptive_, lay.valign);
+		inner->AddSpacer(0);
+		inner->AddSpacer(0);
 	}
 
 	{
@@ -126,12 +148,31 @@ bool COptionsPageTransfer::CreateControls(wxWindow* parent)
 		inner->Add(new wxStaticText(box, nullID, filtered));
 	}
 
+	{
+		auto [box, inner] = lay.createStatBox(main, _("Transfer queue"), 1);
+		auto innermost = lay.createFlex(3);
+		inner->Add(innermost);
+		innermost->Add(new wxStaticText(box, nullID, _("Files per server kept in &memory:")), lay.valign);
+		impl_->files_in_memory_ = new wxSpinCtrlEx(box, nullID, wxString(), wxDefaultPosition, wxSize(lay.dlgUnits(40), -1));
+		impl_->files_in_memory_->SetRange(0, 1000000);
+		impl_->files_in_memory_->SetMaxLength(7);
+		innermost->Add(impl_->files_in_memory_, lay.valign);
+		innermost->Add(new wxStaticText(box, nullID, _("(0 for no limit)")), lay.valign);
+		inner->Add(new wxStaticText(box, nullID, _("Further files are only kept in the queue database until needed.")));
+	}
+
 	{
 		auto [box, inner] = lay.createStatBox(main, _("Preallocation"), 1);
 		impl_->preallocate_ = new wxCheckBox(box, nullID, _("Pre&allocate space before downloading"));
 		inner->Add(impl_->preallocate_);
 	}
 
+	{
+		auto [box, inner] = lay.createStatBox(main, _("Verification"), 1);
+		impl_->verify_checksums_ = new wxCheckBox(box, nullID, _("&Verify checksums of transferred files if supported by the server"));
+		inner->Add(impl_->verify_checksums_);
+	}
+
 	GetSizer()->Fit(this);
 
 	return true;
@@ -151,6 +192,10 @@ bool COptionsPageTransfer::LoadPage()
 	impl_->transfers_->SetValue(m_pOptions->get_int(OPTION_NUMTRANSFERS));
 	impl_->downloads_->SetValue(m_pOptions->get_int(OPTION_CONCURRENTDOWNLOADLIMIT));
 	impl_->uploads_->SetValue(m_pOptions->get_int(OPTION_CONCURRENTUPLOADLIMIT));
+	impl_->segments_->SetValue(m_pOptions->get_int(OPTION_DOWNLOAD_SEGMENTS));
+	impl_->warm_->SetValue(m_pOptions->get_int(OPTION_WARM_CONNECTIONS));
+	impl_->adaptive_->SetValue(m_pOptions->get_bool(OPTION_ADAPTIVE_CONCURRENCY));
+	impl_->files_in_memory_->SetValue(m_pOptions->get_int(OPTION_QUEUE_FILES_IN_MEMORY));
 
 	impl_->burst_tolerance_->SetSelection(m_pOptions->get_int(OPTION_SPEEDLIMIT_BURSTTOLERANCE));
 	impl_->burst_tolerance_->Enable(enable_speedlimits);
@@ -159,6 +204,7 @@ bool COptionsPageTransfer::LoadPage()
 	impl_->replace_->ChangeValue(m_pOptions->get_string(OPTION_INVALID_CHAR_REPLACE));
 
 	impl_->preallocate_->SetValue(m_pOptions->get_bool(OPTION_PREALLOCATE_SPACE));
+	impl_->verify_checksums_->SetValue(m_pOptions->get_bool(OPTION_VERIFY_CHECKSUMS));
 
 	return true;
 }
@@ -170,6 +216,10 @@ bool COptionsPageTransfer::SavePage()
 	m_pOptions->set(OPTION_NUMTRANSFERS, impl_->transfers_->GetValue());
 	m_pOptions->set(OPTION_CONCURRENTDOWNLOADLIMIT,	impl_->downloads_->GetValue());
 	m_pOptions->set(OPTION_CONCURRENTUPLOADLIMIT, impl_->uploads_->GetValue());
+	m_pOptions->set(OPTION_DOWNLOAD_SEGMENTS, impl_->segments_->GetValue());
+	m_pOptions->set(OPTION_WARM_CONNECTIONS, impl_->warm_->GetValue());
+	m_pOptions->set(OPTION_ADAPTIVE_CONCURRENCY, impl_->adaptive_->GetValue());
+	m_pOptions->set(OPTION_QUEUE_FILES_IN_MEMORY, impl_->files_in_memory_->GetValue());
 
 	m_pOptions->set(OPTION_SPEEDLIMIT_INBOUND, impl_->dllimit_->GetValue().ToStdWstring());
 	m_pOptions->set(OPTION_SPEEDLIMIT_OUTBOUND, impl_->ullimit_->GetValue().ToStdWstring());
@@ -177,6 +227,7 @@ bool COptionsPageTransfer::SavePage()
 	m_pOptions->set(OPTION_INVALID_CHAR_REPLACE, impl_->replace_->GetValue().ToStdWstring());
 	m_pOptions->set(OPTION_INVALID_CHAR_REPLACE_ENABLE, impl_->enable_replace_->GetValue());
 	m_pOptions->set(OPTION_PREALLOCATE_SPACE, impl_->preallocate_->GetValue());
+	m_pOptions->set(OPTION_VERIFY_CHECKSUMS, impl_->verify_checksums_->GetValue());
 
 	return true;
 }
@@ -195,6 +246,18 @@ bool COptionsPageTransfer::Validate()
 		return DisplayError(impl_->uploads_, _("Please enter a number between 0 and 10 for the number of concurrent uploads."));
 	}
 
+	if (impl_->segments_->GetValue() < 1 || impl_->segments_->GetValue() > 10) {
+		return DisplayError(impl_->segments_, _("Please enter a number between 1 and 10 for the number of download segments."));
+	}
+
+	if (impl_->warm_->GetValue() < 0 || impl_->warm_->GetValue() > 10) {
+		return DisplayError(impl_->warm_, _("Please enter a number between 0 and 10 for the number of spare connections."));
+	}
+
+	if (impl_->files_in_memory_->GetValue() < 0 || impl_->files_in_memory_->GetValue() > 1000000) {
+		return DisplayError(impl_->files_in_memory_, _("Please enter a number between 0 and 1000000 for the number of files kept in memory."));
+	}
+
 	if (fz::to_integral<int>(impl_->dllimit_->GetValue().ToStdWstring(), -1) < 0) {
 		const wxString unit = CSizeFormat::GetUnitWithBase(CSizeFormat::kilo, 1024);
 		return DisplayError(impl_->dllimit_, wxString::Format(_("Please enter a download speed limit greater or equal to 0 %s/s."), unit));
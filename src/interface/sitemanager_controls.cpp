@@ -1171,6 +1171,15 @@ TransferSettingsSiteControls::TransferSettingsSiteControls(wxWindow & parent, Di
 	row->Add(spin, lay.valign);
 
 	limit->Bind(wxEVT_CHECKBOX, [spin](wxCommandEvent const& ev){ spin->Enable(ev.IsChecked()); });
+
+	row = lay.createFlex(0, 1);
+	sizer.Add(row);
+	row->Add(new wxStaticText(&parent, XRCID("ID_MODE_Z_LABEL"), _("MODE &Z compression:")), lay.valign);
+	auto * modeZ = new wxChoice(&parent, XRCID("ID_MODE_Z"));
+	modeZ->Append(_("Default"));
+	modeZ->Append(_("Enabled"));
+	modeZ->Append(_("Disabled"));
+	row->Add(modeZ, lay.valign);
 }
 
 void TransferSettingsSiteControls::SetSite(Site const& site)
@@ -1179,12 +1188,14 @@ void TransferSettingsSiteControls::SetSite(Site const& site)
 	xrc_call(parent_, "ID_TRANSFERMODE_ACTIVE", &wxWindow::Enable, !predefined_);
 	xrc_call(parent_, "ID_TRANSFERMODE_PASSIVE", &wxWindow::Enable, !predefined_);
 	xrc_call(parent_, "ID_LIMITMULTIPLE", &wxWindow::Enable, !predefined_);
+	xrc_call(parent_, "ID_MODE_Z", &wxWindow::Enable, !predefined_);
 
 	if (!site) {
 		xrc_call(parent_, "ID_TRANSFERMODE_DEFAULT", &wxRadioButton::SetValue, true);
 		xrc_call(parent_, "ID_LIMITMULTIPLE", &wxCheckBox::SetValue, false);
 		xrc_call(parent_, "ID_MAXMULTIPLE", &wxSpinCtrl::Enable, false);
 		xrc_call<wxSpinCtrl, int>(parent_, "ID_MAXMULTIPLE", &wxSpinCtrl::SetValue, 1);
+		xrc_call(parent_, "ID_MODE_Z", &wxChoice::SetSelection, 0);
 	}
 	else {
 		if (CServer::ProtocolHasFeature(site.server.GetProtocol(), ProtocolFeature::TransferMode)) {
@@ -1198,6 +1209,17 @@ void TransferSettingsSiteControls::SetSite(Site const& site)
 			else {
 				xrc_call(parent_, "ID_TRANSFERMODE_DEFAULT", &wxRadioButton::SetValue, true);
 			}
+
+			auto const modeZ = site.server.GetExtraParameter("mode_z");
+			if (modeZ == L"1") {
+				xrc_call(parent_, "ID_MODE_Z", &wxChoice::SetSelection, 1);
+			}
+			else if (modeZ == L"0") {
+				xrc_call(parent_, "ID_MODE_Z", &wxChoice::SetSelection, 2);
+			}
+			else {
+				xrc_call(parent_, "ID_MODE_Z", &wxChoice::SetSelection, 0);
+			}
 		}
 
 		int const maxMultiple = site.server.MaximumMultipleConnections();
@@ -1226,6 +1248,17 @@ bool TransferSettingsSiteControls::UpdateSite(Site & site, bool)
 		else {
 			site.server.SetPasvMode(MODE_DEFAULT);
 		}
+
+		int const modeZ = xrc_call(parent_, "ID_MODE_Z", &wxChoice::GetSelection);
+		if (modeZ == 1) {
+			site.server.SetExtraParameter("mode_z", L"1");
+		}
+		else if (modeZ == 2) {
+			site.server.SetExtraParameter("mode_z", L"0");
+		}
+		else {
+			site.server.ClearExtraParameter("mode_z");
+		}
 	}
 	else {
 		site.server.SetPasvMode(MODE_DEFAULT);
@@ -1247,6 +1280,8 @@ void TransferSettingsSiteControls::SetControlVisibility(ServerProtocol protocol,
 	xrc_call(parent_, "ID_TRANSFERMODE_DEFAULT", &wxWindow::Show, hasTransferMode);
 	xrc_call(parent_, "ID_TRANSFERMODE_ACTIVE", &wxWindow::Show, hasTransferMode);
 	xrc_call(parent_, "ID_TRANSFERMODE_PASSIVE", &wxWindow::Show, hasTransferMode);
+	xrc_call(parent_, "ID_MODE_Z_LABEL", &wxWindow::Show, hasTransferMode);
+	xrc_call(parent_, "ID_MODE_Z", &wxWindow::Show, hasTransferMode);
 	auto* transferModeLabel = XRCCTRL(parent_, "ID_TRANSFERMODE_LABEL", wxStaticText);
 	transferModeLabel->Show(hasTransferMode);
 	transferModeLabel->GetContainingSizer()->CalcMin();
@@ -17,10 +17,11 @@
 
 #include <algorithm>
 
-static const int statbarWidths[3] = {
-	-1, 0, 0
+static const int statbarWidths[4] = {
+	-1, 0, 0, 0
 };
-#define FIELD_QUEUESIZE 1
+#define FIELD_CONCURRENCY 1
+#define FIELD_QUEUESIZE 2
 
 BEGIN_EVENT_TABLE(wxStatusBarEx, wxStatusBar)
 EVT_SIZE(wxStatusBarEx::OnSize)
@@ -343,12 +344,13 @@ CStatusBar::CStatusBar(wxTopLevelWindow* pParent, activity_logger& al, COptionsB
 	CContextManager::Get()->RegisterHandler(this, STATECHANGE_CHANGEDCONTEXT, false);
 	CContextManager::Get()->RegisterHandler(this, STATECHANGE_ENCRYPTION, true);
 
-	const int count = 3;
+	const int count = 4;
 	SetFieldsCount(count);
 	int array[count];
 	array[0] = wxSB_FLAT;
-	array[1] = wxSB_NORMAL;
-	array[2] = wxSB_FLAT;
+	array[1] = wxSB_FLAT;
+	array[2] = wxSB_NORMAL;
+	array[3] = wxSB_FLAT;
 	SetStatusStyles(count, array);
 
 	SetStatusWidths(count, statbarWidths);
@@ -393,6 +395,23 @@ void CStatusBar::DisplayQueueSize(int64_t totalSize, bool hasUnknown)
 	}
 }
 
+void CStatusBar::DisplayConcurrency(wxString const& text)
+{
+	// Own field, the first one shows menu help texts
+	if (text == GetStatusText(FIELD_CONCURRENCY)) {
+		return;
+	}
+
+	int width = 0;
+	if (!text.empty()) {
+		wxClientDC dc(this);
+		dc.SetFont(GetFont());
+		width = dc.GetTextExtent(text).x + 10;
+	}
+	SetFieldWidth(FIELD_CONCURRENCY, width);
+	SetStatusText(text, FIELD_CONCURRENCY);
+}
+
 void CStatusBar::DoDisplayQueueSize()
 {
 	m_queue_size_changed = false;
@@ -100,6 +100,10 @@ public:
 
 	void DisplayQueueSize(int64_t totalSize, bool hasUnknown);
 
+	// Shows the transfer limits chosen by the adaptive concurrency
+	// control of the queue, empty to clear.
+	void DisplayConcurrency(wxString const& text);
+
 	void OnHandleLeftClick(wxWindow* wnd);
 	void OnHandleRightClick(wxWindow* wnd);
 
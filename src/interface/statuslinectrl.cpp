@@ -10,7 +10,6 @@
 
 BEGIN_EVENT_TABLE(CStatusLineCtrl, wxWindow)
 EVT_PAINT(CStatusLineCtrl::OnPaint)
-EVT_TIMER(wxID_ANY, CStatusLineCtrl::OnTimer)
 EVT_ERASE_BACKGROUND(CStatusLineCtrl::OnEraseBackground)
 END_EVENT_TABLE()
 
@@ -32,8 +31,6 @@ CStatusLineCtrl::CStatusLineCtrl(CQueueView* pParent, const t_EngineData* const
 	SetBackgroundStyle(wxBG_STYLE_CUSTOM);
 	SetBackgroundColour(pParent->GetBackgroundColour());
 
-	m_transferStatusTimer.SetOwner(this);
-
 	InitFieldOffsets();
 
 	ClearTransferStatus();
@@ -75,10 +72,6 @@ CStatusLineCtrl::~CStatusLineCtrl()
 			m_pEngineData->pItem->SetSize(status_.totalSize);
 		}
 	}
-
-	if (m_transferStatusTimer.IsRunning()) {
-		m_transferStatusTimer.Stop();
-	}
 }
 
 void CStatusLineCtrl::OnPaint(wxPaintEvent&)
@@ -272,9 +265,7 @@ void CStatusLineCtrl::ClearTransferStatus()
 		break;
 	}
 
-	if (m_transferStatusTimer.IsRunning()) {
-		m_transferStatusTimer.Stop();
-	}
+	m_polling = false;
 
 	m_past_data_count = 0;
 
@@ -288,22 +279,38 @@ void CStatusLineCtrl::SetTransferStatus(CTransferStatus const& status)
 		ClearTransferStatus();
 	}
 	else {
+		if (!status.list) {
+			int64_t base = status.startOffset;
+			if (m_countedStart == status.startOffset && m_countedOffset <= status.currentOffset) {
+				base = m_countedOffset;
+			}
+			if (status.currentOffset > base) {
+				m_transferredBytes += status.currentOffset - base;
+			}
+			m_countedStart = status.startOffset;
+			m_countedOffset = status.currentOffset;
+			m_countedTotal = status.totalSize;
+		}
+
 		status_ = status;
 
 		m_lastOffset = status.currentOffset;
 
-		if (!m_transferStatusTimer.IsRunning()) {
-			m_transferStatusTimer.Start(100);
-		}
+		m_polling = true;
+		m_pParent->StartTransferStatusTimer();
 		Refresh(false);
 	}
 }
 
-void CStatusLineCtrl::OnTimer(wxTimerEvent&)
+bool CStatusLineCtrl::UpdateTransferStatus()
 {
+	if (!m_polling) {
+		return false;
+	}
+
 	if (!m_pEngineData || !m_pEngineData->pEngine) {
-		m_transferStatusTimer.Stop();
-		return;
+		m_polling = false;
+		return false;
 	}
 
 	bool changed;
@@ -322,8 +329,10 @@ void CStatusLineCtrl::OnTimer(wxTimerEvent&)
 		SetTransferStatus(status);
 	}
 	else {
-		m_transferStatusTimer.Stop();
+		m_polling = false;
 	}
+
+	return m_polling;
 }
 
 void CStatusLineCtrl::DrawRightAlignedText(wxDC& dc, wxString const& text, int x, int y)
@@ -414,6 +423,27 @@ wxFileOffset CStatusLineCtrl::GetAverageSpeed(int elapsed_milli_seconds)
 	return ((status_.currentOffset - status_.startOffset - forget.offset) * 1000) / (elapsed_milli_seconds - forget.elapsed);
 }
 
+int64_t CStatusLineCtrl::TakeTransferredBytes()
+{
+	int64_t const ret = m_transferredBytes;
+	m_transferredBytes = 0;
+	return ret;
+}
+
+int64_t CStatusLineCtrl::TakeFinalTransferredBytes(bool success)
+{
+	int64_t ret = TakeTransferredBytes();
+	if (success && m_countedOffset >= 0 && m_countedTotal > m_countedOffset) {
+		ret += m_countedTotal - m_countedOffset;
+	}
+
+	m_countedStart = -1;
+	m_countedOffset = -1;
+	m_countedTotal = -1;
+
+	return ret;
+}
+
 wxFileOffset CStatusLineCtrl::GetMomentarySpeed()
 {
 	if (status_.empty()) {
@@ -448,13 +478,9 @@ wxFileOffset CStatusLineCtrl::GetMomentarySpeed()
 
 bool CStatusLineCtrl::Show(bool show)
 {
+	m_polling = show;
 	if (show) {
-		if (!m_transferStatusTimer.IsRunning()) {
-			m_transferStatusTimer.Start(100);
-		}
-	}
-	else {
-		m_transferStatusTimer.Stop();
+		m_pParent->StartTransferStatusTimer();
 	}
 
 	return wxWindow::Show(show);
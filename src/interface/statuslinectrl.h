@@ -15,11 +15,22 @@ public:
 	void SetTransferStatus(CTransferStatus const& status);
 	void ClearTransferStatus();
 
+	// Called periodically by the queue. Returns false once the status
+	// stopped changing, polling resumes with the next SetTransferStatus.
+	bool UpdateTransferStatus();
+
 	int64_t GetLastOffset() const { return status_.empty() ? m_lastOffset : status_.currentOffset; }
 	int64_t GetTotalSize() const { return status_.empty() ? -1 : status_.totalSize; }
 	wxFileOffset GetAverageSpeed(int elapsed_milli_seconds);
 	wxFileOffset GetMomentarySpeed();
 
+	// Returns the bytes transferred since the previous call
+	int64_t TakeTransferredBytes();
+
+	// Like TakeTransferredBytes, to be called once the transfer is over. On
+	// success, the remainder not reported by a status update gets counted.
+	int64_t TakeFinalTransferredBytes(bool success);
+
 	virtual bool Show(bool show = true);
 
 protected:
@@ -33,7 +44,7 @@ protected:
 	CTransferStatus status_;
 
 	wxString m_statusText;
-	wxTimer m_transferStatusTimer;
+	bool m_polling{};
 
 	static int m_fieldOffsets[4];
 	static int m_barWidth;
@@ -44,6 +55,12 @@ protected:
 
 	int64_t m_lastOffset{-1}; // Stores the last transfer offset so that the total queue size can be accurately calculated.
 
+	// Used by TakeTransferredBytes
+	int64_t m_transferredBytes{};
+	int64_t m_countedOffset{-1};
+	int64_t m_countedStart{-1};
+	int64_t m_countedTotal{-1};
+
 	// This is used by GetSpeed to forget about the first 10 seconds on longer transfers
 	// since at the very start the speed is hardly accurate (e.g. due to TCP slow start)
 	struct _past_data final
@@ -72,7 +89,6 @@ protected:
 
 	DECLARE_EVENT_TABLE()
 	void OnPaint(wxPaintEvent& event);
-	void OnTimer(wxTimerEvent& event);
 	void OnEraseBackground(wxEraseEvent& event);
 };
 
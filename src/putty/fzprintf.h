@@ -1,4 +1,4 @@
-#define FZSFTP_PROTOCOL_VERSION 11
+#define FZSFTP_PROTOCOL_VERSION 17
 
 typedef enum
 {
@@ -33,6 +33,10 @@ typedef enum
     sftp_io_open,
     sftp_io_nextbuf,
     sftp_io_finalize,
+    sftp_io_release,
+    sftpPipelining,
+    sftpListentryRecord,
+    sftpCheckFile, /* Whether the server supports the check-file extension */
 } sftpEventTypes;
 
 extern bool pending_reply;
@@ -32,13 +32,13 @@ char* priority_read()
     newmode &= ~ENABLE_ECHO_INPUT;
     SetConsoleMode(hin, newmode);
 
-    char buffer[256];
+    char buffer[4096]; /* Large enough for a full buffer ring */
 
     while (!ret) {
         DWORD read;
         BOOL r;
 
-        r = ReadFile(hin, buffer, 255, &read, 0);
+        r = ReadFile(hin, buffer, sizeof(buffer) - 1, &read, 0);
         if (!r || read == 0) {
                 fzprintf(sftpError, "ReadFile failed in priority_read");
                 cleanup_exit(1);
@@ -359,6 +359,11 @@ int fz_timer_check(_fztimer *timer)
     return 1;
 }
 
+unsigned long fz_ticks(void)
+{
+    return GETTICKCOUNT();
+}
+
 int CurrentSpeedLimit(int direction)
 {
     return limit[direction];
@@ -377,3 +382,42 @@ uintptr_t next_int(char ** s)
     }
     return ret;
 }
+
+void fz_ring_init(fz_ring *ring)
+{
+    ring->head = 0;
+    ring->count = 0;
+}
+
+int fz_ring_next(fz_ring *ring, int processed, uintptr_t *offset, int *size)
+{
+    if (ring->count) {
+        /* Hand back the exhausted buffer, no need to wait for a reply. */
+        fznotify1(sftp_io_release, processed);
+    }
+    else {
+        fznotify1(sftp_io_nextbuf, processed);
+        char *s = priority_read();
+        if (s[1] == '-') {
+            sfree(s);
+            return -1;
+        }
+        char *p = s + 1;
+        while (*p && ring->count < FZSFTP_RING_MAX) {
+            ring->offset[ring->count] = next_int(&p);
+            ring->size[ring->count] = (int)next_int(&p);
+            ++ring->count;
+        }
+        ring->head = 0;
+        sfree(s);
+        if (!ring->count) {
+            return 0;
+        }
+    }
+
+    *offset = ring->offset[ring->head];
+    *size = ring->size[ring->head];
+    ++ring->head;
+    --ring->count;
+    return 1;
+}
@@ -28,6 +28,27 @@ typedef struct
 void fz_timer_init(_fztimer *timer);
 int fz_timer_check(_fztimer *timer);
 
+/* Monotonic milliseconds */
+unsigned long fz_ticks(void);
+
 uintptr_t next_int(char ** s);
 
+/* FileZilla may hand out several shared memory buffers at once, they
+   are used up in order. */
+#define FZSFTP_RING_MAX 64
+
+typedef struct
+{
+    uintptr_t offset[FZSFTP_RING_MAX];
+    int size[FZSFTP_RING_MAX];
+    int head;
+    int count;
+} fz_ring;
+
+void fz_ring_init(fz_ring *ring);
+
+/* Returns the buffer after the current one, processed is the amount of data
+   placed in the current one. Returns 1 on success, 0 on EOF and -1 on error. */
+int fz_ring_next(fz_ring *ring, int processed, uintptr_t *offset, int *size);
+
 #endif
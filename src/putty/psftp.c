@@ -283,7 +283,7 @@ int sftp_get_file(char *fname, char *outfname, bool restart)
     struct sftp_packet *pktin;
     struct sftp_request *req;
     struct fxp_xfer *xfer;
-    uint64_t offset;
+    uint64_t offset, length;
     WFile *file;
     int ret, shown_err = false;
     struct fxp_attrs attrs;
@@ -305,8 +305,9 @@ int sftp_get_file(char *fname, char *outfname, bool restart)
     }
 
     offset = 0;
+    length = 0;
     if (restart) {
-        file = open_existing_wfile(outfname, &offset);
+        file = open_existing_wfile(outfname, &offset, &length);
     } else {
         file = open_new_file(outfname, GET_PERMISSIONS(attrs, -1));
     }
@@ -331,7 +332,7 @@ int sftp_get_file(char *fname, char *outfname, bool restart)
      * thus put up a progress bar.
      */
     ret = 1;
-    xfer = xfer_download_init(fh, offset);
+    xfer = xfer_download_init(fh, offset, length);
     while (!xfer_done(xfer)) {
         void *vbuf;
         int retd, len;
@@ -413,6 +414,8 @@ int sftp_put_file(char *fname, char *outfname, int restart)
     uint64_t offset = 0;
     RFile *file = 0;
     bool err = false, eof;
+    char *buffer;
+    int buffer_size;
     struct fxp_attrs attrs;
     long permissions;
 
@@ -471,12 +474,13 @@ int sftp_put_file(char *fname, char *outfname, int restart)
      */
     xfer = xfer_upload_init(fh, offset);
     eof = false;
+    buffer_size = xfer_chunk_size(xfer);
+    buffer = snewn(buffer_size, char);
     while ((!err && !eof) || !xfer_done(xfer)) {
-        char buffer[4096*4];
         int len, ret;
 
         while (xfer_upload_ready(xfer) && !err && !eof) {
-            len = read_from_file(file, buffer, sizeof(buffer));
+            len = read_from_file(file, buffer, buffer_size);
             if (len == -1) {
                 fzprintf(sftpError, "error while reading local file");
                 err = true;
@@ -513,6 +517,7 @@ int sftp_put_file(char *fname, char *outfname, int restart)
         }
     }
 
+    sfree(buffer);
     xfer_cleanup(xfer);
 
   cleanup:
@@ -641,6 +646,70 @@ int sftp_cmd_close(struct sftp_command *cmd)
     return 0;
 }
 
+/*
+ * Find the n-th whitespace separated field of an ls -l style longname.
+ */
+static ptrlen longname_field(const char *longname, int n)
+{
+    const char *p = longname;
+    while (1) {
+        while (*p == ' ')
+            p++;
+        const char *start = p;
+        while (*p && *p != ' ')
+            p++;
+        if (!n--)
+            return make_ptrlen(start, p - start);
+        if (!*p)
+            return make_ptrlen(p, 0);
+    }
+}
+
+/*
+ * Pass a directory entry on as a single record made up of its
+ * attributes, so that FileZilla does not have to parse the longname:
+ *
+ *   <mode in octal> <size, -1 if unknown> <mtime, 0 if unknown> <owner> <group> <name>
+ *
+ * Returns false if the attributes are insufficient, the entry then has
+ * to be sent as a longname. This is the case for links, as only the
+ * longname contains their target.
+ */
+static bool list_record(struct fxp_name *name, unsigned long mtime)
+{
+    const struct fxp_attrs *attrs = &name->attrs;
+    if (!(attrs->flags & SSH_FILEXFER_ATTR_PERMISSIONS)) {
+        return false;
+    }
+    if ((attrs->permissions & 0170000) == 0120000) {
+        return false;
+    }
+
+    /* Prefer the user and group names from the longname over the ids */
+    char owner[32], group[32];
+    ptrlen mode = longname_field(name->longname, 0);
+    ptrlen o = longname_field(name->longname, 2);
+    ptrlen g = longname_field(name->longname, 3);
+    if (mode.len >= 10 && strchr("-dbcps", *(const char *)mode.ptr) && o.len && o.len < sizeof(owner) && g.len && g.len < sizeof(group)) {
+        memcpy(owner, o.ptr, o.len);
+        owner[o.len] = 0;
+        memcpy(group, g.ptr, g.len);
+        group[g.len] = 0;
+    }
+    else if (attrs->flags & SSH_FILEXFER_ATTR_UIDGID) {
+        sprintf(owner, "%lu", attrs->uid);
+        sprintf(group, "%lu", attrs->gid);
+    }
+    else {
+        return false;
+    }
+
+    int64_t size = (attrs->flags & SSH_FILEXFER_ATTR_SIZE) ? (int64_t)attrs->size : -1;
+    fzprintf_raw_untrusted(sftpListentryRecord, "%lo %"PRId64" %lu %s %s %s",
+                           attrs->permissions, size, mtime, owner, group, name->filename);
+    return true;
+}
+
 /*
  * List a directory. If no arguments are given, list pwd; otherwise
  * list the directory given in words[1].
@@ -711,6 +780,9 @@ int sftp_cmd_ls(struct sftp_command *cmd)
             if (names->names[i].attrs.flags & SSH_FILEXFER_ATTR_ACMODTIME) {
                 mtime = names->names[i].attrs.mtime;
             }
+            if (list_record(&names->names[i], mtime)) {
+                continue;
+            }
             fzprintf_raw_untrusted(sftpListentry, "%s", names->names[i].longname);
             fzprintf_raw_untrusted(sftpUnknown, "%lu", mtime);
             fzprintf_raw_untrusted(sftpUnknown, "%s", names->names[i].filename);
@@ -1395,6 +1467,49 @@ static int sftp_cmd_mtime(struct sftp_command *cmd)
     return 1;
 }
 
+static int sftp_cmd_checksum(struct sftp_command *cmd)
+{
+    char *cname, *hash, *alg = NULL;
+    struct sftp_packet *pktin;
+    struct sftp_request *req;
+
+    if (!backend) {
+        not_connected();
+        return 0;
+    }
+
+    if (cmd->nwords != 3) {
+        fzprintf(sftpError, "checksum: expects a list of algorithms and a filename as arguments");
+        return 0;
+    }
+
+    if (!fxp_has_check_file()) {
+        fzprintf(sftpError, "checksum: server does not support the check-file extension");
+        return 0;
+    }
+
+    cname = canonify(cmd->words[2], false);
+    if (!cname) {
+        fzprintf(sftpError, "%s: canonify: %s", cmd->words[2], fxp_error());
+        return 0;
+    }
+
+    req = fxp_check_file_send(cname, cmd->words[1]);
+    pktin = sftp_wait_for_reply(req);
+    hash = fxp_check_file_recv(pktin, req, &alg);
+    if (!hash) {
+        fzprintf(sftpError, "checksum %s: %s", cname, fxp_error());
+        sfree(cname);
+        return 0;
+    }
+    sfree(cname);
+
+    fzprintf(sftpReply, "%s %s", alg, hash);
+    sfree(alg);
+    sfree(hash);
+    return 1;
+}
+
 static int sftp_cmd_open(struct sftp_command *cmd)
 {
     int portnumber;
@@ -1443,6 +1558,9 @@ static struct sftp_cmd_lookup {
     {
         "cd", sftp_cmd_cd
     },
+    {
+        "checksum", sftp_cmd_checksum
+    },
     {
         "chmod", sftp_cmd_chmod
     },
@@ -1663,6 +1781,17 @@ static int do_sftp_init(void)
         return 1;                      /* failure */
     }
 
+    if (fxp_has_limits()) {
+        req = fxp_limits_send();
+        pktin = sftp_wait_for_reply(req);
+        if (!fxp_limits_recv(pktin, req)) {
+            fzprintf(sftpVerbose, "Could not query server limits: %s", fxp_error());
+        }
+    }
+
+    /* Spares the engine asking for checksums the server cannot compute */
+    fzprintf(sftpCheckFile, "%d", fxp_has_check_file() ? 1 : 0);
+
     /*
      * Find out where our home directory is.
      */
@@ -94,7 +94,8 @@ typedef struct WFile WFile;
 RFile *open_existing_file(const char *name, uint64_t offset,
                           unsigned long *mtime, unsigned long *atime,
                           long *perms);
-WFile *open_existing_wfile(const char *name, uint64_t *size);
+WFile *open_existing_wfile(const char *name, uint64_t *size,
+                           uint64_t *length);
 /* Returns <0 on error, 0 on eof, or number of bytes read, as usual */
 int read_from_file(RFile *f, void *buffer, int length);
 /* Closes and frees the RFile */
@@ -274,6 +274,19 @@ int fxp_error_type(void)
     return fxp_errtype;
 }
 
+/*
+ * Maximum read and write lengths advertised by the server through the
+ * limits@openssh.com extension, zero if unknown.
+ */
+static bool has_limits = false;
+static uint64_t max_read_len = 0, max_write_len = 0;
+
+/*
+ * Whether the server advertised the check-file extension, allowing
+ * us to ask for the hash of a file.
+ */
+static bool has_check_file = false;
+
 /*
  * Perform exchange of init/version packets. Return 0 on failure.
  */
@@ -309,16 +322,121 @@ bool fxp_init(void)
         return false;
     }
     /*
-     * In principle, this packet might also contain extension-
-     * string pairs. We should work through them and look for any
-     * we recognise. In practice we don't currently do so because
-     * we know we don't recognise _any_.
+     * Work through the extension-string pairs. We care about the one
+     * telling us how large reads and writes may be and whether we can
+     * ask the server for file hashes.
      */
+    has_limits = false;
+    has_check_file = false;
+    while (get_avail(pktin)) {
+        ptrlen name = get_string(pktin);
+        get_string(pktin);
+        if (get_err(pktin))
+            break;
+        if (ptrlen_eq_string(name, "limits@openssh.com"))
+            has_limits = true;
+        else if (ptrlen_eq_string(name, "check-file") ||
+                 ptrlen_eq_string(name, "check-file-name"))
+            has_check_file = true;
+    }
     sftp_pkt_free(pktin);
 
     return true;
 }
 
+bool fxp_has_limits(void)
+{
+    return has_limits;
+}
+
+struct sftp_request *fxp_limits_send(void)
+{
+    struct sftp_request *req = sftp_alloc_request();
+    struct sftp_packet *pktout;
+
+    pktout = sftp_pkt_init(SSH_FXP_EXTENDED);
+    put_uint32(pktout, req->id);
+    put_stringz(pktout, "limits@openssh.com");
+    sftp_send(pktout);
+
+    return req;
+}
+
+bool fxp_limits_recv(struct sftp_packet *pktin, struct sftp_request *req)
+{
+    sfree(req);
+    if (pktin->type == SSH_FXP_EXTENDED_REPLY) {
+        get_uint64(pktin); /* max packet length, implied by the others */
+        uint64_t read_len = get_uint64(pktin);
+        uint64_t write_len = get_uint64(pktin);
+        if (get_err(pktin)) {
+            fxp_internal_error("malformed limits@openssh.com reply");
+            sftp_pkt_free(pktin);
+            return false;
+        }
+        max_read_len = read_len;
+        max_write_len = write_len;
+        fzprintf(sftpVerbose, "Server limits reads to %"PRIu64" and writes to %"PRIu64" bytes",
+                 read_len, write_len);
+        sftp_pkt_free(pktin);
+        return true;
+    } else {
+        fxp_got_status(pktin);
+        sftp_pkt_free(pktin);
+        return false;
+    }
+}
+
+bool fxp_has_check_file(void)
+{
+    return has_check_file;
+}
+
+struct sftp_request *fxp_check_file_send(const char *path, const char *algs)
+{
+    struct sftp_request *req = sftp_alloc_request();
+    struct sftp_packet *pktout;
+
+    pktout = sftp_pkt_init(SSH_FXP_EXTENDED);
+    put_uint32(pktout, req->id);
+    put_stringz(pktout, "check-file-name");
+    put_stringz(pktout, path);
+    put_stringz(pktout, algs);
+    put_uint64(pktout, 0);             /* start offset */
+    put_uint64(pktout, 0);             /* length, 0 for the whole file */
+    put_uint32(pktout, 0);             /* block size, 0 for a single hash */
+    sftp_send(pktout);
+
+    return req;
+}
+
+char *fxp_check_file_recv(struct sftp_packet *pktin, struct sftp_request *req,
+                          char **alg)
+{
+    sfree(req);
+    if (pktin->type == SSH_FXP_EXTENDED_REPLY) {
+        ptrlen name = get_string(pktin);
+        ptrlen used = get_string(pktin);
+        ptrlen hash = get_data(pktin, get_avail(pktin));
+        if (get_err(pktin) || !ptrlen_eq_string(name, "check-file") ||
+            !hash.len) {
+            fxp_internal_error("malformed check-file reply");
+            sftp_pkt_free(pktin);
+            return NULL;
+        }
+        char *hex = snewn(hash.len * 2 + 1, char);
+        for (size_t i = 0; i < hash.len; i++)
+            sprintf(hex + i * 2, "%02x", ((const unsigned char *)hash.ptr)[i]);
+        *alg = mkstr(used);
+        sftp_pkt_free(pktin);
+        return hex;
+    } else {
+        fxp_got_status(pktin);
+        sftp_pkt_free(pktin);
+        return NULL;
+    }
+}
+
 /*
  * Canonify a pathname.
  */
@@ -903,20 +1021,40 @@ struct req {
     char *buffer;
     int len, retlen, complete;
     uint64_t offset;
+    unsigned long sent;
     struct req *next, *prev;
 };
 
+/*
+ * Without the limits@openssh.com extension we cannot know how large
+ * requests the server accepts, 32K is what every server supports.
+ */
+#define XFER_DEFAULT_CHUNK 32768
+#define XFER_MAX_CHUNK (256 * 1024)
+
+#define XFER_MIN_WINDOW (1024 * 1024)
+#define XFER_INITIAL_WINDOW (4 * 1024 * 1024)
+#define XFER_MAX_WINDOW (32 * 1024 * 1024)
+
 struct fxp_xfer {
     uint64_t offset, furthestdata, filesize;
+    uint64_t end;                      /* downloads stop here */
     int req_totalsize, req_maxsize;
+    int chunk, peak_maxsize;
     bool eof, err;
     struct fxp_handle *fh;
     struct req *head, *tail;
     _fztimer send_timer;
     int sent_interval;
+
+    /* For sizing the window, see xfer_completed */
+    unsigned long srtt, min_rtt;
+    unsigned long sample_start;
+    uint64_t sample_bytes;
 };
 
-static struct fxp_xfer *xfer_init(struct fxp_handle *fh, uint64_t offset)
+static struct fxp_xfer *xfer_init(struct fxp_handle *fh, uint64_t offset,
+                                  uint64_t max_len)
 {
     struct fxp_xfer *xfer = snew(struct fxp_xfer);
 
@@ -924,16 +1062,72 @@ static struct fxp_xfer *xfer_init(struct fxp_handle *fh, uint64_t offset)
     xfer->offset = offset;
     xfer->head = xfer->tail = NULL;
     xfer->req_totalsize = 0;
-    xfer->req_maxsize = 1048576*4;
+    xfer->req_maxsize = XFER_INITIAL_WINDOW;
+    xfer->peak_maxsize = xfer->req_maxsize;
+    if (max_len >= XFER_MAX_CHUNK)
+        xfer->chunk = XFER_MAX_CHUNK;
+    else if (max_len)
+        xfer->chunk = (int)max_len;
+    else
+        xfer->chunk = XFER_DEFAULT_CHUNK;
     xfer->err = false;
     xfer->filesize = UINT64_MAX;
+    xfer->end = UINT64_MAX;
     xfer->furthestdata = 0;
     fz_timer_init(&xfer->send_timer);
     xfer->sent_interval = 0;
+    xfer->srtt = 0;
+    xfer->min_rtt = 0;
+    xfer->sample_start = fz_ticks();
+    xfer->sample_bytes = 0;
 
     return xfer;
 }
 
+/*
+ * Size the window of outstanding data from the bandwidth-delay product,
+ * once per round trip. The window becomes twice the throughput times
+ * the smallest round trip time seen. While the window is what limits
+ * the throughput this doubles it every round trip, once the link is the
+ * limit it settles at twice the actual product. The smallest rather
+ * than the average round trip time is used as the average grows with
+ * the data queued up due to a too large window.
+ */
+static void xfer_completed(struct fxp_xfer *xfer, struct req *rr, int len)
+{
+    unsigned long now = fz_ticks();
+    unsigned long rtt = now - rr->sent;
+    if (!rtt)
+        rtt = 1;
+
+    if (!xfer->srtt) {
+        xfer->srtt = rtt;
+        xfer->min_rtt = rtt;
+    } else {
+        xfer->srtt = (xfer->srtt * 7 + rtt) / 8;
+        if (rtt < xfer->min_rtt)
+            xfer->min_rtt = rtt;
+    }
+
+    xfer->sample_bytes += len;
+    unsigned long elapsed = now - xfer->sample_start;
+    /* Coarse timers make shorter samples meaningless */
+    if (elapsed < xfer->srtt || elapsed < 100)
+        return;
+
+    uint64_t window = xfer->sample_bytes * xfer->min_rtt * 2 / elapsed;
+    if (window < XFER_MIN_WINDOW)
+        window = XFER_MIN_WINDOW;
+    else if (window > XFER_MAX_WINDOW)
+        window = XFER_MAX_WINDOW;
+    xfer->req_maxsize = (int)window;
+    if (xfer->req_maxsize > xfer->peak_maxsize)
+        xfer->peak_maxsize = xfer->req_maxsize;
+
+    xfer->sample_start = now;
+    xfer->sample_bytes = 0;
+}
+
 bool xfer_done(struct fxp_xfer *xfer)
 {
     /*
@@ -953,6 +1147,12 @@ void xfer_download_queue(struct fxp_xfer *xfer)
         struct req *rr;
         struct sftp_request *req;
 
+        if (xfer->offset >= xfer->end) {
+            /* Everything we were asked for has been requested */
+            xfer->eof = true;
+            break;
+        }
+
         rr = snew(struct req);
         rr->offset = xfer->offset;
         rr->complete = 0;
@@ -966,7 +1166,10 @@ void xfer_download_queue(struct fxp_xfer *xfer)
         xfer->tail = rr;
         rr->next = NULL;
 
-        rr->len = 32768;
+        rr->len = xfer->chunk;
+        if (xfer->end - xfer->offset < (uint64_t)rr->len)
+            rr->len = (int)(xfer->end - xfer->offset);
+        rr->sent = fz_ticks();
         rr->buffer = snewn(rr->len, char);
         sftp_register(req = fxp_read_send(xfer->fh, rr->offset, rr->len));
         fxp_set_userdata(req, rr);
@@ -980,11 +1183,14 @@ void xfer_download_queue(struct fxp_xfer *xfer)
     }
 }
 
-struct fxp_xfer *xfer_download_init(struct fxp_handle *fh, uint64_t offset)
+struct fxp_xfer *xfer_download_init(struct fxp_handle *fh, uint64_t offset,
+                                    uint64_t length)
 {
-    struct fxp_xfer *xfer = xfer_init(fh, offset);
+    struct fxp_xfer *xfer = xfer_init(fh, offset, max_read_len);
 
     xfer->eof = false;
+    if (length)
+        xfer->end = offset + length;
     xfer_download_queue(xfer);
 
     return xfer;
@@ -1027,6 +1233,8 @@ int xfer_download_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
     }
 
     rr->complete = 1;
+    if (rr->retlen > 0)
+        xfer_completed(xfer, rr, rr->retlen);
 
     /*
      * Special case: if we have received fewer bytes than we
@@ -1119,7 +1327,7 @@ bool xfer_download_data(struct fxp_xfer *xfer, void **buf, int *len)
 
 struct fxp_xfer *xfer_upload_init(struct fxp_handle *fh, uint64_t offset)
 {
-    struct fxp_xfer *xfer = xfer_init(fh, offset);
+    struct fxp_xfer *xfer = xfer_init(fh, offset, max_write_len);
 
     /*
      * We set `eof' to 1 because this will cause xfer_done() to
@@ -1136,7 +1344,12 @@ struct fxp_xfer *xfer_upload_init(struct fxp_handle *fh, uint64_t offset)
 
 bool xfer_upload_ready(struct fxp_xfer *xfer)
 {
-    return sftp_sendbuffer() == 0;
+    return sftp_sendbuffer() == 0 && xfer->req_totalsize < xfer->req_maxsize;
+}
+
+int xfer_chunk_size(struct fxp_xfer *xfer)
+{
+    return xfer->chunk;
 }
 
 void xfer_upload_data(struct fxp_xfer *xfer, char *buffer, int len)
@@ -1158,6 +1371,7 @@ void xfer_upload_data(struct fxp_xfer *xfer, char *buffer, int len)
     rr->next = NULL;
 
     rr->len = len;
+    rr->sent = fz_ticks();
     rr->buffer = NULL;
     sftp_register(req = fxp_write_send(xfer->fh, buffer, rr->offset, len));
     fxp_set_userdata(req, rr);
@@ -1209,6 +1423,8 @@ int xfer_upload_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
         xfer->tail = prev;
     xfer->req_totalsize -= rr->len;
     xfer->sent_interval += rr->len;
+    if (ret)
+        xfer_completed(xfer, rr, rr->len);
     if (fz_timer_check(&xfer->send_timer)) {
         /* The data we sent is the data we earlier read from file */
         fzprintf(sftpTransfer, "%d", xfer->sent_interval);
@@ -1227,6 +1443,7 @@ void xfer_cleanup(struct fxp_xfer *xfer)
     if (xfer->sent_interval > 0) {
         fzprintf(sftpTransfer, "%d", xfer->sent_interval);
     }
+    fzprintf(sftpPipelining, "%d %d %lu", xfer->chunk, xfer->peak_maxsize, xfer->min_rtt);
 
     struct req *rr;
     while (xfer->head) {
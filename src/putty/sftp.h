@@ -168,6 +168,26 @@ int fxp_error_type(void);
  */
 bool fxp_init(void);
 
+/*
+ * Query the server's limits@openssh.com limits. Only to be used if
+ * fxp_has_limits() returns true after fxp_init.
+ */
+bool fxp_has_limits(void);
+struct sftp_request *fxp_limits_send(void);
+bool fxp_limits_recv(struct sftp_packet *pktin, struct sftp_request *req);
+
+/*
+ * Ask the server for the hash of a file through the check-file
+ * extension. algs is a comma-separated list of acceptable hash
+ * algorithms. Returns the hash hex-encoded and sets alg to the
+ * algorithm the server picked. Only to be used if
+ * fxp_has_check_file() returns true after fxp_init.
+ */
+bool fxp_has_check_file(void);
+struct sftp_request *fxp_check_file_send(const char *path, const char *algs);
+char *fxp_check_file_recv(struct sftp_packet *pktin, struct sftp_request *req,
+                          char **alg);
+
 /*
  * Canonify a pathname. Concatenate the two given path elements
  * with a separating slash, unless the second is NULL.
@@ -298,13 +318,17 @@ struct sftp_packet *sftp_recv(void);
 
 struct fxp_xfer;
 
-struct fxp_xfer *xfer_download_init(struct fxp_handle *fh, uint64_t offset);
+/* length limits the download to a range of the file, 0 for all of it */
+struct fxp_xfer *xfer_download_init(struct fxp_handle *fh, uint64_t offset,
+                                    uint64_t length);
 void xfer_download_queue(struct fxp_xfer *xfer);
 int xfer_download_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin);
 bool xfer_download_data(struct fxp_xfer *xfer, void **buf, int *len);
 
 struct fxp_xfer *xfer_upload_init(struct fxp_handle *fh, uint64_t offset);
 bool xfer_upload_ready(struct fxp_xfer *xfer);
+/* Largest amount of data to pass to a single xfer_upload_data call */
+int xfer_chunk_size(struct fxp_xfer *xfer);
 void xfer_upload_data(struct fxp_xfer *xfer, char *buffer, int len);
 int xfer_upload_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin);
 
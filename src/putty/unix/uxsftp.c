@@ -127,6 +127,7 @@ struct RFile {
     int state;
     uint8_t * buffer_;
     int remaining_;
+    fz_ring ring_;
 #else
     int fd;
 #endif
@@ -164,6 +165,7 @@ RFile *open_existing_file(const char *name, uint64_t offset,
     ret->memory_ = memory;
     ret->memory_size_ = memory_size;
     ret->remaining_ = 0;
+    fz_ring_init(&ret->ring_);
     ret->buffer_  = NULL;
     ret->state = ok;
 
@@ -210,21 +212,18 @@ int read_from_file(RFile *f, void *buffer, int length)
 {
 #if 1
     if (f->state == ok && !f->remaining_) {
-        fznotify1(sftp_io_nextbuf, 0);
-        char const* s = priority_read();
-        if (s[1] == '-') {
+        uintptr_t offset;
+        int res = fz_ring_next(&f->ring_, 0, &offset, &f->remaining_);
+        if (res < 0) {
             f->state = error;
             return -1;
         }
-        else if (s[1] == 0) {
+        else if (!res) {
             f->state = eof;
         }
         else {
-            char const* p = s + 1;
-            f->buffer_ = f->memory_ + next_int(&p);
-            f->remaining_ = (int)next_int(&p);
+            f->buffer_ = f->memory_ + offset;
         }
-        sfree(s);
     }
     if (f->state == eof) {
         return 0;
@@ -266,6 +265,7 @@ struct WFile {
     int state;
     uint8_t * buffer_;
     int remaining_;
+    fz_ring ring_;
     int size_;
 #else
     int fd;
@@ -302,6 +302,7 @@ WFile *open_new_file(const char *name, long perms)
     ret->memory_ = memory;
     ret->memory_size_ = memory_size;
     ret->remaining_ = 0;
+    fz_ring_init(&ret->ring_);
     ret->buffer_  = NULL;
     ret->state = ok;
     ret->size_ = 0;
@@ -325,7 +326,8 @@ WFile *open_new_file(const char *name, long perms)
 }
 
 
-WFile *open_existing_wfile(const char *name, uint64_t *size)
+WFile *open_existing_wfile(const char *name, uint64_t *size,
+                           uint64_t *length)
 {
 #if 1
     fzprintf(sftp_io_open, "%"PRIu64, (uint64_t)-1);
@@ -341,6 +343,10 @@ WFile *open_existing_wfile(const char *name, uint64_t *size)
     if (size) {
         *size = next_int(&p);
     }
+    if (length) {
+        /* Number of bytes to download, 0 for all */
+        *length = next_int(&p);
+    }
 
     sfree(s);
 
@@ -357,6 +363,7 @@ WFile *open_existing_wfile(const char *name, uint64_t *size)
     ret->memory_ = memory;
     ret->memory_size_ = memory_size;
     ret->remaining_ = 0;
+    fz_ring_init(&ret->ring_);
     ret->buffer_ = NULL;
     ret->state = ok;
     ret->size_ = 0;
@@ -392,22 +399,19 @@ int write_to_file(WFile *f, void *buffer, int length)
 {
 #if 1
     if (f->state == ok && !f->remaining_) {
-        fznotify1(sftp_io_nextbuf, f->size_ - f->remaining_);
-        char * s = priority_read();
-        if (s[1] == '-') {
+        uintptr_t offset;
+        int res = fz_ring_next(&f->ring_, f->size_, &offset, &f->remaining_);
+        if (res < 0) {
             f->state = error;
             return -1;
         }
-        else if (s[1] == 0) {
+        else if (!res) {
             f->state = eof;
         }
         else {
-            char * p = s + 1;
-            f->buffer_ = f->memory_ + next_int(&p);
-            f->remaining_ = (int)next_int(&p);
+            f->buffer_ = f->memory_ + offset;
             f->size_ = f->remaining_;
         }
-        sfree(s);
     }
     if (f->state == eof) {
         return 0;
@@ -114,6 +114,7 @@ struct RFile {
     int state;
     uint8_t* buffer_;
     int remaining_;
+    fz_ring ring_;
 #else
     HANDLE h;
 #endif
@@ -149,6 +150,7 @@ RFile *open_existing_file(const char *name, uint64_t offset,
     ret->memory_ = memory;
     ret->memory_size_ = memory_size;
     ret->remaining_ = 0;
+    fz_ring_init(&ret->ring_);
     ret->buffer_  = NULL;
     ret->state = ok;
 
@@ -196,21 +198,18 @@ int read_from_file(RFile *f, void *buffer, int length)
 {
 #if 1
     if (f->state == ok && !f->remaining_) {
-        fznotify1(sftp_io_nextbuf, 0);
-        char const* s = priority_read();
-        if (s[1] == '-') {
+        uintptr_t offset;
+        int res = fz_ring_next(&f->ring_, 0, &offset, &f->remaining_);
+        if (res < 0) {
             f->state = error;
             return -1;
         }
-        else if (s[1] == 0) {
+        else if (!res) {
             f->state = eof;
         }
         else {
-            char const* p = s + 1;
-            f->buffer_ = f->memory_ + next_int(&p);
-            f->remaining_ = (int)next_int(&p);
+            f->buffer_ = f->memory_ + offset;
         }
-        sfree(s);
     }
     if (f->state == eof) {
         return 0;
@@ -255,6 +254,7 @@ struct WFile {
     int state;
     uint8_t* buffer_;
     int remaining_;
+    fz_ring ring_;
     int size_;
 #else
     HANDLE h;
@@ -289,6 +289,7 @@ WFile *open_new_file(const char *name, long perms)
     ret->memory_ = memory;
     ret->memory_size_ = memory_size;
     ret->remaining_ = 0;
+    fz_ring_init(&ret->ring_);
     ret->buffer_  = NULL;
     ret->state = ok;
     ret->size_ = 0;
@@ -315,7 +316,8 @@ WFile *open_new_file(const char *name, long perms)
 #endif
 }
 
-WFile *open_existing_wfile(const char *name, uint64_t *size)
+WFile *open_existing_wfile(const char *name, uint64_t *size,
+                           uint64_t *length)
 {
 #if 1
     fzprintf(sftp_io_open, "%"PRIu64, (uint64_t)-1);
@@ -332,6 +334,10 @@ WFile *open_existing_wfile(const char *name, uint64_t *size)
     if (size) {
         *size = next_int(&p);
     }
+    if (length) {
+        /* Number of bytes to download, 0 for all */
+        *length = next_int(&p);
+    }
 
     sfree(s);
 
@@ -346,6 +352,7 @@ WFile *open_existing_wfile(const char *name, uint64_t *size)
     ret->memory_ = memory;
     ret->memory_size_ = memory_size;
     ret->remaining_ = 0;
+    fz_ring_init(&ret->ring_);
     ret->buffer_  = NULL;
     ret->state = ok;
     ret->size_ = 0;
@@ -382,22 +389,19 @@ int write_to_file(WFile *f, void *buffer, int length)
 {
 #if 1
     if (f->state == ok && !f->remaining_) {
-        fznotify1(sftp_io_nextbuf, f->size_ - f->remaining_);
-        char const* s = priority_read();
-        if (s[1] == '-') {
+        uintptr_t offset;
+        int res = fz_ring_next(&f->ring_, f->size_, &offset, &f->remaining_);
+        if (res < 0) {
             f->state = error;
             return -1;
         }
-        else if (s[1] == 0) {
+        else if (!res) {
             f->state = eof;
         }
         else {
-            char const* p = s + 1;
-            f->buffer_ = f->memory_ + next_int(&p);
-            f->remaining_ = (int)next_int(&p);
+            f->buffer_ = f->memory_ + offset;
             f->size_ = f->remaining_;
         }
-        sfree(s);
     }
     if (f->state == eof) {
         return 0;
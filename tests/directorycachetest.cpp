@@ -0,0 +1,103 @@
+#include "../src/include/libfilezilla_engine.h"
+#include "../src/engine/directorycache.h"
+#include "../src/engine/stringpool.h"
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/*
+ * This testsuite asserts that the directory cache evicts the least recently
+ * used listings once over its memory limit, and never the one just stored.
+ */
+
+class CDirectoryCacheTest final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(CDirectoryCacheTest);
+	CPPUNIT_TEST(testStoreReferenced);
+	CPPUNIT_TEST(testEvictUnreferenced);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp() {}
+	void tearDown() {}
+
+	void testStoreReferenced();
+	void testEvictUnreferenced();
+
+protected:
+	static CDirectoryListing MakeListing(int i);
+	static bool Has(CDirectoryCache & cache, CServer const& server, int i);
+
+	CServer const server_{FTP, DEFAULT, L"cache.example.com", 21};
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CDirectoryCacheTest);
+
+CDirectoryListing CDirectoryCacheTest::MakeListing(int i)
+{
+	// Same size for all of them
+	CDirectoryListing listing;
+	listing.path = CServerPath(fz::sprintf(L"/dir%d", i));
+
+	std::vector<fz::shared_value<CDirentry>> entries;
+	for (int j = 0; j < 10; ++j) {
+		CDirentry entry;
+		entry.name = fz::sprintf(L"file%d", j);
+		entry.size = j;
+		entries.emplace_back(std::move(entry));
+	}
+	listing.Assign(std::move(entries));
+
+	return listing;
+}
+
+bool CDirectoryCacheTest::Has(CDirectoryCache & cache, CServer const& server, int i)
+{
+	CDirectoryListing listing;
+	bool outdated{};
+	return cache.Lookup(listing, server, CServerPath(fz::sprintf(L"/dir%d", i)), true, outdated);
+}
+
+void CDirectoryCacheTest::testStoreReferenced()
+{
+	CStringPool pool;
+	CDirectoryCache cache(pool);
+
+	for (int i = 0; i < 4; ++i) {
+		cache.Store(MakeListing(i), server_);
+	}
+	cache.SetMemoryLimit(cache.GetStats().bytes);
+
+	// All of them got used since
+	for (int i = 0; i < 4; ++i) {
+		CPPUNIT_ASSERT(Has(cache, server_, i));
+	}
+
+	cache.Store(MakeListing(4), server_);
+	CPPUNIT_ASSERT(Has(cache, server_, 4));
+
+	auto const stats = cache.GetStats();
+	CPPUNIT_ASSERT_EQUAL(uint64_t(1), stats.evictions);
+	CPPUNIT_ASSERT_EQUAL(size_t(4), stats.listings);
+	CPPUNIT_ASSERT(!Has(cache, server_, 0));
+}
+
+void CDirectoryCacheTest::testEvictUnreferenced()
+{
+	CStringPool pool;
+	CDirectoryCache cache(pool);
+
+	for (int i = 0; i < 4; ++i) {
+		cache.Store(MakeListing(i), server_);
+	}
+	cache.SetMemoryLimit(cache.GetStats().bytes);
+
+	// Only the oldest one got used, the next oldest goes
+	CPPUNIT_ASSERT(Has(cache, server_, 0));
+	cache.Store(MakeListing(4), server_);
+
+	CPPUNIT_ASSERT(Has(cache, server_, 4));
+	CPPUNIT_ASSERT(Has(cache, server_, 0));
+	CPPUNIT_ASSERT(!Has(cache, server_, 1));
+	CPPUNIT_ASSERT(Has(cache, server_, 2));
+	CPPUNIT_ASSERT(Has(cache, server_, 3));
+}
@@ -0,0 +1,100 @@
+#include "../src/include/libfilezilla_engine.h"
+#include "../src/engine/directorylistingparser.h"
+#include "../src/engine/listing_scan.h"
+
+#include <libfilezilla/string.hpp>
+
+#include <algorithm>
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Benchmark of the directory listing parser, not part of the testsuite.
+ * Build it with `make dirparserbench`, it takes the number of lines to
+ * parse as optional argument.
+ */
+
+namespace {
+// A mix of common listing styles
+char const* const lines[] = {
+	"-rw-r--r--   1 user     group      123456 Jan  1 12:34 file.txt\r\n",
+	"drwxr-xr-x   2 user     group        4096 Feb 29  2020 directory\r\n",
+	"lrwxrwxrwx   1 user     group          11 Mar 10 08:00 link -> target\r\n",
+	"-rw-r--r--   1 1000     1000    987654321 Dec 31 23:59 archive-2020-12-31.tar.gz\r\n",
+	"type=file;size=2048;modify=20200101123456;perm=adfrw; document.pdf\r\n",
+	"type=dir;modify=20200101123456;perm=flcdmpe; folder\r\n",
+	"01-01-20  12:34PM                 1234 dos.txt\r\n",
+	"01-01-20  12:34PM       <DIR>          dosdir\r\n"
+};
+
+long long elapsed(fz::monotonic_clock const& start)
+{
+	return static_cast<long long>((fz::monotonic_clock::now() - start).get_milliseconds());
+}
+}
+
+int main(int argc, char* argv[])
+{
+	size_t count = 2000000;
+	if (argc > 1) {
+		count = fz::to_integral<size_t>(std::string_view(argv[1]));
+		if (!count) {
+			fprintf(stderr, "Usage: %s [lines]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	std::string all;
+	for (size_t i = 0; i < count; ++i) {
+		all += lines[i % (sizeof(lines) / sizeof(*lines))];
+	}
+
+	auto const scan = [&all](bool vectorized) {
+		size_t found = 0;
+		auto const start = fz::monotonic_clock::now();
+		char const* p = all.c_str();
+		size_t remaining = all.size();
+		while (remaining) {
+			bool ascii{};
+			size_t const len = vectorized ? listing_scan::find_line_end(p, remaining, ascii) : listing_scan::find_line_end_scalar(p, remaining, ascii);
+			if (len < remaining) {
+				++found;
+				++p;
+				--remaining;
+			}
+			p += len;
+			remaining -= len;
+		}
+		return std::make_pair(found, elapsed(start));
+	};
+
+	auto const scalar = scan(false);
+	auto const vectorized = scan(true);
+	if (scalar.first != vectorized.first) {
+		fprintf(stderr, "Scalar and vectorized line scans disagree\n");
+		return 1;
+	}
+
+	auto const start = fz::monotonic_clock::now();
+	CServer server;
+	CDirectoryListingParser parser(0, server);
+	size_t const chunk = 64 * 1024;
+	for (size_t pos = 0; pos < all.size(); pos += chunk) {
+		size_t const len = std::min(chunk, all.size() - pos);
+		memcpy(parser.GetDataBuffer(len), all.c_str() + pos, len);
+		if (!parser.AddData(len)) {
+			fprintf(stderr, "Parser rejected the data\n");
+			return 1;
+		}
+	}
+	CDirectoryListing listing = parser.Parse(CServerPath());
+	long long const parse = elapsed(start);
+
+	printf("Directory listing parser benchmark, %zu lines, %zu bytes, %zu entries, SIMD level %d\n", count, all.size(), listing.size(), static_cast<int>(listing_scan::get_simd_level()));
+	printf("  Line scan, scalar:     %lld ms\n", scalar.second);
+	printf("  Line scan, vectorized: %lld ms\n", vectorized.second);
+	printf("  Full parse:            %lld ms\n", parse);
+
+	return 0;
+}
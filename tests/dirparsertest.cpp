@@ -1,5 +1,8 @@
 #include "../src/include/libfilezilla_engine.h"
+#include "../src/engine/compactlisting.h"
 #include "../src/engine/directorylistingparser.h"
+#include "../src/engine/listing_scan.h"
+#include "../src/engine/servercapabilities.h"
 
 #include <libfilezilla/format.hpp>
 #include <libfilezilla/util.hpp>
@@ -31,6 +34,10 @@ class CDirectoryListingParserTest final : public CppUnit::TestFixture
 	}
 	CPPUNIT_TEST(testAll);
 	CPPUNIT_TEST(testSpecial);
+	CPPUNIT_TEST(testChunked);
+	CPPUNIT_TEST(testCompact);
+	CPPUNIT_TEST(testLineScan);
+	CPPUNIT_TEST(testLearnedFormat);
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -40,6 +47,10 @@ public:
 	void testIndividual();
 	void testAll();
 	void testSpecial();
+	void testChunked();
+	void testCompact();
+	void testLineScan();
+	void testLearnedFormat();
 
 	static std::vector<t_entry> m_entries;
 
@@ -1471,10 +1482,7 @@ void CDirectoryListingParserTest::testIndividual()
 
 	CDirectoryListingParser parser(0, server);
 
-	size_t const len = entry.data.size();
-	char* data = new char[len];
-	memcpy(data, entry.data.c_str(), len);
-	parser.AddData(data, len);
+	parser.AddData(entry.data.c_str(), entry.data.size());
 
 	CDirectoryListing listing = parser.Parse(CServerPath());
 
@@ -1495,10 +1503,7 @@ void CDirectoryListingParserTest::testAll()
 	for (auto const& entry : m_entries) {
 		server.SetType(entry.serverType);
 		parser.SetServer(server);
-		size_t const len = entry.data.size();
-		char* data = new char[len];
-		memcpy(data, entry.data.c_str(), len);
-		parser.AddData(data, len);
+		parser.AddData(entry.data.c_str(), entry.data.size());
 	}
 	CDirectoryListing listing = parser.Parse(CServerPath());
 
@@ -1538,14 +1543,189 @@ void CDirectoryListingParserTest::testSpecial()
 
 			CDirectoryListingParser parser(0, server);
 
-			char* data = new char[line.size()];
-			memcpy(data, line.c_str(), line.size());
-			parser.AddData(data, line.size());
+			parser.AddData(line.c_str(), line.size());
 			parser.Parse(CServerPath());
 		}
 	}
 }
 
+void CDirectoryListingParserTest::testChunked()
+{
+	// Lines split across chunks must be reassembled correctly
+	std::string all;
+	std::vector<t_entry const*> expected;
+	for (auto const& entry : m_entries) {
+		if (entry.serverType == DEFAULT) {
+			all += entry.data;
+			expected.push_back(&entry);
+		}
+	}
+
+	// Also pipelined, twice to cover reuse after Reset
+	fz::thread_pool pool;
+	for (bool pipelined : {false, true}) {
+		for (size_t chunk : {size_t(1), size_t(7), size_t(4096)}) {
+			CServer server;
+			CDirectoryListingParser parser(0, server);
+			if (pipelined) {
+				parser.EnablePipelining(pool);
+			}
+			for (int pass = 0; pass < (pipelined ? 2 : 1); ++pass) {
+				if (pass) {
+					parser.Reset();
+				}
+				for (size_t pos = 0; pos < all.size(); pos += chunk) {
+					size_t const len = std::min(chunk, all.size() - pos);
+					memcpy(parser.GetDataBuffer(len), all.c_str() + pos, len);
+					CPPUNIT_ASSERT(parser.AddData(len));
+				}
+				CDirectoryListing listing = parser.Parse(CServerPath());
+
+				CPPUNIT_ASSERT(listing.size() == expected.size());
+				for (size_t i = 0; i < expected.size(); ++i) {
+					std::string msg = fz::sprintf("Chunk size: %u  Pipelined: %d  Data: %s  Expected:\n%s\n  Got:\n%s", chunk, pipelined, expected[i]->data, expected[i]->reference.dump(), listing[i].dump());
+					CPPUNIT_ASSERT_MESSAGE(msg, listing[i] == expected[i]->reference);
+				}
+			}
+		}
+	}
+}
+
+void CDirectoryListingParserTest::testCompact()
+{
+	CServer server;
+	CDirectoryListingParser parser(0, server);
+	for (auto const& entry : m_entries) {
+		server.SetType(entry.serverType);
+		parser.SetServer(server);
+		parser.AddData(entry.data.c_str(), entry.data.size());
+	}
+	CDirectoryListing listing = parser.Parse(CServerPath());
+
+	CCompactListing const compact(listing);
+	CPPUNIT_ASSERT(compact.valid());
+	CPPUNIT_ASSERT_EQUAL(listing.size(), compact.size());
+
+	auto const expanded = compact.Expand();
+	for (size_t i = 0; i < listing.size(); ++i) {
+		CDirentry const& entry = listing[i];
+		std::string msg = fz::sprintf("Expected:\n%s\n  Got:\n%s", entry.dump(), expanded[i]->dump());
+		CPPUNIT_ASSERT_MESSAGE(msg, *expanded[i] == entry);
+		CPPUNIT_ASSERT(expanded[i]->target == entry.target);
+
+		CPPUNIT_ASSERT_EQUAL(listing.FindFile_CmpCase(entry.name), compact.FindFile_CmpCase(entry.name));
+		std::wstring const upper = fz::str_toupper_ascii(entry.name);
+		size_t const nocase = compact.FindFile_CmpNoCase(upper);
+		CPPUNIT_ASSERT(nocase != std::wstring::npos);
+		CPPUNIT_ASSERT(fz::str_tolower(compact[nocase].name()) == fz::str_tolower(entry.name));
+	}
+	CPPUNIT_ASSERT_EQUAL(std::wstring::npos, compact.FindFile_CmpCase(L"no such file"));
+
+	// Listing served from the compact form
+	CDirectoryListing backed = listing;
+	backed.Assign(std::make_shared<CCompactListing const>(listing));
+	CPPUNIT_ASSERT_EQUAL(listing.size(), backed.size());
+	CPPUNIT_ASSERT_EQUAL(listing.has_perms(), backed.has_perms());
+	CPPUNIT_ASSERT_EQUAL(listing.has_dirs(), backed.has_dirs());
+	CPPUNIT_ASSERT_EQUAL(listing.has_usergroup(), backed.has_usergroup());
+	for (size_t i = 0; i < listing.size(); ++i) {
+		CPPUNIT_ASSERT(backed[i] == listing[i]);
+		CPPUNIT_ASSERT_EQUAL(listing.FindFile_CmpCase(listing[i].name), backed.FindFile_CmpCase(listing[i].name));
+	}
+
+	// Copies share the materialized entries
+	CDirectoryListing const copy = backed;
+	CPPUNIT_ASSERT(&copy[0] == &backed[0]);
+
+	// Modifications detach the listing, other entries stay where they are
+	size_t const last = listing.size() - 1;
+	CDirentry const& lastEntry = backed[last];
+	backed.get(0).size = 42;
+	CPPUNIT_ASSERT_EQUAL(listing.size(), backed.size());
+	CPPUNIT_ASSERT_EQUAL(int64_t(42), backed[0].size);
+	CPPUNIT_ASSERT(&backed[last] == &lastEntry);
+	CPPUNIT_ASSERT(backed[last] == listing[last]);
+	CPPUNIT_ASSERT(copy[0] == listing[0]);
+}
+
+void CDirectoryListingParserTest::testLineScan()
+{
+	// Vectorized line end search must agree with the scalar reference for
+	// every position of the terminator and of non-ASCII bytes.
+	for (size_t len = 0; len <= 80; ++len) {
+		for (size_t eol = 0; eol <= len; ++eol) {
+			for (size_t high = 0; high <= len; high += 5) {
+				std::string data(len, 'a');
+				if (high < len) {
+					data[high] = '\xe4';
+				}
+				if (eol < len) {
+					data[eol] = "\r\n"[eol % 3];
+				}
+
+				bool ascii{};
+				bool ref_ascii{};
+				size_t const res = listing_scan::find_line_end(data.c_str(), data.size(), ascii);
+				size_t const ref = listing_scan::find_line_end_scalar(data.c_str(), data.size(), ref_ascii);
+				CPPUNIT_ASSERT_EQUAL(ref, res);
+				CPPUNIT_ASSERT_EQUAL(ref_ascii, ascii);
+			}
+		}
+	}
+}
+
+void CDirectoryListingParserTest::testLearnedFormat()
+{
+	// Valid both as VMS and as IBM AS/400, VMS gets tried first.
+	std::string const ambiguous = "36-vms-dir.DIR;1  1 19-NOV-2001 21:41 [root,root] (RWE,RWE,RE,RE)\r\n";
+
+	// Own hosts, the capabilities are global.
+	CServer server(FTP, DEFAULT, L"learned.example.com", 21);
+	CServer other(FTP, DEFAULT, L"unlearned.example.com", 21);
+
+	std::string data;
+	for (int i = 0; i < 8; ++i) {
+		data += fz::sprintf("QSYS            77824 02/23/00 15:09:55 *DIR %d-ibm-as400 dir/\r\n", i);
+	}
+	data += ambiguous;
+
+	{
+		// Learned from the first lines, already applies to the rest
+		CDirectoryListingParser parser(0, server);
+		parser.AddData(data.c_str(), data.size());
+		CDirectoryListing listing = parser.Parse(CServerPath());
+		CPPUNIT_ASSERT_EQUAL(size_t(9), listing.size());
+		CPPUNIT_ASSERT(listing[8].name == L"(RWE,RWE,RE,RE)");
+		CPPUNIT_ASSERT(*listing[8].ownerGroup == L"36-vms-dir.DIR;1");
+	}
+
+	int format{};
+	CPPUNIT_ASSERT(CServerCapabilities::GetCapability(server, listing_format, &format) == yes);
+	CPPUNIT_ASSERT_EQUAL(int(listingFormat::ibm), format);
+	CPPUNIT_ASSERT(CServerCapabilities::GetCapability(other, listing_format, &format) == unknown);
+
+	{
+		// Remembered for subsequent listings
+		CDirectoryListingParser parser(0, server);
+		parser.AddData(ambiguous.c_str(), ambiguous.size());
+		CDirectoryListing listing = parser.Parse(CServerPath());
+		CPPUNIT_ASSERT_EQUAL(size_t(1), listing.size());
+		CPPUNIT_ASSERT(listing[0].name == L"(RWE,RWE,RE,RE)");
+		CPPUNIT_ASSERT(!listing[0].is_dir());
+	}
+
+	{
+		// No preference, regular order
+		CDirectoryListingParser parser(0, other);
+		parser.AddData(ambiguous.c_str(), ambiguous.size());
+		CDirectoryListing listing = parser.Parse(CServerPath());
+		CPPUNIT_ASSERT_EQUAL(size_t(1), listing.size());
+		CPPUNIT_ASSERT(listing[0].name == L"36-vms-dir");
+		CPPUNIT_ASSERT(*listing[0].ownerGroup == L"root,root");
+		CPPUNIT_ASSERT(listing[0].is_dir());
+	}
+}
+
 void CDirectoryListingParserTest::setUp()
 {
 }
@@ -0,0 +1,183 @@
+#include "../src/include/libfilezilla_engine.h"
+#include "../src/include/segment_writer.h"
+
+#include <libfilezilla/aio/aio.hpp>
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/local_filesys.hpp>
+#include <libfilezilla/logger.hpp>
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/thread_pool.hpp>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <algorithm>
+#include <string>
+
+/*
+ * This testsuite asserts that segment_writer writes exactly its byte range
+ * of the shared file and leaves the rest of it alone.
+ */
+
+class SegmentWriterTest final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(SegmentWriterTest);
+	CPPUNIT_TEST(testPositioned);
+	CPPUNIT_TEST(testOpenOffset);
+	CPPUNIT_TEST(testShort);
+	CPPUNIT_TEST(testExcess);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp();
+	void tearDown();
+
+	void testPositioned();
+	void testOpenOffset();
+	void testShort();
+	void testExcess();
+
+protected:
+	bool Write(fz::writer_factory & factory, std::string const& data, uint64_t offset = 0);
+	std::string Read();
+
+	std::wstring const file_{L"segmentwritertest.part"};
+	fz::thread_pool pool_;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(SegmentWriterTest);
+
+namespace {
+class waiter final : public fz::aio_waiter
+{
+public:
+	void wait()
+	{
+		fz::scoped_lock l(mtx_);
+		while (!signalled_) {
+			cond_.wait(l);
+		}
+		signalled_ = false;
+	}
+
+private:
+	virtual void on_buffer_availability(fz::aio_waitable const*) override
+	{
+		fz::scoped_lock l(mtx_);
+		signalled_ = true;
+		cond_.signal(l);
+	}
+
+	fz::mutex mtx_;
+	fz::condition cond_;
+	bool signalled_{};
+};
+}
+
+void SegmentWriterTest::setUp()
+{
+	// Existing content must survive, the other segments wrote it.
+	fz::file f(fz::to_native(file_), fz::file::writing, fz::file::empty);
+	CPPUNIT_ASSERT(f);
+	std::string const content(30, 'x');
+	CPPUNIT_ASSERT_EQUAL(int64_t(30), f.write(content.data(), 30));
+	f.close();
+
+	CPPUNIT_ASSERT(segment_writer_factory::preallocate(file_, 30));
+}
+
+void SegmentWriterTest::tearDown()
+{
+	fz::remove_file(fz::to_native(file_));
+}
+
+bool SegmentWriterTest::Write(fz::writer_factory & factory, std::string const& data, uint64_t offset)
+{
+	fz::aio_buffer_pool buffers(fz::get_null_logger(), 8);
+	waiter w;
+
+	auto writer = factory.open(buffers, offset);
+	if (!writer) {
+		return false;
+	}
+
+	// Small chunks, so that the data gets written in several steps
+	for (size_t pos = 0; pos < data.size(); ) {
+		auto b = buffers.get_buffer(w);
+		if (!b) {
+			w.wait();
+			continue;
+		}
+		size_t const len = std::min(data.size() - pos, size_t(4));
+		b->append(reinterpret_cast<uint8_t const*>(data.data() + pos), len);
+		pos += len;
+
+		auto const r = writer->add_buffer(std::move(b), w);
+		if (r == fz::aio_result::error) {
+			return false;
+		}
+		if (r == fz::aio_result::wait) {
+			w.wait();
+		}
+	}
+
+	fz::aio_result r;
+	while ((r = writer->finalize(w)) == fz::aio_result::wait) {
+		w.wait();
+	}
+	return r == fz::aio_result::ok;
+}
+
+std::string SegmentWriterTest::Read()
+{
+	fz::file f(fz::to_native(file_), fz::file::reading);
+	CPPUNIT_ASSERT(f);
+
+	std::string ret(64, '\0');
+	int64_t const read = f.read(ret.data(), static_cast<int64_t>(ret.size()));
+	CPPUNIT_ASSERT(read >= 0);
+	ret.resize(static_cast<size_t>(read));
+	return ret;
+}
+
+void SegmentWriterTest::testPositioned()
+{
+	segment_writer_factory factory(file_, pool_, 10, 10);
+	CPPUNIT_ASSERT(Write(factory, "0123456789"));
+	CPPUNIT_ASSERT_EQUAL(std::string("xxxxxxxxxx0123456789xxxxxxxxxx"), Read());
+
+	// Segments can be written in any order
+	segment_writer_factory first(file_, pool_, 0, 10);
+	CPPUNIT_ASSERT(Write(first, "abcdefghij"));
+	CPPUNIT_ASSERT_EQUAL(std::string("abcdefghij0123456789xxxxxxxxxx"), Read());
+}
+
+void SegmentWriterTest::testOpenOffset()
+{
+	// Resuming a segment, offsets are relative to the segment
+	segment_writer_factory factory(file_, pool_, 20, 10);
+	CPPUNIT_ASSERT(Write(factory, "56789", 5));
+	CPPUNIT_ASSERT_EQUAL(std::string("xxxxxxxxxxxxxxxxxxxxxxxxx56789"), Read());
+
+	fz::aio_buffer_pool buffers(fz::get_null_logger(), 1);
+	CPPUNIT_ASSERT(!factory.open(buffers, 11));
+}
+
+void SegmentWriterTest::testShort()
+{
+	segment_writer_factory factory(file_, pool_, 10, 10);
+	CPPUNIT_ASSERT(!Write(factory, "01234"));
+
+	// Neither truncated nor deleted
+	CPPUNIT_ASSERT_EQUAL(std::string("xxxxxxxxxx01234xxxxxxxxxxxxxxx"), Read());
+}
+
+void SegmentWriterTest::testExcess()
+{
+	segment_writer_factory factory(file_, pool_, 0, 10);
+	CPPUNIT_ASSERT(!Write(factory, "0123456789A"));
+
+	// Nothing written past the end of the segment
+	std::string const content = Read();
+	CPPUNIT_ASSERT_EQUAL(size_t(30), content.size());
+	CPPUNIT_ASSERT_EQUAL(std::string(20, 'x'), content.substr(10));
+}
@@ -16,6 +16,7 @@ class CServerPathTest final : public CppUnit::TestFixture
 	CPPUNIT_TEST(testGetCommonParent);
 	CPPUNIT_TEST(testFormatFilename);
 	CPPUNIT_TEST(testChangePath);
+	CPPUNIT_TEST(testHashNoCase);
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -29,6 +30,7 @@ public:
 	void testGetCommonParent();
 	void testFormatFilename();
 	void testChangePath();
+	void testHashNoCase();
 
 protected:
 };
@@ -686,3 +688,15 @@ void CServerPathTest::testChangePath()
 	}
 
 }
+
+void CServerPathTest::testHashNoCase()
+{
+	CPPUNIT_ASSERT_EQUAL(CServerPath(L"/Foo/BAR").HashNoCase(), CServerPath(L"/foo/bar").HashNoCase());
+	CPPUNIT_ASSERT(!CServerPath(L"/Foo/BAR").CmpNoCase(CServerPath(L"/foo/bar")));
+
+	// Non-ASCII characters must not all hash the same
+	CPPUNIT_ASSERT(CServerPath(L"/\u00e4").HashNoCase() != CServerPath(L"/\u00f6").HashNoCase());
+	CPPUNIT_ASSERT(CServerPath(L"/\u4e00\u4e01").HashNoCase() != CServerPath(L"/\u4e01\u4e00").HashNoCase());
+
+	CPPUNIT_ASSERT(CServerPath(L"/foo/bar").HashNoCase() != CServerPath(L"/foobar").HashNoCase());
+}
@@ -0,0 +1,128 @@
+#include "../src/include/libfilezilla_engine.h"
+#include "../src/engine/stringpool.h"
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <thread>
+#include <vector>
+
+/*
+ * This testsuite asserts that CStringPool hands out a single instance per
+ * value, also when used from several threads at once.
+ */
+
+class CStringPoolTest final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(CStringPoolTest);
+	CPPUNIT_TEST(testIdentity);
+	CPPUNIT_TEST(testEviction);
+	CPPUNIT_TEST(testConcurrent);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp() {}
+	void tearDown() {}
+
+	void testIdentity();
+	void testEviction();
+	void testConcurrent();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CStringPoolTest);
+
+void CStringPoolTest::testIdentity()
+{
+	CStringPool pool;
+
+	auto const a = pool.Get(L"drwxr-xr-x");
+	std::wstring const copy = L"drwxr-xr-x";
+	auto const b = pool.Get(copy);
+	CPPUNIT_ASSERT(a.is_same(b));
+	CPPUNIT_ASSERT(*a == copy);
+
+	auto const c = pool.Get(L"-rw-r--r--");
+	CPPUNIT_ASSERT(!a.is_same(c));
+	CPPUNIT_ASSERT(*c == L"-rw-r--r--");
+
+	// Lookups are by value, not by prefix
+	auto const d = pool.Get(L"drwxr-xr");
+	CPPUNIT_ASSERT(!a.is_same(d));
+
+	auto const stats = pool.GetStats();
+	CPPUNIT_ASSERT_EQUAL(uint64_t(4), stats.lookups);
+	CPPUNIT_ASSERT_EQUAL(uint64_t(1), stats.hits);
+	CPPUNIT_ASSERT_EQUAL(size_t(3), stats.size);
+}
+
+void CStringPoolTest::testEviction()
+{
+	CStringPool pool(16);
+
+	std::vector<fz::shared_value<std::wstring>> values;
+	for (int i = 0; i < 10000; ++i) {
+		values.push_back(pool.Get(std::to_wstring(i)));
+	}
+
+	// Bounded, but strings dropped from the pool stay valid
+	auto const stats = pool.GetStats();
+	CPPUNIT_ASSERT(stats.size < 1000);
+	CPPUNIT_ASSERT(stats.evictions > 0);
+	for (int i = 0; i < 10000; ++i) {
+		CPPUNIT_ASSERT(*values[i] == std::to_wstring(i));
+	}
+}
+
+void CStringPoolTest::testConcurrent()
+{
+	CStringPool pool;
+
+	size_t const threadCount = 8;
+	size_t const valueCount = 500;
+	size_t const rounds = 20;
+
+	std::vector<std::vector<fz::shared_value<std::wstring>>> results(threadCount);
+	std::vector<size_t> mismatches(threadCount);
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < threadCount; ++t) {
+		threads.emplace_back([&, t] {
+			// Assertions throw, keep them out of the threads
+			auto & result = results[t];
+			std::vector<bool> seen(valueCount);
+			result.resize(valueCount);
+			for (size_t r = 0; r < rounds; ++r) {
+				// Different order in each thread
+				for (size_t i = 0; i < valueCount; ++i) {
+					size_t const v = (i + t * 37 + r) % valueCount;
+					auto value = pool.Get(L"owner" + std::to_wstring(v));
+					if (!seen[v]) {
+						seen[v] = true;
+						result[v] = value;
+					}
+					else if (!result[v].is_same(value)) {
+						++mismatches[t];
+					}
+				}
+			}
+		});
+	}
+	for (auto & thread : threads) {
+		thread.join();
+	}
+
+	for (size_t t = 0; t < threadCount; ++t) {
+		CPPUNIT_ASSERT_EQUAL(size_t(0), mismatches[t]);
+	}
+
+	// All threads got the very same instances
+	for (size_t i = 0; i < valueCount; ++i) {
+		CPPUNIT_ASSERT(*results[0][i] == L"owner" + std::to_wstring(i));
+		for (size_t t = 1; t < threadCount; ++t) {
+			CPPUNIT_ASSERT(results[0][i].is_same(results[t][i]));
+		}
+	}
+
+	auto const stats = pool.GetStats();
+	CPPUNIT_ASSERT_EQUAL(uint64_t(threadCount * valueCount * rounds), stats.lookups);
+	CPPUNIT_ASSERT_EQUAL(uint64_t(threadCount * valueCount * rounds - valueCount), stats.hits);
+	CPPUNIT_ASSERT_EQUAL(valueCount, stats.size);
+}
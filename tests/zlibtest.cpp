@@ -0,0 +1,131 @@
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "../src/engine/ftp/zlib_layer.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+/*
+ * This testsuite asserts the correctness of the decompressing zlib_layer.
+ */
+
+namespace {
+// Serves fixed data in small chunks, then reports EOF
+class memory_socket final : public fz::socket_interface
+{
+public:
+	memory_socket(std::string const& data, unsigned int chunk)
+		: fz::socket_interface(this)
+		, data_(data)
+		, chunk_(chunk)
+	{}
+
+	virtual int read(void* buffer, unsigned int size, int&) override
+	{
+		unsigned int const len = static_cast<unsigned int>(std::min(size_t(std::min(size, chunk_)), data_.size() - pos_));
+		memcpy(buffer, data_.data() + pos_, len);
+		pos_ += len;
+		return static_cast<int>(len);
+	}
+
+	virtual int write(void const*, unsigned int, int& error) override
+	{
+		error = EINVAL;
+		return -1;
+	}
+
+	virtual void set_event_handler(fz::event_handler*, fz::socket_event_flag) override {}
+	virtual fz::native_string peer_host() const override { return fz::native_string(); }
+	virtual int peer_port(int& error) const override { error = ENOTCONN; return -1; }
+	virtual int connect(fz::native_string const&, unsigned int, fz::address_type) override { return EINVAL; }
+	virtual fz::socket_state get_state() const override { return fz::socket_state::connected; }
+	virtual int shutdown() override { return 0; }
+	virtual int shutdown_read() override { return 0; }
+
+private:
+	std::string const data_;
+	size_t pos_{};
+	unsigned int const chunk_;
+};
+
+std::string compress(std::string const& in)
+{
+	uLongf len = compressBound(static_cast<uLong>(in.size()));
+	std::string out(len, '\0');
+	compress2(reinterpret_cast<Bytef*>(out.data()), &len, reinterpret_cast<Bytef const*>(in.data()), static_cast<uLong>(in.size()), 9);
+	out.resize(len);
+	return out;
+}
+}
+
+class CZlibLayerTest final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(CZlibLayerTest);
+	CPPUNIT_TEST(testInflate);
+	CPPUNIT_TEST(testTruncated);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp() {}
+	void tearDown() {}
+
+	void testInflate();
+	void testTruncated();
+
+protected:
+	int readAll(fz::socket_interface & s, std::string & out, unsigned int size);
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CZlibLayerTest);
+
+int CZlibLayerTest::readAll(fz::socket_interface & s, std::string & out, unsigned int size)
+{
+	std::string buffer(size, '\0');
+	while (true) {
+		int error = 0;
+		int const read = s.read(buffer.data(), size, error);
+		if (read < 0) {
+			return error;
+		}
+		if (!read) {
+			return 0;
+		}
+		out.append(buffer.data(), static_cast<size_t>(read));
+	}
+}
+
+void CZlibLayerTest::testInflate()
+{
+	// Highly compressible, so that the last bit of input inflates to far
+	// more than fits into the read buffer.
+	std::string data;
+	for (int i = 0; i < 200000; ++i) {
+		data += std::to_string(i % 100);
+	}
+	std::string const compressed = compress(data);
+
+	memory_socket next(compressed, 1000);
+	zlib_layer layer(nullptr, next, false, 0);
+
+	std::string out;
+	CPPUNIT_ASSERT_EQUAL(0, readAll(layer, out, 4096));
+	CPPUNIT_ASSERT(out == data);
+	CPPUNIT_ASSERT_EQUAL(int64_t(compressed.size()), layer.wire_bytes());
+	CPPUNIT_ASSERT_EQUAL(int64_t(data.size()), layer.payload_bytes());
+}
+
+void CZlibLayerTest::testTruncated()
+{
+	std::string data(100000, 'x');
+	std::string compressed = compress(data);
+	compressed.resize(compressed.size() - 4);
+
+	memory_socket next(compressed, 1000);
+	zlib_layer layer(nullptr, next, false, 0);
+
+	std::string out;
+	CPPUNIT_ASSERT_EQUAL(int(ECONNABORTED), readAll(layer, out, 4096));
+}